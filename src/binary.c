@@ -15,10 +15,13 @@ Systems Consortium License, which can be found in file "LICENSE".
 
 /// Return x after reversing the order of the bits.
 tipId_t reverseBits(tipId_t x) {
-    if(sizeof(x)==4)
-        return rev32(x);
-    assert(sizeof(x) == 8);
+#if TIPID_SIZE==32
+    return rev32(x);
+#elif TIPID_SIZE==64
     return rev64(x);
+#else
+    return ((tipId_t) rev64((uint64_t) x) << 64) | rev64((uint64_t) (x >> 64));
+#endif
 }
 
 /// Reverse bits in a 32-bit integer.  p 129 of Hacker's Delight, 2nd
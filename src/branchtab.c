@@ -1,7 +1,7 @@
 /**
  * @file branchtab.c
  * @author Alan R. Rogers
- * @brief Hash table associating key (an unsigned int encoding a site
+ * @brief Table associating key (an unsigned int encoding a site
  * pattern) and value (a double representing the length of the
  * ascending branch)
  *
@@ -14,241 +14,325 @@
 #include "tokenizer.h"
 #include "lblndx.h"
 #include "parstore.h"
+#include "patfold.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 
-/// Dimension of hash table. Must be a power of 2
-#define BT_DIM 16u
+/// Tables whose keys have at most this many bits are indexed
+/// directly, through an array with an entry for every possible key.
+#define BT_DENSE_BITS 14
 
-/// Make sure BT_DIM is a power of 2
-#if (BT_DIM==0u || (BT_DIM & (BT_DIM-1u)))
-# error BT_DIM must be a power of 2
-#endif
+/// Initial number of entries for which space is allocated. Must be a
+/// power of 2
+#define BT_INIT 32u
 
-/// A single element of hash table
-typedef struct BTLink {
-    struct BTLink  *next;
-    tipId_t         key;
-    double          value;
-#if COST==CHISQR_COST
-    double          sumsqr;   // squares
+/// Make sure BT_INIT is a power of 2
+#if (BT_INIT==0u || (BT_INIT & (BT_INIT-1u)))
+# error BT_INIT must be a power of 2
 #endif
-} BTLink;
 
-/// Hash table for branch lengths.
+/// Table of branch lengths. Entry i has key key[i] and value
+/// value[i]. Entries are stored contiguously, in the order in which
+/// their keys were first added. Each element of slot is 1 plus the
+/// index of an entry, or 0 if empty. If the table was made for keys
+/// of nbits <= BT_DENSE_BITS bits, slot has 2^nbits elements, and
+/// slot[key] belongs to key. Otherwise, slot is an open-addressing
+/// hash table of 2*dim elements, which is therefore never more than
+/// half full. A key's search begins at its hash and proceeds by
+/// linear probing to the key's own slot or to an empty one.
 struct BranchTab {
 #ifndef NDEBUG
     int frozen;   // nonzero => no further changes allowed
 #endif
-    BTLink         *tab[BT_DIM];
+    unsigned        n, dim;   // number of entries, allocated space
+    tipId_t        *key;
+    double         *value;
+#if COST==CHISQR_COST
+    double         *sumsqr;   // squares
+#endif
+    int             nbits;    // bits in keys of dense table, or 0
+    unsigned        mask;     // hashed: number of slots minus 1
+    unsigned       *slot;
+    PatFold        *fold;     // if non-NULL, fold keys into populations
+    int             foldSing; // keep folded singleton patterns?
 };
 
-BTLink     *BTLink_new(tipId_t key, double value);
-BTLink     *BTLink_add(BTLink * self, tipId_t key, double value);
-double      BTLink_get(BTLink * self, tipId_t key);
-int         BTLink_hasSingletons(BTLink * self);
-void        BTLink_free(BTLink * self);
-void        BTLink_printShallow(const BTLink * self, FILE *fp);
-void        BTLink_print(const BTLink * self, FILE *fp);
-BTLink     *BTLink_dup(const BTLink *self);
-int         BTLink_equals(const BTLink *lhs, const BTLink *rhs);
-
-#if TIPID_SIZE==32
-uint32_t    tipIdHash(uint32_t key);
-#elif TIPID_SIZE==64
-uint32_t    tipIdHash(uint64_t key);
-#endif
+static BranchTab *BranchTab_alloc(int nbits);
+static int  BranchTab_find(const BranchTab * self, tipId_t key);
+static unsigned BranchTab_insert(BranchTab * self, tipId_t key);
+static unsigned BranchTab_probe(const BranchTab * self, tipId_t key);
+static void BranchTab_grow(BranchTab * self);
+static void BranchTab_rehash(BranchTab * self);
+static void BranchTab_addKey(BranchTab * self, tipId_t key, double value);
+static int  BranchTab_sameFold(const BranchTab * lhs, const BranchTab * rhs);
+static void BranchTab_addFolded(BranchTab * self, tipId_t pat, double value,
+                                int m, const tipId_t bit[m],
+                                const double p[m]);
+static void printTipId(tipId_t key, FILE * fp);
 
 #if TIPID_SIZE==32
 /// Hash function for a 32-bit integer. From Thomas Wang's 1997
 /// article: /// https://gist.github.com/badboy/6267743
-uint32_t tipIdHash( uint32_t key) {
+/// All 32 bits are returned. Callers mask them to the size of their
+/// table.
+uint32_t tipIdHash(tipId_t key) {
    key = (key+0x7ed55d16) + (key<<12);
    key = (key^0xc761c23c) ^ (key>>19);
    key = (key+0x165667b1) + (key<<5);
    key = (key+0xd3a2646c) ^ (key<<9);
    key = (key+0xfd7046c5) + (key<<3);
    key = (key^0xb55a4f09) ^ (key>>16);
-   return key & (BT_DIM-1);
+   return key;
 }
-#elif TIPID_SIZE==64
-/// Hash function for a 64-bit integer.
-uint32_t tipIdHash(uint64_t key) {
+#elif TIPID_SIZE==64 || TIPID_SIZE==128
+/// Hash function for a 64-bit integer. A 128-bit key is first folded
+/// into 64 bits. Returns the low 32 bits of the hash, which callers
+/// mask to the size of their table.
+uint32_t tipIdHash(tipId_t tid) {
+#  if TIPID_SIZE==128
+  uint64_t key = (uint64_t) tid ^ ((uint64_t) (tid >> 64)
+                                   * 0x9e3779b97f4a7c15ULL);
+#  else
+  uint64_t key = tid;
+#  endif
   key = (~key) + (key << 18); // key = (key << 18) - key - 1;
   key = key ^ (key >> 31);
   key = key * 21; // key = (key + (key << 2)) + (key << 4);
   key = key ^ (key >> 11);
   key = key + (key << 6);
   key = key ^ (key >> 22);
-  return (uint32_t) (key  & (BT_DIM-1));
+  return (uint32_t) key;
 }
 #else
 #error "Can't compile tipIdHash function. See branchtab.c"
 #endif
 
-/// Constructor of class BTLink
-BTLink         *BTLink_new(tipId_t key, double value) {
-    BTLink         *new = malloc(sizeof(*new));
+/// Allocate an empty table. It is dense if 0 < nbits <=
+/// BT_DENSE_BITS, and hashed otherwise.
+static BranchTab *BranchTab_alloc(int nbits) {
+    BranchTab    *new = malloc(sizeof(*new));
     CHECKMEM(new);
-
-    new->next = NULL;
-    new->key = key;
-    new->value = value;
+    memset(new, 0, sizeof(*new));
+    new->dim = BT_INIT;
+    new->key = malloc(new->dim * sizeof(new->key[0]));
+    CHECKMEM(new->key);
+    new->value = malloc(new->dim * sizeof(new->value[0]));
+    CHECKMEM(new->value);
 #if COST==CHISQR_COST
-    new->sumsqr = value*value;
+    new->sumsqr = malloc(new->dim * sizeof(new->sumsqr[0]));
+    CHECKMEM(new->sumsqr);
 #endif
+    if(0 < nbits && nbits <= BT_DENSE_BITS) {
+        new->nbits = nbits;
+        new->slot = calloc(1u << nbits, sizeof(new->slot[0]));
+        CHECKMEM(new->slot);
+    } else {
+        new->mask = 2 * new->dim - 1;
+        new->slot = calloc(2 * new->dim, sizeof(new->slot[0]));
+        CHECKMEM(new->slot);
+    }
     return new;
 }
 
-/// Duplicate linked list.
-BTLink     *BTLink_dup(const BTLink *old) {
-    if(old == NULL)
-        return NULL;
+/// Construct an empty table, whose keys may be any site pattern.
+BranchTab    *BranchTab_new(void) {
+    return BranchTab_alloc(0);
+}
+
+/// Construct an empty table for site patterns of nbits samples or
+/// populations, whose keys are therefore less than 2^nbits. If nbits
+/// is small, values are reached by indexing an array with the key,
+/// which is faster than hashing. This costs memory proportional to
+/// 2^nbits, so larger tables are hashed, as in BranchTab_new. See
+/// test/benchbranchtab.c. Adding a larger key turns a dense table into
+/// a hashed one.
+BranchTab    *BranchTab_newDense(int nbits) {
+    assert(0 < nbits && nbits <= TIPID_SIZE);
+    return BranchTab_alloc(nbits);
+}
+
+/// Construct a BranchTab that folds the site patterns of samples into
+/// those of populations, as described in patfold.c. Each key passed
+/// to BranchTab_add is a set of samples. Its value is divided among
+/// population-level site patterns, which become the keys of the
+/// table. Patterns in which all populations or none carry the derived
+/// allele are discarded, as are singleton patterns unless doSing is
+/// nonzero.
+BranchTab    *BranchTab_newFolded(const PatFold *fold, int doSing) {
+    BranchTab    *new = BranchTab_newDense(fold->npops);
+    new->fold = memdup(fold, sizeof(*fold));
+    CHECKMEM(new->fold);
+    new->foldSing = doSing;
+    return new;
+}
 
-    BTLink *new = malloc(sizeof(*new));
+/// Construct an empty table with the same kind of index and the same
+/// folding as old.
+BranchTab    *BranchTab_newLike(const BranchTab *old) {
+    BranchTab    *new = BranchTab_alloc(old->nbits);
+    if(old->fold) {
+        new->fold = memdup(old->fold, sizeof(*old->fold));
+        CHECKMEM(new->fold);
+        new->foldSing = old->foldSing;
+    }
+    return new;
+}
+
+BranchTab    *BranchTab_dup(const BranchTab *old) {
+    BranchTab *new = memdup(old, sizeof(*old));
     CHECKMEM(new);
-    new->key = old->key;
-    new->value = old->value;
+    new->key = memdup(old->key, old->dim * sizeof(old->key[0]));
+    CHECKMEM(new->key);
+    new->value = memdup(old->value, old->dim * sizeof(old->value[0]));
+    CHECKMEM(new->value);
 #if COST==CHISQR_COST
-    new->sumsqr = old->sumsqr;
+    new->sumsqr = memdup(old->sumsqr, old->dim * sizeof(old->sumsqr[0]));
+    CHECKMEM(new->sumsqr);
 #endif
-    new->next = BTLink_dup(old->next);
+    size_t nslots = (old->nbits ? 1u << old->nbits : old->mask + 1u);
+    new->slot = memdup(old->slot, nslots * sizeof(old->slot[0]));
+    CHECKMEM(new->slot);
+    if(old->fold) {
+        new->fold = memdup(old->fold, sizeof(*old->fold));
+        CHECKMEM(new->fold);
+    }
     return new;
 }
 
-/// Return 1 if the two linked lists are equal, or 0 otherwise.
-int  BTLink_equals(const BTLink *lhs, const BTLink *rhs) {
-    if(lhs==NULL && rhs==NULL)
-        return 1;
-    if(lhs==NULL || rhs==NULL)
-        return 0;
-    if(lhs->key!=rhs->key
-       || lhs->value!=rhs->value)
+/// Return 1 if two BranchTab objects are equal; 0 otherwise. Tables
+/// are equal if they have the same keys and values, whatever the
+/// order in which keys were added.
+int BranchTab_equals(const BranchTab *lhs, const BranchTab *rhs) {
+    unsigned i;
+    int j;
+
+    if(lhs->n != rhs->n)
         return 0;
+    for(i=0; i < lhs->n; ++i) {
+        j = BranchTab_find(rhs, lhs->key[i]);
+        if(j < 0 || lhs->value[i] != rhs->value[j])
+            return 0;
 #if COST==CHISQR_COST
-    if(lhs->sumsqr != rhs->sumsqr)
+        if(lhs->sumsqr[i] != rhs->sumsqr[j])
+            return 0;
+#endif
+    }
+#ifndef NDEBUG
+    if(lhs->frozen != rhs->frozen)
         return 0;
 #endif
-    return BTLink_equals(lhs->next, rhs->next);
-}
-
-/// Destructor for BTLink
-void BTLink_free(BTLink * self) {
-    if(self == NULL)
-        return;
-    BTLink_free(self->next);
-    free(self);
+    return 1;
 }
 
-/// Add a value to a BTLink object. On return, self->value
-/// equals the old value and the new one. If COST==CHISQR_COST,
-/// the function also adds the square of value to self->sumsqr.
-BTLink *BTLink_add(BTLink * self, tipId_t key, double value) {
-    if(self == NULL || key < self->key) {
-        BTLink *new = BTLink_new(key, value);
-        new->next = self;
-        return new;
-    } else if(key > self->key) {
-        self->next = BTLink_add(self->next, key, value);
-        return self;
-    }
-    assert(key == self->key);
-    self->value += value;
+/// Destructor for BranchTab.
+void BranchTab_free(BranchTab * self) {
+    free(self->key);
+    free(self->value);
 #if COST==CHISQR_COST
-    self->sumsqr += value*value;
+    free(self->sumsqr);
 #endif
-    return self;
-}
-
-/// Return value corresponding to key, or nan if no value is found.
-double BTLink_get(BTLink * self, tipId_t key) {
-    if(self == NULL || key < self->key)
-        return nan("");
-    else if(key > self->key)
-        return BTLink_get(self->next, key);
-    assert(key == self->key);
-    return self->value;
-}
-
-/// Return 1 if linked list contains keys for singletone site patterns.
-int BTLink_hasSingletons(BTLink * self) {
-    if(self == NULL)
-        return 0;
-    if(isPow2(self->key))
-        return 1;
-    return BTLink_hasSingletons(self->next);
+    free(self->slot);
+    free(self->fold);
+    free(self);
 }
 
-void BTLink_printShallow(const BTLink * self, FILE *fp) {
-    if(self == NULL)
-        return;
-#if COST==CHISQR_COST
-    fprintf(fp, " [%lu, %lf, %lf]",
-           (unsigned long) self->key, self->value, self->sumsqr);
-#else
-    fprintf(fp, " [%lu, %lf]", (unsigned long) self->key, self->value);
+/// Remove all entries, leaving an empty table that folds as before.
+/// Its memory is kept for reuse, so refilling the table allocates
+/// nothing unless it grows beyond its previous size.
+void BranchTab_clear(BranchTab * self) {
+    unsigned i;
+    if(self->nbits) {
+        for(i=0; i < self->n; ++i)
+            self->slot[self->key[i]] = 0;
+    } else
+        memset(self->slot, 0, (self->mask + 1u) * sizeof(self->slot[0]));
+    self->n = 0;
+#ifndef NDEBUG
+    self->frozen = 0;
 #endif
 }
 
-void BTLink_print(const BTLink * self, FILE *fp) {
-    if(self == NULL)
-        return;
-    BTLink_printShallow(self, fp);
-    BTLink_print(self->next, fp);
-}
+/// Return the index of the element of slot that belongs to key. In
+/// a hashed table, this is either the slot of key's entry or the
+/// empty slot where that entry belongs. In a dense table, key must be
+/// less than 2^nbits.
+static unsigned BranchTab_probe(const BranchTab * self, tipId_t key) {
+    unsigned h, s;
 
-BranchTab    *BranchTab_new(void) {
-    BranchTab    *new = malloc(sizeof(*new));
-    CHECKMEM(new);
-    memset(new, 0, sizeof(*new));
-    return new;
+    if(self->nbits) {
+        assert((key >> self->nbits) == 0);
+        return (unsigned) key;
+    }
+    for(h = tipIdHash(key) & self->mask;
+        (s = self->slot[h]) != 0 && self->key[s - 1] != key;
+        h = (h + 1) & self->mask)
+        ;
+    return h;
 }
 
-BranchTab    *BranchTab_dup(const BranchTab *old) {
-    BranchTab *new = BranchTab_new();
+/// Return the index of the entry for key, or -1 if there is none.
+static int BranchTab_find(const BranchTab * self, tipId_t key) {
+    if(self->nbits && (key >> self->nbits) != 0)
+        return -1;
+    return (int) self->slot[BranchTab_probe(self, key)] - 1;
+}
 
-#ifndef NDEBUG
-    new->frozen = old->frozen;
+/// Double the space for entries and, in a hashed table, the number
+/// of slots, which must then be filled again.
+static void BranchTab_grow(BranchTab * self) {
+    self->dim *= 2;
+    self->key = realloc(self->key, self->dim * sizeof(self->key[0]));
+    CHECKMEM(self->key);
+    self->value = realloc(self->value, self->dim * sizeof(self->value[0]));
+    CHECKMEM(self->value);
+#if COST==CHISQR_COST
+    self->sumsqr = realloc(self->sumsqr, self->dim * sizeof(self->sumsqr[0]));
+    CHECKMEM(self->sumsqr);
 #endif
+    if(self->nbits == 0)
+        BranchTab_rehash(self);
+}
 
-    int i;
-    for(i=0; i < BT_DIM; ++i)
-        new->tab[i] = BTLink_dup(old->tab[i]);
+/// Replace the slots with a hash table of 2*dim slots, filled from the
+/// entries. A dense table becomes a hashed one.
+static void BranchTab_rehash(BranchTab * self) {
+    unsigned i;
 
-    return new;
+    free(self->slot);
+    self->nbits = 0;
+    self->mask = 2 * self->dim - 1;
+    self->slot = calloc(2 * self->dim, sizeof(self->slot[0]));
+    CHECKMEM(self->slot);
+    for(i=0; i < self->n; ++i)
+        self->slot[BranchTab_probe(self, self->key[i])] = i + 1;
 }
 
-/// Return 1 if two BranchTab objects are equal; 0 otherwise.
-int BranchTab_equals(const BranchTab *lhs, const BranchTab *rhs) {
-    int i;
+/// Add an entry for key, with value zero, and return its index. The
+/// key must not already be present.
+static unsigned BranchTab_insert(BranchTab * self, tipId_t key) {
+    unsigned i = self->n;
 
-    for(i=0; i < BT_DIM; ++i) {
-        if(!BTLink_equals(lhs->tab[i], rhs->tab[i]))
-            return 0;
-    }
-#ifndef NDEBUG
-    if(lhs->frozen != rhs->frozen)
-        return 0;
+    if(i == self->dim)
+        BranchTab_grow(self);
+    self->key[i] = key;
+    self->value[i] = 0.0;
+#if COST==CHISQR_COST
+    self->sumsqr[i] = 0.0;
 #endif
-    return 1;
-}
-
-/// Destructor for BranchTab.
-void BranchTab_free(BranchTab * self) {
-    int i;
-    for(i=0; i < BT_DIM; ++i)
-        BTLink_free(self->tab[i]);
-    free(self);
+    self->slot[BranchTab_probe(self, key)] = i + 1;
+    self->n += 1;
+    return i;
 }
 
 /// Return 1 if BranchTab includes singleton site patterns
 int BranchTab_hasSingletons(BranchTab * self) {
-    int i;
-    for(i=0; i < BT_DIM; ++i) {
-        if(BTLink_hasSingletons(self->tab[i]))
+    unsigned i;
+    for(i=0; i < self->n; ++i) {
+        if(isPow2(self->key[i]))
             return 1;
     }
     return 0;
@@ -256,33 +340,66 @@ int BranchTab_hasSingletons(BranchTab * self) {
 
 /// Return value corresponding to key, or nan if no value is found.
 double BranchTab_get(BranchTab * self, tipId_t key) {
-    unsigned h = tipIdHash(key);
-    assert(h < BT_DIM);
     assert(self);
-    return BTLink_get(self->tab[h], key);
+    int i = BranchTab_find(self, key);
+    return i < 0 ? nan("") : self->value[i];
 }
 
 /// Add a value to table. If key already exists, new value is added to
-/// old one.
+/// old one. If the table was made by BranchTab_newFolded, key is a
+/// set of samples, and value is divided among population-level keys.
+/// If COST==CHISQR_COST, the square of each value is also added to
+/// a sum of squares.
 void BranchTab_add(BranchTab * self, tipId_t key, double value) {
-    assert(!self->frozen);
-    unsigned h = tipIdHash(key);
-    assert(h < BT_DIM);
     assert(self);
-    self->tab[h] = BTLink_add(self->tab[h], key, value);
+    assert(!self->frozen);
+    if(self->fold == NULL) {
+        BranchTab_addKey(self, key, value);
+        return;
+    }
+    tipId_t     fixed, bit[self->fold->npops];
+    double      p[self->fold->npops];
+    int         m = PatFold_split(self->fold, key, &fixed, bit, p);
+    BranchTab_addFolded(self, fixed, value, m, bit, p);
 }
 
-/// Return the number of elements in the BranchTab.
-unsigned BranchTab_size(BranchTab * self) {
-    unsigned    i;
-    unsigned    size = 0;
+/// Add value to the entry for key, without folding. A key too large
+/// for a dense table turns it into a hashed one.
+static void BranchTab_addKey(BranchTab * self, tipId_t key, double value) {
+    if(self->nbits && (key >> self->nbits) != 0)
+        BranchTab_rehash(self);
+    unsigned s = self->slot[BranchTab_probe(self, key)];
+    unsigned i = (s ? s - 1 : BranchTab_insert(self, key));
+    self->value[i] += value;
+#if COST==CHISQR_COST
+    self->sumsqr[i] += value*value;
+#endif
+}
 
-    for(i = 0; i < BT_DIM; ++i) {
-        BTLink *el;
-        for(el = self->tab[i]; el; el = el->next)
-            ++size;
+/// Divide value between population-level patterns with and without
+/// bit[0], in proportions p[0] and 1-p[0], and recurse on the
+/// remaining m-1 populations. Pattern pat holds the bits chosen so
+/// far.
+static void BranchTab_addFolded(BranchTab * self, tipId_t pat, double value,
+                                int m, const tipId_t bit[m],
+                                const double p[m]) {
+    if(m == 0) {
+        if(pat == 0 || pat == PatFold_full(self->fold))
+            return;
+        if(!self->foldSing && isPow2(pat))
+            return;
+        BranchTab_addKey(self, pat, value);
+        return;
     }
-    return size;
+    BranchTab_addFolded(self, pat | bit[0], value * p[0], m - 1, bit + 1,
+                        p + 1);
+    BranchTab_addFolded(self, pat, value * (1.0 - p[0]), m - 1, bit + 1,
+                        p + 1);
+}
+
+/// Return the number of elements in the BranchTab.
+unsigned BranchTab_size(BranchTab * self) {
+    return self->n;
 }
 
 /// Divide all values by denom. Return 0 on success, or 1 on failure.
@@ -294,14 +411,11 @@ int BranchTab_divideBy(BranchTab *self, double denom) {
 
     // divide by denom
     unsigned i;
-    for(i = 0; i < BT_DIM; ++i) {
-        BTLink *el;
-        for(el = self->tab[i]; el; el = el->next) {
-            el->value /= denom;
+    for(i = 0; i < self->n; ++i) {
+        self->value[i] /= denom;
 #if COST==CHISQR_COST
-            el->sumsqr /= denom;
+        self->sumsqr[i] /= denom;
 #endif
-        }
     }
 
     return 0;
@@ -310,22 +424,48 @@ int BranchTab_divideBy(BranchTab *self, double denom) {
 /// Print a BranchTab to standard output.
 void BranchTab_print(const BranchTab *self, FILE *fp) {
     unsigned i;
-    for(i=0; i < BT_DIM; ++i) {
-        fprintf(fp, "%2u:", i);
-        BTLink_print(self->tab[i], fp);
-        putc('\n', fp);
+    for(i=0; i < self->n; ++i) {
+        fprintf(fp, "%4u: [", i);
+        printTipId(self->key[i], fp);
+#if COST==CHISQR_COST
+        fprintf(fp, ", %lf, %lf]\n", self->value[i], self->sumsqr[i]);
+#else
+        fprintf(fp, ", %lf]\n", self->value[i]);
+#endif
     }
 }
 
-/// Add each entry in table rhs to table lhs
+/// Print a tipId_t in decimal if it fits in 64 bits, or otherwise in
+/// hexadecimal, as its high and low 64-bit halves.
+static void printTipId(tipId_t key, FILE * fp) {
+#if TIPID_SIZE==128
+    uint64_t    hi = (uint64_t) (key >> 64);
+    if(hi) {
+        fprintf(fp, "0x%" PRIx64 "%016" PRIx64, hi, (uint64_t) key);
+        return;
+    }
+#endif
+    fprintf(fp, "%" PRIu64, (uint64_t) key);
+}
+
+/// Return 1 if lhs and rhs fold keys in the same way, or if neither
+/// folds them; 0 otherwise.
+static int BranchTab_sameFold(const BranchTab * lhs, const BranchTab * rhs) {
+    if(lhs->fold == NULL || rhs->fold == NULL)
+        return lhs->fold == rhs->fold;
+    return lhs->foldSing == rhs->foldSing
+        && PatFold_equals(lhs->fold, rhs->fold);
+}
+
+/// Add each entry in table rhs to table lhs. Keys of rhs are
+/// already folded, if folding is called for, so they are copied as
+/// they are. The two tables must fold in the same way.
 void BranchTab_plusEquals(BranchTab *lhs, BranchTab *rhs) {
     assert(!lhs->frozen && !rhs->frozen);
-    int i;
-    for(i=0; i<BT_DIM; ++i) {
-        BTLink *link;
-        for(link=rhs->tab[i]; link!=NULL; link=link->next)
-            BranchTab_add(lhs, link->key, link->value);
-    }
+    assert(BranchTab_sameFold(lhs, rhs));
+    unsigned i;
+    for(i=0; i < rhs->n; ++i)
+        BranchTab_addKey(lhs, rhs->key[i], rhs->value[i]);
 }
 
 /// Fill arrays key, value, and square with values in BranchTab.
@@ -334,21 +474,14 @@ void BranchTab_plusEquals(BranchTab *lhs, BranchTab *rhs) {
 /// sumsqr[i] is the corresponding sum of squared branch lengths.
 void BranchTab_toArrays(BranchTab *self, unsigned n, tipId_t key[n],
 						double value[n], double sumsqr[n]) {
-    int i, j=0;
-    for(i=0; i<BT_DIM; ++i) {
-        BTLink *link;
-        for(link=self->tab[i]; link!=NULL; link=link->next) {
-            if(j >= n)
-                eprintf("%s:%s:%d: buffer overflow\n",
-						__FILE__,__func__,__LINE__);
-            key[j] = link->key;
-            value[j] = link->value;
+    if(self->n > n)
+        eprintf("%s:%s:%d: buffer overflow\n",
+                __FILE__,__func__,__LINE__);
+    memcpy(key, self->key, self->n * sizeof(key[0]));
+    memcpy(value, self->value, self->n * sizeof(value[0]));
 #if COST==CHISQR_COST
-            sumsqr[j] = link->sumsqr;
+    memcpy(sumsqr, self->sumsqr, self->n * sizeof(sumsqr[0]));
 #endif
-            ++j;
-        }
-    }
 }
 
 /// Construct a BranchTab by parsing an input file.
@@ -356,12 +489,12 @@ void BranchTab_toArrays(BranchTab *self, unsigned n, tipId_t key[n],
 BranchTab *BranchTab_parse(const char *fname, const LblNdx *lblndx) {
     FILE *fp = efopen(fname, "r");
 
-    BranchTab *self = BranchTab_new();
+    BranchTab *self = BranchTab_newDense(LblNdx_size(lblndx));
     CHECKMEM(self);
 
     int         i, ntokens;
-    char        buff[500];
-    char        lblbuff[100];
+    char        buff[MAXSAMP * POPNAMESIZE + 100];
+    char        lblbuff[MAXSAMP * POPNAMESIZE];
     Tokenizer  *tkz = Tokenizer_new(50);
 
     while(1) {
@@ -426,66 +559,34 @@ BranchTab *BranchTab_parse(const char *fname, const LblNdx *lblndx) {
 double        BranchTab_chiSqCost(const BranchTab *obs, const BranchTab *expt,
                              double u, long nnuc, double n) {
     assert(expt->frozen);
-    int i;
+    unsigned i;
+    int j;
     double U = u*nnuc;
     double cost=0.0, diff;
     double v;     // nnuc*u*u*Var(B), the variance of branch length
     double obval;  // observed mutations
     double exval;  // mutations expected under model
-    for(i=0; i < BT_DIM; ++i) {
-        BTLink *o = obs->tab[i];
-        BTLink *e = expt->tab[i];
-        while(o && e) {
-            if(o->key < e->key) {
-                // e link missing, so exval=0.
-                obval = o->value;
-                exval = 0.0;
-                o = o->next;
-                v = 0.0;
-            }else if(o->key > e->key) {
-                // o link missing, so obval=0.
-                obval = 0.0;
-                exval = e->value * U;
-                v = e->sumsqr - e->value * e->value;
-                assert(v>=0.0);
-                v *= u*U*n/(n-1.0);
-                e = e->next;
-            }else {
-                assert(o->key == e->key);
-                obval = o->value;
-                exval = e->value * U;
-                v = e->sumsqr - e->value * e->value;
-                assert(v>=0.0);
-                v *= u*U*n/(n-1.0);
-                e = e->next;
-                o = o->next;
-            }
-            diff = obval-exval;
-#if 0
-            printf("o=%lg e=%lg v=%lg chisq=%lg\n",
-                   obval, exval, v, diff*diff/(exval+v));
-#endif
-            cost += diff*diff/(exval+v);
-        }
-        if(o) { // e link missing, so exval=0
-            cost = HUGE_VAL;
-            break;
-        }
-        obval=0.0;
-        while(e) { // o link missing, so obval=0
-            exval = e->value * U;
-            v = e->sumsqr - e->value * e->value;
-            assert(v>=0.0);
-            v *= u*U*n/(n-1.0);
-            diff = obval-exval;
+
+    // Patterns in expt, observed or not.
+    for(i=0; i < expt->n; ++i) {
+        j = BranchTab_find(obs, expt->key[i]);
+        obval = (j < 0 ? 0.0 : obs->value[j]);
+        exval = expt->value[i] * U;
+        v = expt->sumsqr[i] - expt->value[i] * expt->value[i];
+        assert(v>=0.0);
+        v *= u*U*n/(n-1.0);
+        diff = obval-exval;
 #if 0
-            printf("o=%lg e=%lg v=%lg chisq=%lg\n",
-                   obval, exval, v, diff*diff/(exval+v));
+        printf("o=%lg e=%lg v=%lg chisq=%lg\n",
+               obval, exval, v, diff*diff/(exval+v));
 #endif
-            assert(v>=0.0);
-            cost += diff*diff/(exval+v);
-            e = e->next;
-        }
+        cost += diff*diff/(exval+v);
+    }
+
+    // An observed pattern missing from expt has exval=0.
+    for(i=0; i < obs->n; ++i) {
+        if(BranchTab_find(expt, obs->key[i]) < 0)
+            return HUGE_VAL;
     }
     assert(cost >= 0.0);
     return cost;
@@ -499,54 +600,30 @@ double        BranchTab_smplChiSqCost(const BranchTab *obs,
                                       const BranchTab *expt,
                                       double u, long nnuc, double n) {
     assert(expt->frozen);
-    int i;
+    unsigned i;
+    int j;
     double U = u*nnuc;
     double cost=0.0, diff;
     double obval;  // observed mutations
     double exval;  // mutations expected under model
-    for(i=0; i < BT_DIM; ++i) {
-        BTLink *o = obs->tab[i];
-        BTLink *e = expt->tab[i];
-        while(o && e) {
-            if(o->key < e->key) {
-                // e link missing, so exval=0.
-                obval = o->value;
-                exval = 0.0;
-                o = o->next;
-            }else if(o->key > e->key) {
-                // o link missing, so obval=0.
-                obval = 0.0;
-                exval = e->value * U;
-                e = e->next;
-            }else {
-                assert(o->key == e->key);
-                obval = o->value;
-                exval = e->value * U;
-                e = e->next;
-                o = o->next;
-            }
-            diff = obval-exval;
-#if 0
-            printf("o=%lg e=%lg chisq=%lg\n",
-                   obval, exval, diff*diff/exval);
-#endif
-            cost += diff*diff/exval;
-        }
-        if(o) { // e link missing, so exval=0
-            cost = HUGE_VAL;
-            break;
-        }
-        obval=0.0;
-        while(e) { // o link missing, so obval=0
-            exval = e->value * U;
-            diff = obval-exval;
+
+    // Patterns in expt, observed or not.
+    for(i=0; i < expt->n; ++i) {
+        j = BranchTab_find(obs, expt->key[i]);
+        obval = (j < 0 ? 0.0 : obs->value[j]);
+        exval = expt->value[i] * U;
+        diff = obval-exval;
 #if 0
-            printf("o=%lg e=%lg chisq=%lg\n",
-                   obval, exval, diff*diff/exval);
+        printf("o=%lg e=%lg chisq=%lg\n",
+               obval, exval, diff*diff/exval);
 #endif
-            cost += diff*diff/exval;
-            e = e->next;
-        }
+        cost += diff*diff/exval;
+    }
+
+    // An observed pattern missing from expt has exval=0.
+    for(i=0; i < obs->n; ++i) {
+        if(BranchTab_find(expt, obs->key[i]) < 0)
+            return HUGE_VAL;
     }
     assert(cost >= 0.0);
     return cost;
@@ -558,44 +635,25 @@ double        BranchTab_smplChiSqCost(const BranchTab *obs,
 double BranchTab_poissonCost(const BranchTab *obs, const BranchTab *expt,
                              double u, long nnuc, double n) {
     assert(expt->frozen);
-    int i;
+    unsigned i;
+    int j;
     double U = u*nnuc;
     double cost=0.0;
     double obval;  // observed mutations
     double exval;  // mutations expected under model
-    for(i=0; i < BT_DIM; ++i) {
-        BTLink *o = obs->tab[i];
-        BTLink *e = expt->tab[i];
-        while(o && e) {
-            if(o->key < e->key) {
-                // e link missing, so exval=0.
-                obval = o->value;
-                exval = 0.0;
-                o = o->next;
-            }else if(o->key > e->key) {
-                // o link missing, so obval=0.
-                obval = 0.0;
-                exval = e->value * U;
-                e = e->next;
-            }else {
-                assert(o->key == e->key);
-                obval = o->value;
-                exval = e->value * U;
-                e = e->next;
-                o = o->next;
-            }
-            cost += -obval*log(exval) + exval + lgamma(obval+1.0);
-        }
-        if(o) { // e link missing, so exval=0
-            cost = HUGE_VAL;
-            break;
-        }
-        obval=0.0;
-        while(e) { // o link missing, so obval=0
-            exval = e->value * U;
-            cost += -obval*log(exval) + exval + lgamma(obval+1.0);
-            e = e->next;
-        }
+
+    // Patterns in expt, observed or not.
+    for(i=0; i < expt->n; ++i) {
+        j = BranchTab_find(obs, expt->key[i]);
+        obval = (j < 0 ? 0.0 : obs->value[j]);
+        exval = expt->value[i] * U;
+        cost += -obval*log(exval) + exval + lgamma(obval+1.0);
+    }
+
+    // An observed pattern missing from expt has exval=0.
+    for(i=0; i < obs->n; ++i) {
+        if(BranchTab_find(expt, obs->key[i]) < 0)
+            return HUGE_VAL;
     }
     assert(cost >= 0.0);
     return cost;
@@ -607,11 +665,8 @@ double BranchTab_sum(const BranchTab *self) {
     unsigned i;
     double s=0.0;
 
-    for(i = 0; i < BT_DIM; ++i) {
-        BTLink *el;
-        for(el = self->tab[i]; el; el = el->next)
-            s += el->value;
-    }
+    for(i = 0; i < self->n; ++i)
+        s += self->value[i];
 
     return s;
 }
@@ -626,11 +681,8 @@ int BranchTab_normalize(BranchTab *self) {
         return 1;
 
     // divide by sum
-    for(i = 0; i < BT_DIM; ++i) {
-        BTLink *el;
-        for(el = self->tab[i]; el; el = el->next)
-            el->value /= s;
-    }
+    for(i = 0; i < self->n; ++i)
+        self->value[i] /= s;
 
     return 0;
 }
@@ -643,48 +695,27 @@ double BranchTab_KLdiverg(const BranchTab *obs, const BranchTab *expt) {
     assert(Dbl_near(1.0, BranchTab_sum(obs)));
     assert(Dbl_near(1.0, BranchTab_sum(expt)));
 
-    int i;
+    unsigned i;
+    int j;
     double kl=0.0;
     double p;  // observed frequency
     double q;  // frequency under model
-    for(i=0; i < BT_DIM; ++i) {
-        BTLink *o, *e;
-        o = obs->tab[i];
-        e = expt->tab[i];
-        while(o && e) {
-            if(o->key < e->key) {
-                p = o->value;
-                q = 0.0;
-                o = o->next;
-            }else if(o->key > e->key) {
-                p = 0.0;
-                q = e->value;
-                e = e->next;
-            }else {
-                assert(o->key == e->key);
-                p = o->value;
-                q = e->value;
-                e = e->next;
-                o = o->next;
-            }
-            if(p == 0.0) {
-                // Do nothing: p*log(p/q) -> 0 as p->0, regardless of
-                // q. This is because p*log(p/q) is the log of
-                // (p/q)**p, which equals 1 if p=0, no matter the value
-                // of q.
-            }else{
-                if(q==0.0)
-                    return HUGE_VAL;
-                kl += p*log(p/q);
-            }
-        }
-        while(o) { // e->value is q=0: fail unless p=0
-            p = o->value;
-            if(p != 0.0)
-                return HUGE_VAL;
-            o = o->next;
+
+    // Patterns missing from obs have p=0 and contribute nothing.
+    for(i=0; i < obs->n; ++i) {
+        p = obs->value[i];
+        if(p == 0.0) {
+            // Do nothing: p*log(p/q) -> 0 as p->0, regardless of
+            // q. This is because p*log(p/q) is the log of
+            // (p/q)**p, which equals 1 if p=0, no matter the value
+            // of q.
+            continue;
         }
-        // Any remaining cases have p=0, so contribution to kl is 0.
+        j = BranchTab_find(expt, obs->key[i]);
+        q = (j < 0 ? 0.0 : expt->value[j]);
+        if(q==0.0)
+            return HUGE_VAL;
+        kl += p*log(p/q);
     }
     return kl;
 }
@@ -695,48 +726,26 @@ double BranchTab_KLdiverg(const BranchTab *obs, const BranchTab *expt) {
 double BranchTab_negLnL(const BranchTab *obs, const BranchTab *expt) {
     assert(Dbl_near(1.0, BranchTab_sum(expt)));
 
-    int i;
+    unsigned i;
+    int j;
     double lnL=0.0;
     double x;  // observed count
     double p;  // probability under model
-    for(i=0; i < BT_DIM; ++i) {
-        BTLink *o, *e;  // observed and expected
-        o = obs->tab[i];
-        e = expt->tab[i];
-        while(o && e) {
-            if(o->key < e->key) {
-                x = o->value;
-                p = 0.0;
-                o = o->next;
-            }else if(o->key > e->key) {
-                x = 0.0;
-                p = e->value;
-                e = e->next;
-            }else {
-                assert(o->key == e->key);
-                x = o->value;
-                p = e->value;
-                e = e->next;
-                o = o->next;
-            }
-            if(p == 0.0) {
-                if(x != 0.0)
-                    return HUGE_VAL;  // blows up
-            }else
-                lnL += x*log(p);
-        }
-        while(o) { // e->value is p=0
-            x = o->value;
+
+    // Patterns missing from obs have x=0 and contribute nothing.
+    for(i=0; i < obs->n; ++i) {
+        x = obs->value[i];
+        j = BranchTab_find(expt, obs->key[i]);
+        p = (j < 0 ? 0.0 : expt->value[j]);
+        if(p == 0.0) {
             if(x != 0.0)
-                return HUGE_VAL; // blows up
-            o = o->next;
-        }
-        // Any remaining cases have x=0, so contribution to lnL is 0.
+                return HUGE_VAL;  // blows up
+        }else
+            lnL += x*log(p);
     }
     return -lnL;
 }
 
-
 #ifdef TEST
 
 #include <string.h>
@@ -784,6 +793,52 @@ const char *tstPatProbInput =
     "a:c        1.0\n"
     "b:c        1.0\n";
 
+// A bit beyond the range of any dense table, as wide as tipId_t allows.
+#if TIPID_SIZE==128
+static const tipId_t wideBit = ((tipId_t) 1) << 100;
+#elif TIPID_SIZE==64
+static const tipId_t wideBit = ((tipId_t) 1) << 40;
+#else
+static const tipId_t wideBit = ((tipId_t) 1) << 30;
+#endif
+
+static void checkOps(BranchTab *bt, unsigned n, const tipId_t key[n]);
+
+/// Add n distinct keys to empty table bt, and check add, get,
+/// plusEquals, subtraction, and divideBy. Values are small integers
+/// and halves, so sums are exact.
+static void checkOps(BranchTab *bt, unsigned n, const tipId_t key[n]) {
+    unsigned i;
+    BranchTab *rhs = BranchTab_newLike(bt);
+
+    assert(0 == BranchTab_size(bt));
+    for(i=0; i < n; ++i) {
+        assert(isnan(BranchTab_get(bt, key[i])));
+        BranchTab_add(bt, key[i], 1.0 + i);
+        assert(i+1 == BranchTab_size(bt));
+    }
+    for(i=0; i < n; ++i) {
+        assert(1.0 + i == BranchTab_get(bt, key[i]));
+        BranchTab_add(rhs, key[n-1-i], 2.0);
+    }
+    BranchTab_plusEquals(bt, rhs);
+    assert(n == BranchTab_size(bt));
+    for(i=0; i < n; ++i)
+        assert(3.0 + i == BranchTab_get(bt, key[i]));
+
+    // Subtraction adds a negative value.
+    for(i=0; i < n; ++i)
+        BranchTab_add(bt, key[i], -1.0);
+    assert(n == BranchTab_size(bt));
+    for(i=0; i < n; ++i)
+        assert(2.0 + i == BranchTab_get(bt, key[i]));
+
+    BranchTab_divideBy(bt, 2.0);
+    for(i=0; i < n; ++i)
+        assert(1.0 + 0.5*i == BranchTab_get(bt, key[i]));
+    BranchTab_free(rhs);
+}
+
 int main(int argc, char **argv) {
     int verbose=0;
     if(argc > 1) {
@@ -830,8 +885,194 @@ int main(int argc, char **argv) {
 
     if(verbose)
         BranchTab_print(bt, stdout);
+
+    // Keys are printed without truncation. Those wider than 64 bits
+    // are in hexadecimal.
+    {
+        BranchTab *wide = BranchTab_new();
+        char line[100];
+        FILE *tmp = tmpfile();
+        assert(tmp);
+        BranchTab_add(wide, 5, 1.0);
+#if TIPID_SIZE==128
+        BranchTab_add(wide, (((tipId_t) 1) << 100) | 5, 2.0);
+#endif
+        BranchTab_print(wide, tmp);
+        rewind(tmp);
+        assert(fgets(line, sizeof line, tmp));
+        assert(0 == strncmp(line, "   0: [5, ", 10));
+#if TIPID_SIZE==128
+        assert(fgets(line, sizeof line, tmp));
+        assert(0 == strncmp(line, "   1: [0x10000000000000000000000005, ",
+                            37));
+#endif
+        fclose(tmp);
+        BranchTab_free(wide);
+    }
+
+    // Clearing keeps the memory, which is reused in any order.
+    BranchTab_divideBy(bt, 2.0);
+    BranchTab_clear(bt);
+    assert(0 == BranchTab_size(bt));
+    assert(isnan(BranchTab_get(bt, key[0])));
+    for(i=24; i >= 0; --i)
+        BranchTab_add(bt, key[i], val[i]);
+    BranchTab_add(bt, 100, 1.0);
+    assert(26 == BranchTab_size(bt));
+    for(i=0; i < 25; ++i)
+        assert(val[i] == BranchTab_get(bt, key[i]));
+    assert(1.0 == BranchTab_get(bt, 100));
+
+    // A dense table holds the same values as a hashed one.
+    BranchTab *dense = BranchTab_newDense(7);
+    assert(0 == BranchTab_size(dense));
+    for(i=0; i < 25; ++i)
+        BranchTab_add(dense, key[i], val[i]);
+    assert(25 == BranchTab_size(dense));
+    assert(isnan(BranchTab_get(dense, 100)));
+    BranchTab_add(dense, 100, 1.0);
+    assert(BranchTab_equals(bt, dense));
+    assert(BranchTab_equals(dense, bt));
+    BranchTab_add(dense, 127, 1.0);
+    assert(!BranchTab_equals(bt, dense));
+    BranchTab_clear(dense);
+    assert(isnan(BranchTab_get(dense, 100)));
+    for(i=0; i < 100; ++i)
+        BranchTab_add(dense, i+1, 0.5);
+    assert(100 == BranchTab_size(dense));
+    BranchTab *dense2 = BranchTab_dup(dense);
+    assert(BranchTab_equals(dense, dense2));
+    BranchTab_plusEquals(bt, dense2);
+    assert(val[3] + 0.5 == BranchTab_get(bt, key[3]));
+    assert(1.5 == BranchTab_get(bt, 100));
+    assert(0.5 == BranchTab_get(bt, 99));
+    BranchTab_free(dense2);
+    BranchTab_free(dense);
     BranchTab_free(bt);
 
+    // Dense and hashed tables, with keys of every width.
+    {
+        tipId_t k[200];
+        unsigned n;
+
+        // Every key of a dense table, enough to make it grow.
+        dense = BranchTab_newDense(7);
+        for(i=0; i < 128; ++i)
+            k[i] = (tipId_t) i;
+        checkOps(dense, 128, k);
+        BranchTab_free(dense);
+
+        // Keys as wide as tipId_t, in a hashed table that grows.
+        bt = BranchTab_new();
+        for(i=0; i < 200; ++i)
+            k[i] = wideBit | (tipId_t) (7 * i + 1);
+        checkOps(bt, 200, k);
+        BranchTab_free(bt);
+
+        // Keys whose hashes collide in the last slot of a new table,
+        // so that linear probing wraps around to the first.
+        tipId_t j, last = 2 * BT_INIT - 1;
+        for(n=0, j=1; n < 8; ++j) {
+            if((tipIdHash(wideBit | j) & last) == last)
+                k[n++] = wideBit | j;
+        }
+        bt = BranchTab_new();
+        checkOps(bt, n, k);
+        BranchTab_free(bt);
+
+        // A key too large for a dense table makes it a hashed one,
+        // and is not found before it is added.
+        dense = BranchTab_newDense(4);
+        for(i=0; i < 16; ++i)
+            k[i] = (tipId_t) i;
+        k[16] = wideBit;
+        k[17] = ((tipId_t) 1) << 4;
+        for(i=0; i < 8; ++i)
+            k[18 + i] = wideBit | (tipId_t) (i + 1);
+        checkOps(dense, 26, k);
+        BranchTab_free(dense);
+    }
+
+    // Populations A, B, and C have samples {0}, {1,2}, and {3}, and
+    // bits 1, 2, and 4 in folded patterns.
+    SampNdx     sndx = {.n = 4, .node = {0, 1, 1, 2} };
+    PatFold     pf;
+    PatFold_init(&pf, &sndx);
+    bt = BranchTab_newFolded(&pf, 1);
+    BranchTab_add(bt, 1 | 2, 4.0);      // A and half of B
+    assert(2 == BranchTab_size(bt));
+    assert(2.0 == BranchTab_get(bt, 1 | 2));
+    assert(2.0 == BranchTab_get(bt, 1));
+    BranchTab_add(bt, 2 | 4, 1.0);      // all of B
+    assert(2.0 == BranchTab_get(bt, 1));
+    assert(1.0 == BranchTab_get(bt, 2));
+    BranchTab_add(bt, 15, 1.0);         // all samples: discarded
+    BranchTab_add(bt, 4 | 8, 2.0);      // half of B and C
+    assert(1.0 == BranchTab_get(bt, 2 | 4));
+    assert(1.0 == BranchTab_get(bt, 4));
+    assert(5 == BranchTab_size(bt));
+    BranchTab *bt2 = BranchTab_dup(bt);
+    BranchTab_add(bt2, 2 | 4, 1.0);
+    assert(2.0 == BranchTab_get(bt2, 2));
+    BranchTab_free(bt2);
+    BranchTab_free(bt);
+
+    bt = BranchTab_newFolded(&pf, 0);   // without singletons
+    BranchTab_add(bt, 1 | 2, 4.0);
+    assert(1 == BranchTab_size(bt));
+    assert(2.0 == BranchTab_get(bt, 1 | 2));
+
+    // plusEquals copies folded keys without folding them again.
+    bt2 = BranchTab_newLike(bt);
+    BranchTab_plusEquals(bt2, bt);
+    BranchTab_plusEquals(bt2, bt);
+    assert(1 == BranchTab_size(bt2));
+    assert(4.0 == BranchTab_get(bt2, 1 | 2));
+    BranchTab_free(bt2);
+    BranchTab_free(bt);
+
+    // Entries are stored contiguously, in the order in which their
+    // keys were added, in hashed and dense tables alike, and after
+    // the tables grow and are cleared.
+    for(int dns = 0; dns < 2; ++dns) {
+        bt = (dns ? BranchTab_newDense(7) : BranchTab_new());
+        for(int rep = 0; rep < 2; ++rep) {
+            tipId_t k[100];
+            double  v[100], sq[100];
+            BranchTab_clear(bt);
+            for(i=0; i < 100; ++i)
+                BranchTab_add(bt, (tipId_t) ((37 * i + 11 * rep) % 128),
+                              i + 0.5);
+            assert(100 == BranchTab_size(bt));
+            BranchTab_toArrays(bt, 100, k, v, sq);
+            for(i=0; i < 100; ++i) {
+                assert(k[i] == (tipId_t) ((37 * i + 11 * rep) % 128));
+                assert(v[i] == i + 0.5);
+            }
+        }
+        BranchTab_free(bt);
+    }
+
+    // A dense table indexes every key below 2^nbits directly, from 0
+    // through all bits set, and forgets them when cleared.
+    dense = BranchTab_newDense(7);
+    BranchTab_add(dense, 0, 1.0);
+    BranchTab_add(dense, 127, 2.0);
+    BranchTab_add(dense, 64, 3.0);
+    assert(3 == BranchTab_size(dense));
+    assert(1.0 == BranchTab_get(dense, 0));
+    assert(2.0 == BranchTab_get(dense, 127));
+    assert(3.0 == BranchTab_get(dense, 64));
+    assert(isnan(BranchTab_get(dense, 63)));
+    bt2 = BranchTab_newLike(dense);
+    BranchTab_plusEquals(bt2, dense);
+    assert(BranchTab_equals(dense, bt2));
+    BranchTab_free(bt2);
+    BranchTab_clear(dense);
+    for(i=0; i < 128; ++i)
+        assert(isnan(BranchTab_get(dense, (tipId_t) i)));
+    BranchTab_free(dense);
+
 	Bounds   bnd = {
 		.lo_twoN = 0.0,
 		.hi_twoN = 1e7,
@@ -843,14 +1084,14 @@ int main(int argc, char **argv) {
 
     bt = BranchTab_parse(tstPatProbFname, &lblndx);
 
-    BranchTab *bt2 = BranchTab_dup(bt);
+    bt2 = BranchTab_dup(bt);
     assert(BranchTab_equals(bt, bt2));
 
     if(verbose)
         BranchTab_print(bt, stdout);
     BranchTab_free(bt);
     GPTree_free(g);
-	unitTstResult("BranchTab", "untested");
+	unitTstResult("BranchTab", "OK");
     unlink(tstFname);
     unlink(tstPatProbFname);
 }
@@ -4,8 +4,13 @@
 #include "typedefs.h"
 #include <stdio.h>
 
+uint32_t      tipIdHash(tipId_t key);
 BranchTab    *BranchTab_new(void);
+BranchTab    *BranchTab_newDense(int nbits);
+BranchTab    *BranchTab_newFolded(const PatFold *fold, int doSing);
+BranchTab    *BranchTab_newLike(const BranchTab *old);
 void          BranchTab_free(BranchTab * self);
+void          BranchTab_clear(BranchTab * self);
 double        BranchTab_get(BranchTab * self, tipId_t tipid);
 int           BranchTab_hasSingletons(BranchTab * self);
 void          BranchTab_add(BranchTab * self, tipId_t key, double value);
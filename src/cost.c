@@ -22,20 +22,41 @@ extern pthread_mutex_t outputLock;
 #include "gptree.h"
 #include "branchtab.h"
 #include "patprob.h"
+#include "treebank.h"
+#include "segcache.h"
+#include "fastrng.h"
 #include "misc.h"
 #include <math.h>
-#include <gsl/gsl_rng.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Combine seed with the bits of parameter vector x to form the seed
+/// of a family of random streams specific to x.
+static unsigned long evalSeed(unsigned long seed, int dim,
+                              const double x[dim]) {
+    for(int i = 0; i < dim; ++i) {
+        uint64_t    bits;
+        memcpy(&bits, x + i, sizeof bits);
+        seed = FastRng_streamSeed(seed, (unsigned long) bits);
+    }
+    return seed;
+}
 
 /// Calculate cost.
 /// @param[in] dim dimension of x
 /// @param[in] x vector of parameter values.
 /// @param jdata void pointer to a CostPar object, which contains
 /// exogeneous parameters of the cost function.
-/// @param tdata void pointer to a random number generator
+/// @param tdata void pointer to the SimState of the calling thread
+/// (see SimState_new), or NULL. If not NULL, SimState_patprob and
+/// SimState_simulateIncr reuse its memory rather than allocating
+/// their own. Other paths allocate: the exact calculation, the result
+/// table of TreeBank_estimate, and the control-variate expectations
+/// that SimState_patprob calculates exactly at each point.
 /// @return cost
 double costFun(int dim, double x[dim], void *jdata, void *tdata) {
     CostPar *cp = (CostPar *) jdata;
-    gsl_rng *rng = (gsl_rng *) tdata;
+    SimState *state = (SimState *) tdata;
 
     long nreps = SimSched_getSimReps(cp->simSched);
     DPRINTF(("%s:%d: nreps=%ld\n",__FILE__,__LINE__,nreps));
@@ -44,7 +65,54 @@ double costFun(int dim, double x[dim], void *jdata, void *tdata) {
 	if(!GPTree_feasible(cp->gptree, 0))
 		return HUGE_VAL;
 
-    BranchTab  *prob = patprob(cp->gptree, nreps, cp->doSing, rng);
+    // Each stage gets its own family of random streams.
+    // SimSched_nStages counts the stages that remain, so it
+    // identifies the current stage. Unless we are using common
+    // random numbers, the streams are also keyed by the parameter
+    // vector. The cost of a point therefore does not depend on which
+    // thread evaluates it or on what that thread did before.
+    unsigned long seed = FastRng_streamSeed(cp->seed,
+                                            SimSched_nStages(cp->simSched));
+    if(!cp->crn)
+        seed = evalSeed(seed, dim, x);
+
+    // costFun already runs within a worker thread of diffev, so
+    // patprob runs serially here. Whether to calculate exactly is
+    // decided once, at startup, by checking that the model at its
+    // initial point is small enough. There is no fallback to
+    // simulation, which would mix exact and simulated costs within a
+    // single run. A point at which admixture creates too many states
+    // is treated as infeasible.
+    //
+    // The bank of genealogies is shared among threads. Where time
+    // parameters differ from those at which it was built, it returns
+    // NULL, and the point is simulated. Each copy of CostPar has its
+    // own cache of segments, which holds its previous simulation.
+    // Tables returned by SimState_simulateIncr and SimState_patprob
+    // belong to state.
+    BranchTab  *prob = NULL;
+    int         owned = 1;
+    if(cp->exact) {
+        prob = exactprob(cp->gptree, nreps, cp->doSing);
+        if(prob == NULL)
+            return HUGE_VAL;
+    }
+    if(prob == NULL && cp->bank)
+        prob = TreeBank_estimate(cp->bank, cp->gptree, nreps, cp->doSing,
+                                 seed);
+    if(prob == NULL && cp->cache && state) {
+        prob = SimState_simulateIncr(state, cp->gptree, cp->cache, nreps,
+                                     cp->doSing, seed);
+        owned = (prob == NULL);
+    }
+    if(prob == NULL && state) {
+        prob = SimState_patprob(state, cp->gptree, nreps, cp->doSing, seed,
+                                cp->crn, cp->antithetic, cp->qmc, cp->cv);
+        owned = 0;
+    }
+    if(prob == NULL)
+        prob = patprob(cp->gptree, nreps, cp->doSing, 1, seed, cp->crn,
+                       cp->antithetic, cp->qmc, cp->cv);
     BranchTab_divideBy(prob, nreps);
 #if COST==KL_COST
     BranchTab_normalize(prob);
@@ -65,7 +133,8 @@ double costFun(int dim, double x[dim], void *jdata, void *tdata) {
 # error "Unknown cost method"
 #endif
 
-    BranchTab_free(prob);
+    if(owned)
+        BranchTab_free(prob);
 
     return cost;
 }
@@ -84,12 +153,16 @@ void * CostPar_dup(const void * arg) {
     CHECKMEM(new->gptree);
     new->simSched = old->simSched;
     CHECKMEM(new->simSched);
+    new->cache = (old->incremental ? SegCache_new() : NULL);
     return new;
 }
 
 /// CostPar destructor.
 void CostPar_free(void *arg) {
     CostPar *self = (CostPar *) arg;
-    if(self)
+    if(self) {
+        if(self->cache)
+            SegCache_free(self->cache);
         free(self);
+    }
 }
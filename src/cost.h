@@ -13,6 +13,15 @@ typedef struct CostPar {
     GPTree     *gptree;   // model of population history
     int         nThreads; // number of threads to use
     int         doSing;   // nonzero => use singleton site patterns
+    unsigned long seed;   // identifies random number streams
+    int         crn;      // nonzero => use common random numbers
+    int         antithetic; // nonzero => use antithetic pairs
+    int         qmc;      // nonzero => use quasi-Monte Carlo
+    int         cv;       // nonzero => use control variates
+    int         exact;    // nonzero => calculate without simulation
+    TreeBank   *bank;     // if not NULL, reweight stored genealogies
+    int         incremental; // nonzero => reuse unchanged segments
+    SegCache   *cache;    // segments of previous simulation; per copy
 #if COST!=KL_COST
     double      u;        // mutation rate per generation
     long        nnuc;     // number of nucleotide sites in genome
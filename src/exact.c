@@ -0,0 +1,735 @@
+/**
+ * @file exact.c
+ * @author Alan R. Rogers
+ * @brief Exact expected branch lengths for small samples.
+ *
+ * The coalescent process within a network of PopNode segments is a
+ * Markov chain whose state is the set of lineages that are present
+ * at a given time, each labeled by the samples it contains (its
+ * tipId) and the segment in which it lies. This file steps the
+ * probability distribution of that state from one epoch to the next,
+ * where epochs are the intervals between successive values of the
+ * segments' start times. Within an epoch, each segment evolves
+ * independently. The number of lineages within a segment is a pure
+ * death process, whose state at the end of the epoch and whose
+ * expected time at each level are read from the matrix exponential
+ * of a small augmented rate matrix. Which lineages coalesce is
+ * governed by the jump chain, in which each pair is equally likely
+ * to be next.
+ *
+ * The number of states grows rapidly with the number of samples, so
+ * this approach is practical only for small samples. If the number
+ * of states exceeds EXACT_MAXSTATES, the calculation is abandoned.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "exact.h"
+#include "binary.h"
+#include "branchtab.h"
+#include "misc.h"
+#include "popnode.h"
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Maximum number of states in any probability distribution.
+#define EXACT_MAXSTATES 100000
+
+/// Maximum number of lineages whose migration is enumerated
+/// explicitly at an admixture event.
+#define EXACT_MAXMIX 20
+
+typedef struct Lineage Lineage;
+typedef struct Config Config;
+typedef struct ConfigMap ConfigMap;
+
+/// A lineage, which contains the samples in tip and lies in segment
+/// seg.
+struct Lineage {
+    tipId_t     tip;
+    int         seg;
+};
+
+/// A set of n lineages, sorted by seg and then by tip, so that
+/// equivalent sets compare equal. Array lin has room for one lineage
+/// per sample in the model. See Config_size.
+struct Config {
+    int         n;
+    Lineage     lin[];
+};
+
+/// A probability distribution over Configs, stored in a hash table
+/// with open addressing. Configs lie end to end in array cfg, each
+/// occupying "stride" bytes.
+struct ConfigMap {
+    int         n, cap;         // number of Configs, size of arrays
+    unsigned    nslot;          // size of slot; a power of 2
+    int        *slot;           // index into cfg, or -1 if empty
+    size_t      stride;         // bytes per Config
+    char       *cfg;
+    double     *prob;
+};
+
+static size_t Config_size(int nsamp);
+static Config *Config_new(int nsamp);
+static void Config_copy(Config * dst, const Config * src);
+static void Config_sort(Config * self);
+static unsigned Config_hash(const Config * self);
+static int  Config_equals(const Config * a, const Config * b);
+static inline Config *ConfigMap_cfg(const ConfigMap * self, int i);
+static ConfigMap *ConfigMap_new(int nsamp);
+static void ConfigMap_free(ConfigMap * self);
+static void ConfigMap_clear(ConfigMap * self);
+static void ConfigMap_rehash(ConfigMap * self, unsigned nslot);
+static int  ConfigMap_add(ConfigMap * self, const Config * c, double p);
+static void expm(int n, double a[n][n]);
+static void levelDist(int k, double twoN, double T, double lp[k + 1],
+                      double et[k + 1]);
+static int  segEvolve(const Config * grp, double twoN, double T,
+                      double prob, tipId_t allMask, int doSing,
+                      double scale, BranchTab * bt, ConfigMap * end,
+                      ConfigMap * cur, ConfigMap * next, Config * v);
+
+/// Bytes occupied by a Config with room for nsamp lineages. This is a
+/// multiple of the alignment of Lineage, so Configs can be stored end
+/// to end.
+static size_t Config_size(int nsamp) {
+    return sizeof(Config) + nsamp * sizeof(Lineage);
+}
+
+/// Allocate an empty Config with room for nsamp lineages.
+static Config *Config_new(int nsamp) {
+    Config     *self = malloc(Config_size(nsamp));
+    CHECKMEM(self);
+    self->n = 0;
+    return self;
+}
+
+/// Copy src into dst, which must have room for src->n lineages.
+static void Config_copy(Config * dst, const Config * src) {
+    memcpy(dst, src, offsetof(Config, lin) + src->n * sizeof(Lineage));
+}
+
+/// Sort lineages by segment and then by tipId.
+static void Config_sort(Config * self) {
+    for(int i = 1; i < self->n; ++i) {
+        Lineage     x = self->lin[i];
+        int         j = i;
+        while(j > 0 && (self->lin[j - 1].seg > x.seg
+                        || (self->lin[j - 1].seg == x.seg
+                            && self->lin[j - 1].tip > x.tip))) {
+            self->lin[j] = self->lin[j - 1];
+            --j;
+        }
+        self->lin[j] = x;
+    }
+}
+
+/// FNV-1a hash of a Config.
+static unsigned Config_hash(const Config * self) {
+    uint32_t    h = 2166136261u;
+    for(int i = 0; i < self->n; ++i) {
+        h = (h ^ (uint32_t) self->lin[i].seg) * 16777619u;
+        h = (h ^ (uint32_t) self->lin[i].tip) * 16777619u;
+    }
+    return h;
+}
+
+static int Config_equals(const Config * a, const Config * b) {
+    if(a->n != b->n)
+        return 0;
+    for(int i = 0; i < a->n; ++i)
+        if(a->lin[i].seg != b->lin[i].seg || a->lin[i].tip != b->lin[i].tip)
+            return 0;
+    return 1;
+}
+
+/// Return a pointer to the i'th Config in self.
+static inline Config *ConfigMap_cfg(const ConfigMap * self, int i) {
+    return (Config *) (self->cfg + i * self->stride);
+}
+
+/// Allocate an empty ConfigMap for Configs of up to nsamp lineages.
+static ConfigMap *ConfigMap_new(int nsamp) {
+    ConfigMap  *self = malloc(sizeof(ConfigMap));
+    CHECKMEM(self);
+    self->n = 0;
+    self->cap = 16;
+    self->nslot = 32;
+    self->stride = Config_size(nsamp);
+    self->slot = malloc(self->nslot * sizeof(self->slot[0]));
+    self->cfg = malloc(self->cap * self->stride);
+    self->prob = malloc(self->cap * sizeof(self->prob[0]));
+    CHECKMEM(self->slot);
+    CHECKMEM(self->cfg);
+    CHECKMEM(self->prob);
+    memset(self->slot, -1, self->nslot * sizeof(self->slot[0]));
+    return self;
+}
+
+static void ConfigMap_free(ConfigMap * self) {
+    free(self->slot);
+    free(self->cfg);
+    free(self->prob);
+    free(self);
+}
+
+/// Remove all entries without releasing memory.
+static void ConfigMap_clear(ConfigMap * self) {
+    self->n = 0;
+    memset(self->slot, -1, self->nslot * sizeof(self->slot[0]));
+}
+
+static void ConfigMap_rehash(ConfigMap * self, unsigned nslot) {
+    free(self->slot);
+    self->nslot = nslot;
+    self->slot = malloc(nslot * sizeof(self->slot[0]));
+    CHECKMEM(self->slot);
+    memset(self->slot, -1, nslot * sizeof(self->slot[0]));
+    for(int i = 0; i < self->n; ++i) {
+        unsigned    h = Config_hash(ConfigMap_cfg(self, i)) & (nslot - 1);
+        while(self->slot[h] >= 0)
+            h = (h + 1) & (nslot - 1);
+        self->slot[h] = i;
+    }
+}
+
+/// Add probability p to that of Config c, which must be sorted.
+/// Return 0 on success or 1 if the table is full.
+static int ConfigMap_add(ConfigMap * self, const Config * c, double p) {
+    unsigned    h = Config_hash(c) & (self->nslot - 1);
+    int         i;
+    while((i = self->slot[h]) >= 0) {
+        if(Config_equals(ConfigMap_cfg(self, i), c)) {
+            self->prob[i] += p;
+            return 0;
+        }
+        h = (h + 1) & (self->nslot - 1);
+    }
+    if(self->n == EXACT_MAXSTATES)
+        return 1;
+    if(self->n == self->cap) {
+        self->cap *= 2;
+        self->cfg = realloc(self->cfg, self->cap * self->stride);
+        self->prob = realloc(self->prob, self->cap * sizeof(self->prob[0]));
+        CHECKMEM(self->cfg);
+        CHECKMEM(self->prob);
+    }
+    i = self->n++;
+    Config_copy(ConfigMap_cfg(self, i), c);
+    self->prob[i] = p;
+    self->slot[h] = i;
+    if(2u * self->n > self->nslot)
+        ConfigMap_rehash(self, 2u * self->nslot);
+    return 0;
+}
+
+/// Replace square matrix a with its exponential, using a Taylor
+/// series together with scaling and squaring.
+static void expm(int n, double a[n][n]) {
+    double      term[n][n], sum[n][n], tmp[n][n];
+    double      norm = 0.0;
+    int         i, j, k, m, s = 0;
+
+    // 1-norm: maximum absolute column sum
+    for(j = 0; j < n; ++j) {
+        double      colsum = 0.0;
+        for(i = 0; i < n; ++i)
+            colsum += fabs(a[i][j]);
+        if(colsum > norm)
+            norm = colsum;
+    }
+    while(norm > 0.5) {
+        norm *= 0.5;
+        ++s;
+    }
+    double      f = ldexp(1.0, -s);
+    for(i = 0; i < n; ++i)
+        for(j = 0; j < n; ++j) {
+            a[i][j] *= f;
+            term[i][j] = sum[i][j] = (i == j);
+        }
+
+    // With norm <= 1/2, 20 terms give full double precision.
+    for(m = 1; m <= 20; ++m) {
+        for(i = 0; i < n; ++i)
+            for(j = 0; j < n; ++j) {
+                double      x = 0.0;
+                for(k = 0; k < n; ++k)
+                    x += term[i][k] * a[k][j];
+                tmp[i][j] = x / m;
+            }
+        for(i = 0; i < n; ++i)
+            for(j = 0; j < n; ++j) {
+                term[i][j] = tmp[i][j];
+                sum[i][j] += tmp[i][j];
+            }
+    }
+
+    while(s-- > 0) {
+        for(i = 0; i < n; ++i)
+            for(j = 0; j < n; ++j) {
+                double      x = 0.0;
+                for(k = 0; k < n; ++k)
+                    x += sum[i][k] * sum[k][j];
+                tmp[i][j] = x;
+            }
+        memcpy(sum, tmp, sizeof(sum));
+    }
+    memcpy(a, sum, sizeof(sum));
+}
+
+/// Distribution of the number of lineages in a population of size
+/// twoN, which begins with k lineages. On return, lp[j] is the
+/// probability that j lineages remain after time T, and et[j] is the
+/// expected time during which there are j lineages. If T is
+/// infinite, lp is zero and et[1] is infinite. Entry 0 of each array
+/// is unused.
+static void levelDist(int k, double twoN, double T, double lp[k + 1],
+                      double et[k + 1]) {
+    int         i, j;
+
+    lp[0] = et[0] = 0.0;
+    if(!isfinite(T)) {
+        for(j = 1; j <= k; ++j) {
+            lp[j] = 0.0;
+            et[j] = (j == 1 ? HUGE_VAL : 2.0 * twoN / (j * (j - 1.0)));
+        }
+        return;
+    }
+    if(k == 1) {
+        lp[1] = 1.0;
+        et[1] = T;
+        return;
+    }
+
+    // State i of the death process has k-i lineages. The augmented
+    // matrix [[Q, I], [0, 0]] has exponential [[P, R], [0, I]], where
+    // P = exp(QT) and R is the integral of exp(Qt) from 0 to T.
+    int         n = 2 * k;
+    double      a[n][n];
+    memset(a, 0, sizeof(a));
+    for(i = 0; i < k; ++i) {
+        j = k - i;
+        double      rate = j * (j - 1.0) / (2.0 * twoN);
+        a[i][i] = -rate * T;
+        if(i + 1 < k)
+            a[i][i + 1] = rate * T;
+        a[i][k + i] = T;
+    }
+    expm(n, a);
+    for(i = 0; i < k; ++i) {
+        j = k - i;
+        lp[j] = a[0][i];
+        et[j] = a[0][k + i];
+    }
+}
+
+/// Evolve the lineages of Config grp, all of which lie in a single
+/// segment of size twoN, for time T. Expected branch lengths, weighted
+/// by prob and scale, are added to bt. The probability distribution
+/// of lineages at the end of the interval is placed in end, unless T
+/// is infinite. Arguments cur, next, and v are scratch space. Return
+/// 0 on success or 1 if too many states.
+static int segEvolve(const Config * grp, double twoN, double T,
+                     double prob, tipId_t allMask, int doSing,
+                     double scale, BranchTab * bt, ConfigMap * end,
+                     ConfigMap * cur, ConfigMap * next, Config * v) {
+    int         k = grp->n;
+    double      lp[k + 1], et[k + 1];
+
+    levelDist(k, twoN, T, lp, et);
+    ConfigMap_clear(end);
+    ConfigMap_clear(cur);
+    if(ConfigMap_add(cur, grp, 1.0))
+        return 1;
+
+    // Step through the jump chain. At level j, cur holds the
+    // probability that the lineages are as in each Config when their
+    // number first drops to j.
+    for(int j = k; j >= 1; --j) {
+        ConfigMap_clear(next);
+        double      pairs = j * (j - 1) / 2.0;
+        for(int u = 0; u < cur->n; ++u) {
+            const Config *c = ConfigMap_cfg(cur, u);
+            double      q = cur->prob[u];
+            if(isfinite(et[j]) && et[j] > 0.0) {
+                double      w = prob * q * et[j] * scale;
+                for(int i = 0; i < j; ++i) {
+                    tipId_t     t = c->lin[i].tip;
+                    if(t != allMask && (doSing || !isPow2(t)))
+                        BranchTab_add(bt, t, w);
+                }
+            }
+            if(lp[j] > 0.0 && ConfigMap_add(end, c, q * lp[j]))
+                return 1;
+            if(j == 1)
+                continue;
+            for(int a = 0; a < j - 1; ++a)
+                for(int b = a + 1; b < j; ++b) {
+                    Config_copy(v, c);
+                    v->lin[a].tip |= v->lin[b].tip;
+                    v->lin[b] = v->lin[--v->n];
+                    Config_sort(v);
+                    if(ConfigMap_add(next, v, q / pairs))
+                        return 1;
+                }
+        }
+        ConfigMap  *tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+    return 0;
+}
+
+/// Calculate expected branch lengths exactly. Arguments describe a
+/// network of nseg PopNode segments, in which children precede
+/// parents in array "order". Parameter values are in "par", and sndx
+/// identifies the segment of each sample. Expected branch lengths,
+/// multiplied by scale, are added to bt. If doSing is zero, singleton
+/// site patterns are ignored.
+///
+/// Return 0 on success, or 1 if the model has too many states, in
+/// which case the contents of bt are meaningless.
+int exactBranchLengths(int nseg, const PopNode * pnv, const int *order,
+                       const double *par, const SampNdx * sndx,
+                       int doSing, double scale, BranchTab * bt) {
+    int         i, j, e, ntimes = 0, status = 1;
+    int         nsamp = (int) sndx->n;
+    double      times[nseg];
+    tipId_t     allMask = 0;
+
+    if(nsamp > MAXSAMP)
+        return 1;
+    for(i = 0; i < nsamp; ++i)
+        allMask |= ((tipId_t) 1) << i;
+
+    // Epoch boundaries are the distinct start times.
+    for(i = 0; i < nseg; ++i)
+        times[i] = par[pnv[i].start];
+    qsort(times, nseg, sizeof(times[0]), compareDoubles);
+    for(i = 0; i < nseg; ++i)
+        if(ntimes == 0 || times[i] != times[ntimes - 1])
+            times[ntimes++] = times[i];
+
+    ConfigMap  *dist = ConfigMap_new(nsamp);
+    ConfigMap  *nextDist = ConfigMap_new(nsamp);
+    ConfigMap  *cur = ConfigMap_new(nsamp);
+    ConfigMap  *next = ConfigMap_new(nsamp);
+    ConfigMap  *end[nseg];
+    for(i = 0; i < nseg; ++i)
+        end[i] = ConfigMap_new(nsamp);
+
+    // Scratch Configs
+    Config     *c = Config_new(nsamp);
+    Config     *add = Config_new(nsamp);
+    Config     *grp = Config_new(nsamp);
+    Config     *v = Config_new(nsamp);
+
+    ConfigMap_add(dist, c, 1.0);
+
+    for(e = 0; e < ntimes; ++e) {
+        double      tau = times[e];
+        double      T = (e + 1 < ntimes ? times[e + 1] - tau : HUGE_VAL);
+
+        // Add samples whose segments begin now.
+        add->n = 0;
+        for(i = 0; i < nsamp; ++i) {
+            if(par[pnv[sndx->node[i]].start] == tau) {
+                add->lin[add->n].seg = sndx->node[i];
+                add->lin[add->n].tip = ((tipId_t) 1) << i;
+                ++add->n;
+            }
+        }
+        if(add->n > 0) {
+            ConfigMap_clear(nextDist);
+            for(i = 0; i < dist->n; ++i) {
+                Config_copy(c, ConfigMap_cfg(dist, i));
+                for(j = 0; j < add->n; ++j)
+                    c->lin[c->n++] = add->lin[j];
+                Config_sort(c);
+                if(ConfigMap_add(nextDist, c, dist->prob[i]))
+                    goto done;
+            }
+            ConfigMap  *tmp = dist;
+            dist = nextDist;
+            nextDist = tmp;
+        }
+
+        // Move lineages of segments that end now into their parents.
+        // Children precede parents, so lineages can traverse
+        // segments of zero length.
+        for(int o = 0; o < nseg; ++o) {
+            const PopNode *pn = pnv + order[o];
+            int         s = order[o];
+            if(pn->end < 0 || par[pn->end] != tau)
+                continue;
+            ConfigMap_clear(nextDist);
+            for(i = 0; i < dist->n; ++i) {
+                const Config *d = ConfigMap_cfg(dist, i);
+                int         ndx[nsamp], k = 0;
+                for(j = 0; j < d->n; ++j)
+                    if(d->lin[j].seg == s)
+                        ndx[k++] = j;
+                if(k == 0 || pn->nparents == 1) {
+                    Config_copy(c, d);
+                    for(j = 0; j < k; ++j)
+                        c->lin[ndx[j]].seg = pn->parent[0];
+                    Config_sort(c);
+                    if(ConfigMap_add(nextDist, c, dist->prob[i]))
+                        goto done;
+                    continue;
+                }
+
+                // Each lineage goes to parent[1] with probability m.
+                assert(pn->nparents == 2);
+                if(k > EXACT_MAXMIX)
+                    goto done;
+                double      m = par[pn->mix];
+                for(unsigned long mask = 0; mask < (1UL << k); ++mask) {
+                    double      p = dist->prob[i];
+                    Config_copy(c, d);
+                    for(j = 0; j < k; ++j) {
+                        if(mask & (1UL << j)) {
+                            p *= m;
+                            c->lin[ndx[j]].seg = pn->parent[1];
+                        } else {
+                            p *= 1.0 - m;
+                            c->lin[ndx[j]].seg = pn->parent[0];
+                        }
+                    }
+                    if(p == 0.0)
+                        continue;
+                    Config_sort(c);
+                    if(ConfigMap_add(nextDist, c, p))
+                        goto done;
+                }
+            }
+            ConfigMap  *tmp = dist;
+            dist = nextDist;
+            nextDist = tmp;
+        }
+
+        // Evolve each segment independently until the next epoch.
+        // The joint distribution at the end is the product of the
+        // distributions of the segments.
+        ConfigMap_clear(nextDist);
+        for(i = 0; i < dist->n; ++i) {
+            const Config *d = ConfigMap_cfg(dist, i);
+            int         ngrp = 0, ndx[nseg];
+            for(j = 0; j < d->n;) {
+                int         s = d->lin[j].seg;
+                grp->n = 0;
+                while(j < d->n && d->lin[j].seg == s)
+                    grp->lin[grp->n++] = d->lin[j++];
+                if(segEvolve(grp, par[pnv[s].twoN], T, dist->prob[i],
+                             allMask, doSing, scale, bt, end[ngrp],
+                             cur, next, v))
+                    goto done;
+                ndx[ngrp++] = 0;
+            }
+            if(!isfinite(T))
+                continue;
+
+            // Enumerate the cartesian product of the groups' end
+            // distributions, odometer-style.
+            for(;;) {
+                double      p = dist->prob[i];
+                c->n = 0;
+                for(j = 0; j < ngrp; ++j) {
+                    const Config *g = ConfigMap_cfg(end[j], ndx[j]);
+                    p *= end[j]->prob[ndx[j]];
+                    memcpy(c->lin + c->n, g->lin, g->n * sizeof(g->lin[0]));
+                    c->n += g->n;
+                }
+                if(ConfigMap_add(nextDist, c, p))
+                    goto done;
+                for(j = ngrp - 1; j >= 0; --j) {
+                    if(++ndx[j] < end[j]->n)
+                        break;
+                    ndx[j] = 0;
+                }
+                if(j < 0)
+                    break;
+            }
+        }
+        ConfigMap  *tmp = dist;
+        dist = nextDist;
+        nextDist = tmp;
+    }
+    status = 0;
+
+ done:
+    ConfigMap_free(dist);
+    ConfigMap_free(nextDist);
+    ConfigMap_free(cur);
+    ConfigMap_free(next);
+    for(i = 0; i < nseg; ++i)
+        ConfigMap_free(end[i]);
+    free(c);
+    free(add);
+    free(grp);
+    free(v);
+    return status;
+}
+
+#ifdef TEST
+
+#  include "gptree.h"
+#  include "parstore.h"
+#  include <stdio.h>
+#  include <unistd.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+static BranchTab *expected(const char *input, int doSing);
+static int  approxEq(double x, double y);
+
+// x and y split at time 1000 from xy.
+const char *splitInput =
+    "time fixed  T0=0\n"
+    "time fixed  Txy=1000\n"
+    "twoN fixed  2Nx=100\n"
+    "twoN fixed  2Ny=200\n"
+    "twoN fixed  2Nxy=3000\n"
+    "segment x   t=T0     twoN=2Nx    samples=1\n"
+    "segment y   t=T0     twoN=2Ny    samples=1\n"
+    "segment xy  t=Txy    twoN=2Nxy\n"
+    "derive x from xy\n" "derive y from xy\n";
+
+// Three samples from a single population.
+const char *panmixInput =
+    "time fixed  T0=0\n"
+    "twoN fixed  2Nx=600\n" "segment x   t=T0     twoN=2Nx    samples=3\n";
+
+// Two samples from x, whose ancestor, a, is of different size.
+const char *epochInput =
+    "time fixed  T0=0\n"
+    "time fixed  Ta=500\n"
+    "twoN fixed  2Nx=400\n"
+    "twoN fixed  2Na=1500\n"
+    "segment x   t=T0     twoN=2Nx    samples=2\n"
+    "segment a   t=Ta     twoN=2Na\n" "derive x from a\n";
+
+// Sample y is admixed with probability m=0.3 into c, which
+// also contains the ancestor of sample x.
+const char *mixInput =
+    "time fixed  T0=0\n"
+    "time fixed  Tc=200\n"
+    "time fixed  Tr=900\n"
+    "twoN fixed  2Nx=100\n"
+    "twoN fixed  2Nc=700\n"
+    "twoN fixed  2Nr=2000\n"
+    "mixFrac fixed m=0.3\n"
+    "segment x   t=T0     twoN=2Nx    samples=1\n"
+    "segment y   t=T0     twoN=2Nx    samples=1\n"
+    "segment c   t=Tc     twoN=2Nc\n"
+    "segment yy  t=Tc     twoN=2Nx\n"
+    "segment r   t=Tr     twoN=2Nr\n"
+    "mix    y  from yy + m * c\n"
+    "derive x  from c\n" "derive c  from r\n" "derive yy from r\n";
+
+/// Return exact expected branch lengths for a model, specified as a
+/// string in .lgo format.
+static BranchTab *expected(const char *input, int doSing) {
+    const char *fname = "exact-tmp.lgo";
+    FILE       *fp = fopen(fname, "w");
+    fputs(input, fp);
+    fclose(fp);
+
+    Bounds      bnd = {
+        .lo_twoN = 0.0,
+        .hi_twoN = 1e7,
+        .lo_t = 0.0,
+        .hi_t = HUGE_VAL
+    };
+    GPTree     *g = GPTree_new(fname, bnd);
+    unlink(fname);
+    BranchTab  *bt = BranchTab_new();
+    int         status = GPTree_expected(g, bt, 1.0, doSing);
+    assert(status == 0);
+    GPTree_free(g);
+    return bt;
+}
+
+static int approxEq(double x, double y) {
+    return fabs(x - y) <= 1e-9 * fmax(1.0, fabs(y));
+}
+
+int main(int argc, char **argv) {
+    int         verbose = 0;
+
+    if(argc > 1) {
+        if(argc != 2 || 0 != strcmp(argv[1], "-v")) {
+            fprintf(stderr, "usage: xexact [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    BranchTab  *bt;
+
+    // Each singleton branch lasts until the lineages meet in xy, and
+    // then for an additional 2Nxy generations on average.
+    bt = expected(splitInput, 1);
+    if(verbose)
+        BranchTab_print(bt, stdout);
+    assert(BranchTab_size(bt) == 2);
+    assert(approxEq(BranchTab_get(bt, 1), 1000.0 + 3000.0));
+    assert(approxEq(BranchTab_get(bt, 2), 1000.0 + 3000.0));
+    BranchTab_free(bt);
+
+    bt = expected(splitInput, 0);
+    assert(BranchTab_size(bt) == 0);
+    BranchTab_free(bt);
+
+    // On average, 2N generations pass while there are 2 lineages,
+    // and each pair is equally likely to be the doubleton. Singletons
+    // accumulate 2N/3 during each of the two intervals.
+    bt = expected(panmixInput, 0);
+    if(verbose)
+        BranchTab_print(bt, stdout);
+    assert(BranchTab_size(bt) == 3);
+    assert(approxEq(BranchTab_get(bt, 3), 200.0));
+    assert(approxEq(BranchTab_get(bt, 5), 200.0));
+    assert(approxEq(BranchTab_get(bt, 6), 200.0));
+    BranchTab_free(bt);
+
+    bt = expected(panmixInput, 1);
+    assert(BranchTab_size(bt) == 6);
+    assert(approxEq(BranchTab_get(bt, 1), 400.0));
+    assert(approxEq(BranchTab_get(bt, 4), 400.0));
+    BranchTab_free(bt);
+
+    // Coalescence within x, with mean 2Nx, is truncated at Ta.
+    double      p = exp(-500.0 / 400.0);
+    bt = expected(epochInput, 1);
+    if(verbose)
+        BranchTab_print(bt, stdout);
+    assert(approxEq(BranchTab_get(bt, 1), 400.0 * (1.0 - p) + p * 1500.0));
+    assert(approxEq(BranchTab_get(bt, 2), 400.0 * (1.0 - p) + p * 1500.0));
+    BranchTab_free(bt);
+
+    // With probability m, both lineages enter c at Tc.
+    double      m = 0.3;
+    p = exp(-700.0 / 700.0);
+    double      inC = 200.0 + 700.0 * (1.0 - p) + p * 2000.0;
+    double      notC = 900.0 + 2000.0;
+    bt = expected(mixInput, 1);
+    if(verbose)
+        BranchTab_print(bt, stdout);
+    assert(approxEq(BranchTab_get(bt, 1), m * inC + (1.0 - m) * notC));
+    assert(approxEq(BranchTab_get(bt, 2), m * inC + (1.0 - m) * notC));
+    BranchTab_free(bt);
+
+    unitTstResult("exact", "OK");
+    return 0;
+}
+#endif
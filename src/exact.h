@@ -0,0 +1,11 @@
+#ifndef ARR_EXACT_H
+#  define ARR_EXACT_H
+
+#  include "typedefs.h"
+
+int         exactBranchLengths(int nseg, const PopNode * pnv,
+                               const int *order, const double *par,
+                               const SampNdx * sndx, int doSing,
+                               double scale, BranchTab * bt);
+
+#endif
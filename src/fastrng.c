@@ -0,0 +1,350 @@
+/**
+ * @file fastrng.c
+ * @author Alan R. Rogers
+ * @brief The xoshiro256++ generator, packaged as a gsl_rng_type.
+ *
+ * xoshiro256++ was written by David Blackman and Sebastiano Vigna,
+ * who placed it in the public domain. See http://prng.di.unimi.it.
+ * Seeds are expanded into state using splitmix64, as those authors
+ * recommend.
+ *
+ * Exponential variates are generated in blocks by the ziggurat method
+ * of Marsaglia and Tsang (2000, J Stat Software 5(8)), using 256
+ * layers and 53-bit integers. The buffer is short, because it is
+ * discarded whenever the generator is reseeded, and patprob reseeds
+ * once per replicate when using common random numbers.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "fastrng.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// Ziggurat tables for the unit exponential: ke holds acceptance
+// thresholds, we the widths of the layers, and fe the density at
+// their edges.
+static uint64_t ke[256];
+static double we[256], fe[256];
+static pthread_once_t zigOnce = PTHREAD_ONCE_INIT;
+
+static void zigInit(void);
+static double zigTail(FastRngState * state, uint64_t jz, int iz);
+static uint64_t splitmix64(uint64_t * x);
+static void xoshiro_set(void *vstate, unsigned long seed);
+static unsigned long xoshiro_get(void *vstate);
+static double xoshiro_get_double(void *vstate);
+static unsigned long xoshiro_get_neg(void *vstate);
+static double xoshiro_get_double_neg(void *vstate);
+
+/// Return the next value of the splitmix64 sequence.
+static uint64_t splitmix64(uint64_t * x) {
+    uint64_t    z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// Build the ziggurat tables. Called once, via pthread_once.
+static void zigInit(void) {
+    const double m2 = 0x1.0p53;  // 2^53
+    const double ve = 3.949659822581572e-3;  // area of each layer
+    double      de = 7.697117470131487;      // right edge of base
+    double      te = de;
+    double      q = ve / exp(-de);
+
+    ke[0] = (uint64_t) ((de / q) * m2);
+    ke[1] = 0;
+    we[0] = q / m2;
+    we[255] = de / m2;
+    fe[0] = 1.0;
+    fe[255] = exp(-de);
+
+    for(int i = 254; i >= 1; --i) {
+        de = -log(ve / de + exp(-de));
+        ke[i + 1] = (uint64_t) ((de / te) * m2);
+        te = de;
+        fe[i] = exp(-de);
+        we[i] = de / m2;
+    }
+}
+
+/// Slow path of the ziggurat, taken when a point falls outside the
+/// rectangular core of layer iz.
+static double zigTail(FastRngState * state, uint64_t jz, int iz) {
+    double      x, u;
+    for(;;) {
+        if(iz == 0) {
+            u = (Xoshiro_next(state->s) >> 11) * 0x1.0p-53;
+            return 7.697117470131487 - log1p(-u);
+        }
+        x = jz * we[iz];
+        u = (Xoshiro_next(state->s) >> 11) * 0x1.0p-53;
+        if(fe[iz] + u * (fe[iz - 1] - fe[iz]) < exp(-x))
+            return x;
+        uint64_t    r = Xoshiro_next(state->s);
+        iz = r & 255;
+        jz = r >> 11;
+        if(jz < ke[iz])
+            return jz * we[iz];
+    }
+}
+
+/// Refill the buffer of unit exponentials.
+void FastRng_fillExp(FastRngState * state) {
+    for(int i = 0; i < FASTRNG_EXPBUF; ++i) {
+        uint64_t    r = Xoshiro_next(state->s);
+        int         iz = r & 255;
+        uint64_t    jz = r >> 11;
+        if(jz < ke[iz])
+            state->expbuf[i] = jz * we[iz];
+        else
+            state->expbuf[i] = zigTail(state, jz, iz);
+    }
+    state->nexp = FASTRNG_EXPBUF;
+}
+
+/// Return a seed for stream number "stream" of a family of streams
+/// identified by "seed". Nearby values of either argument give
+/// unrelated results.
+unsigned long FastRng_streamSeed(unsigned long seed, unsigned long stream) {
+    uint64_t    x = seed;
+    x = splitmix64(&x) ^ stream;
+    return (unsigned long) splitmix64(&x);
+}
+
+static void xoshiro_set(void *vstate, unsigned long seed) {
+    FastRngState *state = (FastRngState *) vstate;
+    uint64_t    x = seed;
+    for(int i = 0; i < 4; ++i)
+        state->s[i] = splitmix64(&x);
+    state->nexp = 0;
+    pthread_once(&zigOnce, zigInit);
+}
+
+/// GSL generators return values in [min,max]. Use the high 32 bits,
+/// which are the strongest.
+static unsigned long xoshiro_get(void *vstate) {
+    FastRngState *state = (FastRngState *) vstate;
+    return (unsigned long) (Xoshiro_next(state->s) >> 32);
+}
+
+static double xoshiro_get_double(void *vstate) {
+    FastRngState *state = (FastRngState *) vstate;
+    return (Xoshiro_next(state->s) >> 11) * 0x1.0p-53;
+}
+
+/// Integers, which choose the lineages that coalesce, should not be
+/// complemented: reversing the order of a list of lineages merely
+/// relabels them, and this tends to produce the same tree topology in
+/// both members of a pair. Instead, scramble the generator's output,
+/// so that these choices are independent of those made by
+/// rng_xoshiro_pos.
+static unsigned long xoshiro_get_neg(void *vstate) {
+    FastRngState *state = (FastRngState *) vstate;
+    uint64_t    x = Xoshiro_next(state->s);
+    return (unsigned long) (splitmix64(&x) >> 32);
+}
+
+/// Complement of xoshiro_get_double: if that function would have
+/// returned u, this one returns 1 - 2^-53 - u, which also lies in
+/// [0,1).
+static double xoshiro_get_double_neg(void *vstate) {
+    FastRngState *state = (FastRngState *) vstate;
+    return ((~Xoshiro_next(state->s)) >> 11) * 0x1.0p-53;
+}
+
+static const gsl_rng_type xoshiro256pp_type = {
+    "xoshiro256++",
+    0xffffffffUL,               // max
+    0,                          // min
+    sizeof(FastRngState),
+    &xoshiro_set,
+    &xoshiro_get,
+    &xoshiro_get_double
+};
+
+static const gsl_rng_type xoshiro_pos_type = {
+    "xoshiro256++ antithetic +",
+    0xffffffffUL,               // max
+    0,                          // min
+    sizeof(FastRngState),
+    &xoshiro_set,
+    &xoshiro_get,
+    &xoshiro_get_double
+};
+
+static const gsl_rng_type xoshiro_neg_type = {
+    "xoshiro256++ antithetic -",
+    0xffffffffUL,               // max
+    0,                          // min
+    sizeof(FastRngState),
+    &xoshiro_set,
+    &xoshiro_get_neg,
+    &xoshiro_get_double_neg
+};
+
+const gsl_rng_type *rng_xoshiro256pp = &xoshiro256pp_type;
+const gsl_rng_type *rng_xoshiro_pos = &xoshiro_pos_type;
+const gsl_rng_type *rng_xoshiro_neg = &xoshiro_neg_type;
+
+#ifdef TEST
+
+#  include "misc.h"
+#  include <assert.h>
+#  include <stdio.h>
+#  include <string.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+int main(int argc, char **argv) {
+    int         verbose = 0, i;
+    const int   nreps = 100000;
+
+    switch (argc) {
+    case 1:
+        break;
+    case 2:
+        if(strncmp(argv[1], "-v", 2) != 0) {
+            fprintf(stderr, "usage: xfastrng [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+        break;
+    default:
+        fprintf(stderr, "usage: xfastrng [-v]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gsl_rng    *rng = gsl_rng_alloc(rng_xoshiro256pp);
+    gsl_rng    *rng2 = gsl_rng_alloc(rng_xoshiro256pp);
+    gsl_rng    *taus = gsl_rng_alloc(gsl_rng_taus);
+    CHECKMEM(rng);
+    CHECKMEM(rng2);
+    CHECKMEM(taus);
+
+    // Equal seeds give equal sequences, whether values are drawn
+    // through GSL or through the inline functions.
+    gsl_rng_set(rng, 1234);
+    gsl_rng_set(rng2, 1234);
+    for(i = 0; i < 100; ++i)
+        assert(gsl_rng_uniform(rng) == FastRng_uniform(rng2));
+    gsl_rng_set(rng2, 1235);
+    assert(gsl_rng_uniform(rng) != FastRng_uniform(rng2));
+
+    double      x, sum = 0.0;
+    for(i = 0; i < nreps; ++i) {
+        x = FastRng_uniform(rng);
+        assert(0.0 <= x && x < 1.0);
+        sum += x;
+    }
+    if(verbose)
+        printf("mean uniform: %lf\n", sum / nreps);
+    assert(fabs(sum / nreps - 0.5) < 0.01);
+
+    unsigned long k, count[7] = { 0 };
+    for(i = 0; i < nreps; ++i) {
+        k = FastRng_uniformInt(rng, 7);
+        assert(k < 7);
+        ++count[k];
+    }
+    for(i = 0; i < 7; ++i)
+        assert(fabs(count[i] / (double) nreps - 1.0 / 7.0) < 0.01);
+
+    for(i = 0; i < nreps; ++i) {
+        k = gsl_rng_uniform_int(rng, 5);
+        assert(k < 5);
+    }
+
+    sum = 0.0;
+    for(i = 0; i < nreps; ++i) {
+        x = FastRng_exponential(rng, 3.0);
+        assert(x >= 0.0);
+        sum += x;
+    }
+    if(verbose)
+        printf("mean exponential: %lf\n", sum / nreps);
+    assert(fabs(sum / nreps - 3.0) < 0.1);
+
+    // Check variance and upper tail of ziggurat exponentials. Values
+    // above 7.697 come from the base strip of the ziggurat.
+    const int   bigreps = 1000000;
+    double      sumsq = 0.0;
+    long        over2 = 0, over8 = 0;
+    sum = 0.0;
+    for(i = 0; i < bigreps; ++i) {
+        x = FastRng_exponential(rng, 1.0);
+        sum += x;
+        sumsq += x * x;
+        over2 += (x > 2.0);
+        over8 += (x > 8.0);
+    }
+    sum /= bigreps;
+    sumsq = sumsq / bigreps - sum * sum;
+    if(verbose)
+        printf("unit exponential: mean=%lf var=%lf P[x>2]=%lf P[x>8]=%lg\n",
+               sum, sumsq, over2 / (double) bigreps,
+               over8 / (double) bigreps);
+    assert(fabs(sum - 1.0) < 0.01);
+    assert(fabs(sumsq - 1.0) < 0.02);
+    assert(fabs(over2 / (double) bigreps - exp(-2.0)) < 0.002);
+    assert(fabs(over8 / (double) bigreps - exp(-8.0)) < 1e-4);
+
+    // Stream seeds are deterministic and distinct.
+    assert(FastRng_streamSeed(1, 2) == FastRng_streamSeed(1, 2));
+    assert(FastRng_streamSeed(1, 2) != FastRng_streamSeed(1, 3));
+    assert(FastRng_streamSeed(1, 2) != FastRng_streamSeed(2, 2));
+    assert(FastRng_streamSeed(1, 2) != FastRng_streamSeed(2, 1));
+
+    // Reseeding discards buffered exponentials.
+    gsl_rng_set(rng, 99);
+    x = FastRng_exponential(rng, 1.0);
+    gsl_rng_set(rng, 99);
+    assert(x == FastRng_exponential(rng, 1.0));
+
+    // Antithetic generators with equal seeds give complementary
+    // uniforms, and exponentials come from inversion.
+    gsl_rng    *pos = gsl_rng_alloc(rng_xoshiro_pos);
+    gsl_rng    *neg = gsl_rng_alloc(rng_xoshiro_neg);
+    CHECKMEM(pos);
+    CHECKMEM(neg);
+    gsl_rng_set(pos, 77);
+    gsl_rng_set(neg, 77);
+    gsl_rng_set(rng, 77);
+    for(i = 0; i < 100; ++i) {
+        double      u = FastRng_uniform(pos);
+        assert(u == gsl_rng_uniform(rng));
+        assert(u + FastRng_uniform(neg) == 1.0 - 0x1.0p-53);
+    }
+    for(i = 0; i < 100; ++i) {
+        x = FastRng_exponential(pos, 2.0);
+        double      y = FastRng_exponential(neg, 2.0);
+        assert(x >= 0.0 && y >= 0.0);
+        // u and 1-u give exponentials whose survival
+        // probabilities sum to 1.
+        assert(fabs(exp(-x / 2.0) + exp(-y / 2.0) - 1.0) < 1e-9);
+    }
+    gsl_rng_free(pos);
+    gsl_rng_free(neg);
+
+    // Other generators fall back to GSL.
+    gsl_rng_set(taus, 1);
+    x = gsl_rng_uniform(taus);
+    gsl_rng_set(taus, 1);
+    assert(x == FastRng_uniform(taus));
+    gsl_rng_set(taus, 1);
+    k = gsl_rng_uniform_int(taus, 11);
+    gsl_rng_set(taus, 1);
+    assert(k == FastRng_uniformInt(taus, 11));
+
+    gsl_rng_free(rng);
+    gsl_rng_free(rng2);
+    gsl_rng_free(taus);
+    unitTstResult("FastRng", "OK");
+    return 0;
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef ARR_FASTRNG_H
+#  define ARR_FASTRNG_H
+
+#  include <stdint.h>
+#  include <math.h>
+#  include <gsl/gsl_rng.h>
+
+/// xoshiro256++ packaged as a gsl_rng_type. Generators allocated with
+/// gsl_rng_alloc(rng_xoshiro256pp) work with every GSL function, but
+/// the inline functions below bypass GSL's function pointers and
+/// draw directly from the generator's state. For any other type of
+/// gsl_rng, these functions fall back to the corresponding GSL call,
+/// so callers need not know which generator they have been handed.
+extern const gsl_rng_type *rng_xoshiro256pp;
+
+/// Two further types share the state of rng_xoshiro256pp but are
+/// meant for antithetic sampling. rng_xoshiro_pos returns the
+/// generator's usual values. rng_xoshiro_neg returns their
+/// complements, so that a uniform u from one corresponds to 1-u from
+/// the other when both have the same seed, but its integers (as from
+/// gsl_rng_uniform_int) are unrelated to those of rng_xoshiro_pos.
+/// Because they are not
+/// rng_xoshiro256pp, the inline functions below treat them as generic
+/// GSL generators, and exponentials are drawn by inversion, which
+/// preserves the pairing.
+extern const gsl_rng_type *rng_xoshiro_pos;
+extern const gsl_rng_type *rng_xoshiro_neg;
+
+#  define FASTRNG_EXPBUF 32
+
+typedef struct FastRngState FastRngState;
+
+/// State of a rng_xoshiro256pp generator. Besides the generator
+/// itself, it holds a buffer of unit exponential variates, which
+/// FastRng_fillExp refills in bulk using the ziggurat method.
+struct FastRngState {
+    uint64_t    s[4];
+    int         nexp;           // number of unused values in expbuf
+    double      expbuf[FASTRNG_EXPBUF];
+};
+
+void        FastRng_fillExp(FastRngState * state);
+unsigned long FastRng_streamSeed(unsigned long seed, unsigned long stream);
+
+static inline uint64_t Xoshiro_next(uint64_t s[4]);
+static inline double FastRng_uniform(const gsl_rng * rng);
+static inline unsigned long FastRng_uniformInt(const gsl_rng * rng,
+                                               unsigned long n);
+static inline double FastRng_exponential(const gsl_rng * rng, double mean);
+
+static inline uint64_t Xoshiro_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/// Advance xoshiro256++ state s and return a 64-bit random integer.
+static inline uint64_t Xoshiro_next(uint64_t s[4]) {
+    uint64_t    result = Xoshiro_rotl(s[0] + s[3], 23) + s[0];
+    uint64_t    t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = Xoshiro_rotl(s[3], 45);
+
+    return result;
+}
+
+/// Uniform on [0,1).
+static inline double FastRng_uniform(const gsl_rng * rng) {
+    if(rng->type == rng_xoshiro256pp)
+        return (Xoshiro_next(((FastRngState *) rng->state)->s) >> 11)
+            * 0x1.0p-53;
+    return gsl_rng_uniform(rng);
+}
+
+/// Uniform integer on [0,n-1]. Uses Lemire's multiply-and-shift
+/// method, which needs a division only in the rare case of rejection.
+static inline unsigned long FastRng_uniformInt(const gsl_rng * rng,
+                                               unsigned long n) {
+    if(rng->type != rng_xoshiro256pp)
+        return gsl_rng_uniform_int(rng, n);
+
+    uint64_t   *s = ((FastRngState *) rng->state)->s;
+    unsigned __int128 m = (unsigned __int128) Xoshiro_next(s) * n;
+    uint64_t    lo = (uint64_t) m;
+    if(lo < n) {
+        uint64_t    thresh = -(uint64_t) n % n;
+        while(lo < thresh) {
+            m = (unsigned __int128) Xoshiro_next(s) * n;
+            lo = (uint64_t) m;
+        }
+    }
+    return (unsigned long) (m >> 64);
+}
+
+/// Exponential random variate with given mean. For a
+/// rng_xoshiro256pp generator, this rescales the next unit
+/// exponential from the generator's buffer and needs no log().
+static inline double FastRng_exponential(const gsl_rng * rng, double mean) {
+    if(rng->type == rng_xoshiro256pp) {
+        FastRngState *state = (FastRngState *) rng->state;
+        if(state->nexp == 0)
+            FastRng_fillExp(state);
+        return mean * state->expbuf[--state->nexp];
+    }
+    return -mean * log1p(-gsl_rng_uniform(rng));
+}
+
+#endif
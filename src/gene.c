@@ -1,7 +1,7 @@
 /**
  * @file gene.c
- * @brief Class Gene. Defines the objects that are linked together to
- * form a gene genealogy.
+ * @brief Class Gene. Defines the lineages that make up a gene
+ * genealogy.
  * @author Alan R. Rogers
  * @copyright Copyright (c) 2016, Alan R. Rogers
  * <rogers@anthro.utah.edu>. This file is released under the Internet
@@ -14,63 +14,85 @@
 #include <string.h>
 #include <stdlib.h>
 
+/// This structure allocates an array of Gene objects and doles them
+/// out one at a time via calls to GeneStore_alloc. The entire
+/// genealogy is released at once by GeneStore_reset, which rewinds a
+/// single counter, so simulating a gene tree requires no calls to
+/// malloc or free. Genes allocated before a call to GeneStore_retain
+/// survive each reset.
+struct GeneStore {
+    int nused, nkept, len;
+    Gene *v;    // locally owned
+};
+
 /// Constructor for Gene
 /// @param[in] tipId the identifier of this gene
-Gene *Gene_new(tipId_t tipId) {
-    Gene       *gene = malloc(sizeof(Gene));
-    CHECKMEM(gene);
+/// @param[in] birth the time at which this gene arose
+/// @param[inout] gs GeneStore from which memory is allocated
+Gene *Gene_new(tipId_t tipId, double birth, GeneStore * gs) {
+    Gene       *gene = GeneStore_alloc(gs);
 
     gene->tipId = tipId;
-    gene->parent = gene->lchild = gene->rchild = NULL;
-    gene->branch = 0.0;
+    gene->birth = birth;
 
     return gene;
 }
 
-/**
- * Tabulate branch lengths by tipId.
- *
- * Ignore root (which has null parent) because mutations
- * there don't contribute to genetic variation.
- *
- * If doSing==0, then also ignore nodes with only one descendant.
- * These are recognizable because their tipIds are powers of 2.
- *
- * Tabulate everything else.
- */
-void Gene_tabulate(Gene * self, BranchTab * bt, int doSing) {
-    if(self == NULL)
-        return;
+/// Create a parental Gene by coalescing two children at time t.
+/// The tipId of the parental gene is generated by "or"ing those
+/// of the two children. The children are not modified; the caller
+/// is responsible for tabulating their branches, which end at t.
+/// @return pointer to parental gene.
+Gene *Gene_join(Gene * lchild, Gene * rchild, double t, GeneStore * gs) {
+    assert(t >= lchild->birth);
+    assert(t >= rchild->birth);
+    return Gene_new(lchild->tipId | rchild->tipId, t, gs);
+}
 
-    if(self->parent && (doSing || !isPow2(self->tipId)))
-        BranchTab_add(bt, self->tipId, self->branch);
+/// Allocate a new GeneStore, with room for len Gene objects. A gene
+/// genealogy with n samples requires 2n-1 Genes.
+GeneStore *GeneStore_new(int len) {
+    assert(len > 0);
+    GeneStore *self = malloc(sizeof(GeneStore));
+    CHECKMEM(self);
+
+    self->nused = self->nkept = 0;
+    self->len = len;
+    self->v = malloc(len * sizeof(self->v[0]));
+    CHECKMEM(self->v);
+    return self;
+}
 
-    Gene_tabulate(self->lchild, bt, doSing);
-    Gene_tabulate(self->rchild, bt, doSing);
+/// Destructor for GeneStore. Frees all Genes allocated from it.
+void GeneStore_free(GeneStore * self) {
+    free(self->v);
+    free(self);
 }
 
-/// Create a parental Gene by coalescing two children.
-/// The tipId of the parental gene is generated by "or"ing those
-/// of the two children. The parental gene has pointers to the children,
-/// and the children have pointers to the parent.
-/// @return pointer to parental gene.
-Gene *Gene_join(Gene * lchild, Gene * rchild) {
-    tipId_t     id = lchild->tipId | rchild->tipId;
-    Gene       *parent = Gene_new(id);
-    CHECKMEM(parent);
-    parent->lchild = lchild;
-    parent->rchild = rchild;
-    lchild->parent = rchild->parent = parent;
-    return parent;
+/// Return a pointer to an unused Gene object within GeneStore. Abort
+/// if none are left.
+Gene *GeneStore_alloc(GeneStore * self) {
+    if(self->nused >= self->len)
+        eprintf("%s:%s:%d: Ran out of Gene objects.\n",
+                __FILE__, __func__, __LINE__);
+    return &self->v[self->nused++];
+}
+
+/// Release all Gene objects except those retained, making them
+/// available for reuse. Pointers to other Genes become invalid.
+void GeneStore_reset(GeneStore * self) {
+    self->nused = self->nkept;
 }
 
-/// Destroy a Gene
-void Gene_free(Gene * gene) {
-    if(gene == NULL)
-        return;
-    Gene_free(gene->lchild);
-    Gene_free(gene->rchild);
-    free(gene);
+/// Make the Genes allocated so far permanent, so that GeneStore_reset
+/// does not release them.
+void GeneStore_retain(GeneStore * self) {
+    self->nkept = self->nused;
+}
+
+/// Return the number of Gene objects currently in use.
+int GeneStore_size(const GeneStore * self) {
+    return self->nused;
 }
 
 #ifdef TEST
@@ -94,61 +116,77 @@ int main(int argc, char **argv) {
         verbose = 1;
     }
 
+    GeneStore *gs = GeneStore_new(5);
+    CHECKMEM(gs);
+    assert(GeneStore_size(gs) == 0);
+
     tipId_t id1 = 1;
-    Gene *g1 = Gene_new(id1);
+    Gene *g1 = Gene_new(id1, 0.0, gs);
     assert(g1);
-    Gene_addToBranch(g1, 1.0);
     assert(g1->tipId == id1);
-    assert(g1->parent == NULL);
-    assert(g1->lchild == NULL);
-    assert(g1->rchild == NULL);
-    assert(g1->branch == 1.0);
+    assert(g1->birth == 0.0);
 
     tipId_t id2 = 2;
-    Gene *g2 = Gene_new(id2);
+    Gene *g2 = Gene_new(id2, 0.0, gs);
     assert(g2);
-    Gene_addToBranch(g2, 1.0);
     assert(g2->tipId == id2);
-    assert(g2->parent == NULL);
-    assert(g2->lchild == NULL);
-    assert(g2->rchild == NULL);
-    assert(g2->branch == 1.0);
+    assert(g2->birth == 0.0);
 
-    Gene *g3 = Gene_join(g1, g2);
+    BranchTab *bt = BranchTab_new();
+
+    // Singletons are tabulated only if doSing is nonzero.
+    Gene_tabulate(g1, 1.0, bt, 0);
+    assert(BranchTab_size(bt) == 0);
+    Gene_tabulate(g2, 1.0, bt, 1);
+    assert(BranchTab_size(bt) == 1);
+    assert(1.0 == BranchTab_get(bt, id2));
+
+    Gene *g3 = Gene_join(g1, g2, 1.0, gs);
     assert(g3);
-    Gene_addToBranch(g3, 2.0);
     assert(g3->tipId == (id1|id2));
-    assert(g3->parent == NULL);
-    assert(g3->lchild == g1);
-    assert(g3->rchild == g2);
-    assert(g3->branch == 2.0);
+    assert(g3->birth == 1.0);
 
     tipId_t id4 = 4;
-    Gene *g4 = Gene_new(id4);
+    Gene *g4 = Gene_new(id4, 0.5, gs);
     assert(g4);
-    Gene_addToBranch(g4, 2.0);
     assert(g4->tipId == id4);
-    assert(g4->parent == NULL);
-    assert(g4->lchild == NULL);
-    assert(g4->rchild == NULL);
-    assert(g4->branch == 2.0);
+    assert(g4->birth == 0.5);
 
-    Gene *g5 = Gene_join(g3, g4);
+    Gene *g5 = Gene_join(g3, g4, 3.0, gs);
     assert(g5);
     assert(g5->tipId == (id1|id2|id4));
-    assert(g5->parent == NULL);
-    assert(g5->lchild == g3);
-    assert(g5->rchild == g4);
-    assert(g5->branch == 0.0);
-
-    BranchTab *bt = BranchTab_new();
-    Gene_tabulate(g5, bt, 0);
+    assert(g5->birth == 3.0);
 
-    assert(BranchTab_size(bt) == 1);
+    Gene_tabulate(g3, g5->birth, bt, 0);
+    Gene_tabulate(g4, g5->birth, bt, 0);
+    assert(BranchTab_size(bt) == 2);
     assert(2.0 == BranchTab_get(bt, (id1|id2)));
+    BranchTab_free(bt);
 
     unitTstResult("Gene", "OK");
 
+    assert(GeneStore_size(gs) == 5);
+    assert(g1 + 4 == g5);
+    GeneStore_reset(gs);
+    assert(GeneStore_size(gs) == 0);
+    g1 = Gene_new(id4, 2.0, gs);
+    assert(g1 == g4 - 3);
+    assert(g1->tipId == id4);
+    assert(g1->birth == 2.0);
+    assert(GeneStore_size(gs) == 1);
+
+    // Retained Genes survive a reset.
+    GeneStore_retain(gs);
+    g2 = Gene_new(id2, 0.0, gs);
+    assert(GeneStore_size(gs) == 2);
+    GeneStore_reset(gs);
+    assert(GeneStore_size(gs) == 1);
+    assert(Gene_new(id1, 0.0, gs) == g2);
+    assert(g1->tipId == id4);
+    GeneStore_free(gs);
+
+    unitTstResult("GeneStore", "OK");
+
     return 0;
 }
 #endif
@@ -2,24 +2,38 @@
 #define ARR_GENE
 
 #  include "typedefs.h"
+#  include "binary.h"
 #  include "branchtab.h"
 
+/// A Gene is a single lineage within the gene genealogy. It records
+/// the set of samples that descend from it and the time at which it
+/// arose. Its branch length is not known until the lineage coalesces.
 struct Gene {
     tipId_t     tipId;
-    struct Gene *parent, *lchild, *rchild;
-    double      branch;
+    double      birth;  // time at which lineage arose
 };
 
-Gene       *Gene_join(Gene * lchild, Gene * rchild);
-Gene       *Gene_new(tipId_t tipId);
-void        Gene_tabulate(Gene * self, BranchTab * bt, int doSing);
-void        Gene_free(Gene * gene);
+Gene       *Gene_join(Gene * lchild, Gene * rchild, double t, GeneStore * gs);
+Gene       *Gene_new(tipId_t tipId, double birth, GeneStore * gs);
 
-static inline void Gene_addToBranch(Gene * gene, double x);
+GeneStore  *GeneStore_new(int len);
+void        GeneStore_free(GeneStore * self);
+Gene       *GeneStore_alloc(GeneStore * self);
+void        GeneStore_reset(GeneStore * self);
+void        GeneStore_retain(GeneStore * self);
+int         GeneStore_size(const GeneStore * self);
 
-static inline void Gene_addToBranch(Gene * gene, double x) {
-    gene->branch += x;
-}
+static inline void Gene_tabulate(Gene * self, double t, BranchTab * bt,
+                                 int doSing);
 
+/// Add the branch of Gene self, which ends at time t, to the bin of
+/// BranchTab bt that corresponds to its site pattern.  If doSing==0,
+/// ignore genes with only one descendant.  These are recognizable
+/// because their tipIds are powers of 2.
+static inline void Gene_tabulate(Gene * self, double t, BranchTab * bt,
+                                 int doSing) {
+    if(doSing || !isPow2(self->tipId))
+        BranchTab_add(bt, self->tipId, t - self->birth);
+}
 
 #endif
@@ -9,10 +9,15 @@
  */
 
 #include "gptree.h"
+#include "exact.h"
 #include "gene.h"
 #include "lblndx.h"
 #include "parse.h"
 #include "parstore.h"
+#include "patfold.h"
+#include "popnode.h"
+#include "segcache.h"
+#include "fastrng.h"
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -21,6 +26,10 @@
 #include <pthread.h>
 extern pthread_mutex_t outputLock;
 
+static int GPTree_isClear(const GPTree *self);
+static void GPTree_initGenes(GPTree *self);
+static void GPTree_addLeaf(GPTree *self, unsigned i);
+
 /// GPTree stands for Gene-Population tree. It represents a network
 /// of populations, which can split to form daughter populations or
 /// exchange genes at various points in time. The population tree
@@ -31,12 +40,22 @@ extern pthread_mutex_t outputLock;
 struct GPTree {
     int nseg;         // number of segments in population tree.
     PopNode *pnv;     // array of nseg PopNode objects
-    PopNode *rootPop; // root of population tree
+    int *order;       // indices into pnv: children precede parents
     Gene *rootGene;   // root of gene tree
+    GeneStore *gstore; // memory for Gene objects in gene tree
+    Gene *leaf[MAXSAMP]; // lineage of each sample; kept in gstore
+    Gene **pool;      // sample buffers of all PopNode objects
+    SegPar *segpar;   // parameters of each PopNode; 64-byte aligned
+    SegStat *segstat; // see GPTree_setSegStats; NULL unless collected
     Bounds bnd;       // legal range of twoN parameters and time parameters
     ParStore *parstore; // Fixed and free parameters
     LblNdx lblndx;    // Index of sample labels
-    SampNdx sndx;     // Index of sample pointers into PopNode objects.
+    SampNdx sndx;     // Index of samples into PopNode objects.
+    int tailK;        // see GPTree_setTailK
+    int folded;       // see GPTree_setFold
+    PatFold fold;     // map from samples to populations
+    int ngauss;       // number of entries in gauss
+    GaussPar *gauss;  // Gaussian parameters, parents before children
 };
 
 /// Print a description of parameters.
@@ -54,7 +73,13 @@ void GPTree_printParStoreFree(GPTree *self, FILE *fp) {
 /// Randomly perturb all free parameters in the population tree while
 /// maintaining inequality constraints.
 void GPTree_randomize(GPTree *self, gsl_rng *rng) {
-	PopNode_randomize(self->rootPop, self->bnd, self->parstore, rng);
+    int i;
+    do{
+        // parents before children
+        for(i = self->nseg - 1; i >= 0; --i)
+            PopNode_randomize(self->pnv + self->order[i], self->pnv,
+                              self->bnd, self->parstore, rng);
+    }while(!GPTree_feasible(self, 0));
 }
 
 /// Set free parameters from an array.
@@ -71,7 +96,7 @@ void GPTree_setParams(GPTree *self, int n, double x[n]) {
 /// @param[out] n number of parameters in array, which should equal the
 /// number of free parameters in the GPTree.
 /// @param[out] x array into which parameters will be copied
-void GPTree_getParams(GPTree *self, int n, double x[n]) {
+void GPTree_getParams(const GPTree *self, int n, double x[n]) {
     assert(n == ParStore_nFree(self->parstore));
     ParStore_getFreeParams(self->parstore, n, x);
 }
@@ -81,8 +106,9 @@ int GPTree_nFree(const GPTree *self) {
     return ParStore_nFree(self->parstore);
 }
 
-/// Build a gene tree by coalescent simulation and then tabulate
-/// branch lengths associated with each site pattern.
+/// Simulate a gene genealogy by coalescent simulation, tabulating
+/// the branch lengths associated with each site pattern as lineages
+/// coalesce.
 /// @param self GPTree object
 /// @param[out] branchtab BranchTab object, which will tabulate branch
 /// lengths from this (and other) simulations.
@@ -93,26 +119,356 @@ int GPTree_nFree(const GPTree *self) {
 void GPTree_simulate(GPTree *self, BranchTab *branchtab, gsl_rng *rng,
                      unsigned long nreps, int doSing) {
     unsigned long rep;
+    int i;
+    PopNode *pnv = self->pnv;
+    const int *order = self->order;
+    const double *par = ParStore_values(self->parstore);
     ParStore_constrain(self->parstore);
+
+    // Parameters are gathered once for the whole batch unless
+    // Gaussian ones change them in each replicate.
+    PopNode_segPars(self->nseg, pnv, par, self->segpar);
     for(rep = 0; rep < nreps; ++rep) {
-        PopNode_clear(self->rootPop); // remove old samples
-        SampNdx_populateTree(&(self->sndx));    // add new samples
-        PopNode_gaussian(self->rootPop, self->bnd,
-                         self->parstore, rng);
-
-        // coalescent simulation generates gene genealogy within
-        // population tree.
-        self->rootGene = PopNode_coalesce(self->rootPop, rng);
+        // remove old samples
+        for(i = 0; i < self->nseg; ++i)
+            PopNode_clear(pnv + order[i]);
+        if(self->segstat)
+            memset(self->segstat, 0, self->nseg * sizeof(self->segstat[0]));
+
+        // Resample Gaussian parameters, if there are any.
+        if(self->ngauss > 0) {
+            ParStore_constrain(self->parstore);
+            GaussPar_sample(self->ngauss, self->gauss, self->parstore, rng);
+            PopNode_segPars(self->nseg, pnv, par, self->segpar);
+        }
+
+        // Add new samples. This must follow GaussPar_sample,
+        // because each sample's birth is the start of its PopNode.
+        for(i = 0; i < self->sndx.n; ++i)
+            GPTree_addLeaf(self, i);
+
+        // Coalescent simulation generates gene genealogy within
+        // population tree, accumulating branch lengths in bins that
+        // correspond to site patterns. Children precede parents, so
+        // the root comes last.
+        for(i = 0; i < self->nseg; ++i)
+            self->rootGene = PopNode_coalesce(pnv + order[i], pnv,
+                                              self->segpar, self->gstore,
+                                              branchtab, doSing,
+                                              self->tailK,
+                                              (self->segstat
+                                               ? self->segstat + order[i]
+                                               : NULL), rng);
         assert(self->rootGene);
 
-        // Traverse gene tree, accumulating branch lengths in bins
-        // that correspond to site patterns.
-        Gene_tabulate(self->rootGene, branchtab, doSing);
+        // Release gene genealogy but not population tree.
+        GeneStore_reset(self->gstore);
+        self->rootGene = NULL;
+    }
+}
+
+/// Like GPTree_simulate, but reuse the parts of the previous
+/// simulation that are unaffected by changes in parameter values.
+///
+/// Each segment of each replicate gets its own random number stream,
+/// derived from seed, the replicate, and the segment's index. The
+/// gene genealogy within a segment is therefore a function of the
+/// segment's parameters and of the lineages that enter it from
+/// samples and from child segments. Cache holds the branch lengths
+/// tabulated within each segment and the lineages that leave it.
+/// Where neither the segment's parameters nor those of any descendant
+/// segment have changed since the previous call with the same cache,
+/// seed, nreps, and doSing, this output is reused in place of
+/// simulation. Results do not depend on the cache's history: they are
+/// identical to those of a call with an empty cache.
+///
+/// The streams differ from those of GPTree_simulate, so results do
+/// too, although both have the same expectation. Because rng is
+/// reseeded for each segment, a generic type such as rng_xoshiro_pos,
+/// which draws exponentials by inversion, is faster here than
+/// rng_xoshiro256pp, which refills a buffer of them after each seed.
+/// Branch lengths are folded as in branchtab, which must fold in the
+/// same way at each call with a given cache.
+/// @return 0 on success, or 1 if the cache can't be used, because the
+/// model has Gaussian parameters or because nreps*nseg exceeds
+/// SEGCACHE_MAXREC. In that case, branchtab and cache are unchanged.
+int GPTree_simulateIncr(GPTree *self, SegCache *cache, BranchTab *branchtab,
+                        gsl_rng *rng, unsigned long seed,
+                        unsigned long nreps, int doSing) {
+    int nseg = self->nseg;
+    if(ParStore_nGaussian(self->parstore) > 0
+       || nreps * nseg > SEGCACHE_MAXREC)
+        return 1;
+    unsigned long rep;
+    unsigned m, n;
+    int i, j, p;
+    PopNode *pnv = self->pnv;
+    const int *order = self->order;
+    ParStore_constrain(self->parstore);
+    PopNode_segPars(nseg, pnv, ParStore_values(self->parstore),
+                    self->segpar);
+    double segpar[nseg][4];
+    int changed[nseg], dirty[nseg];
+
+    // Segments are identified by their position in order.
+    for(i = 0; i < nseg; ++i) {
+        const SegPar *sp = self->segpar + order[i];
+        segpar[i][0] = sp->twoN;
+        segpar[i][1] = sp->start;
+        segpar[i][2] = sp->end;
+        segpar[i][3] = sp->mix;
+    }
+    SegCache_begin(cache, nseg, segpar, nreps, seed, doSing, self->tailK,
+                   changed);
+
+    // A segment must be simulated if it or any descendant has
+    // changed. Children precede parents in order. A clean segment
+    // need only pass its lineages on, and only if a parent is dirty.
+    int feeds[nseg];
+    for(i = 0; i < nseg; ++i) {
+        const PopNode *node = pnv + order[i];
+        dirty[order[i]] = changed[i];
+        for(j = 0; j < node->nchildren; ++j)
+            dirty[order[i]] |= dirty[node->child[j]];
+        if(dirty[order[i]])
+            SegCache_clear(cache, i, branchtab);
+    }
+    for(i = 0; i < nseg; ++i) {
+        const PopNode *node = pnv + order[i];
+        feeds[i] = 0;
+        for(p = 0; p < node->nparents; ++p)
+            feeds[i] |= dirty[node->parent[p]];
+    }
+
+    for(rep = 0; rep < nreps; ++rep) {
+        unsigned long repSeed = FastRng_streamSeed(seed, rep);
+        for(i = 0; i < nseg; ++i)
+            PopNode_clear(pnv + order[i]);
+
+        // Samples are needed only in segments that will be simulated.
+        for(m = 0; m < self->sndx.n; ++m) {
+            if(dirty[self->sndx.node[m]])
+                GPTree_addLeaf(self, m);
+        }
 
-        // Free gene genealogy but not population tree.
-        Gene_free(self->rootGene);
+        for(i = 0; i < nseg; ++i) {
+            PopNode *node = pnv + order[i];
+            if(!dirty[order[i]]) {
+                if(!feeds[i])
+                    continue;
+                const SegLineage *lin = SegCache_lineages(cache, i, rep,
+                                                          &n);
+                for(m = 0; m < n; ++m) {
+                    PopNode *parent = pnv + node->parent[lin[m].parent];
+                    if(dirty[parent->ndx])
+                        PopNode_addSample(parent,
+                                          Gene_new(lin[m].tipId,
+                                                   lin[m].birth,
+                                                   self->gstore));
+                }
+                continue;
+            }
+
+            // Simulate, recording departing lineages. Random numbers
+            // are needed only for coalescence and admixture.
+            int nbefore[2] = {0, 0};
+            for(p = 0; p < node->nparents; ++p)
+                nbefore[p] = pnv[node->parent[p]].nsamples;
+            if(node->nsamples > 1 || node->nparents == 2)
+                gsl_rng_set(rng, FastRng_streamSeed(repSeed, order[i]));
+            PopNode_coalesce(node, pnv, self->segpar, self->gstore,
+                             SegCache_branchTab(cache, i), doSing,
+                             self->tailK, NULL, rng);
+            for(p = 0; p < node->nparents; ++p) {
+                PopNode *parent = pnv + node->parent[p];
+                for(j = nbefore[p]; j < parent->nsamples; ++j)
+                    SegCache_addLineage(cache, i, parent->sample[j]->tipId,
+                                        parent->sample[j]->birth, p);
+            }
+            SegCache_endRep(cache, i, rep);
+        }
+        GeneStore_reset(self->gstore);
         self->rootGene = NULL;
     }
+
+    for(i = 0; i < nseg; ++i)
+        BranchTab_plusEquals(branchtab, SegCache_branchTab(cache, i));
+    return 0;
+}
+
+/// Add exact expected branch lengths, multiplied by scale, to
+/// branchtab. Return 0 on success, or 1 if the model cannot be
+/// handled exactly, either because it has Gaussian parameters or
+/// because it has too many samples. In that case, branchtab is
+/// unchanged.
+int GPTree_expected(GPTree *self, BranchTab *branchtab, double scale,
+                    int doSing) {
+    if(ParStore_nGaussian(self->parstore) > 0)
+        return 1;
+    ParStore_constrain(self->parstore);
+    BranchTab *bt = BranchTab_newLike(branchtab);
+    int status = exactBranchLengths(self->nseg, self->pnv, self->order,
+                                    ParStore_values(self->parstore),
+                                    &(self->sndx), doSing, scale, bt);
+    if(status == 0)
+        BranchTab_plusEquals(branchtab, bt);
+    BranchTab_free(bt);
+    return status;
+}
+
+/// Set mu[k] to the expected length of the branches that separate
+/// samples a[k] and b[k] in the gene tree, for k = 0..npairs-1. This
+/// is the sum of the two branch lengths of a tree of these samples
+/// alone, calculated exactly. Return 0 on success, or 1 if the model
+/// has Gaussian parameters.
+int GPTree_pairExpected(GPTree *self, int npairs, const int a[npairs],
+                        const int b[npairs], double mu[npairs]) {
+    if(ParStore_nGaussian(self->parstore) > 0)
+        return 1;
+    ParStore_constrain(self->parstore);
+    const double *par = ParStore_values(self->parstore);
+    for(int k = 0; k < npairs; ++k) {
+        SampNdx     pair = {.n = 2};
+        pair.node[0] = self->sndx.node[a[k]];
+        pair.node[1] = self->sndx.node[b[k]];
+        BranchTab  *bt = BranchTab_new();
+        int status = exactBranchLengths(self->nseg, self->pnv, self->order,
+                                        par, &pair, 1, 1.0, bt);
+        if(status == 0)
+            mu[k] = BranchTab_get(bt, 1) + BranchTab_get(bt, 2);
+        BranchTab_free(bt);
+        if(status)
+            return status;
+    }
+    return 0;
+}
+
+/// Return the number of segments in the population tree.
+int GPTree_nseg(const GPTree *self) {
+    return self->nseg;
+}
+
+/// Fill arrays with the population size, admixture fraction, and
+/// start time of each segment, at the current parameter values. For
+/// segments with fewer than two parents, mix[i] is 0. Return 0 on
+/// success, or 1 if the likelihood of a gene genealogy does not
+/// depend on these values alone: that is, if the model has Gaussian
+/// parameters or if GPTree_simulate tabulates expected tails (see
+/// GPTree_setTailK).
+int GPTree_segPars(GPTree *self, int nseg, double twoN[nseg],
+                   double mix[nseg], double start[nseg]) {
+    assert(nseg == self->nseg);
+    if(ParStore_nGaussian(self->parstore) > 0 || self->tailK > 0)
+        return 1;
+    ParStore_constrain(self->parstore);
+    const double *par = ParStore_values(self->parstore);
+    for(int i = 0; i < nseg; ++i) {
+        const PopNode *node = self->pnv + i;
+        twoN[i] = par[node->twoN];
+        mix[i] = (node->nparents == 2 ? par[node->mix] : 0.0);
+        start[i] = par[node->start];
+    }
+    return 0;
+}
+
+/// If on is nonzero, GPTree_simulate will record the sufficient
+/// statistics of the gene genealogy within each segment (see SegStat
+/// and GPTree_segStats). They are needed only to reweight stored
+/// genealogies (see treebank.c), so by default they are not
+/// collected.
+void GPTree_setSegStats(GPTree *self, int on) {
+    if(on && self->segstat == NULL) {
+        self->segstat = calloc(self->nseg, sizeof(self->segstat[0]));
+        CHECKMEM(self->segstat);
+    } else if(!on) {
+        free(self->segstat);
+        self->segstat = NULL;
+    }
+}
+
+/// Copy the sufficient statistics of the gene genealogy within each
+/// segment, as left by the most recent replicate of GPTree_simulate.
+/// Collection must have been turned on by GPTree_setSegStats.
+void GPTree_segStats(const GPTree *self, int nseg, SegStat *stat) {
+    assert(nseg == self->nseg);
+    assert(self->segstat);
+    memcpy(stat, self->segstat, nseg * sizeof(stat[0]));
+}
+
+/// Once the root segment contains tailK or fewer lineages,
+/// GPTree_simulate will tabulate their expected branch lengths rather
+/// than simulating the rest of the gene tree. This reduces Monte Carlo
+/// noise but costs time proportional to 2^tailK per replicate. If
+/// tailK is 0 (the default), all coalescent events are simulated.
+void GPTree_setTailK(GPTree *self, int tailK) {
+    assert(tailK >= 0 && tailK <= POPNODE_MAXTAIL);
+    self->tailK = tailK;
+}
+
+/// If fold is nonzero, site patterns describe populations rather than
+/// samples, as in the output of tabpat. BranchTab objects made by
+/// GPTree_newBranchTab then fold each branch's samples into
+/// population-level patterns as branches are tabulated (see
+/// patfold.c), and GPTree_getLblNdx returns population labels. This
+/// matters only for segments with more than one sample.
+void GPTree_setFold(GPTree *self, int fold) {
+    self->folded = fold;
+}
+
+/// Return nonzero if site patterns describe populations. See
+/// GPTree_setFold.
+int GPTree_folded(const GPTree *self) {
+    return self->folded;
+}
+
+/// Return a new BranchTab to hold branch lengths simulated or
+/// calculated from this tree. It folds samples into populations if
+/// GPTree_setFold has been called with a nonzero argument. In that
+/// case, singleton site patterns of populations are discarded unless
+/// doSing is nonzero.
+BranchTab *GPTree_newBranchTab(const GPTree *self, int doSing) {
+    if(self->folded)
+        return BranchTab_newFolded(&self->fold, doSing);
+    return BranchTab_newDense(self->sndx.n);
+}
+
+/// Give each PopNode a sample buffer just large enough for the
+/// lineages that can reach it, and build the leaf lineage of each
+/// sample once, so that replicates need only reset its birth.
+static void GPTree_initGenes(GPTree *self) {
+    int i, maxsamp[self->nseg];
+    int total = SampNdx_maxLineages(&self->sndx, self->nseg, self->pnv,
+                                    self->order, maxsamp);
+    self->pool = malloc(total * sizeof(self->pool[0]));
+    CHECKMEM(self->pool);
+    Gene **buff = self->pool;
+    for(i = 0; i < self->nseg; ++i) {
+        PopNode_setBuffer(self->pnv + i, buff, maxsamp[i]);
+        buff += maxsamp[i];
+    }
+
+    // A gene tree with n samples has 2n-1 nodes. GPTree_simulateIncr
+    // also copies as many as n lineages that leave unchanged segments.
+    unsigned n = SampNdx_size(&self->sndx);
+    self->gstore = GeneStore_new(3*n - 1);
+    CHECKMEM(self->gstore);
+    for(i = 0; i < n; ++i)
+        self->leaf[i] = Gene_new(((tipId_t) 1) << i, 0.0, self->gstore);
+    GeneStore_retain(self->gstore);
+
+    errno = posix_memalign((void **) &self->segpar, 64,
+                           self->nseg * sizeof(self->segpar[0]));
+    if(errno)
+        eprintf("%s:%s:%d: can't allocate segpar:", __FILE__, __func__,
+                __LINE__);
+}
+
+/// Add the leaf lineage of sample i to its PopNode. It is born at the
+/// PopNode's start.
+static void GPTree_addLeaf(GPTree *self, unsigned i) {
+    PopNode *node = self->pnv + self->sndx.node[i];
+    self->leaf[i]->birth = self->segpar[node->ndx].start;
+    PopNode_addSample(node, self->leaf[i]);
 }
 
 /// GPTree constructor
@@ -134,11 +490,37 @@ GPTree *GPTree_new(const char *fname, Bounds bnd) {
     NodeStore *ns = NodeStore_new(self->nseg, self->pnv);
     CHECKMEM(ns);
 
-    self->rootPop = mktree(fp, &self->sndx, &self->lblndx, self->parstore,
-                           &self->bnd, ns);
+    PopNode *rootPop = mktree(fp, &self->sndx, &self->lblndx,
+                              self->parstore, &self->bnd, ns);
 
     fclose(fp);
     NodeStore_free(ns);
+    PatFold_init(&self->fold, &self->sndx);
+
+    // Compile the order in which segments are processed during
+    // each replicate.
+    self->order = malloc(self->nseg * sizeof(self->order[0]));
+    CHECKMEM(self->order);
+    if(self->nseg != PopNode_postorder(rootPop - self->pnv, self->pnv,
+                                       self->nseg, self->order)) {
+        fprintf(stderr,"%s:%s:%d: file \"%s\" has segments that are"
+                " not connected to the root\n",
+                __FILE__,__func__,__LINE__,fname);
+        exit(EXIT_FAILURE);
+    }
+
+    GPTree_initGenes(self);
+
+    // List Gaussian parameters once, parents before children, so that
+    // each replicate can resample them without visiting every node.
+    self->gauss = malloc(3 * self->nseg * sizeof(self->gauss[0]));
+    CHECKMEM(self->gauss);
+    self->ngauss = 0;
+    for(int i = self->nseg - 1; i >= 0; --i)
+        self->ngauss += PopNode_gaussPars(self->pnv + self->order[i],
+                                          self->pnv, self->bnd,
+                                          self->gauss + self->ngauss);
+
     GPTree_sanityCheck(self, __FILE__, __LINE__);
     if(!GPTree_feasible(self, 1)) {
         fprintf(stderr,"%s:%s:%d: file \"%s\" describes an infeasible tree.\n",
@@ -151,10 +533,13 @@ GPTree *GPTree_new(const char *fname, Bounds bnd) {
 
 /// GPTree destructor.
 void GPTree_free(GPTree *self) {
-    Gene_free(self->rootGene);
+    GeneStore_free(self->gstore);
     self->rootGene = NULL;
-    PopNode_clear(self->rootPop);
-    self->rootPop = NULL;
+    free(self->order);
+    free(self->gauss);
+    free(self->pool);
+    free(self->segpar);
+    free(self->segstat);
     free(self->pnv);
     ParStore_free(self->parstore);
     free(self);
@@ -170,59 +555,32 @@ GPTree *GPTree_dup(const GPTree *old) {
                 __FILE__,__func__,__LINE__);
         exit(EXIT_FAILURE);
     }
-    if(!PopNode_isClear(old->rootPop)) {
+    if(!GPTree_isClear(old)) {
         fprintf(stderr,"%s:%s:%d: clear GPTree of samples before call"
                 " to GPTree_dup\n",
                 __FILE__,__func__,__LINE__);
         exit(EXIT_FAILURE);
     }
 
+    // PopNode objects refer to one another and to parameters by
+    // index rather than by pointer, so copying them requires no
+    // adjustment.
     GPTree *new   = memdup(old, sizeof(GPTree));
     new->parstore = ParStore_dup(old->parstore);
     new->pnv      = memdup(old->pnv, old->nseg * sizeof(PopNode));
+    new->order    = memdup(old->order, old->nseg * sizeof(old->order[0]));
+    new->gauss    = memdup(old->gauss, 3 * old->nseg * sizeof(GaussPar));
+    new->segstat  = NULL;
+    GPTree_setSegStats(new, old->segstat != NULL);
+    GPTree_initGenes(new);
 
     assert(old->nseg == new->nseg);
     CHECKMEM(new->parstore);
     CHECKMEM(new->pnv);
-
-    new->sndx = old->sndx;
-
-    /*
-     * Adjust the pointers so they refer to the memory allocated in
-     * "new" rather than that in "old".  dpar is the absolute offset
-     * between new and old for parameter pointers.  dpop is the
-     * analogous offset for PopNode pointers. spar and spop are the
-     * signs of these offsets. Everything has to be cast to size_t,
-     * because we are not doing pointer arithmetic in the usual
-     * sense. Ordinarily, ptr+3 means ptr + 3*sizeof(*ptr). We want it
-     * to mean ptr+3*sizeof(char).
-     */
-    int i, spar, spop;
-    size_t dpar, dpop;
-
-    // Calculate offsets and signs
-    if(new->parstore > old->parstore) {
-        dpar = ((size_t) new->parstore) - ((size_t) old->parstore);
-        spar = 1;
-    }else{
-        dpar = ((size_t) old->parstore) - ((size_t) new->parstore);
-        spar = -1;
-    }
-    if(new->pnv > old->pnv) {
-        dpop = ((size_t) new->pnv) - ((size_t) old->pnv);
-        spop = 1;
-    }else{
-        dpop = ((size_t) old->pnv) - ((size_t) new->pnv);
-        spop = -1;
-    }
-
-    SHIFT_PTR(new->rootPop, dpop, spop);
-    for(i=0; i < old->nseg; ++i) {
-        PopNode_shiftParamPtrs(&new->pnv[i], dpar, spar);
-        PopNode_shiftPopNodePtrs(&new->pnv[i], dpop, spop);
-    }
-    SampNdx_shiftPtrs(&new->sndx, dpop, spop);
-    assert(SampNdx_ptrsLegal(&new->sndx, new->pnv, new->pnv + new->nseg));
+    CHECKMEM(new->order);
+    CHECKMEM(new->gauss);
+    CHECKMEM(new->gstore);
+    assert(SampNdx_ndxLegal(&new->sndx, new->nseg));
 
     GPTree_sanityCheck(new, __FILE__, __LINE__);
     assert(GPTree_equals(old, new));
@@ -243,8 +601,11 @@ void GPTree_sanityCheck(GPTree *self, const char *file, int line) {
 #ifndef NDEBUG
     REQUIRE(self->nseg > 0,                         file, line);
     REQUIRE(self->pnv != NULL,                      file, line);
-    REQUIRE(self->rootPop >= self->pnv,             file, line);
-    REQUIRE(self->rootPop < self->pnv + self->nseg, file, line);
+    REQUIRE(self->gstore != NULL,                   file, line);
+    REQUIRE(self->order != NULL,                    file, line);
+    REQUIRE(self->pnv[self->order[self->nseg-1]].nparents == 0,
+            file, line);
+    REQUIRE(SampNdx_ndxLegal(&self->sndx, self->nseg), file, line);
     Bounds_sanityCheck(&self->bnd,                  file, line);
     ParStore_sanityCheck(self->parstore,            file, line);
     LblNdx_sanityCheck(&self->lblndx,               file, line);
@@ -253,8 +614,7 @@ void GPTree_sanityCheck(GPTree *self, const char *file, int line) {
 
 /// Return 1 if two GPTree objects are equal, 0 if they differ.  Abort
 /// with an error if the GPTree pointers are different but one or more
-/// of the internal pointers is the same.  Does not access rootPop or
-/// rootGene.
+/// of the internal pointers is the same.  Does not access rootGene.
 int GPTree_equals(const GPTree *lhs, const GPTree *rhs) {
     if(lhs == rhs)
         return 0;
@@ -272,11 +632,17 @@ int GPTree_equals(const GPTree *lhs, const GPTree *rhs) {
         return 0;
     if(!SampNdx_equals(&lhs->sndx, &rhs->sndx))
         return 0;
+    if(lhs->folded != rhs->folded
+       || !PatFold_equals(&lhs->fold, &rhs->fold))
+        return 0;
     return 1;
 }
 
-/// Get the LblNdx object from a GPTree
+/// Get the LblNdx object from a GPTree. It labels populations rather
+/// than samples if site patterns are folded (see GPTree_setFold).
 LblNdx GPTree_getLblNdx(GPTree *self) {
+    if(self->folded)
+        return PatFold_lblndx(&self->fold, &self->lblndx);
     return self->lblndx;
 }
 
@@ -297,8 +663,25 @@ unsigned    GPTree_nsamples(GPTree *self) {
 
 /// Are parameters within the feasible region?
 int GPTree_feasible(const GPTree *self, int verbose) {
+    int i;
     ParStore_constrain(self->parstore);
-	return PopNode_feasible(self->rootPop, self->bnd, verbose);
+    const double *par = ParStore_values(self->parstore);
+    for(i = 0; i < self->nseg; ++i) {
+        if(!PopNode_feasible(self->pnv + i, self->pnv, par, self->bnd,
+                             verbose))
+            return 0;
+    }
+	return 1;
+}
+
+/// Return 1 if no PopNode contains samples; 0 otherwise.
+static int GPTree_isClear(const GPTree *self) {
+    int i;
+    for(i = 0; i < self->nseg; ++i) {
+        if(!PopNode_isClear(self->pnv + i))
+            return 0;
+    }
+    return 1;
 }
 
 
@@ -380,11 +763,42 @@ int main(int argc, char **argv) {
     if(verbose)
         LblNdx_print(&lblndx, stdout);
 
+    // After a parameter changes, incremental simulation must give
+    // exactly what it gives with an empty cache.
+    gsl_rng *rng = gsl_rng_alloc(rng_xoshiro_pos);
+    SegCache *cache = SegCache_new();
+    SegCache *fresh = SegCache_new();
+    unsigned long nreps = 500, seed = 31;
+    BranchTab *bt0 = BranchTab_new();
+    BranchTab *bt1 = BranchTab_new();
+    BranchTab *bt2 = BranchTab_new();
+    assert(0 == GPTree_simulateIncr(g, cache, bt0, rng, seed, nreps, 1));
+    int npar = GPTree_nFree(g);
+    double x[npar];
+    GPTree_getParams(g, npar, x);
+    x[npar-1] *= 1.1;
+    GPTree_setParams(g, npar, x);
+    assert(GPTree_feasible(g, 0));
+    assert(0 == GPTree_simulateIncr(g, cache, bt1, rng, seed, nreps, 1));
+    assert(0 == GPTree_simulateIncr(g, fresh, bt2, rng, seed, nreps, 1));
+    assert(BranchTab_equals(bt1, bt2));
+    assert(!BranchTab_equals(bt0, bt1));
+    if(verbose) {
+        printf("incremental:\n");
+        BranchTab_print(bt1, stdout);
+    }
+    BranchTab_free(bt0);
+    BranchTab_free(bt1);
+    BranchTab_free(bt2);
+    SegCache_free(cache);
+    SegCache_free(fresh);
+    gsl_rng_free(rng);
+
     GPTree_free(g);
     GPTree_free(g2);
 
     unlink(fname);
-    unitTstResult("GPTree", "untested");
+    unitTstResult("GPTree", "OK");
     return 0;
 }
 #endif
@@ -14,12 +14,31 @@ LblNdx      GPTree_getLblNdx(GPTree *self);
 void        GPTree_simulate(GPTree *self, BranchTab *branchtab,
                             gsl_rng *rng, unsigned long nreps,
                             int doSing);
+int         GPTree_simulateIncr(GPTree *self, SegCache *cache,
+                                BranchTab *branchtab, gsl_rng *rng,
+                                unsigned long seed, unsigned long nreps,
+                                int doSing);
+int         GPTree_expected(GPTree *self, BranchTab *branchtab,
+                            double scale, int doSing);
+int         GPTree_pairExpected(GPTree *self, int npairs,
+                                const int a[npairs], const int b[npairs],
+                                double mu[npairs]);
+int         GPTree_nseg(const GPTree *self);
+int         GPTree_segPars(GPTree *self, int nseg, double twoN[nseg],
+                           double mix[nseg], double start[nseg]);
+void        GPTree_setSegStats(GPTree *self, int on);
+void        GPTree_segStats(const GPTree *self, int nseg,
+                            SegStat *stat);
+void        GPTree_setTailK(GPTree *self, int tailK);
+void        GPTree_setFold(GPTree *self, int fold);
+int         GPTree_folded(const GPTree *self);
+BranchTab  *GPTree_newBranchTab(const GPTree *self, int doSing);
 int         GPTree_nFree(const GPTree *self);
 double     *GPTree_loBounds(GPTree *self);
 double     *GPTree_upBounds(GPTree *self);
 unsigned    GPTree_nsamples(GPTree *self);
 void        GPTree_setParams(GPTree *self, int n, double x[n]);
-void        GPTree_getParams(GPTree *self, int n, double x[n]);
+void        GPTree_getParams(const GPTree *self, int n, double x[n]);
 void        GPTree_randomize(GPTree *self, gsl_rng *rng);
 void        GPTree_printParStore(GPTree *self, FILE *fp);
 void        GPTree_printParStoreFree(GPTree *self, FILE *fp);
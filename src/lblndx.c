@@ -25,7 +25,7 @@ void LblNdx_init(LblNdx * self) {
 /// each sampled population.
 void LblNdx_addSamples(LblNdx * self, unsigned nsamples, const char *lbl) {
     unsigned    i;
-    if(self->n + nsamples >= MAXSAMP)
+    if(self->n + nsamples > MAXSAMP)
         eprintf("%s:%s:%d: too many samples\n", __FILE__, __func__, __LINE__);
     for(i = 0; i < nsamples; ++i) {
         if(nsamples == 1)
@@ -51,7 +51,7 @@ unsigned LblNdx_size(const LblNdx * self) {
 void        LblNdx_sanityCheck(const LblNdx *self, const char *file, int line) {
 #ifndef NDEBUG
     REQUIRE(self, file, line);
-    REQUIRE(self->n < MAXSAMP, file, line);
+    REQUIRE(self->n <= MAXSAMP, file, line);
 
     int i;
     for(i=0; i < self->n; ++i) {
@@ -105,7 +105,7 @@ void LblNdx_print(const LblNdx *self, FILE *fp) {
 /// Generate a label for site pattern tid. Label goes into
 /// buff. Function returns a pointer to buff;
 char       *patLbl(size_t n, char buff[n], tipId_t tid, const LblNdx * lblndx) {
-    const int   maxbits = 40;
+    const int   maxbits = MAXSAMP;
     int         bit[maxbits];
     int         i, nbits;
     char        lbl[100];
@@ -146,8 +146,8 @@ int comparePtrs(const void *void_x, const void *void_y) {
     // sort order of samples corresponds to the
     // order in which they were listed in the input
     // data.
-    unsigned rx = reverseBits(**x);
-    unsigned ry = reverseBits(**y);
+    tipId_t rx = reverseBits(**x);
+    tipId_t ry = reverseBits(**y);
 
     return ry>rx ? 1 : ry<rx ? -1 : 0;
 }
@@ -173,8 +173,8 @@ int compare_tipId(const void *void_x, const void *void_y) {
     // sort order of samples corresponds to the
     // order in which they were listed in the input
     // data.
-    unsigned rx = reverseBits(*x);
-    unsigned ry = reverseBits(*y);
+    tipId_t rx = reverseBits(*x);
+    tipId_t ry = reverseBits(*y);
 
     return ry>rx ? 1 : ry<rx ? -1 : 0;
 }
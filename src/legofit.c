@@ -26,6 +26,24 @@ of separations and of episodes of gene flow, and levels of gene flow.
           number of DE points per free var
        -1 or --singletons
           Use singleton site patterns
+       -C or --crn
+          use common random numbers within each stage
+       -e or --exact
+          calculate expected branch lengths exactly, without simulation
+       -R <k> or --raoBlackwell <k>
+          use expected branch lengths once root has <= k lineages
+       -A or --antithetic
+          simulate antithetic pairs of replicates
+       -Q or --qmc
+          use randomized quasi-Monte Carlo
+       -V or --controlVariates
+          adjust simulated branch lengths using control variates
+       -I <x> or --importance <x>
+          reweight stored genealogies while ESS exceeds fraction <x>
+       -D or --incremental
+          re-simulate only segments affected by changed parameters
+       -P or --popPatterns
+          site patterns of populations rather than samples
        -v or --verbose
           verbose output
        -h or --help
@@ -84,6 +102,112 @@ artifacts. With high-quality modern DNA, it may one day prove
 useful. To use it, you need to generate a data set that contains
 singletons, by using the `-1` option of @\ref tabpat "tabpat".
 
+The `-C` option tells legofit to use common random numbers. Within
+each stage of the simulation schedule, the i'th simulation replicate
+uses the same random number stream at every point in the DE swarm and
+in every generation. Differences in cost between points then reflect
+differences in their parameters rather than Monte Carlo noise, so
+fewer replicates are needed to rank points correctly. A fresh set of
+streams is used in each stage, and the final estimate of site pattern
+branch lengths uses independent random numbers.
+
+The `-A` option simulates replicates in antithetic pairs: the
+second replicate of each pair uses the complement, 1-u, of each
+uniform random number u used by the first. The negative correlation
+within pairs reduces the variance of each function evaluation. It can
+be combined with `-C`, `-R`, or both.
+
+The `-Q` option replaces the first few uniform random numbers of each
+simulation replicate, which determine the earliest waiting times and
+admixture decisions, with the coordinates of a point in a randomly
+scrambled Sobol sequence. These quasi-random points cover the space
+more evenly than independent ones, which reduces the error of each
+function evaluation. Each evaluation uses its own scrambling, or
+with `-C` each stage does. It cannot be combined with `-A`. Use
+the `-Q` option of @ref legosim "legosim" to measure the
+reduction in error for a given model.
+
+The `-V` option adjusts the simulated branch length of each site
+pattern using control variates. For each pair of samples, each
+simulation replicate records the length of the branches that
+separate the two samples. The expected value of this length is
+calculated exactly, and the estimate of each site pattern's branch
+length is corrected by regression on the difference between the
+simulated and expected values. This reduces the error of each
+function evaluation. It has no effect in models with Gaussian
+parameters, and it combines with all options other than `-e`.
+
+The `-I <x>` option saves simulation time late in the run, when
+the points of the DE swarm are close together. Genealogies simulated
+at one point are stored in a bank, which is shared by all threads.
+At nearby points, the cost function is estimated by weighting each
+stored genealogy by the ratio of its likelihoods at the new and old
+points, rather than by simulating. When these weights become so
+uneven that the effective sample size falls below a fraction `x` of
+the number of replicates, the bank is refilled by simulating at the
+current point, using all threads. Because the bank is shared, the
+point at which it is refilled depends on the order in which threads
+evaluate points. Stored genealogies can be reweighted only for new
+population sizes and admixture fractions, so at points whose time
+parameters differ from those of the bank, the cost function is
+estimated by simulating, as it would be without `-I`, and the bank
+is kept. It is most useful when time parameters are fixed. It cannot
+be used in models with Gaussian parameters, or with `-R`, `-D`,
+`-A`, `-Q`, `-V`, or `-e`. A value of `x` near 0.5 is reasonable.
+
+The `-D` option re-simulates only the part of the population tree
+whose parameters have changed. Each population segment of each
+replicate gets its own random number stream, and each point of the
+DE swarm saves the branch lengths tabulated within each segment and
+the lineages that leave it. At the next trial for that point, a
+segment is simulated again only if its own parameters or those of a
+descendant segment have changed; otherwise its saved output is
+reused. The results are identical to those of a full simulation with
+the same streams. A full simulation costs about 1.5 times as much as
+usual, so this pays only when trials differ mainly in parameters near
+the root, as with a small crossover probability (`-x`) in a model
+whose free parameters lie mostly in ancestral segments. It requires
+`-C`, cannot be combined with `-A`, `-Q`, or `-V`, and has no effect
+in models with Gaussian parameters. Memory grows with the number of
+replicates times the number of segments, so stages in which this
+product exceeds SEGCACHE_MAXREC (see segcache.h) simulate as usual.
+
+The `-P` option is for models in which some segments have more than
+one sample, fitted to site patterns from @ref tabpat "tabpat". Without
+it, each sample is a separate element of a site pattern, and the
+patterns in the input file must be labeled "x.0", "x.1", and so on.
+With `-P`, site patterns refer to populations, labeled by segment
+name, and each simulated branch is divided among them as it is
+tabulated. If k of the n samples from a population descend from the
+branch, that population carries the derived allele with probability
+k/n. This is the rule tabpat uses to tabulate observed data, and it
+keeps the simulated table no larger than the observed one. Additional
+samples then reduce Monte Carlo noise instead of multiplying the
+number of site patterns. The control variates of `-V` refer to pairs
+of samples and have no effect in this mode.
+
+The `-R <k>` option reduces the Monte Carlo noise in each
+simulation replicate. Once the root population contains `k` or fewer
+lineages, legofit adds the expected lengths of the remaining branches,
+given those lineages, instead of simulating them. This leaves
+expectations unchanged but reduces their variance, so fewer
+replicates are needed for a given precision in the cost function.
+The work per replicate grows as @f$2^k@f$, so `k` should be small.
+
+The `-e` option tells legofit to calculate expected branch lengths
+exactly rather than by simulation. The cost function is then smooth
+and free of Monte Carlo noise, and each evaluation is much faster.
+This works only for models without Gaussian parameters and with
+small samples--typically one or two haploid samples per
+population--because the number of states that must be tracked grows
+rapidly with the number of samples. If the model is too large at its
+initial parameter values, legofit aborts with an error message. Later
+points at which admixture creates too many states are treated as
+infeasible; legofit never falls back to simulation. The simulation
+schedule still
+determines the number of DE generations, but the numbers of
+replicates are ignored.
+
 @copyright Copyright (c) 2016, Alan R. Rogers
 <rogers@anthro.utah.edu>. This file is released under the Internet
 Systems Consortium License, which can be found in file "LICENSE".
@@ -92,11 +216,15 @@ Systems Consortium License, which can be found in file "LICENSE".
 #include "branchtab.h"
 #include "cost.h"
 #include "diffev.h"
+#include "fastrng.h"
 #include "gptree.h"
 #include "lblndx.h"
+#include "parse.h"
 #include "parstore.h"
 #include "patprob.h"
+#include "popnode.h"
 #include "simsched.h"
+#include "treebank.h"
 #include <assert.h>
 #include <float.h>
 #include <getopt.h>
@@ -111,32 +239,11 @@ Systems Consortium License, which can be found in file "LICENSE".
 #include <time.h>
 #include <unistd.h>
 
-extern pthread_mutex_t seedLock;
-extern unsigned long rngseed;
 extern volatile sig_atomic_t sigstat;
 
 void        usage(void);
 void        initStateVec(int ndx, void *void_p, int n, double x[n],
                          gsl_rng *rng);
-void       *ThreadState_new(void *notused);
-void        ThreadState_free(void *rng);
-
-void *ThreadState_new(void *notused) {
-	// Lock seed, initialize random number generator, increment seed,
-	// and unlock.
-    gsl_rng    *rng = gsl_rng_alloc(gsl_rng_taus);
-
-	pthread_mutex_lock(&seedLock);
-    gsl_rng_set(rng, rngseed);
-	rngseed = (rngseed == ULONG_MAX ? 0 : rngseed+1);
-	pthread_mutex_unlock(&seedLock);
-
-    return rng;
-}
-
-void ThreadState_free(void *rng) {
-    gsl_rng_free( (gsl_rng *) rng );
-}
 
 void usage(void) {
 #if COST==KL_COST || COST==LNL_COST
@@ -162,6 +269,20 @@ void usage(void) {
             "add stage with <g> generations and <r> simulation reps");
     tellopt("-p <x> or --ptsPerDim <x>", "number of DE points per free var");
 	tellopt("-1 or --singletons", "Use singleton site patterns");
+    tellopt("-C or --crn", "use common random numbers within each stage");
+    tellopt("-e or --exact", "calculate branch lengths exactly");
+    tellopt("-R <k> or --raoBlackwell <k>",
+            "use expected branch lengths once root has <= k lineages");
+    tellopt("-A or --antithetic", "simulate antithetic pairs of replicates");
+    tellopt("-Q or --qmc", "use randomized quasi-Monte Carlo");
+    tellopt("-V or --controlVariates",
+            "adjust simulated branch lengths using control variates");
+    tellopt("-I <x> or --importance <x>",
+            "reweight stored genealogies while ESS exceeds fraction <x>");
+    tellopt("-D or --incremental",
+            "re-simulate only segments affected by changed parameters");
+    tellopt("-P or --popPatterns",
+            "site patterns of populations rather than samples");
     tellopt("-v or --verbose", "verbose output");
     tellopt("-h or --help", "print this message");
     exit(1);
@@ -204,16 +325,20 @@ int main(int argc, char **argv) {
         {"genomeSize", required_argument, 0, 'n'},
 #endif
         {"singletons", no_argument, 0, '1'},
+        {"crn", no_argument, 0, 'C'},
+        {"exact", no_argument, 0, 'e'},
+        {"raoBlackwell", required_argument, 0, 'R'},
+        {"antithetic", no_argument, 0, 'A'},
+        {"qmc", no_argument, 0, 'Q'},
+        {"controlVariates", no_argument, 0, 'V'},
+        {"importance", required_argument, 0, 'I'},
+        {"incremental", no_argument, 0, 'D'},
+        {"popPatterns", no_argument, 0, 'P'},
         {"help", no_argument, 0, 'h'},
         {"verbose", no_argument, 0, 'v'},
         {NULL, 0, NULL, 0}
     };
 
-    printf("########################################\n"
-           "# legofit: estimate population history #\n"
-           "########################################\n");
-    putchar('\n');
-
     int         i, j;
     time_t      currtime = time(NULL);
 	unsigned long pid = (unsigned long) getpid();
@@ -221,6 +346,15 @@ int main(int argc, char **argv) {
     double      lo_t = 0.0, hi_t = 1e7;        // t bounds
     int         nThreads = 0;     // total number of threads
     int         doSing=0;  // nonzero means use singleton site patterns
+    int         crn=0;     // nonzero means use common random numbers
+    int         exact=0;   // nonzero means calculate without simulation
+    int         tailK=0;   // see GPTree_setTailK
+    int         antithetic=0; // nonzero means use antithetic pairs
+    int         qmc=0;     // nonzero means use quasi-Monte Carlo
+    int         cv=0;      // nonzero means use control variates
+    double      minEss=0.0; // >0 means reweight a bank of genealogies
+    int         incremental=0; // nonzero means reuse unchanged segments
+    int         fold=0;    // nonzero means population site patterns
     int         status, optndx;
     long        simreps = 1000000;
     char        lgofname[200] = { '\0' };
@@ -239,26 +373,21 @@ int main(int argc, char **argv) {
     int         verbose = 0;
     SimSched    *simSched = SimSched_new();
 
-#if defined(__DATE__) && defined(__TIME__)
-    printf("# Program was compiled: %s %s\n", __DATE__, __TIME__);
-#endif
-    printf("# Program was run: %s\n", ctime(&currtime));
+    // getopt may permute argv, so keep the original order.
+    char       *cmd[argc + 1];
+    memcpy(cmd, argv, (argc + 1) * sizeof(cmd[0]));
 
-    printf("# cmd:");
-    for(i = 0; i < argc; ++i)
-        printf(" %s", argv[i]);
-    putchar('\n');
-    fflush(stdout);
-
-	rngseed = currtime^pid;
+    // Seed of random number generator. All random numbers used in
+    // simulations come from streams keyed by this seed.
+	unsigned long rngseed = currtime^pid;
 
     // command line arguments
     for(;;) {
 #if COST==KL_COST || COST==LNL_COST
-        i = getopt_long(argc, argv, "t:F:p:s:S:a:vx:1h",
+        i = getopt_long(argc, argv, "t:F:p:s:S:a:vx:1ACDeI:PQR:Vh",
                         myopts, &optndx);
 #else
-        i = getopt_long(argc, argv, "t:F:p:s:S:a:vx:u:n:1h",
+        i = getopt_long(argc, argv, "t:F:p:s:S:a:vx:u:n:1ACDeI:PQR:Vh",
                         myopts, &optndx);
 #endif
         if(i == -1)
@@ -322,6 +451,43 @@ int main(int argc, char **argv) {
         case '1':
             doSing=1;
             break;
+        case 'A':
+            antithetic=1;
+            break;
+        case 'C':
+            crn=1;
+            break;
+        case 'Q':
+            qmc=1;
+            break;
+        case 'V':
+            cv=1;
+            break;
+        case 'I':
+            minEss = strtod(optarg, NULL);
+            if(minEss <= 0.0 || minEss > 1.0) {
+                fprintf(stderr, "%s:%d: -I argument must be in (0, 1]\n",
+                        __FILE__,__LINE__);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'D':
+            incremental=1;
+            break;
+        case 'P':
+            fold=1;
+            break;
+        case 'e':
+            exact=1;
+            break;
+        case 'R':
+            tailK = strtol(optarg, NULL, 10);
+            if(tailK < 0 || tailK > POPNODE_MAXTAIL) {
+                fprintf(stderr, "%s:%d: -R argument must be in [0, %d]\n",
+                        __FILE__,__LINE__, POPNODE_MAXTAIL);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
             usage();
             break;
@@ -354,6 +520,30 @@ int main(int argc, char **argv) {
     snprintf(patfname, sizeof(patfname), "%s", argv[optind+1]);
     assert(patfname[0] != '\0');
 
+    // Samples must fit in a tipId_t. This precedes all output,
+    // because a wider build may replace this process.
+    {
+        FILE       *fp = efopen(lgofname, "r");
+        tipIdDispatch(countSamples(fp), cmd);
+        fclose(fp);
+    }
+
+    printf("########################################\n"
+           "# legofit: estimate population history #\n"
+           "########################################\n");
+    putchar('\n');
+
+#if defined(__DATE__) && defined(__TIME__)
+    printf("# Program was compiled: %s %s\n", __DATE__, __TIME__);
+#endif
+    printf("# Program was run: %s\n", ctime(&currtime));
+
+    printf("# cmd:");
+    for(i = 0; i < argc; ++i)
+        printf(" %s", cmd[i]);
+    putchar('\n');
+    fflush(stdout);
+
     // Default simulation schedule.
     // Stage 1: 200 DE generations of 1000 simulation replicates
     // Stage 2: 100 generations of 10000 replicates
@@ -373,6 +563,8 @@ int main(int argc, char **argv) {
     };
 
     GPTree *gptree = GPTree_new(lgofname, bnd);
+    GPTree_setTailK(gptree, tailK);
+    GPTree_setFold(gptree, fold);
 	LblNdx lblndx  = GPTree_getLblNdx(gptree);
 
     int dim = GPTree_nFree(gptree); // number of free parameters
@@ -382,11 +574,42 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if(qmc && antithetic) {
+        fprintf(stderr,"%s:%d: -Q and -A are incompatible\n",
+                __FILE__,__LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    if(incremental && (!crn || antithetic || qmc || cv)) {
+        fprintf(stderr,"%s:%d: -D requires -C and is incompatible"
+                " with -A, -Q, and -V\n", __FILE__,__LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    if(minEss > 0.0 && (incremental || antithetic || qmc || cv || exact)) {
+        fprintf(stderr,"%s:%d: -I is incompatible"
+                " with -D, -A, -Q, -V, and -e\n", __FILE__,__LINE__);
+        exit(EXIT_FAILURE);
+    }
+
     if(nThreads == 0)
         nThreads = ceil(0.75*getNumCores());
     if(nThreads > dim*ptsPerDim)
         nThreads = dim*ptsPerDim;
 
+    // Bank of simulated genealogies, shared by all threads.
+    TreeBank *bank = NULL;
+    if(minEss > 0.0) {
+        int nseg = GPTree_nseg(gptree);
+        double twoN[nseg], mix[nseg], start[nseg];
+        if(GPTree_segPars(gptree, nseg, twoN, mix, start)) {
+            fprintf(stderr,"%s:%d: -I can't be used with Gaussian"
+                    " parameters or with -R.\n", __FILE__,__LINE__);
+            exit(EXIT_FAILURE);
+        }
+        bank = TreeBank_new(minEss, nThreads);
+    }
+
     printf("# DE strategy        : %d\n", strategy);
     printf("#    maxFlat         : %d\n", maxFlat);
     printf("#    F               : %lf\n", F);
@@ -401,6 +624,18 @@ int main(int argc, char **argv) {
 #endif
     printf("# %s singleton site patterns.\n",
            (doSing ? "Including" : "Excluding"));
+    printf("# %s common random numbers.\n", (crn ? "Using" : "Not using"));
+    printf("# %s antithetic pairs.\n", (antithetic ? "Using" : "Not using"));
+    printf("# %s quasi-Monte Carlo.\n", (qmc ? "Using" : "Not using"));
+    printf("# %s control variates.\n", (cv ? "Using" : "Not using"));
+    if(minEss > 0.0)
+        printf("# genealogy bank ESS : %lg\n", minEss);
+    printf("# %s incremental simulation.\n",
+           (incremental ? "Using" : "Not using"));
+    printf("# Site patterns of %s.\n", (fold ? "populations" : "samples"));
+    printf("# %s branch lengths.\n", (exact ? "Exact" : "Simulated"));
+    if(tailK)
+        printf("# root tail lineages : %d\n", tailK);
 #if COST==KL_COST
     printf("# cost function      : %s\n", "KL");
 #elif COST==LNL_COST
@@ -438,12 +673,37 @@ int main(int argc, char **argv) {
     BranchTab_normalize(obs);
 #endif
 
+    if(exact) {
+        BranchTab *tst = exactprob(gptree, 1, doSing);
+        if(tst == NULL) {
+            fprintf(stderr,"%s:%d: Model in \"%s\" is too large for exact\n"
+                    "    calculation (-e or --exact) or has Gaussian"
+                    " parameters.\n", __FILE__,__LINE__, lgofname);
+            exit(EXIT_FAILURE);
+        }
+        BranchTab_free(tst);
+    }
+
+    // Each thread of diffev copies its own GPTree from thrTree once,
+    // and reuses it, along with random number generators and tables,
+    // in every evaluation of costFun. See SimState_patprob.
+    GPTree *thrTree = GPTree_dup(gptree);
+
     // parameters for cost function
     CostPar costPar = {
         .obs = obs,
         .gptree = gptree,
         .nThreads = nThreads,
         .doSing = doSing,
+        .seed = rngseed,
+        .crn = crn,
+        .antithetic = antithetic,
+        .qmc = qmc,
+        .cv = cv,
+        .exact = exact,
+        .bank = bank,
+        .incremental = incremental,
+        .cache = NULL,
 #if COST!=KL_COST && COST!=LNL_COST
         .u = u,
         .nnuc = nnuc,
@@ -467,9 +727,9 @@ int main(int argc, char **argv) {
         .JobData_dup = CostPar_dup,
         .JobData_free = CostPar_free,
         .objfun = costFun,
-		.threadData = NULL,
-		.ThreadState_new = ThreadState_new,
-		.ThreadState_free = ThreadState_free,
+		.threadData = thrTree,
+		.ThreadState_new = SimState_new,
+		.ThreadState_free = SimState_free,
         .initData = gptree,
         .initialize = initStateVec,
         .simSched = simSched
@@ -478,9 +738,8 @@ int main(int argc, char **argv) {
     double      estimate[dim];
     double      cost, yspread;
 
-    gsl_rng    *rng = gsl_rng_alloc(gsl_rng_taus);
+    gsl_rng    *rng = gsl_rng_alloc(rng_xoshiro256pp);
     gsl_rng_set(rng, rngseed);
-	rngseed = (rngseed == ULONG_MAX ? 0 : rngseed+1);
 
     printf("Initial parameter values\n");
 	GPTree_printParStore(gptree, stdout);
@@ -490,13 +749,24 @@ int main(int argc, char **argv) {
     fflush(stdout);
 
     status = diffev(dim, estimate, &cost, &yspread, dep, rng);
+    GPTree_free(thrTree);
 
     printf("DiffEv %s. cost=%0.5lg; spread=%0.5lg\n",
            status==0 ? "converged" : "FAILED", cost, yspread);
 
     // Get mean site pattern branch lengths
     GPTree_setParams(gptree, dim, estimate);
-    BranchTab *bt = patprob(gptree, simreps, doSing, rng);
+    // costFun keys its streams by stage number, which is never 0, so
+    // stream 0 is free for the final simulation.
+    BranchTab *bt = NULL;
+    if(exact) {
+        bt = exactprob(gptree, simreps, doSing);
+        if(bt == NULL)
+            eprintf("%s:%s:%d: exact calculation failed at estimate\n",
+                    __FILE__, __func__, __LINE__);
+    } else
+        bt = patprob(gptree, simreps, doSing, nThreads,
+                     FastRng_streamSeed(rngseed, 0), 0, antithetic, qmc, cv);
     BranchTab_divideBy(bt, (double) simreps);
     //    BranchTab_print(bt, stdout);
 
@@ -519,9 +789,9 @@ int main(int argc, char **argv) {
     orderpat(npat, ord, pat);
 
     printf("#%14s %10s\n", "SitePat", "BranchLen");
-    char        buff[100];
+    char        buff[MAXSAMP * POPNAMESIZE];
     for(j = 0; j < npat; ++j) {
-        char        buff2[100];
+        char        buff2[MAXSAMP * POPNAMESIZE];
         snprintf(buff2, sizeof(buff2), "%s",
                  patLbl(sizeof(buff), buff, pat[ord[j]], &lblndx));
         printf("%15s %10.7lf\n", buff2, brlen[ord[j]]);
@@ -532,6 +802,8 @@ int main(int argc, char **argv) {
     GPTree_sanityCheck(gptree, __FILE__, __LINE__);
     GPTree_free(gptree);
     SimSched_free(simSched);
+    if(bank)
+        TreeBank_free(bank);
     fprintf(stderr,"legofit is finished\n");
 
     return 0;
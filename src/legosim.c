@@ -11,6 +11,20 @@
           number of iterations in simulation
        -1 or --singletons
           Use singleton site patterns
+       -e or --exact
+          calculate expected branch lengths exactly, without simulation
+       -R <k> or --raoBlackwell <k>
+          use expected branch lengths once root has <= k lineages
+       -A or --antithetic
+          simulate antithetic pairs of replicates
+       -Q <r> or --qmc <r>
+          quasi-Monte Carlo, averaging <r> independent randomizations
+       -V or --controlVariates
+          adjust simulated branch lengths using control variates
+       -P or --popPatterns
+          site patterns of populations rather than samples
+       -t <x> or --threads <x>
+          number of threads (default is auto)
        -U <x>
           Mutations per generation per haploid genome.
        -h or --help
@@ -82,6 +96,66 @@ independent, ignoring linkage disequilibrium. The counts it provides
 are correct in expectation, but their variances in repeated runs of
 the program are probably too small.
 
+With the `-e` option, legosim calculates expected branch lengths
+exactly rather than estimating them by simulation, and the `-i` option
+is ignored. This works only for models without Gaussian parameters and
+with small samples, because the number of states that must be tracked
+grows rapidly with the number of samples. If the model is too large,
+legosim aborts with an error message.
+
+The `-R` option reduces Monte Carlo noise. Once the root population
+contains no more than `k` lineages, the expected lengths of all
+remaining branches are known exactly, given those lineages. With `-R
+k`, legosim adds these expectations in place of simulated branch
+lengths. The expected values are unchanged, but their variance is
+smaller, so fewer replicates are needed for a given precision. The
+cost per replicate grows as @f$2^k@f$, so `k` should be small. It may
+not exceed POPNODE_MAXTAIL.
+
+The `-A` option simulates replicates in antithetic pairs. The second
+replicate of each pair uses the complement, @f$1-u@f$, of each uniform
+random number @f$u@f$ used by the first. Waiting times are then
+negatively correlated within pairs, which reduces the variance of the
+average. In this mode, exponential random variates are generated by
+inversion, which is a little slower than the default method.
+
+The `-Q r` option uses randomized quasi-Monte Carlo. In each
+replicate, the first few uniform random numbers, which determine the
+earliest waiting times and admixture decisions, are replaced by the
+coordinates of a point in a scrambled Sobol sequence. Such points are
+spread more evenly than independent random points, so averages
+converge faster. The replicates are divided into `r` groups, each of
+which uses an independently scrambled sequence, and the output
+includes a column of standard errors calculated from the variation
+among groups. The number of replicates per group is best a power of
+2.
+
+The `-V` option adjusts each simulated branch length using control
+variates. For each pair of samples, each replicate records the length
+of the branches that separate them, whose expected value is known
+exactly. Each site pattern's estimate is then corrected by regression
+on the difference between the simulated and expected values of these
+controls, which reduces its variance. The correction introduces a
+bias of order 1/nreps, which is negligible with many replicates. It
+has no effect in models with Gaussian parameters.
+
+The `-P` option matters only when some segment has more than one
+sample. By default, each sample is a separate element of a site
+pattern, so "x.0:y" and "x.1:y" are different patterns, and their
+number grows rapidly with the number of samples. With `-P`, site
+patterns refer instead to populations, as in the output of @ref
+tabpat "tabpat". Pattern "x:y" is then the pattern in a subsample
+consisting of one haploid genome from each population, averaged over
+all such subsamples. As each branch is tabulated, its length is divided
+among population-level patterns. If k of the n samples from a
+population descend from the branch, that population carries the
+derived allele with probability k/n. The control variates of `-V`
+refer to pairs of samples, so `-V` has no effect in this mode.
+
+By default, the replicates are divided among threads, which run in
+parallel. The default number of threads is three quarters of the number
+of cores. Use the `-t` option to change this.
+
 @copyright Copyright (c) 2015, 2016, Alan R. Rogers
 <rogers@anthro.utah.edu>. This file is released under the Internet
 Systems Consortium License, which can be found in file "LICENSE".
@@ -90,22 +164,24 @@ Systems Consortium License, which can be found in file "LICENSE".
 #include "gptree.h"
 #include "patprob.h"
 #include "parstore.h"
+#include "popnode.h"
 #include "lblndx.h"
+#include "parse.h"
 #include "branchtab.h"
+#include "fastrng.h"
 #include <assert.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
 #include <limits.h>
+#include <math.h>
 #include <gsl/gsl_rng.h>
 #include <gsl/gsl_randist.h>
 
-extern pthread_mutex_t seedLock;
-extern unsigned long rngseed;
-
 void        usage(void);
 
 void usage(void) {
@@ -113,6 +189,17 @@ void usage(void) {
     fprintf(stderr, "   where options may include:\n");
     tellopt("-i <x> or --nItr <x>", "number of iterations in simulation");
 	tellopt("-1 or --singletons", "Use singleton site patterns");
+    tellopt("-e or --exact", "calculate branch lengths exactly");
+    tellopt("-R <k> or --raoBlackwell <k>",
+            "use expected branch lengths once root has <= k lineages");
+    tellopt("-A or --antithetic", "simulate antithetic pairs of replicates");
+    tellopt("-Q <r> or --qmc <r>",
+            "quasi-Monte Carlo, averaging <r> independent randomizations");
+    tellopt("-V or --controlVariates",
+            "adjust simulated branch lengths using control variates");
+    tellopt("-P or --popPatterns",
+            "site patterns of populations rather than samples");
+    tellopt("-t <x> or --threads <x>", "number of threads (default is auto)");
     tellopt("-U <x>", "Mutations per generation per haploid genome.");
     tellopt("-h or --help", "print this message");
     exit(1);
@@ -125,17 +212,25 @@ int main(int argc, char **argv) {
         {"nItr", required_argument, 0, 'i'},
         {"mutations", required_argument, 0, 'U'},
         {"singletons", no_argument, 0, '1'},
+        {"exact", no_argument, 0, 'e'},
+        {"raoBlackwell", required_argument, 0, 'R'},
+        {"antithetic", no_argument, 0, 'A'},
+        {"qmc", required_argument, 0, 'Q'},
+        {"controlVariates", no_argument, 0, 'V'},
+        {"popPatterns", no_argument, 0, 'P'},
+        {"threads", required_argument, 0, 't'},
         {"help", no_argument, 0, 'h'},
         {NULL, 0, NULL, 0}
     };
 
-    printf("############################################################\n"
-           "# legosim: generate site patterns by coalescent simulation #\n"
-           "############################################################\n");
-    putchar('\n');
-
     int         i, j;
     int         doSing=0;  // nonzero => use singleton site patterns
+    int         exact=0;   // nonzero => calculate without simulation
+    int         tailK=0;   // see GPTree_setTailK
+    int         antithetic=0; // nonzero => antithetic pairs
+    int         nScramble=0;  // >0 => quasi-Monte Carlo
+    int         cv=0;         // nonzero => control variates
+    int         fold=0;       // nonzero => population site patterns
     time_t      currtime = time(NULL);
 	unsigned long pid = (unsigned long) getpid();
     double      lo_twoN = 1.0, hi_twoN = 1e6;  // twoN bounds
@@ -143,20 +238,16 @@ int main(int argc, char **argv) {
     double      U=0.0;          // mutations pre gen per haploid genome
     int         optndx;
     long        nreps = 100;
+    int         nThreads = 0;   // total number of threads
     char        fname[200] = { '\0' };
-#if defined(__DATE__) && defined(__TIME__)
-    printf("# Program was compiled: %s %s\n", __DATE__, __TIME__);
-#endif
-    printf("# Program was run: %s\n", ctime(&currtime));
 
-    printf("# cmd:");
-    for(i = 0; i < argc; ++i)
-        printf(" %s", argv[i]);
-    putchar('\n');
+    // getopt may permute argv, so keep the original order.
+    char       *cmd[argc + 1];
+    memcpy(cmd, argv, (argc + 1) * sizeof(cmd[0]));
 
     // command line arguments
     for(;;) {
-        i = getopt_long(argc, argv, "i:t:U:1h", myopts, &optndx);
+        i = getopt_long(argc, argv, "Aei:PQ:R:t:U:V1h", myopts, &optndx);
         if(i == -1)
             break;
         switch (i) {
@@ -164,12 +255,38 @@ int main(int argc, char **argv) {
         case '?':
             usage();
             break;
+        case 'A':
+            antithetic = 1;
+            break;
+        case 'e':
+            exact = 1;
+            break;
+        case 'P':
+            fold = 1;
+            break;
+        case 'Q':
+            nScramble = strtol(optarg, NULL, 10);
+            break;
         case 'i':
             nreps = strtol(optarg, 0, 10);
             break;
+        case 'R':
+            tailK = strtol(optarg, NULL, 10);
+            if(tailK < 0 || tailK > POPNODE_MAXTAIL) {
+                fprintf(stderr, "%s: -R argument must be in [0, %d]\n",
+                        argv[0], POPNODE_MAXTAIL);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            nThreads = strtol(optarg, NULL, 10);
+            break;
         case 'U':
             U = strtod(optarg,NULL);
             break;
+        case 'V':
+            cv = 1;
+            break;
         case '1':
             doSing=1;
             break;
@@ -194,8 +311,57 @@ int main(int argc, char **argv) {
     }
     assert(fname[0] != '\0');
 
-    printf("# nreps                       : %lu\n", nreps);
+    if(nThreads == 0)
+        nThreads = ceil(0.75*getNumCores());
+
+    if(nScramble < 0 || nScramble > nreps) {
+        fprintf(stderr, "%s: -Q argument must be in [1, nreps]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if(nScramble && antithetic) {
+        fprintf(stderr, "%s: -Q and -A are incompatible\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Samples must fit in a tipId_t. This precedes all output,
+    // because a wider build may replace this process.
+    {
+        FILE       *fp = efopen(fname, "r");
+        tipIdDispatch(countSamples(fp), cmd);
+        fclose(fp);
+    }
+
+    printf("############################################################\n"
+           "# legosim: generate site patterns by coalescent simulation #\n"
+           "############################################################\n");
+    putchar('\n');
+
+#if defined(__DATE__) && defined(__TIME__)
+    printf("# Program was compiled: %s %s\n", __DATE__, __TIME__);
+#endif
+    printf("# Program was run: %s\n", ctime(&currtime));
+
+    printf("# cmd:");
+    for(i = 0; i < argc; ++i)
+        printf(" %s", cmd[i]);
+    putchar('\n');
+
+    if(exact)
+        printf("# exact branch lengths; no simulation\n");
+    else
+        printf("# nreps                       : %lu\n", nreps);
+    printf("# nthreads                    : %d\n", nThreads);
     printf("# input file                  : %s\n", fname);
+    if(tailK)
+        printf("# expected root branches at k : %d\n", tailK);
+    if(antithetic)
+        printf("# using antithetic pairs of replicates\n");
+    if(nScramble)
+        printf("# QMC randomizations          : %d\n", nScramble);
+    if(cv)
+        printf("# using control variates\n");
+    if(fold)
+        printf("# site patterns of populations\n");
     if(U)
         printf("# mutations per haploid genome: %lf\n", U);
     else
@@ -211,20 +377,57 @@ int main(int argc, char **argv) {
             .hi_t = hi_t
     };
     GPTree *gptree = GPTree_new(fname, bnd);
+    GPTree_setTailK(gptree, tailK);
+    GPTree_setFold(gptree, fold);
 	LblNdx lblndx = GPTree_getLblNdx(gptree);
 
     int dim = GPTree_nFree(gptree);
     double x[dim];
     GPTree_getParams(gptree, dim, x);
 
-    // No need to lock rngseed, because only 1 thread is running.
-	rngseed = currtime^pid;
-    gsl_rng  *rng = gsl_rng_alloc(gsl_rng_taus);
+	unsigned long rngseed = currtime^pid;
+    gsl_rng  *rng = gsl_rng_alloc(rng_xoshiro256pp);
     gsl_rng_set(rng, rngseed);
-	rngseed = (rngseed == ULONG_MAX ? 0 : rngseed+1);
 
-    BranchTab *bt = patprob(gptree, nreps, doSing, rng);
-    BranchTab_divideBy(bt, (double) nreps);
+    // The master generator is used only for mutations. Simulations use
+    // streams keyed by rngseed.
+    BranchTab *bt, *btsq = NULL;
+    if(exact) {
+        bt = exactprob(gptree, nreps, doSing);
+        if(bt == NULL) {
+            fprintf(stderr, "%s: model is too large for exact calculation"
+                    " or has Gaussian parameters\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        BranchTab_divideBy(bt, (double) nreps);
+    } else if(nScramble) {
+        // Average over independent randomizations, and accumulate
+        // the squares of their means in btsq.
+        long nper = nreps / nScramble;
+        bt = BranchTab_newDense(LblNdx_size(&lblndx));
+        btsq = BranchTab_newDense(LblNdx_size(&lblndx));
+        for(i = 0; i < nScramble; ++i) {
+            BranchTab *b = patprob(gptree, nper, doSing, nThreads,
+                                   FastRng_streamSeed(rngseed, i + 1),
+                                   0, 0, 1, cv);
+            BranchTab_divideBy(b, (double) nper);
+            unsigned n = BranchTab_size(b);
+            tipId_t key[n];
+            double val[n], sq[n];
+            BranchTab_toArrays(b, n, key, val, sq);
+            for(j = 0; j < n; ++j) {
+                BranchTab_add(bt, key[j], val[j]);
+                BranchTab_add(btsq, key[j], val[j] * val[j]);
+            }
+            BranchTab_free(b);
+        }
+        BranchTab_divideBy(bt, (double) nScramble);
+        BranchTab_divideBy(btsq, (double) nScramble);
+    } else {
+        bt = patprob(gptree, nreps, doSing, nThreads,
+                     FastRng_streamSeed(rngseed, 0), 0, antithetic, 0, cv);
+        BranchTab_divideBy(bt, (double) nreps);
+    }
     //BranchTab_print(bt, stdout);
 
     // Put site patterns and branch lengths into arrays.
@@ -241,17 +444,25 @@ int main(int argc, char **argv) {
 
     if(U)
         printf("#%14s %15s\n", "SitePat", "Count");
+    else if(nScramble > 1)
+        printf("#%14s %15s %15s\n", "SitePat", "E[BranchLength]",
+               "StdErr");
     else
         printf("#%14s %15s\n", "SitePat", "E[BranchLength]");
-    char        buff[100];
+    char        buff[MAXSAMP * POPNAMESIZE];
     for(j = 0; j < npat; ++j) {
-        char        buff2[100];
+        char        buff2[MAXSAMP * POPNAMESIZE];
         snprintf(buff2, sizeof(buff2), "%s",
                  patLbl(sizeof(buff), buff, pat[ord[j]], &lblndx));
         if(U) {
             unsigned mutations;
             mutations = gsl_ran_poisson(rng, U*prob[ord[j]]);
             printf("%15s %15u\n", buff2, mutations);
+        }else if(nScramble > 1) {
+            double v = BranchTab_get(btsq, pat[ord[j]])
+                - prob[ord[j]] * prob[ord[j]];
+            printf("%15s %15.7lf %15.7lf\n", buff2, prob[ord[j]],
+                   sqrt(fmax(v, 0.0) / (nScramble - 1)));
         }else
             printf("%15s %15.7lf\n", buff2, prob[ord[j]]);
     }
@@ -131,6 +131,53 @@ FILE *efopen(const char *restrict name, const char *restrict mode) {
     return fp;
 }
 
+/// Make sure that tipId_t is wide enough for nsamples samples. Each
+/// program that uses tipId_t is built for tipIds of 32, 64, and 128
+/// bits (see typedefs.h). The 32-bit build has the plain name, such
+/// as "legosim", and the others add the width, as in "legosim64". If
+/// nsamples exceeds the width of the current build, replace the
+/// current process with the narrowest build that is wide enough,
+/// passing the same arguments. It is sought in the directory named in
+/// argv[0] or, if argv[0] contains no '/', in PATH. This should be
+/// called before any output is written. Returns only if the current
+/// build is wide enough.
+void tipIdDispatch(int nsamples, char **argv) {
+    static const int width[] = {32, 64, 128};
+    const int   nwidth = sizeof(width) / sizeof(width[0]);
+    int         i;
+    char        path[FILENAMESIZE], suffix[10];
+    size_t      len = strlen(argv[0]);
+
+    if(nsamples <= TIPID_SIZE)
+        return;
+    for(i = 0; i < nwidth && width[i] < nsamples; ++i)
+        ;
+    if(i == nwidth)
+        eprintf("%s:%s:%d: %d samples is too many: max is %d",
+                __FILE__, __func__, __LINE__, nsamples, width[nwidth - 1]);
+
+    // Strip the width of the current build from the program name.
+    if(TIPID_SIZE != 32) {
+        snprintf(suffix, sizeof suffix, "%d", TIPID_SIZE);
+        if(len > strlen(suffix)
+           && 0 == strcmp(argv[0] + len - strlen(suffix), suffix))
+            len -= strlen(suffix);
+    }
+    if(len + 4 > sizeof path)
+        eprintf("%s:%s:%d: program name is too long",
+                __FILE__, __func__, __LINE__);
+    snprintf(path, sizeof path, "%.*s%d", (int) len, argv[0], width[i]);
+
+    fflush(stdout);
+    argv[0] = path;
+    if(strchr(path, '/'))
+        execv(path, argv);
+    else
+        execvp(path, argv);
+    eprintf("%s:%s:%d: %d samples require %s, which can't be run:",
+            __FILE__, __func__, __LINE__, nsamples, path);
+}
+
 
 /**
  * Uniform perturbation on log scale. Log10 of new value in range
@@ -21,6 +21,7 @@ long double perturb_interval(long double x, long double lo, long double hi,
                              gsl_rng * rng);
 void        eprintf(const char *fmt, ...);
 FILE       *efopen(const char *restrict name, const char *restrict mode);
+void        tipIdDispatch(int nsamples, char **argv);
 void        printBranchTab(double tab[3][3], FILE * fp);
 void        unitTstResult(const char *facility, const char *result);
 void        tellopt(const char *opt, const char *description);
@@ -264,27 +264,20 @@ void		parseParam(char *next, enum ParamType type,
     }
 }
 
-/// Parse a line describing a segment of the population tree
-/// @param[inout] next pointer to unparsed portion of input line
-/// @param[inout] poptbl associates names of segments
-/// with pointers to them.
-/// @param[inout] sndx associates the index of each
-/// sample with the PopNode object to which it belongs.
-/// @param[inout] lndx associated index of each sample with its name
-/// @param[out] parstore structure that maintains info about
-/// parameters
-/// @param[inout] ns allocates PopNode objects
-void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
-				  LblNdx *lndx, ParStore *parstore, NodeStore *ns,
-                       const char *orig) {
-    char *popName, *tok;
-    double *tPtr, *twoNptr;
-	ParamStatus tstat, twoNstat;
-    unsigned long nsamples=0;
+/// Split the unparsed portion of a "segment" statement into the
+/// segment's name, the names of its t and twoN parameters, and its
+/// number of samples, which is 0 if omitted. Tokens point into
+/// next. Abort with a message if the statement is malformed.
+static void segmentTokens(char *next, const char *orig, char **popName,
+                          char **tName, char **twoNName,
+                          unsigned long *nsamples) {
+    char *tok;
+
+    *nsamples = 0;
 
     // Read name of segment
-    popName = nextWhitesepToken(&next);
-    CHECK_TOKEN(popName, orig);
+    *popName = nextWhitesepToken(&next);
+    CHECK_TOKEN(*popName, orig);
 
     // Read t
     tok = strsep(&next, "=");
@@ -296,15 +289,8 @@ void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
         fprintf(stderr,"input: %s", orig);
         exit(EXIT_FAILURE);
     }
-    tok = nextWhitesepToken(&next);
-    CHECK_TOKEN(tok, orig);
-    tPtr = ParStore_findPtr(parstore, &tstat, tok);
-	if(NULL == tPtr) {
-		fprintf(stderr,"%s:%s:%d: Parameter \"%s\" is undefined\n",
-				__FILE__,__func__,__LINE__,tok);
-        fprintf(stderr,"input: %s", orig);
-        exit(EXIT_FAILURE);
-    }
+    *tName = nextWhitesepToken(&next);
+    CHECK_TOKEN(*tName, orig);
 
     // Read twoN
     tok = strsep(&next, "=");
@@ -318,14 +304,7 @@ void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
     }
     tok = nextWhitesepToken(&next);
     CHECK_TOKEN(tok, orig);
-    tok = stripWhiteSpace(tok);
-    twoNptr = ParStore_findPtr(parstore, &twoNstat, tok);
-	if(NULL == twoNptr) {
-		fprintf(stderr,"%s:%s:%dParameter \"%s\" is undefined\n",
-				__FILE__,__func__,__LINE__, tok);
-        fprintf(stderr,"input: %s", orig);
-        exit(EXIT_FAILURE);
-    }
+    *twoNName = stripWhiteSpace(tok);
 
     // Read (optional) number of samples
     if(next) {
@@ -338,20 +317,12 @@ void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
             fprintf(stderr,"input: %s", orig);
             exit(EXIT_FAILURE);
         }
-        if(getULong(&nsamples, &next, orig)) {
+        if(getULong(nsamples, &next, orig)) {
             fprintf(stderr, "%s:%s:%d: Can't parse unsigned int."
                     " Expecting value of \"samples\"\n",
                     __FILE__,__func__,__LINE__);
             fprintf(stderr,"input: %s", orig);
             exit(EXIT_FAILURE);
-        }else {
-            if(nsamples > MAXSAMP) {
-                fprintf(stderr,
-                        "%s:%s:%d: %lu samples is too many: max is %d:\n",
-                         __FILE__,__func__,__LINE__, nsamples, MAXSAMP);
-                fprintf(stderr,"input: %s", orig);
-                exit(EXIT_FAILURE);
-            }
         }
     }
 
@@ -361,10 +332,55 @@ void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
         fprintf(stderr,"input: %s", orig);
         exit(EXIT_FAILURE);
     }
+}
+
+/// Parse a line describing a segment of the population tree
+/// @param[inout] next pointer to unparsed portion of input line
+/// @param[inout] poptbl associates names of segments
+/// with pointers to them.
+/// @param[inout] sndx associates the index of each
+/// sample with the PopNode object to which it belongs.
+/// @param[inout] lndx associated index of each sample with its name
+/// @param[out] parstore structure that maintains info about
+/// parameters
+/// @param[inout] ns allocates PopNode objects
+void parseSegment(char *next, PopNodeTab *poptbl, SampNdx *sndx,
+				  LblNdx *lndx, ParStore *parstore, NodeStore *ns,
+                       const char *orig) {
+    char *popName, *tName, *twoNName;
+    int tNdx, twoNndx;
+	ParamStatus tstat, twoNstat;
+    unsigned long nsamples;
+
+    segmentTokens(next, orig, &popName, &tName, &twoNName, &nsamples);
+
+    tNdx = ParStore_findNdx(parstore, &tstat, tName);
+	if(tNdx < 0) {
+		fprintf(stderr,"%s:%s:%d: Parameter \"%s\" is undefined\n",
+				__FILE__,__func__,__LINE__,tName);
+        fprintf(stderr,"input: %s", orig);
+        exit(EXIT_FAILURE);
+    }
+
+    twoNndx = ParStore_findNdx(parstore, &twoNstat, twoNName);
+	if(twoNndx < 0) {
+		fprintf(stderr,"%s:%s:%dParameter \"%s\" is undefined\n",
+				__FILE__,__func__,__LINE__, twoNName);
+        fprintf(stderr,"input: %s", orig);
+        exit(EXIT_FAILURE);
+    }
+
+    if(nsamples > MAXSAMP) {
+        fprintf(stderr,
+                "%s:%s:%d: %lu samples is too many: max is %d:\n",
+                 __FILE__,__func__,__LINE__, nsamples, MAXSAMP);
+        fprintf(stderr,"input: %s", orig);
+        exit(EXIT_FAILURE);
+    }
 
     assert(strlen(popName) > 0);
-    PopNode *thisNode = PopNode_new(twoNptr, twoNstat==Free,
-                                    tPtr, tstat==Free, ns);
+    PopNode *thisNode = PopNode_new(twoNndx, twoNstat==Free,
+                                    tNdx, tstat==Free, ns);
     if(0 != PopNodeTab_insert(poptbl, popName, thisNode)) {
         fprintf(stderr,"%s:%d: duplicate \"segment %s\"\n",
                  __FILE__,__LINE__, popName);
@@ -438,7 +454,7 @@ void parseDerive(char *next, PopNodeTab *poptbl,
 void parseMix(char *next, PopNodeTab *poptbl, ParStore *parstore,
                        const char *orig) {
     char *childName, *parName[2], *tok;
-    double *mPtr;
+    int mNdx;
 	ParamStatus mstat;
 
     // Read name of child
@@ -460,12 +476,12 @@ void parseMix(char *next, PopNodeTab *poptbl, ParStore *parstore,
     CHECK_TOKEN(parName[0], orig);
     parName[0] = stripWhiteSpace(parName[0]);
 
-    // Read mixture fraction, mPtr
+    // Read mixture fraction, mNdx
     tok = strsep(&next, "*");
     CHECK_TOKEN(tok, orig);
     tok = stripWhiteSpace(tok);
-    mPtr = ParStore_findPtr(parstore, &mstat, tok);
-	if(NULL == mPtr) {
+    mNdx = ParStore_findNdx(parstore, &mstat, tok);
+	if(mNdx < 0) {
 		fprintf(stderr,"%s:%s:%d: Parameter \"%s\" is undefined\n",
 				__FILE__,__func__,__LINE__, tok);
         fprintf(stderr,"input: %s", orig);
@@ -510,7 +526,7 @@ void parseMix(char *next, PopNodeTab *poptbl, ParStore *parstore,
         exit(EXIT_FAILURE);
     }
 
-    PopNode_mix(childNode, mPtr, mstat==Free, parNode1, parNode0);
+    PopNode_mix(childNode, mNdx, mstat==Free, parNode1, parNode0);
 }
 
 // Read a line into buff; strip comments and trailing whitespace.
@@ -610,49 +626,59 @@ PopNode    *mktree(FILE * fp, SampNdx *sndx, LblNdx *lndx, ParStore *parstore,
     }
 
     // Make sure the tree of populations has a single root. This
-    // code iterates through all the nodes in the PopNodeTab, and
-    // searches from each node back to the root. If all is well,
-    // these searches all find the same root. Otherwise, it aborts
-    // with an error.
+    // code iterates through all the nodes in the PopNodeTab, checking
+    // each one and counting those without parents. If all is well,
+    // there is only one. Otherwise, it aborts with an error.
     PopNode *root = PopNodeTab_check_and_root(poptbl, __FILE__, __LINE__);
     PopNodeTab_free(poptbl);
     return root;
 }
 
-/// Count the number of "segment" statements in input file.
-int countSegments(FILE * fp) {
+/// Read the "segment" statements of input file, returning their
+/// number and setting *nsamples to the number of samples they
+/// declare. Statements are split into tokens as in parseSegment.
+static int scanSegments(FILE * fp, int *nsamples) {
     int         nseg=0;
     char        orig[500], buff[500];
     char        *tok, *next;
 
+    *nsamples = 0;
     while(1) {
-        if(fgets(buff, sizeof(buff), fp) == NULL)
+        if(1 == get_one_line(sizeof(buff), buff, fp))
             break;
-        next = buff;
-
-        if(!strchr(buff, '\n') && !feof(fp)) {
-            fprintf(stderr, "ERR@%s:%d: input buffer overflow."
-                    " buff size: %zu\n", __FILE__, __LINE__, sizeof(buff));
-            fprintf(stderr,"input: %s", orig);
-            exit(EXIT_FAILURE);
-        }
-
-        // strip trailing comments
-        char *comment = strchr(buff, '#');
-        if(comment)
-            *comment = '\0';
 
         snprintf(orig, sizeof orig, "%s", buff);
+        next = stripWhiteSpace(buff);
         tok = nextWhitesepToken(&next);
         if(tok==NULL)
             continue;
 
-		if(0 == strcmp(tok, "segment"))
+		if(0 == strcmp(tok, "segment")) {
+            char *popName, *tName, *twoNName;
+            unsigned long n;
             ++nseg;
+            segmentTokens(next, orig, &popName, &tName, &twoNName, &n);
+            *nsamples += n;
+        }
     }
     return nseg;
 }
 
+/// Count the number of "segment" statements in input file.
+int countSegments(FILE * fp) {
+    int         nsamples;
+    return scanSegments(fp, &nsamples);
+}
+
+/// Count the samples declared in the "segment" statements of input
+/// file. Unlike mktree, this doesn't depend on the width of tipId_t,
+/// so it can be used to choose one. See tipIdDispatch.
+int countSamples(FILE * fp) {
+    int         nsamples;
+    scanSegments(fp, &nsamples);
+    return nsamples;
+}
+
 #ifdef TEST
 
 #include <string.h>
@@ -694,6 +720,16 @@ const char *tstInput =
     "derive bb from ab\n"
     "derive ab from abc\n"
     "derive c  from abc\n";
+
+// The word "samples" appears in the name of the first segment, and
+// that segment's time parameter begins with a digit.
+const char *countInput =
+    "time fixed  2T=0\n"
+    "twoN fixed  2N=100\n"
+    "segment samples t=2T twoN=2N\n"
+    "segment x       t=2T twoN=2N samples=3\n"
+    "derive samples from x\n";
+
 int main(int argc, char **argv) {
 
     int verbose=0;
@@ -734,6 +770,18 @@ int main(int argc, char **argv) {
     assert(6 == nseg);
     unitTstResult("countSegments", "OK");
 
+    rewind(fp);
+    assert(3 == countSamples(fp));
+    {
+        FILE *fp2 = tmpfile();
+        assert(fp2);
+        fputs(countInput, fp2);
+        rewind(fp2);
+        assert(3 == countSamples(fp2));
+        fclose(fp2);
+    }
+    unitTstResult("countSamples", "OK");
+
     rewind(fp);
 
     PopNode  nodeVec[nseg];
@@ -747,7 +795,7 @@ int main(int argc, char **argv) {
     }
 
     if(verbose) {
-        PopNode_print(stdout, root, 0);
+        PopNode_print(stdout, root, nodeVec, ParStore_values(parstore), 0);
         unsigned i;
         for(i=0; i < LblNdx_size(&lndx); ++i)
             printf("%2u %s\n", i, LblNdx_lbl(&lndx, i));
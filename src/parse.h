@@ -3,6 +3,7 @@
 
 #include "typedefs.h"
 int         countSegments(FILE * fp);
+int         countSamples(FILE * fp);
 PopNode    *mktree(FILE * fp, SampNdx *sndx, LblNdx *lndx, ParStore *parstore,
                    Bounds *bnd, NodeStore *ns);
 
@@ -11,8 +11,11 @@
  * that value is returned, so that it can be stored in the distributed
  * data structure.
  *
- * In fact, it maintains 3 such vectors: one each for free parameters,
- * fixed parameters, and Gaussian parameters. ParStore knows how to
+ * In fact, it maintains 4 such vectors: one each for free parameters,
+ * fixed parameters, Gaussian parameters, and constrained parameters.
+ * These are stored as consecutive blocks of a single array, so that
+ * each parameter can also be referred to by an integer index, which
+ * remains valid when the ParStore is copied. ParStore knows how to
  * perturb Gaussian parameters by sampling from a truncated Gaussian
  * distribution. Fixed parameters never change. Free ones are manipulated
  * from outside via function calls.
@@ -59,15 +62,18 @@ struct ParStore {
     char       *nameGaussian[MAXPAR];    // Parameter names
     char       *nameConstrained[MAXPAR]; // Parameter names
     ParKeyVal  *pkv;           // linked list of name/ptr pairs
-    double      fixedVal[MAXPAR];   // parameter values
-    double      freeVal[MAXPAR];    // parameter values
-    double      gaussianVal[MAXPAR]; // parameter values
-    double      constrainedVal[MAXPAR]; // parameter values
+    double      val[NPARSTATUS*MAXPAR]; // parameter values; see VALS
     double      mean[MAXPAR];        // Gaussian means
     double      sd[MAXPAR];          // Gaussian standard deviations
-    Constraint *constr[MAXPAR];      // controls constrainedVal entries
+    Constraint *constr[MAXPAR];      // controls constrained values
 };
 
+// Array val holds a block of MAXPAR values for each ParamStatus.
+// VALS(self, pstat) points to the first entry in the block for
+// status pstat. A parameter's index (see ParStore_findNdx) is its
+// offset from the beginning of array val.
+#define VALS(self, pstat) ((self)->val + (pstat)*MAXPAR)
+
 static int compareDblPtrs(const void *void_x, const void *void_y);
 static int compareDbls(const void *void_x, const void *void_y);
 static inline int chrcount(const char *s, char c);
@@ -108,13 +114,13 @@ static int compareDbls(const void *void_x, const void *void_y) {
 /// Set vector of free parameters.
 void ParStore_setFreeParams(ParStore *self, int n, double x[n]) {
     assert(n == self->nFree);
-    memcpy(self->freeVal, x, n*sizeof(double));
+    memcpy(VALS(self, Free), x, n*sizeof(double));
 }
 
 /// Get vector of free parameters.
-void ParStore_getFreeParams(ParStore *self, int n, double x[n]) {
+void ParStore_getFreeParams(const ParStore *self, int n, double x[n]) {
     assert(n == self->nFree);
-    memcpy(x, self->freeVal, n*sizeof(double));
+    memcpy(x, VALS(self, Free), n*sizeof(double));
 }
 
 /// Print a ParStore
@@ -122,7 +128,7 @@ void ParStore_print(ParStore *self, FILE *fp) {
     int i;
     fprintf(fp, "%5d fixed:\n", self->nFixed);
     for(i=0; i < self->nFixed; ++i)
-        fprintf(fp, "   %8s = %lg\n", self->nameFixed[i], self->fixedVal[i]);
+        fprintf(fp, "   %8s = %lg\n", self->nameFixed[i], VALS(self, Fixed)[i]);
     fprintf(fp, "%5d Gaussian:\n", self->nGaussian);
     for(i=0; i < self->nGaussian; ++i)
         fprintf(fp, "   %8s = Gaussian(%lg, %lg)\n", self->nameGaussian[i],
@@ -136,7 +142,7 @@ void ParStore_printFree(ParStore *self, FILE *fp) {
     int i;
     fprintf(fp, "%5d free:\n", self->nFree);
     for(i=0; i < self->nFree; ++i)
-        fprintf(fp, "   %8s = %lg\n", self->nameFree[i], self->freeVal[i]);
+        fprintf(fp, "   %8s = %lg\n", self->nameFree[i], VALS(self, Free)[i]);
 }
 
 /// Print constrained parameter values
@@ -145,7 +151,7 @@ void ParStore_printConstrained(ParStore *self, FILE *fp) {
     fprintf(fp, "%5d constrained:\n", self->nConstrained);
     for(i=0; i < self->nConstrained; ++i) {
         fprintf(fp, "   %8s = %lg = ", self->nameConstrained[i],
-                self->constrainedVal[i]);
+                VALS(self, Constrained)[i]);
         Constraint_prFormula(self->constr[i], fp);
     }
 }
@@ -169,25 +175,25 @@ ParStore   *ParStore_dup(const ParStore * old) {
     for(i = 0; i < new->nFree; ++i) {
         new->nameFree[i] = strdup(old->nameFree[i]);
         new->pkv = ParKeyVal_add(new->pkv, new->nameFree[i],
-                                  new->freeVal + i, Free);
+                                  VALS(new, Free) + i, Free);
     }
 
     for(i = 0; i < new->nFixed; ++i) {
         new->nameFixed[i] = strdup(old->nameFixed[i]);
         new->pkv = ParKeyVal_add(new->pkv, new->nameFixed[i],
-                                  new->fixedVal + i, Fixed);
+                                  VALS(new, Fixed) + i, Fixed);
     }
 
     for(i = 0; i < new->nGaussian; ++i) {
         new->nameGaussian[i] = strdup(old->nameGaussian[i]);
         new->pkv = ParKeyVal_add(new->pkv, new->nameGaussian[i],
-                                  new->gaussianVal + i, Gaussian);
+                                  VALS(new, Gaussian) + i, Gaussian);
     }
 
     for(i = 0; i < new->nConstrained; ++i) {
         new->nameConstrained[i] = strdup(old->nameConstrained[i]);
         new->pkv = ParKeyVal_add(new->pkv, new->nameConstrained[i],
-                                  new->constrainedVal + i, Constrained);
+                                  VALS(new, Constrained) + i, Constrained);
         new->constr[i] = Constraint_dup(old->constr[i], new->pkv);
     }
     ParStore_sanityCheck(new, __FILE__, __LINE__);
@@ -236,14 +242,14 @@ void ParStore_addFreePar(ParStore * self, double value,
         exit(1);
     }
 
-    self->freeVal[i] = value;
+    VALS(self, Free)[i] = value;
     self->loFree[i] = lo;
     self->hiFree[i] = hi;
     self->nameFree[i] = strdup(name);
     CHECKMEM(self->nameFree[i]);
 
     // Linked list associates pointer with parameter name.
-    self->pkv = ParKeyVal_add(self->pkv, name, self->freeVal + i,
+    self->pkv = ParKeyVal_add(self->pkv, name, VALS(self, Free) + i,
 							   Free);
 }
 
@@ -269,13 +275,13 @@ void ParStore_addGaussianPar(ParStore * self, double mean, double sd,
     assert(mean >= 0.0);
     assert(sd >= 0.0);
 
-    self->gaussianVal[i] = self->mean[i] = mean;
+    VALS(self, Gaussian)[i] = self->mean[i] = mean;
     self->sd[i] = sd;
     self->nameGaussian[i] = strdup(name);
     CHECKMEM(self->nameGaussian[i]);
 
     // Linked list associates pointer with parameter name.
-    self->pkv = ParKeyVal_add(self->pkv, name, self->gaussianVal + i,
+    self->pkv = ParKeyVal_add(self->pkv, name, VALS(self, Gaussian) + i,
 							   Gaussian);
 }
 
@@ -295,12 +301,12 @@ void ParStore_addFixedPar(ParStore * self, double value, const char *name) {
                 " Increase MAXPAR and recompile.\n",
                 __FILE__, __func__, __LINE__, self->nFixed, MAXPAR);
 
-    self->fixedVal[i] = value;
+    VALS(self, Fixed)[i] = value;
     self->nameFixed[i] = strdup(name);
     CHECKMEM(self->nameFixed[i]);
 
     // Linked list associates pointer with parameter name.
-    self->pkv = ParKeyVal_add(self->pkv, name, self->fixedVal + i,
+    self->pkv = ParKeyVal_add(self->pkv, name, VALS(self, Fixed) + i,
 		Fixed);
 }
 
@@ -326,10 +332,10 @@ void ParStore_addConstrainedPar(ParStore * self, char *str,
     self->nameConstrained[i] = strdup(name);
     CHECKMEM(self->nameConstrained[i]);
 
-    self->pkv = ParKeyVal_add(self->pkv, name, self->constrainedVal + i,
+    self->pkv = ParKeyVal_add(self->pkv, name, VALS(self, Constrained) + i,
 		Constrained);
     self->constr[i] = Constraint_new(self->pkv, str);
-    self->constrainedVal[i] = Constraint_getValue(self->constr[i]);
+    VALS(self, Constrained)[i] = Constraint_getValue(self->constr[i]);
 }
 
 /// Return the number of fixed parameters
@@ -359,19 +365,19 @@ int ParStore_nConstrained(ParStore * self) {
 /// Get value of i'th fixed parameter
 double ParStore_getFixed(ParStore * self, int i) {
     assert(i < self->nFixed);
-    return self->fixedVal[i];
+    return VALS(self, Fixed)[i];
 }
 
 /// Get value of i'th free parameter
 double ParStore_getFree(ParStore * self, int i) {
     assert(i < self->nFree);
-    return self->freeVal[i];
+    return VALS(self, Free)[i];
 }
 
 /// Get value of i'th Gaussian parameter
 double ParStore_getGaussian(ParStore * self, int i) {
     assert(i < self->nGaussian);
-    return self->gaussianVal[i];
+    return VALS(self, Gaussian)[i];
 }
 
 /// Get name of i'th fixed parameter
@@ -395,7 +401,7 @@ const char *ParStore_getNameGaussian(ParStore * self, int i) {
 /// Set value of i'th free parameter
 void ParStore_setFree(ParStore * self, int i, double value) {
     assert(i < self->nFree);
-    self->freeVal[i] = value;
+    VALS(self, Free)[i] = value;
 }
 
 /// Return low bound of i'th free parameter
@@ -426,6 +432,26 @@ double     *ParStore_findPtr(ParStore * self, ParamStatus *pstat,
     return ParKeyVal_get(self->pkv, pstat, name);
 }
 
+/// Return the index of the parameter with the given name, or -1 if
+/// there is no such parameter. The index is position of the
+/// parameter's value within the array returned by ParStore_values.
+/// Unlike a pointer, it remains valid in copies made by
+/// ParStore_dup.
+int         ParStore_findNdx(ParStore * self, ParamStatus *pstat,
+                             const char *name) {
+    double *ptr = ParKeyVal_get(self->pkv, pstat, name);
+    if(ptr == NULL)
+        return -1;
+    assert(ptr >= self->val && ptr < self->val + NPARSTATUS*MAXPAR);
+    return ptr - self->val;
+}
+
+/// Return pointer to array of all parameter values. The value of the
+/// parameter with index ndx is ParStore_values(self)[ndx].
+double     *ParStore_values(ParStore * self) {
+    return self->val;
+}
+
 void ParStore_sanityCheck(ParStore *self, const char *file, int line) {
 #ifndef NDEBUG
     REQUIRE(self, file, line);
@@ -449,7 +475,7 @@ void ParStore_sanityCheck(ParStore *self, const char *file, int line) {
         ptr = ParKeyVal_get(self->pkv, &pstat, s);
         REQUIRE(ptr != NULL, file, line);
         REQUIRE(pstat == Fixed, file, line);
-        REQUIRE(ptr == self->fixedVal+i, file, line);
+        REQUIRE(ptr == VALS(self, Fixed)+i, file, line);
     }
     for(i=0; i < self->nFree; ++i) {
         s = self->nameFree[i];
@@ -458,7 +484,7 @@ void ParStore_sanityCheck(ParStore *self, const char *file, int line) {
         ptr = ParKeyVal_get(self->pkv, &pstat, s);
         REQUIRE(ptr != NULL, file, line);
         REQUIRE(pstat == Free, file, line);
-        REQUIRE(ptr == self->freeVal+i, file, line);
+        REQUIRE(ptr == VALS(self, Free)+i, file, line);
     }
     for(i=0; i < self->nGaussian; ++i) {
         s = self->nameGaussian[i];
@@ -467,7 +493,7 @@ void ParStore_sanityCheck(ParStore *self, const char *file, int line) {
         ptr = ParKeyVal_get(self->pkv, &pstat, s);
         REQUIRE(ptr != NULL, file, line);
         REQUIRE(pstat == Gaussian, file, line);
-        REQUIRE(ptr == self->gaussianVal+i, file, line);
+        REQUIRE(ptr == VALS(self, Gaussian)+i, file, line);
     }
     for(i=0; i < self->nConstrained; ++i) {
         s = self->nameConstrained[i];
@@ -476,7 +502,7 @@ void ParStore_sanityCheck(ParStore *self, const char *file, int line) {
         ptr = ParKeyVal_get(self->pkv, &pstat, s);
         REQUIRE(ptr != NULL, file, line);
         REQUIRE(pstat == Constrained, file, line);
-        REQUIRE(ptr == self->constrainedVal+i, file, line);
+        REQUIRE(ptr == VALS(self, Constrained)+i, file, line);
     }
     ParKeyVal_sanityCheck(self->pkv, file, line);
 #endif
@@ -494,14 +520,14 @@ int         ParStore_equals(const ParStore *lhs, const ParStore *rhs) {
         return 0;
     if(lhs->nConstrained != rhs->nConstrained)
         return 0;
-    if(0 != memcmp(lhs->fixedVal, rhs->fixedVal,
-                   lhs->nFixed*sizeof(lhs->fixedVal[0])))
+    if(0 != memcmp(VALS(lhs, Fixed), VALS(rhs, Fixed),
+                   lhs->nFixed*sizeof(VALS(lhs, Fixed)[0])))
         return 0;
-    if(0 != memcmp(lhs->freeVal, rhs->freeVal,
-                   lhs->nFree*sizeof(lhs->freeVal[0])))
+    if(0 != memcmp(VALS(lhs, Free), VALS(rhs, Free),
+                   lhs->nFree*sizeof(VALS(lhs, Free)[0])))
         return 0;
-    if(0 != memcmp(lhs->constrainedVal, rhs->constrainedVal,
-                   lhs->nConstrained*sizeof(lhs->constrainedVal[0])))
+    if(0 != memcmp(VALS(lhs, Constrained), VALS(rhs, Constrained),
+                   lhs->nConstrained*sizeof(VALS(lhs, Constrained)[0])))
         return 0;
     if(0 != memcmp(lhs->loFree, rhs->loFree,
                    lhs->nFree*sizeof(lhs->loFree[0])))
@@ -532,52 +558,49 @@ int         ParStore_equals(const ParStore *lhs, const ParStore *rhs) {
 }
 
 /// Set Gaussian parameter by sampling from a truncated Gaussian
-/// distribution. If ptr points to a Gaussian parameter, a new
-/// value of that parameter is drawn from a truncated Gaussian. If the
-/// pointer doesn't point to a Gaussian parameter, then the function
+/// distribution. If ndx refers to a Gaussian parameter, a new
+/// value of that parameter is drawn from a truncated Gaussian. If
+/// ndx doesn't refer to a Gaussian parameter, then the function
 /// returns without doing anything.
 /// @param[inout] self ParStore object to be modified
-/// @param[inout] ptr pointer to parameter to be modified
+/// @param[in] ndx index of parameter to be modified
 /// @param[in] low low end of truncation interval
 /// @param[in] high high end of truncation interval
 /// @param[inout] rng GSL random number generator
-void ParStore_sample(ParStore *self, double *ptr, double low, double high,
+void ParStore_sample(ParStore *self, int ndx, double low, double high,
                     gsl_rng * rng) {
-    // If ptr isn't a Gaussian parameter, then return immediately
-    if(ptr < self->gaussianVal
-       || ptr >= self->gaussianVal + MAXPAR)
+    // If ndx isn't a Gaussian parameter, then return immediately
+    if(ndx < 0 || ndx / MAXPAR != Gaussian)
         return;
 
     // index of Gaussian parameter
-    unsigned i = ptr - self->gaussianVal;
+    int i = ndx % MAXPAR;
     assert(i < self->nGaussian);
 
     // sample from doubly-truncated normal distribution
-    self->gaussianVal[i] = dtnorm(self->mean[i], self->sd[i], low, high, rng);
-    assert(*ptr == self->gaussianVal[i]);
+    VALS(self, Gaussian)[i] = dtnorm(self->mean[i], self->sd[i], low,
+                                     high, rng);
 }
 
-/// If ptr points to a constrained parameter, then set its value.
-void ParStore_constrain_ptr(ParStore *self, double *ptr) {
-    // If ptr isn't a constrained parameter, then return immediately
-    if(ptr < self->constrainedVal
-       || ptr >= self->constrainedVal + MAXPAR)
+/// If ndx refers to a constrained parameter, then set its value.
+void ParStore_constrain_ndx(ParStore *self, int ndx) {
+    // If ndx isn't a constrained parameter, then return immediately
+    if(ndx < 0 || ndx / MAXPAR != Constrained)
         return;
 
     // index of constrained parameter
-    unsigned i = ptr - self->constrainedVal;
+    int i = ndx % MAXPAR;
     assert(i < self->nConstrained);
 
     // set value of constrained parameter
-    self->constrainedVal[i] = Constraint_getValue(self->constr[i]);
-    assert(*ptr == self->constrainedVal[i]);
+    VALS(self, Constrained)[i] = Constraint_getValue(self->constr[i]);
 }
 
 /// Set values of all constrained parameters
 void ParStore_constrain(ParStore *self) {
     int i;
     for(i=0; i < self->nConstrained; ++i)
-        self->constrainedVal[i] = Constraint_getValue(self->constr[i]);
+        VALS(self, Constrained)[i] = Constraint_getValue(self->constr[i]);
 }
 
 /// Make sure Bounds object is sane.
@@ -22,7 +22,7 @@ void        ParStore_addFixedPar(ParStore * self, double value,
 void        ParStore_addConstrainedPar(ParStore * self, char *str,
                                        const char *name);
 void        ParStore_constrain(ParStore *self);
-void        ParStore_constrain_ptr(ParStore *self, double *ptr);
+void        ParStore_constrain_ndx(ParStore *self, int ndx);
 int         ParStore_nFixed(ParStore * self);
 int         ParStore_nFree(ParStore * self);
 int         ParStore_nGaussian(ParStore * self);
@@ -43,6 +43,9 @@ double     *ParStore_loBounds(ParStore * self);
 double     *ParStore_upBounds(ParStore * self);
 double     *ParStore_findPtr(ParStore * self, ParamStatus *pstat,
                              const char *name);
+int         ParStore_findNdx(ParStore * self, ParamStatus *pstat,
+                             const char *name);
+double     *ParStore_values(ParStore * self);
 ParStore   *ParStore_dup(const ParStore * old);
 void        ParStore_sanityCheck(ParStore * self, const char *file, int line);
 void        ParStore_print(ParStore * self, FILE * fp);
@@ -50,8 +53,9 @@ void        ParStore_printFree(ParStore * self, FILE * fp);
 void        ParStore_printConstrained(ParStore * self, FILE * fp);
 int         ParStore_equals(const ParStore * lhs, const ParStore * rhs);
 void        ParStore_setFreeParams(ParStore * self, int n, double x[n]);
-void        ParStore_getFreeParams(ParStore * self, int n, double x[n]);
-void        ParStore_sample(ParStore * self, double *ptr, double low,
+void        ParStore_getFreeParams(const ParStore * self, int n,
+                                   double x[n]);
+void        ParStore_sample(ParStore * self, int ndx, double low,
                             double high, gsl_rng * rng);
 
 void        Bounds_sanityCheck(Bounds * self, const char *file, int line);
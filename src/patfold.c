@@ -0,0 +1,194 @@
+/**
+ * @file patfold.c
+ * @author Alan R. Rogers
+ * @brief Fold site patterns of samples into those of populations.
+ *
+ * When a segment of the .lgo file has several samples, the simulated
+ * site patterns distinguish among them, so the number of patterns
+ * grows as 2 to the number of samples. But tabpat describes each
+ * population by the frequency, p, of the derived allele and counts a
+ * pattern with weight equal to the product, across populations, of p
+ * or 1-p. This is the probability of the pattern in a subsample with
+ * one haploid genome per population.
+ *
+ * A PatFold applies the same rule to a simulated branch. If k of the
+ * n samples of a population descend from the branch, the population
+ * is included with probability k/n. The branch's length is divided
+ * among population-level site patterns in proportion to these
+ * probabilities. Populations with k=0 or k=n contribute a fixed bit,
+ * so a branch is split only among the populations in which it is
+ * polymorphic. The resulting table has no more entries than that
+ * made by tabpat.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "patfold.h"
+#include "binary.h"
+#include "lblndx.h"
+#include "misc.h"
+#include <assert.h>
+#include <string.h>
+
+/// Initialize from an index of samples. Samples from the same
+/// segment are adjacent in sndx, and each run of them becomes a
+/// population.
+void PatFold_init(PatFold * self, const SampNdx * sndx) {
+    unsigned    i;
+
+    memset(self, 0, sizeof(*self));
+    for(i = 0; i < sndx->n; ++i) {
+        if(i == 0 || sndx->node[i] != sndx->node[i - 1])
+            self->npops += 1;
+        self->mask[self->npops - 1] |= ((tipId_t) 1) << i;
+        self->nsamp[self->npops - 1] += 1;
+    }
+    for(i = 0; i < self->npops; ++i)
+        self->inv[i] = 1.0 / self->nsamp[i];
+}
+
+/// Describe the population-level site patterns of a branch ancestral
+/// to the samples in tid. On return, fixed has a bit for each
+/// population all of whose samples descend from the branch. The
+/// function returns m, the number of populations that some but not
+/// all of whose samples descend from the branch. For j=0..m-1, bit[j]
+/// is the bit of one such population, and p[j] is the fraction of
+/// its samples that descend from the branch. Arrays bit and p should
+/// have at least npops entries.
+int PatFold_split(const PatFold * self, tipId_t tid, tipId_t * fixed,
+                  tipId_t bit[], double p[]) {
+    int         i, k, m = 0;
+
+    *fixed = 0;
+    for(i = 0; i < self->npops; ++i) {
+        k = num1bits(tid & self->mask[i]);
+        if(k == 0)
+            continue;
+        if(k == self->nsamp[i])
+            *fixed |= ((tipId_t) 1) << i;
+        else {
+            bit[m] = ((tipId_t) 1) << i;
+            p[m] = k * self->inv[i];
+            ++m;
+        }
+    }
+    return m;
+}
+
+/// Return the population-level site pattern in which all populations
+/// carry the derived allele.
+tipId_t PatFold_full(const PatFold * self) {
+    assert(self->npops > 0);
+    return ~((tipId_t) 0) >> (TIPID_SIZE - self->npops);
+}
+
+/// Return an index of population labels, given one of sample
+/// labels. A population with one sample keeps that sample's label. A
+/// population with several samples, labeled "x.0", "x.1", and so on,
+/// is labeled "x".
+LblNdx PatFold_lblndx(const PatFold * self, const LblNdx * samples) {
+    LblNdx      rval;
+    char        lbl[POPNAMESIZE];
+    int         i, j = 0;
+
+    LblNdx_init(&rval);
+    for(i = 0; i < self->npops; ++i) {
+        snprintf(lbl, sizeof lbl, "%s", LblNdx_lbl(samples, j));
+        if(self->nsamp[i] > 1) {
+            char       *dot = strrchr(lbl, '.');
+            assert(dot && 0 == strcmp(dot, ".0"));
+            *dot = '\0';
+        }
+        LblNdx_addSamples(&rval, 1, lbl);
+        j += self->nsamp[i];
+    }
+    return rval;
+}
+
+/// Return 1 if the two arguments are equal; 0 otherwise.
+int PatFold_equals(const PatFold * lhs, const PatFold * rhs) {
+    int         i;
+
+    if(lhs->npops != rhs->npops)
+        return 0;
+    for(i = 0; i < lhs->npops; ++i)
+        if(lhs->mask[i] != rhs->mask[i])
+            return 0;
+    return 1;
+}
+
+#ifdef TEST
+
+#  include <math.h>
+#  include <stdio.h>
+#  include <stdlib.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+int main(int argc, char **argv) {
+    int         verbose = 0;
+
+    if(argc > 1) {
+        if(argc != 2 || 0 != strcmp(argv[1], "-v")) {
+            fprintf(stderr, "usage: xpatfold [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    // Population A has 1 sample (bit 0); B has 2 (bits 1-2); C has 3
+    // (bits 3-5).
+    SampNdx     sndx = {.n = 6,.node = {4, 2, 2, 7, 7, 7} };
+    LblNdx      lndx;
+    PatFold     pf, pf2;
+    tipId_t     fixed, bit[3];
+    double      p[3];
+    int         m;
+
+    LblNdx_init(&lndx);
+    LblNdx_addSamples(&lndx, 1, "A");
+    LblNdx_addSamples(&lndx, 2, "B");
+    LblNdx_addSamples(&lndx, 3, "C.x");
+
+    PatFold_init(&pf, &sndx);
+    assert(pf.npops == 3);
+    assert(pf.mask[0] == 1 && pf.mask[1] == 6 && pf.mask[2] == 56);
+    assert(pf.nsamp[0] == 1 && pf.nsamp[1] == 2 && pf.nsamp[2] == 3);
+    assert(PatFold_full(&pf) == 7);
+
+    // A, all of B, none of C
+    m = PatFold_split(&pf, 7, &fixed, bit, p);
+    assert(m == 0);
+    assert(fixed == 3);
+
+    // one sample of B, two of C
+    m = PatFold_split(&pf, 2 | 8 | 32, &fixed, bit, p);
+    assert(m == 2);
+    assert(fixed == 0);
+    assert(bit[0] == 2 && p[0] == 0.5);
+    assert(bit[1] == 4 && fabs(p[1] - 2.0 / 3.0) < 1e-15);
+
+    LblNdx      plbl = PatFold_lblndx(&pf, &lndx);
+    assert(3 == LblNdx_size(&plbl));
+    assert(0 == strcmp("A", LblNdx_lbl(&plbl, 0)));
+    assert(0 == strcmp("B", LblNdx_lbl(&plbl, 1)));
+    assert(0 == strcmp("C.x", LblNdx_lbl(&plbl, 2)));
+    if(verbose)
+        LblNdx_print(&plbl, stdout);
+
+    PatFold_init(&pf2, &sndx);
+    assert(PatFold_equals(&pf, &pf2));
+    sndx.node[3] = 8;
+    PatFold_init(&pf2, &sndx);
+    assert(pf2.npops == 4);
+    assert(!PatFold_equals(&pf, &pf2));
+
+    unitTstResult("PatFold", "OK");
+
+    return 0;
+}
+#endif
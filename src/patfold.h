@@ -0,0 +1,25 @@
+#ifndef ARR_PATFOLD_H
+#  define ARR_PATFOLD_H
+
+#  include "typedefs.h"
+#  include "popnode.h"
+
+/// Maps site patterns of samples to site patterns of populations.
+/// Population i has nsamp[i] samples, whose bits in a sample-level
+/// tipId_t are those of mask[i]. In a population-level tipId_t,
+/// population i is bit i.
+struct PatFold {
+    int         npops;          // number of sampled populations
+    tipId_t     mask[MAXSAMP];  // sample bits of each population
+    int         nsamp[MAXSAMP]; // number of samples in each population
+    double      inv[MAXSAMP];   // 1/nsamp
+};
+
+void        PatFold_init(PatFold * self, const SampNdx * sndx);
+int         PatFold_split(const PatFold * self, tipId_t tid, tipId_t * all,
+                          tipId_t bit[], double p[]);
+tipId_t     PatFold_full(const PatFold * self);
+LblNdx      PatFold_lblndx(const PatFold * self, const LblNdx * samples);
+int         PatFold_equals(const PatFold * lhs, const PatFold * rhs);
+
+#endif
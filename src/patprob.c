@@ -14,80 +14,792 @@
 #include "parse.h"
 #include "parstore.h"
 #include "binary.h"
+#include "fastrng.h"
+#include "sobol.h"
 #include "gptree.h"
+#include "jobqueue.h"
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 #include <limits.h>
+#include <math.h>
 #include <gsl/gsl_rng.h>
 
+// Replicates are simulated in blocks of PATPROB_BLOCK. Each block is
+// a separate job with its own BranchTab and its own random number
+// stream, so the result does not depend on the number of threads.
+#define PATPROB_BLOCK 4096
+
+// Antithetic pairs must not straddle blocks.
+#if PATPROB_BLOCK % 2
+#  error PATPROB_BLOCK must be even
+#endif
+
+// Largest number of control variates.
+#define PATPROB_MAXCV 32
+
 typedef struct SimArg SimArg;
+typedef struct CVPairs CVPairs;
+typedef struct CVSum CVSum;
+
+/// Control variates. For pair k of samples, a[k] and b[k], the
+/// control is the length of the branches that separate them in the
+/// gene tree of a single replicate. Its expectation, mu[k], is known
+/// exactly.
+struct CVPairs {
+    int         n;
+    int         a[PATPROB_MAXCV], b[PATPROB_MAXCV];
+    double      mu[PATPROB_MAXCV];
+};
+
+/// Sums over the replicates of a block, which are needed for the
+/// control-variate regression. Row i of xc belongs to site pattern
+/// key[i] and holds the sums of its branch length times each control.
+/// Rows are found via an open-addressing hash table, slot, whose
+/// entries are row indices plus 1, or 0 if empty.
+struct CVSum {
+    double      sumC[PATPROB_MAXCV];    // sums of controls
+    double      sumCC[PATPROB_MAXCV][PATPROB_MAXCV]; // cross products
+    unsigned    npat, dim;  // number of rows, size of slot
+    tipId_t    *key;
+    double    (*xc)[PATPROB_MAXCV];
+    unsigned   *slot;
+};
 
-/** Data structure used by each thread */
+/** A block of replicates, which is the unit of work */
 struct SimArg {
+    unsigned long block;    // index of this block
+    unsigned long firstRep; // index of first replicate
     unsigned long nreps;
-    int         doSing; // nonzero => tabulate singletons
-    GPTree     *gptree;
+    unsigned long seed;     // identifies family of random streams
+    int         crn;        // nonzero => one stream per replicate
+    int         antithetic; // nonzero => antithetic pairs of replicates
+    const Sobol *sobol;     // if not NULL, replicate i uses point i
+    int         doSing;     // nonzero => tabulate singletons
+    const CVPairs *cv;      // if not NULL, record control variates
 
-    // Returned value
+    // Returned values
     BranchTab  *branchtab;
+    CVSum      *cvsum;
+};
+
+/** State maintained by each thread */
+struct SimState {
+    GPTree     *gptree;
+    gsl_rng    *rng;
+    gsl_rng    *pos, *neg;      // antithetic pair of generators
+    gsl_rng    *qrng;           // quasi-random generator
+    BranchTab  *rep;            // a single replicate, in simCV
+
+    // Reused by SimState_patprob and SimState_simulateIncr. Made when
+    // first needed.
+    int         doSing;         // argument with which tables were made
+    BranchTab  *blocktab, *rval;
+    BranchTab  *incrtab;        // result of SimState_simulateIncr
+    CVSum      *blockcv, *cvsum;
 };
 
-SimArg     *SimArg_new(const GPTree *gptree, unsigned nreps, int doSing);
-void        SimArg_free(SimArg * targ);
 int         simfun(void *, void *);
+static void SimState_setDoSing(SimState *self, int doSing);
+static gsl_rng *repRng(SimArg *arg, SimState *state, unsigned long i);
+static void simCV(SimArg *arg, SimState *state, gsl_rng *rng);
+static void SimArg_setBlock(SimArg *self, long b, long nreps);
+static void CVPairs_init(CVPairs *self, unsigned nsamples);
+static int  CVPairs_setup(CVPairs *self, GPTree *gptree);
+static CVSum *CVSum_new(void);
+static void CVSum_free(CVSum *self);
+static void CVSum_clear(CVSum *self);
+static unsigned CVSum_find(const CVSum *self, tipId_t key);
+static double *CVSum_row(CVSum *self, tipId_t key, int add);
+static void CVSum_plusEquals(CVSum *lhs, CVSum *rhs, int n);
+static void CVSum_adjust(CVSum *self, const CVPairs *cv, double nreps,
+                         BranchTab *bt);
+static int  cholesky(int n, double a[n][n]);
+static void cholSolve(int n, double L[n][n], double x[n]);
+
+/// Construct the state of a thread, which consists of its own copy
+/// of a GPTree and random number generators. The generators are
+/// reseeded before they are used, so their seeds here are
+/// irrelevant.
+void       *SimState_new(void *gptree) {
+    SimState   *self = malloc(sizeof(SimState));
+    CHECKMEM(self);
+    self->gptree = GPTree_dup((GPTree *) gptree);
+	assert(GPTree_feasible(self->gptree, 0));
+    self->rng = gsl_rng_alloc(rng_xoshiro256pp);
+    self->pos = gsl_rng_alloc(rng_xoshiro_pos);
+    self->neg = gsl_rng_alloc(rng_xoshiro_neg);
+    self->qrng = gsl_rng_alloc(rng_sobol);
+    CHECKMEM(self->rng);
+    CHECKMEM(self->pos);
+    CHECKMEM(self->neg);
+    CHECKMEM(self->qrng);
+    self->rep = BranchTab_newDense(GPTree_nsamples(self->gptree));
+    self->doSing = 0;
+    self->blocktab = self->rval = self->incrtab = NULL;
+    self->blockcv = self->cvsum = NULL;
+    return self;
+}
+
+/// SimState destructor
+void SimState_free(void *state) {
+    SimState   *self = (SimState *) state;
+    GPTree_free(self->gptree);
+    gsl_rng_free(self->rng);
+    gsl_rng_free(self->pos);
+    gsl_rng_free(self->neg);
+    gsl_rng_free(self->qrng);
+    BranchTab_free(self->rep);
+    if(self->blocktab)
+        BranchTab_free(self->blocktab);
+    if(self->rval)
+        BranchTab_free(self->rval);
+    if(self->incrtab)
+        BranchTab_free(self->incrtab);
+    if(self->blockcv)
+        CVSum_free(self->blockcv);
+    if(self->cvsum)
+        CVSum_free(self->cvsum);
+    free(self);
+}
+
+/// Return the random number generator for replicate i, ready to use.
+static gsl_rng *repRng(SimArg *arg, SimState *state, unsigned long i) {
+    if(arg->sobol) {
+        // Randomized quasi-Monte Carlo: the first SOBOL_DIM uniform
+        // deviates of replicate i come from Sobol point i.
+        Sobol_setRng(state->qrng, arg->sobol, i,
+                     FastRng_streamSeed(arg->seed, i));
+        return state->qrng;
+    }
+
+    if(arg->antithetic) {
+        // Replicates 2j and 2j+1 share stream j, but the second sees
+        // the complement of each uniform deviate. Blocks have even
+        // length, so pairs never straddle blocks.
+        gsl_rng    *rng = (i & 1UL) ? state->neg : state->pos;
+        gsl_rng_set(rng, FastRng_streamSeed(arg->seed, i / 2));
+        return rng;
+    }
+
+    if(arg->crn) {
+        // Common random numbers: replicate i always uses stream i.
+        gsl_rng_set(state->rng, FastRng_streamSeed(arg->seed, i));
+    } else if(i == arg->firstRep) {
+        // One stream for the whole block.
+        gsl_rng_set(state->rng, FastRng_streamSeed(arg->seed, arg->block));
+    }
+    return state->rng;
+}
+
+/// Simulate a single replicate, adding its branch lengths to
+/// arg->branchtab and its control variates to arg->cvsum.
+static void simCV(SimArg *arg, SimState *state, gsl_rng *rng) {
+    const CVPairs *cv = arg->cv;
+    CVSum      *cs = arg->cvsum;
+    int         j, k, l;
+
+    // Singletons are always needed here, to calculate the controls.
+    BranchTab  *rep = state->rep;
+    BranchTab_clear(rep);
+    GPTree_simulate(state->gptree, rep, rng, 1, 1);
+
+    unsigned    n = BranchTab_size(rep);
+    tipId_t     key[n];
+    double      len[n], sqr[n], c[PATPROB_MAXCV];
+    BranchTab_toArrays(rep, n, key, len, sqr);
+
+    // A branch separates samples a and b if it is ancestral to one
+    // but not the other. Avoid branching, which mispredicts often.
+    for(k = 0; k < cv->n; ++k) {
+        int         a = cv->a[k], b = cv->b[k];
+        c[k] = 0.0;
+        for(j = 0; j < (int) n; ++j)
+            c[k] += len[j] * (double) (((key[j] >> a) ^ (key[j] >> b)) & 1);
+    }
+
+    for(k = 0; k < cv->n; ++k) {
+        cs->sumC[k] += c[k];
+        for(l = 0; l <= k; ++l)
+            cs->sumCC[k][l] += c[k] * c[l];
+    }
+
+    for(j = 0; j < (int) n; ++j) {
+        if(!arg->doSing && isPow2(key[j]))
+            continue;
+        BranchTab_add(arg->branchtab, key[j], len[j]);
+        double     *xc = CVSum_row(cs, key[j], 1);
+        for(k = 0; k < cv->n; ++k)
+            xc[k] += len[j] * c[k];
+    }
+}
 
 /// function run by each thread
 int simfun(void *varg, void *tdata) {
     SimArg    *arg = (SimArg *) varg;
-    gsl_rng   *rng = (gsl_rng *) tdata;
+    SimState  *state = (SimState *) tdata;
+    unsigned long i, end = arg->firstRep + arg->nreps;
 
-	assert(GPTree_feasible(arg->gptree, 0));
-    GPTree_simulate(arg->gptree, arg->branchtab, rng, arg->nreps,
-                    arg->doSing);
+    for(i = arg->firstRep; i < end; ++i) {
+        gsl_rng    *rng = repRng(arg, state, i);
+        if(arg->cv)
+            simCV(arg, state, rng);
+        else
+            GPTree_simulate(state->gptree, arg->branchtab, rng, 1,
+                            arg->doSing);
+    }
 
     return 0;
 }
 
-/// Construct a new SimArg by copying a template.
-SimArg    *SimArg_new(const GPTree *gptree, unsigned nreps, int doSing) {
-    SimArg    *a = malloc(sizeof(SimArg));
-    CHECKMEM(a);
+/// Set the block index and replicates of arg, which is block b of a
+/// run of nreps replicates.
+static void SimArg_setBlock(SimArg *self, long b, long nreps) {
+    long        nblocks = (nreps + PATPROB_BLOCK - 1) / PATPROB_BLOCK;
+
+    self->block = b;
+    self->firstRep = b * PATPROB_BLOCK;
+    self->nreps = (b + 1 < nblocks ? PATPROB_BLOCK
+                   : nreps - self->firstRep);
+}
+
+/// Choose the pairs of samples that provide control variates: all
+/// pairs if there are few samples, or adjacent pairs otherwise.
+static void CVPairs_init(CVPairs *self, unsigned nsamples) {
+    int         i, j, n = nsamples;
 
-    a->nreps = nreps;
-    a->doSing = doSing;
-    a->gptree = GPTree_dup(gptree);
-	assert(GPTree_feasible(a->gptree));
-    a->branchtab = BranchTab_new();
+    self->n = 0;
+    if(n * (n - 1) / 2 <= PATPROB_MAXCV) {
+        for(i = 0; i < n; ++i)
+            for(j = i + 1; j < n; ++j) {
+                self->a[self->n] = i;
+                self->b[self->n] = j;
+                ++self->n;
+            }
+    } else {
+        for(i = 0; i + 1 < n && self->n < PATPROB_MAXCV; ++i) {
+            self->a[self->n] = i;
+            self->b[self->n] = i + 1;
+            ++self->n;
+        }
+    }
+}
 
-    return a;
+/// Choose the control variates for gptree and calculate their
+/// expectations. Return 1 if they can be used, or 0 if there are none
+/// or their expectations are unknown. Controls are defined for pairs
+/// of samples, so they can't be used when samples are folded into
+/// populations.
+static int CVPairs_setup(CVPairs *self, GPTree *gptree) {
+    if(GPTree_folded(gptree))
+        return 0;
+    CVPairs_init(self, GPTree_nsamples(gptree));
+    if(self->n == 0
+       || GPTree_pairExpected(gptree, self->n, self->a, self->b, self->mu))
+        return 0;
+    return 1;
 }
 
-/// SimArg destructor
-void SimArg_free(SimArg * self) {
-    BranchTab_free(self->branchtab);
-    GPTree_free(self->gptree);
+static CVSum *CVSum_new(void) {
+    CVSum      *self = malloc(sizeof(CVSum));
+    CHECKMEM(self);
+    memset(self, 0, sizeof(CVSum));
+    self->dim = 64;
+    self->key = malloc((self->dim / 2) * sizeof(self->key[0]));
+    self->xc = malloc((self->dim / 2) * sizeof(self->xc[0]));
+    self->slot = calloc(self->dim, sizeof(self->slot[0]));
+    CHECKMEM(self->key);
+    CHECKMEM(self->xc);
+    CHECKMEM(self->slot);
+    return self;
+}
+
+static void CVSum_free(CVSum *self) {
+    free(self->key);
+    free(self->xc);
+    free(self->slot);
     free(self);
 }
 
+/// Remove all rows and zero all sums, keeping the memory.
+static void CVSum_clear(CVSum *self) {
+    memset(self->sumC, 0, sizeof(self->sumC));
+    memset(self->sumCC, 0, sizeof(self->sumCC));
+    memset(self->slot, 0, self->dim * sizeof(self->slot[0]));
+    self->npat = 0;
+}
+
+/// Return the index within the slot table of site pattern key, or
+/// of the empty slot where it belongs.
+static unsigned CVSum_find(const CVSum *self, tipId_t key) {
+    unsigned    h, mask = self->dim - 1;
+
+    for(h = (unsigned) (key * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+        self->slot[h] && self->key[self->slot[h] - 1] != key;
+        h = (h + 1) & mask)
+        ;
+    return h;
+}
+
+/// Return the row of sums that belongs to site pattern key. If there
+/// is none, return NULL, or (if add is nonzero) a new row of zeroes.
+static double *CVSum_row(CVSum *self, tipId_t key, int add) {
+    unsigned    i, h = CVSum_find(self, key);
+
+    if(self->slot[h])
+        return self->xc[self->slot[h] - 1];
+    if(!add)
+        return NULL;
+
+    // Keep the table no more than half full.
+    if(2 * (self->npat + 1) > self->dim) {
+        self->dim *= 2;
+        self->key = realloc(self->key,
+                            (self->dim / 2) * sizeof(self->key[0]));
+        self->xc = realloc(self->xc, (self->dim / 2) * sizeof(self->xc[0]));
+        free(self->slot);
+        self->slot = calloc(self->dim, sizeof(self->slot[0]));
+        CHECKMEM(self->key);
+        CHECKMEM(self->xc);
+        CHECKMEM(self->slot);
+        for(i = 0; i < self->npat; ++i)
+            self->slot[CVSum_find(self, self->key[i])] = i + 1;
+        h = CVSum_find(self, key);
+    }
+    i = self->npat++;
+    self->key[i] = key;
+    memset(self->xc[i], 0, sizeof(self->xc[i]));
+    self->slot[h] = i + 1;
+    return self->xc[i];
+}
+
+static void CVSum_plusEquals(CVSum *lhs, CVSum *rhs, int n) {
+    for(int k = 0; k < n; ++k) {
+        lhs->sumC[k] += rhs->sumC[k];
+        for(int l = 0; l <= k; ++l)
+            lhs->sumCC[k][l] += rhs->sumCC[k][l];
+    }
+    for(unsigned i = 0; i < rhs->npat; ++i) {
+        double     *row = CVSum_row(lhs, rhs->key[i], 1);
+        for(int k = 0; k < n; ++k)
+            row[k] += rhs->xc[i][k];
+    }
+}
+
+/// Cholesky decomposition of a symmetric positive definite matrix,
+/// whose lower triangle is in a. On return, the lower triangle holds
+/// L, where a = L L'. Return 0 on success or 1 if a is not positive
+/// definite.
+static int cholesky(int n, double a[n][n]) {
+    for(int j = 0; j < n; ++j) {
+        double      d = a[j][j];
+        for(int k = 0; k < j; ++k)
+            d -= a[j][k] * a[j][k];
+        if(!(d > 0.0))
+            return 1;
+        a[j][j] = sqrt(d);
+        for(int i = j + 1; i < n; ++i) {
+            double      s = a[i][j];
+            for(int k = 0; k < j; ++k)
+                s -= a[i][k] * a[j][k];
+            a[i][j] = s / a[j][j];
+        }
+    }
+    return 0;
+}
+
+/// Solve L L' y = x, where L is from cholesky. On return, x holds y.
+static void cholSolve(int n, double L[n][n], double x[n]) {
+    int         i, k;
+    for(i = 0; i < n; ++i) {
+        for(k = 0; k < i; ++k)
+            x[i] -= L[i][k] * x[k];
+        x[i] /= L[i][i];
+    }
+    for(i = n - 1; i >= 0; --i) {
+        for(k = i + 1; k < n; ++k)
+            x[i] -= L[k][i] * x[k];
+        x[i] /= L[i][i];
+    }
+}
+
+/// Apply a regression control-variate adjustment to the summed branch
+/// lengths in bt. For each site pattern, the adjusted sum is
+/// Y - b'(C - nreps*mu), where Y is the pattern's summed branch
+/// length, C is the vector of summed controls, and b is the vector of
+/// coefficients from the least-squares regression of the pattern's
+/// branch length on the controls, across replicates. If the controls
+/// are degenerate, nothing is changed. A pattern whose adjusted value
+/// would be negative is left unadjusted.
+static void CVSum_adjust(CVSum *self, const CVPairs *cv, double nreps,
+                         BranchTab *bt) {
+    int         k, l, n = cv->n;
+    double      S[n][n], dev[n];
+
+    if(n == 0 || nreps < n + 2)
+        return;
+
+    // Covariance matrix of controls, times nreps.
+    for(k = 0; k < n; ++k)
+        for(l = 0; l <= k; ++l)
+            S[k][l] = self->sumCC[k][l]
+                - self->sumC[k] * self->sumC[l] / nreps;
+    if(cholesky(n, S))
+        return;
+
+    for(k = 0; k < n; ++k)
+        dev[k] = self->sumC[k] - nreps * cv->mu[k];
+
+    unsigned    npat = BranchTab_size(bt);
+    tipId_t     key[npat];
+    double      y[npat], sqr[npat];
+    BranchTab_toArrays(bt, npat, key, y, sqr);
+    for(unsigned j = 0; j < npat; ++j) {
+        double      beta[n], adj = 0.0;
+        const double *xc = CVSum_row(self, key[j], 0);
+        assert(xc);
+        for(k = 0; k < n; ++k)
+            beta[k] = xc[k] - self->sumC[k] * y[j] / nreps;
+        cholSolve(n, S, beta);
+        for(k = 0; k < n; ++k)
+            adj += beta[k] * dev[k];
+        if(y[j] - adj >= 0.0)
+            BranchTab_add(bt, key[j], -adj);
+    }
+}
+
 /// Run simulations to estimate site pattern probabilities.  On
 /// return, pat[i] identifies the i'th pattern, and prob[i] estimates
 /// its probability.  Function returns a pointer to a newly-allocated
 /// object of type BranchTab, which contains all the observed site
 /// patterns and their summed branch lengths.
-BranchTab *patprob(const GPTree *gptree, long nreps,
-                   int doSing, gsl_rng *rng) {
+///
+/// Random numbers come from streams that are identified by seed and
+/// by the index of a block of replicates, or (if crn is nonzero) by
+/// the index of a single replicate. Any block can therefore be
+/// regenerated on its own. The blocks are divided among nThreads
+/// threads, but their results are summed in order of block index, so
+/// the answer is bit-for-bit the same for any value of nThreads.
+///
+/// Calls that share a seed and have crn nonzero use common random
+/// numbers: each replicate sees the same random stream whatever the
+/// parameter values, so differences in cost between points reflect
+/// the points rather than Monte Carlo noise.
+///
+/// If antithetic is nonzero, replicates are simulated in pairs. The
+/// second member of each pair uses the complement, 1-u, of each
+/// uniform deviate u used by the first, so that long waiting times in
+/// one tend to be matched by short ones in the other. Pairs are
+/// keyed by pair index, so this combines with common random numbers.
+///
+/// If qmc is nonzero, the first SOBOL_DIM uniform deviates of each
+/// replicate--the earliest waiting times and admixture
+/// decisions--come from a Sobol sequence that is randomly scrambled
+/// using seed. Later deviates come from ordinary random streams, as
+/// under common random numbers. Each call is a single randomization,
+/// so standard errors must be estimated from independent calls with
+/// different seeds. Antithetic pairs are not used in this mode.
+///
+/// If cv is nonzero, each replicate also records, for pairs of
+/// samples, the length of the branches that separate them. The
+/// expected values of these controls are calculated exactly, and
+/// each site pattern's sum is adjusted by regression on the
+/// controls' deviations from expectation. This reduces Monte Carlo
+/// variance at the cost of a little bias of order 1/nreps. It is
+/// ignored if the model has Gaussian parameters, whose controls have
+/// no exact expectation, or if gptree folds samples into populations
+/// (see GPTree_setFold).
+BranchTab *patprob(const GPTree *gptree, long nreps, int doSing,
+                   int nThreads, unsigned long seed, int crn,
+                   int antithetic, int qmc, int cv) {
+    Sobol       sobol;
+    if(qmc)
+        Sobol_init(&sobol, FastRng_streamSeed(seed, ULONG_MAX));
+
+    // Template from which each thread copies its GPTree.
+    GPTree     *tmpl = GPTree_dup(gptree);
+
+    CVPairs     cvpairs;
+    if(cv)
+        cv = CVPairs_setup(&cvpairs, tmpl);
+
+    long        b, nblocks = (nreps + PATPROB_BLOCK - 1) / PATPROB_BLOCK;
+    SimArg     *simarg = malloc(nblocks * sizeof(simarg[0]));
+    CHECKMEM(simarg);
+
+    for(b = 0; b < nblocks; ++b) {
+        SimArg_setBlock(simarg + b, b, nreps);
+        simarg[b].seed = seed;
+        simarg[b].crn = crn;
+        simarg[b].antithetic = antithetic;
+        simarg[b].sobol = (qmc ? &sobol : NULL);
+        simarg[b].doSing = doSing;
+        simarg[b].cv = (cv ? &cvpairs : NULL);
+        simarg[b].branchtab = GPTree_newBranchTab(gptree, doSing);
+        simarg[b].cvsum = (cv ? CVSum_new() : NULL);
+    }
+
+    if(nThreads > nblocks)
+        nThreads = nblocks;
+
+    if(nThreads <= 1) {
+        void       *state = SimState_new(tmpl);
+        for(b = 0; b < nblocks; ++b)
+            simfun(simarg + b, state);
+        SimState_free(state);
+    } else {
+        JobQueue   *jq = JobQueue_new(nThreads, tmpl, SimState_new,
+                                      SimState_free);
+        for(b = 0; b < nblocks; ++b)
+            JobQueue_addJob(jq, simfun, simarg + b);
+        JobQueue_waitOnJobs(jq);
+        JobQueue_free(jq);
+    }
+    GPTree_free(tmpl);
+
+    BranchTab *rval = GPTree_newBranchTab(gptree, doSing);
+    CVSum     *cvsum = (cv ? CVSum_new() : NULL);
+    for(b = 0; b < nblocks; ++b) {
+        BranchTab_plusEquals(rval, simarg[b].branchtab);
+        BranchTab_free(simarg[b].branchtab);
+        if(cv) {
+            CVSum_plusEquals(cvsum, simarg[b].cvsum, cvpairs.n);
+            CVSum_free(simarg[b].cvsum);
+        }
+    }
+    free(simarg);
+
+    if(cv) {
+        CVSum_adjust(cvsum, &cvpairs, (double) nreps, rval);
+        CVSum_free(cvsum);
+    }
+
+    return rval;
+}
+
+/// Make the tables that depend on doSing, unless they already exist.
+static void SimState_setDoSing(SimState *self, int doSing) {
+    if(self->blocktab && self->doSing == doSing)
+        return;
+    if(self->blocktab) {
+        BranchTab_free(self->blocktab);
+        BranchTab_free(self->rval);
+        BranchTab_free(self->incrtab);
+    }
+    self->blocktab = GPTree_newBranchTab(self->gptree, doSing);
+    self->rval = GPTree_newBranchTab(self->gptree, doSing);
+    self->incrtab = GPTree_newBranchTab(self->gptree, doSing);
+    self->doSing = doSing;
+}
+
+/// Estimate site pattern probabilities as patprob does with
+/// nThreads=1, reusing the memory of a SimState made by
+/// SimState_new. After the first few calls, no memory is allocated
+/// unless cv is nonzero, in which case the exact expectations of the
+/// control variates are calculated anew at each call, using temporary
+/// tables.
+/// Parameter values are copied from gptree into the state's own
+/// GPTree, which must otherwise be identical to gptree. The returned
+/// table belongs to the state and is overwritten by the next call. It
+/// must not be freed. The result is identical to that of patprob.
+BranchTab *SimState_patprob(SimState *self, const GPTree *gptree,
+                            long nreps, int doSing, unsigned long seed,
+                            int crn, int antithetic, int qmc, int cv) {
+    Sobol       sobol;
+    if(qmc)
+        Sobol_init(&sobol, FastRng_streamSeed(seed, ULONG_MAX));
+
+    int         dim = GPTree_nFree(gptree);
+    double      x[dim];
+    GPTree_getParams(gptree, dim, x);
+    GPTree_setParams(self->gptree, dim, x);
 
-    SimArg    *simarg;
+    CVPairs     cvpairs;
+    if(cv)
+        cv = CVPairs_setup(&cvpairs, self->gptree);
 
-    simarg = SimArg_new(gptree, nreps, doSing);
-    simfun(simarg, rng);
+    SimState_setDoSing(self, doSing);
+    BranchTab_clear(self->rval);
+    if(cv && self->cvsum == NULL) {
+        self->blockcv = CVSum_new();
+        self->cvsum = CVSum_new();
+    }
+    if(cv)
+        CVSum_clear(self->cvsum);
 
-    BranchTab *rval = BranchTab_dup(simarg->branchtab);
+    SimArg      arg = {
+        .seed = seed,
+        .crn = crn,
+        .antithetic = antithetic,
+        .sobol = (qmc ? &sobol : NULL),
+        .doSing = doSing,
+        .cv = (cv ? &cvpairs : NULL),
+        .branchtab = self->blocktab,
+        .cvsum = self->blockcv
+    };
 
-    SimArg_free(simarg);
+    // Blocks are summed in the same order as in patprob.
+    long        b, nblocks = (nreps + PATPROB_BLOCK - 1) / PATPROB_BLOCK;
+    for(b = 0; b < nblocks; ++b) {
+        SimArg_setBlock(&arg, b, nreps);
+        BranchTab_clear(arg.branchtab);
+        if(cv)
+            CVSum_clear(arg.cvsum);
+        simfun(&arg, self);
+        BranchTab_plusEquals(self->rval, arg.branchtab);
+        if(cv)
+            CVSum_plusEquals(self->cvsum, arg.cvsum, cvpairs.n);
+    }
 
+    if(cv)
+        CVSum_adjust(self->cvsum, &cvpairs, (double) nreps, self->rval);
+
+    return self->rval;
+}
+
+/// Simulate with GPTree_simulateIncr, reusing segments of the
+/// previous simulation in cache, and the random number generator and
+/// memory of a SimState. Parameter values are copied from gptree, as
+/// in SimState_patprob. The returned table belongs to the state and is
+/// overwritten by the next call. Return NULL if the cache can't be
+/// used.
+BranchTab *SimState_simulateIncr(SimState *self, const GPTree *gptree,
+                                 SegCache *cache, long nreps, int doSing,
+                                 unsigned long seed) {
+    int         dim = GPTree_nFree(gptree);
+    double      x[dim];
+    GPTree_getParams(gptree, dim, x);
+    GPTree_setParams(self->gptree, dim, x);
+
+    // GPTree_simulateIncr reseeds its generator for each segment, so
+    // it uses pos, whose exponentials need no buffer.
+    SimState_setDoSing(self, doSing);
+    BranchTab_clear(self->incrtab);
+    if(GPTree_simulateIncr(self->gptree, cache, self->incrtab, self->pos,
+                           seed, nreps, doSing))
+        return NULL;
+    return self->incrtab;
+}
+
+/// Calculate site pattern probabilities exactly, without
+/// simulation. The result is scaled to match that of patprob with
+/// nreps replicates, so callers can treat the two interchangeably.
+/// Return NULL if the model cannot be handled exactly, because it has
+/// Gaussian parameters or too many samples.
+BranchTab *exactprob(const GPTree *gptree, long nreps, int doSing) {
+    GPTree     *tree = GPTree_dup(gptree);
+    BranchTab  *rval = GPTree_newBranchTab(gptree, doSing);
+
+    if(GPTree_expected(tree, rval, (double) nreps, doSing)) {
+        BranchTab_free(rval);
+        rval = NULL;
+    }
+    GPTree_free(tree);
     return rval;
 }
+
+#ifdef TEST
+
+#  include <stdio.h>
+#  include <unistd.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+static const char *input =
+    "time fixed  T0=0\n"
+    "time fixed  Txy=500\n"
+    "twoN fixed  2Nx=400\n"
+    "twoN fixed  2Ny=800\n"
+    "twoN fixed  2Nxy=1500\n"
+    "segment x   t=T0     twoN=2Nx    samples=2\n"
+    "segment y   t=T0     twoN=2Ny    samples=1\n"
+    "segment xy  t=Txy    twoN=2Nxy\n"
+    "derive x from xy\n"
+    "derive y from xy\n";
+
+/// Return the largest relative error in est, which sums nreps
+/// replicates, of any site pattern in ex.
+static double maxRelErr(BranchTab *est, BranchTab *ex, long nreps,
+                        int verbose, const char *lbl) {
+    unsigned    i, n = BranchTab_size(ex);
+    tipId_t     key[n];
+    double      val[n], sqr[n], err, maxerr = 0.0;
+
+    BranchTab_toArrays(ex, n, key, val, sqr);
+    for(i = 0; i < n; ++i) {
+        err = fabs(BranchTab_get(est, key[i]) / nreps - val[i]) / val[i];
+        if(verbose)
+            printf("%s: key=%lu est=%lf exact=%lf\n", lbl,
+                   (unsigned long) key[i],
+                   BranchTab_get(est, key[i]) / nreps, val[i]);
+        if(err > maxerr)
+            maxerr = err;
+    }
+    return maxerr;
+}
+
+int main(int argc, char **argv) {
+    int         verbose = 0;
+    const long  nreps = 200000;
+
+    if(argc > 1) {
+        if(argc != 2 || 0 != strcmp(argv[1], "-v")) {
+            fprintf(stderr, "usage: xpatprob [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    const char *fname = "patprob-tmp.lgo";
+    FILE       *fp = fopen(fname, "w");
+    fputs(input, fp);
+    fclose(fp);
+    Bounds      bnd = {
+        .lo_twoN = 1.0,
+        .hi_twoN = 1e7,
+        .lo_t = 0.0,
+        .hi_t = HUGE_VAL
+    };
+    GPTree     *g = GPTree_new(fname, bnd);
+    unlink(fname);
+
+    BranchTab  *ex = BranchTab_new();
+    int         status = GPTree_expected(g, ex, 1.0, 1);
+    assert(status == 0);
+
+    // The result doesn't depend on the number of threads.
+    BranchTab  *bt1 = patprob(g, nreps, 1, 1, 1, 0, 0, 0, 0);
+    BranchTab  *bt4 = patprob(g, nreps, 1, 4, 1, 0, 0, 0, 0);
+    assert(BranchTab_equals(bt1, bt4));
+    assert(maxRelErr(bt1, ex, nreps, verbose, "plain") < 0.03);
+    BranchTab_free(bt1);
+    BranchTab_free(bt4);
+
+    // Common random numbers reproduce exactly, given the seed.
+    bt1 = patprob(g, nreps, 1, 1, 2, 1, 0, 0, 0);
+    bt4 = patprob(g, nreps, 1, 4, 2, 1, 0, 0, 0);
+    assert(BranchTab_equals(bt1, bt4));
+    BranchTab_free(bt4);
+    bt4 = patprob(g, nreps, 1, 1, 3, 1, 0, 0, 0);
+    assert(!BranchTab_equals(bt1, bt4));
+    BranchTab_free(bt1);
+    BranchTab_free(bt4);
+
+    // Antithetic pairs and control variates are close to exact.
+    BranchTab  *bt = patprob(g, nreps, 1, 4, 4, 0, 1, 0, 0);
+    assert(maxRelErr(bt, ex, nreps, verbose, "antithetic") < 0.03);
+    BranchTab_free(bt);
+    bt = patprob(g, nreps, 1, 4, 5, 0, 0, 0, 1);
+    assert(maxRelErr(bt, ex, nreps, verbose, "cv") < 0.01);
+    BranchTab_free(bt);
+
+    BranchTab_free(ex);
+    GPTree_free(g);
+    unitTstResult("patprob", "OK");
+    return 0;
+}
+#endif
@@ -2,8 +2,17 @@
 #  define PATPROB_INCLUDED
 
 #include "typedefs.h"
-#include <gsl/gsl_rng.h>
 
 BranchTab *patprob(const GPTree *gptree, long nreps, int doSing,
-                   gsl_rng *rng);
+                   int nThreads, unsigned long seed, int crn,
+                   int antithetic, int qmc, int cv);
+BranchTab *exactprob(const GPTree *gptree, long nreps, int doSing);
+void      *SimState_new(void *gptree);
+void       SimState_free(void *state);
+BranchTab *SimState_patprob(SimState *self, const GPTree *gptree,
+                            long nreps, int doSing, unsigned long seed,
+                            int crn, int antithetic, int qmc, int cv);
+BranchTab *SimState_simulateIncr(SimState *self, const GPTree *gptree,
+                                 SegCache *cache, long nreps, int doSing,
+                                 unsigned long seed);
 #endif
@@ -5,9 +5,17 @@
  *
  * PopNode objects can be linked together into a network, which models
  * bifurcation of populations and gene flow among them. Each PopNode
- * knows its size and duration. It has pointers to parents and
+ * knows its size and duration. It has links to parents and
  * children. If it has two parents, there is also a mixing parameter,
  * which determines what fraction of the node derives from each parent.
+ *
+ * PopNode objects live in a single array, and links between them are
+ * indices into that array rather than pointers. Similarly, parameters
+ * are referred to by their indices into the array of values returned
+ * by ParStore_values. Consequently, an array of PopNode objects can
+ * be copied with memcpy, and the copy will refer to whatever node
+ * array and parameter values are passed to the functions that
+ * operate on it.
  */
 
 #include "popnode.h"
@@ -15,6 +23,7 @@
 #include "misc.h"
 #include "parstore.h"
 #include "dtnorm.h"
+#include "fastrng.h"
 #include <stdbool.h>
 #include <string.h>
 #include <float.h>
@@ -27,182 +36,160 @@ struct NodeStore {
     PopNode *v; // not locally owned
 };
 
-static void PopNode_sanityCheck(PopNode * self, const char *file, int lineno);
-static void PopNode_randomize_r(PopNode *self, Bounds bnd, ParStore *parstore,
-                                gsl_rng *rng);
-static void PopNode_gaussian_r(PopNode *self, Bounds bnd,
-                               ParStore *ps, gsl_rng *rng);
+static int  PopNode_postorder_r(int self, const PopNode *pnv, int nseg,
+                                int order[nseg], bool visited[nseg], int n);
 
-/// Check for errors in PopNode tree. Call this from each leaf node.
-void PopNode_sanityFromLeaf(PopNode * self, const char *file, int line) {
+/// Check that the links of a PopNode are consistent with the number
+/// of parents and children. Does not check relatives.
+void PopNode_sanityCheck(const PopNode * self, const char *file, int line) {
 #ifndef NDEBUG
+    int         i;
+
     REQUIRE(self != NULL, file, line);
+    REQUIRE(self->ndx >= 0, file, line);
+    REQUIRE(self->twoN >= 0, file, line);
+    REQUIRE(self->start >= 0, file, line);
     switch (self->nparents) {
     case 0:
-        REQUIRE(self->parent[0] == NULL, file, line);
-        REQUIRE(self->parent[1] == NULL, file, line);
-        REQUIRE(self->mix == NULL, file, line);
-        REQUIRE(self->end == NULL, file, line);
+        REQUIRE(self->parent[0] == -1, file, line);
+        REQUIRE(self->parent[1] == -1, file, line);
+        REQUIRE(self->mix == -1, file, line);
+        REQUIRE(self->end == -1, file, line);
         break;
     case 1:
-        REQUIRE(self->parent[0] != NULL, file, line);
-        REQUIRE(self->parent[1] == NULL, file, line);
-        REQUIRE(self->mix == NULL, file, line);
+        REQUIRE(self->parent[0] >= 0, file, line);
+        REQUIRE(self->parent[1] == -1, file, line);
+        REQUIRE(self->mix == -1, file, line);
+		REQUIRE(self->end >= 0, file, line);
         break;
     default:
         REQUIRE(self->nparents == 2, file, line);
-        REQUIRE(self->parent[0] != NULL, file, line);
-        REQUIRE(self->parent[1] != NULL, file, line);
-		REQUIRE(self->end != NULL, file, line);
-		REQUIRE(self->mix != NULL, file, line);
-        REQUIRE(*self->mix >= 0.0, file, line);
+        REQUIRE(self->parent[0] >= 0, file, line);
+        REQUIRE(self->parent[1] >= 0, file, line);
+		REQUIRE(self->end >= 0, file, line);
+		REQUIRE(self->mix >= 0, file, line);
         break;
     }
     switch (self->nchildren) {
     case 0:
-        REQUIRE(self->child[0] == NULL, file, line);
-        REQUIRE(self->child[1] == NULL, file, line);
+        REQUIRE(self->child[0] == -1, file, line);
+        REQUIRE(self->child[1] == -1, file, line);
         break;
     case 1:
-        REQUIRE(self->child[0] != NULL, file, line);
-        REQUIRE(self->child[1] == NULL, file, line);
+        REQUIRE(self->child[0] >= 0, file, line);
+        REQUIRE(self->child[1] == -1, file, line);
         break;
     default:
         REQUIRE(self->nchildren == 2, file, line);
-        REQUIRE(self->child[0] != NULL, file, line);
-        REQUIRE(self->child[1] != NULL, file, line);
+        REQUIRE(self->child[0] >= 0, file, line);
+        REQUIRE(self->child[1] >= 0, file, line);
         break;
     }
-    REQUIRE(self->end==NULL || *self->start <= *self->end, file, line);
-    if(self->nparents > 0)
-        PopNode_sanityFromLeaf(self->parent[0], file, line);
-    if(self->nparents > 1)
-        PopNode_sanityFromLeaf(self->parent[1], file, line);
+    REQUIRE(self->nsamples <= self->maxsamp, file, line);
+    for(i = 0; i < self->nsamples; ++i)
+        REQUIRE(self->sample[i] != NULL, file, line);
 #endif
 }
 
-/// Find root of population tree, starting from given node.
-PopNode    *PopNode_root(PopNode * self) {
-    PopNode    *r0, *r1;
-    assert(self);
-    switch (self->nparents) {
-    case 0:
-        return self;
-        break;
-    case 1:
-        return PopNode_root(self->parent[0]);
-        break;
-    case 2:
-        r0 = PopNode_root(self->parent[0]);
-        r1 = PopNode_root(self->parent[1]);
-        if(r0 != r1) {
-            fprintf(stderr, "%s:%s:%d: Node has multiple roots\n",
-                    __FILE__, __func__, __LINE__);
-            exit(EXIT_FAILURE);
-        }
-        return r0;
-        break;
-    default:
-        fprintf(stderr, "%s:%s:%d: Node %d parents\n",
-                __FILE__, __func__, __LINE__, self->nparents);
-        exit(EXIT_FAILURE);
-    }
-    /* NOTREACHED */
-    return NULL;
-}
-
-/// Remove all references to samples from tree of populations
+/// Remove all references to samples from a PopNode. Does not
+/// affect descendants. Entries of the sample buffer are not erased,
+/// because only the first nsamples are ever read.
 void PopNode_clear(PopNode * self) {
-    int         i;
-    for(i = 0; i < self->nchildren; ++i)
-        PopNode_clear(self->child[i]);
-
     self->nsamples = 0;
-    memset(self->sample, 0, sizeof(self->sample));
     PopNode_sanityCheck(self, __FILE__, __LINE__);
 }
 
-/// Set all "touched" values to "false".
-///
-/// This algorithm is inefficient because it may process a single node
-/// multiple times. This happens when their is gene flow into the
-/// node, because then there multiple paths from the root to the
-/// node. It would be better to implement this as a shallow function
-/// (not recursive) and traverse the hash tab to execute it on each
-/// node exactly once.
-void PopNode_untouch(PopNode * self) {
-    if(self == NULL)
-        return;
-    int         i;
-    for(i = 0; i < self->nchildren; ++i)
-        PopNode_untouch(self->child[i]);
-
-    self->touched = false;
+/// Return 1 if PopNode is empty of samples. Does not check
+/// descendants.
+int PopNode_isClear(const PopNode *self) {
+    return self->nsamples == 0;
 }
 
-/// Return 1 if PopNode tree is empty of samples
-int PopNode_isClear(const PopNode *self) {
-    if(self == NULL)
-        return 1;
-    if(self->nsamples > 0)
-        return 0;
+/// Fill array "order" with the indices, within array pnv, of the
+/// PopNode objects in the network whose root has index root. Each
+/// node appears once, after all of its descendants. Thus, a loop over
+/// "order" visits children before parents, and a loop in reverse
+/// visits parents before children. Within this order, nodes appear
+/// in the order in which a recursive traversal from the root would
+/// first finish them. Return the number of nodes.
+int PopNode_postorder(int root, const PopNode *pnv, int nseg,
+                      int order[nseg]) {
+    bool visited[nseg];
+    memset(visited, 0, sizeof(visited));
+    return PopNode_postorder_r(root, pnv, nseg, order, visited, 0);
+}
 
-    int i;
-    for(i=0; i < self->nchildren; ++i) {
-        if(!PopNode_isClear(self->child[i]))
-            return 0;
-    }
-    return 1;
+/// Recursive helper for PopNode_postorder. On entry, n nodes have
+/// already been placed into "order". Return the new count.
+static int PopNode_postorder_r(int self, const PopNode *pnv, int nseg,
+                               int order[nseg], bool visited[nseg], int n) {
+    if(self < 0 || self >= nseg)
+        eprintf("%s:%s:%d: PopNode index %d is not in [0,%d)\n",
+                __FILE__, __func__, __LINE__, self, nseg);
+    if(visited[self])
+        return n;
+    visited[self] = true;
+    int j;
+    for(j = 0; j < pnv[self].nchildren; ++j)
+        n = PopNode_postorder_r(pnv[self].child[j], pnv, nseg, order,
+                                visited, n);
+    order[n++] = self;
+    return n;
 }
 
 /// Print a PopNode and (recursively) its descendants.
-void PopNode_print(FILE * fp, PopNode * self, int indent) {
+/// @param[in] pnv array of PopNode objects, including self
+/// @param[in] par array of parameter values
+void PopNode_print(FILE * fp, const PopNode * self, const PopNode *pnv,
+                   const double *par, int indent) {
     int         i;
     for(i = 0; i < indent; ++i)
         fputs("   ", fp);
-    fprintf(fp, "%p twoN=%lf ntrval=(%lf,", self, *self->twoN,
-			*self->start);
-    if(self->end != NULL)
-        fprintf(fp, "%lf)\n", *self->end);
+    fprintf(fp, "%d twoN=%lf ntrval=(%lf,", self->ndx, par[self->twoN],
+			par[self->start]);
+    if(self->end >= 0)
+        fprintf(fp, "%lf)\n", par[self->end]);
     else
         fprintf(fp, "Inf)\n");
 
     for(i = 0; i < self->nchildren; ++i)
-        PopNode_print(fp, self->child[i], indent + 1);
+        PopNode_print(fp, pnv + self->child[i], pnv, par, indent + 1);
 }
 
 /// Print a PopNode but not its descendants.
-void PopNode_printShallow(PopNode * self, FILE * fp) {
-    fprintf(fp, "%p twoN=%lf ntrval=(%lf,",
-            self, *self->twoN, *self->start);
-    if(self->end != NULL)
-        fprintf(fp, "%lf)", *self->end);
+/// @param[in] par array of parameter values
+void PopNode_printShallow(const PopNode * self, const double *par,
+                          FILE * fp) {
+    fprintf(fp, "%d twoN=%lf ntrval=(%lf,",
+            self->ndx, par[self->twoN], par[self->start]);
+    if(self->end >= 0)
+        fprintf(fp, "%lf)", par[self->end]);
     else
         fprintf(fp, "Inf)");
-	if(self->mix != NULL)
-		fprintf(fp, " mix=%lf", *self->mix);
+	if(self->mix >= 0)
+		fprintf(fp, " mix=%lf", par[self->mix]);
 
     switch (self->nparents) {
     case 0:
-        fprintf(fp, " par=0");
+        fprintf(fp, " par=none");
         break;
     case 1:
-        fprintf(fp, " par=%p", self->parent[0]);
+        fprintf(fp, " par=%d", self->parent[0]);
         break;
     default:
-        fprintf(fp, " par=[%p,%p]", self->parent[0], self->parent[1]);
+        fprintf(fp, " par=[%d,%d]", self->parent[0], self->parent[1]);
         break;
     }
 
     switch (self->nchildren) {
     case 0:
-        fprintf(fp, " child=0");
+        fprintf(fp, " child=none");
         break;
     case 1:
-        fprintf(fp, " child=%p", self->child[0]);
+        fprintf(fp, " child=%d", self->child[0]);
         break;
     default:
-        fprintf(fp, " child=[%p,%p]", self->child[0], self->child[1]);
+        fprintf(fp, " child=[%d,%d]", self->child[0], self->child[1]);
         break;
     }
     putc('\n', fp);
@@ -214,31 +201,38 @@ int PopNode_nsamples(PopNode * self) {
 }
 
 /// PopNode constructor
-PopNode    *PopNode_new(double *twoN, bool twoNfree, double *start,
+/// @param[in] twoN index of population size parameter
+/// @param[in] twoNfree true if twoN is a free parameter
+/// @param[in] start index of parameter giving start of segment
+/// @param[in] startFree true if start is a free parameter
+/// @param[inout] ns allocates PopNode objects
+PopNode    *PopNode_new(int twoN, bool twoNfree, int start,
                         bool startFree, NodeStore *ns) {
     PopNode    *new = NodeStore_alloc(ns);
     CHECKMEM(new);
 
     new->nparents = new->nchildren = new->nsamples = 0;
+    new->ndx = new - ns->v;
     new->twoN = twoN;
-    new->mix = NULL;
+    new->mix = -1;
     new->start = start;
-    new->end = NULL;
+    new->end = -1;
 
     new->twoNfree = twoNfree;
     new->startFree = startFree;
     new->mixFree = false;
-    new->touched = false;
 
-    memset(new->sample, 0, sizeof(new->sample));
-    memset(new->parent, 0, sizeof(new->parent));
-    memset(new->child, 0, sizeof(new->child));
+    new->sample = NULL;
+    new->maxsamp = 0;
+    new->parent[0] = new->parent[1] = -1;
+    new->child[0] = new->child[1] = -1;
 
     PopNode_sanityCheck(new, __FILE__, __LINE__);
     return new;
 }
 
-/// Connect parent and child
+/// Connect parent and child. Whether the child is younger than
+/// the parent is checked later, by PopNode_feasible.
 void PopNode_addChild(PopNode * parent, PopNode * child) {
     if(parent->nchildren > 1)
         eprintf("%s:%s:%d: Can't add child because parent already has %d.\n",
@@ -246,44 +240,28 @@ void PopNode_addChild(PopNode * parent, PopNode * child) {
     if(child->nparents > 1)
         eprintf("%s:%s:%d: Can't add parent because child already has %d.\n",
                 __FILE__, __func__, __LINE__, child->nparents);
-    if(*child->start > *parent->start)
-        eprintf("%s:%s:%d: Child start (%lf) must be <= parent start (%lf)\n",
-                __FILE__, __func__, __LINE__, *child->start, *parent->start);
-    if(child->end == NULL) {
+    if(child->end < 0) {
         child->end = parent->start;
     } else {
 		if(child->end != parent->start)
 			eprintf("%s:%s:%d: Date mismatch."
-					" child->end=%p != %p = parent->start\n",
+					" child->end=%d != %d = parent->start\n",
 					__FILE__, __func__, __LINE__,
 					child->end, parent->start);
 	}
-    parent->child[parent->nchildren] = child;
-    child->parent[child->nparents] = parent;
+    parent->child[parent->nchildren] = child->ndx;
+    child->parent[child->nparents] = parent->ndx;
     ++parent->nchildren;
     ++child->nparents;
     PopNode_sanityCheck(parent, __FILE__, __LINE__);
     PopNode_sanityCheck(child, __FILE__, __LINE__);
 }
 
-/// Check sanity of PopNode
-static void PopNode_sanityCheck(PopNode * self, const char *file,
-								int lineno) {
-#ifndef NDEBUG
-    int         i;
-
-    REQUIRE(self != NULL, file, lineno);
-
-    for(i = 0; i < self->nsamples; ++i)
-        REQUIRE(self->sample[i] != NULL, file, lineno);
-#endif
-}
-
 /// Add a sample to a PopNode
 void PopNode_addSample(PopNode * self, Gene * gene) {
 	assert(self!=NULL);
 	assert(gene!=NULL);
-    if(self->nsamples == MAXSAMP) {
+    if(self->nsamples == self->maxsamp) {
         fprintf(stderr, "%s:%s:%d: Too many samples\n",
                 __FILE__, __func__, __LINE__);
         exit(1);
@@ -293,13 +271,21 @@ void PopNode_addSample(PopNode * self, Gene * gene) {
     PopNode_sanityCheck(self, __FILE__, __LINE__);
 }
 
+/// Give PopNode self a buffer, buff, with room for maxsamp lineages.
+/// The node must be empty of samples.
+void PopNode_setBuffer(PopNode * self, Gene ** buff, int maxsamp) {
+    assert(self->nsamples == 0);
+    self->sample = buff;
+    self->maxsamp = maxsamp;
+}
+
 /// Connect a child PopNode to two parents.
 /// @param[inout] child pointer to the child PopNode
-/// @param[in] mPtr pointer to the gene flow variable
-/// @param[in] mixFree 1 if mPtr is a free parameter; 0 otherwise
+/// @param[in] mix index of the gene flow parameter
+/// @param[in] mixFree 1 if mix is a free parameter; 0 otherwise
 /// @param[inout] introgressor pointer to the introgressing parent
 /// @param[inout] native pointer to the native parent
-void PopNode_mix(PopNode * child, double *mPtr, bool mixFree,
+void PopNode_mix(PopNode * child, int mix, bool mixFree,
                  PopNode * introgressor, PopNode * native) {
 
     if(introgressor->nchildren > 1)
@@ -314,70 +300,148 @@ void PopNode_mix(PopNode * child, double *mPtr, bool mixFree,
         eprintf("%s:%s:%d:"
 				" Can't add 2 parents because child already has %d.\n",
 				 __FILE__, __func__, __LINE__, child->nparents);
-    if(child->end != NULL) {
+    if(child->end >= 0) {
         if(child->end != introgressor->start)
             eprintf("%s:%s:%d: Date mismatch."
-					 " child->end=%p != %p=introgressor->start\n",
+					 " child->end=%d != %d=introgressor->start\n",
 					 __FILE__, __func__, __LINE__,
 					child->end, introgressor->start);
         if(child->end != native->start)
             eprintf("%s:%s:%d: Date mismatch."
-					 " child->end=%p != %p=native->start\n",
+					 " child->end=%d != %d=native->start\n",
 					 __FILE__, __func__, __LINE__,
 					child->end, native->start);
 	} else if(native->start != introgressor->start) {
 		eprintf("%s:%s:%d: Date mismatch."
-				 "native->start=%p != %p=introgressor->start\n",
+				 "native->start=%d != %d=introgressor->start\n",
 				 __FILE__, __func__, __LINE__,
 				 native->start, introgressor->start);
     } else
         child->end = native->start;
 
-    child->parent[0] = native;
-    child->parent[1] = introgressor;
+    child->parent[0] = native->ndx;
+    child->parent[1] = introgressor->ndx;
     child->nparents = 2;
-    child->mix = mPtr;
+    child->mix = mix;
     child->mixFree = mixFree;
-    introgressor->child[introgressor->nchildren] = child;
+    introgressor->child[introgressor->nchildren] = child->ndx;
     ++introgressor->nchildren;
-    native->child[native->nchildren] = child;
+    native->child[native->nchildren] = child->ndx;
     ++native->nchildren;
     PopNode_sanityCheck(child, __FILE__, __LINE__);
     PopNode_sanityCheck(introgressor, __FILE__, __LINE__);
     PopNode_sanityCheck(native, __FILE__, __LINE__);
 }
 
-/// PopNode constructor
-void PopNode_newGene(PopNode * self, unsigned ndx) {
-    assert(1 + self->nsamples < MAXSAMP);
+/// Add a new Gene, allocated from GeneStore gs, to the samples of
+/// PopNode self. The Gene's tipId has a single bit set: bit ndx. Its
+/// birth is the start of the PopNode, so the start time must be set
+/// before this function is called.
+/// @param[in] par array of parameter values
+void PopNode_newGene(PopNode * self, const double *par, unsigned ndx,
+                     GeneStore * gs) {
+    assert(self->nsamples < self->maxsamp);
     assert(ndx < 8*sizeof(tipId_t));
 
     static const tipId_t one = 1;
-    Gene       *gene = Gene_new(one << ndx);
-    CHECKMEM(gene);
+    Gene       *gene = Gene_new(one << ndx, par[self->start], gs);
     self->sample[self->nsamples] = gene;
     ++self->nsamples;
     PopNode_sanityCheck(self, __FILE__, __LINE__);
 }
 
-/// Coalesce gene tree within population tree.
-Gene       *PopNode_coalesce(PopNode * self, gsl_rng * rng) {
-    unsigned long i, j, k;
-    double      x;
-	double end = (NULL==self->end ? HUGE_VAL : *self->end);
+/// Add to bt the expected lengths of all branches that will descend
+/// from the lineages of self, which has no upper bound, as those
+/// lineages coalesce. Lineages are born at their own birth times, but
+/// the coalescent process starts at time t. Among k lineages, the
+/// expected total length of branches ancestral to exactly m of them
+/// is 2*twoN/m, where twoN is the haploid population size, and each
+/// subset of size m is equally likely to be the one beneath a given
+/// branch.
+static void PopNode_tailExpectation(PopNode * self, double t,
+                                    double twoN, BranchTab * bt,
+                                    int doSing) {
+    int         i, m, k = self->nsamples;
+    unsigned long mask, all = (1UL << k) - 1;
+    double      w[k];           // expected length of one m-subset
+
+    assert(k <= POPNODE_MAXTAIL);
+
+    // w[m] = 2*twoN / (m * choose(k,m))
+    double      choose = 1.0;
+    for(m = 1; m < k; ++m) {
+        choose = choose * (k - m + 1) / m;
+        w[m] = 2.0 * twoN / (m * choose);
+    }
 
-    if(self->child[0])
-        (void) PopNode_coalesce(self->child[0], rng);
-    if(self->child[1])
-        (void) PopNode_coalesce(self->child[1], rng);
+    // Each single lineage has its sampled length so far, plus the
+    // expected remainder.
+    for(i = 0; i < k; ++i)
+        Gene_tabulate(self->sample[i], t + w[1], bt, doSing);
+
+    // Branches ancestral to 2 or more current lineages. Their tipIds
+    // are unions of disjoint nonzero sets, so none is a singleton.
+    for(mask = 1; mask < all; ++mask) {
+        m = __builtin_popcountl(mask);
+        if(m < 2)
+            continue;
+        tipId_t     tip = 0;
+        for(i = 0; i < k; ++i)
+            if(mask & (1UL << i))
+                tip |= self->sample[i]->tipId;
+        BranchTab_add(bt, tip, w[m]);
+    }
+}
 
-    double      t = *self->start;
+/// Copy the current parameter values of each of the nseg PopNode
+/// objects in pnv into sp[0..nseg-1]. This must be repeated whenever
+/// par changes.
+void PopNode_segPars(int nseg, const PopNode *pnv, const double *par,
+                     SegPar *sp) {
+    int         i;
+    for(i = 0; i < nseg; ++i) {
+        const PopNode *node = pnv + i;
+        sp[i].start = par[node->start];
+        sp[i].end = (node->end < 0 ? HUGE_VAL : par[node->end]);
+        sp[i].twoN = par[node->twoN];
+        sp[i].mix = (node->nparents == 2 ? par[node->mix] : 0.0);
+    }
+}
+
+/// Coalesce gene tree within population tree. New Gene objects are
+/// allocated from gs. Descendants are not processed, so each child
+/// must be coalesced before its parents. Lineages are not linked
+/// into a tree. Instead, the branch of each lineage is added to
+/// BranchTab bt at the moment it coalesces. The root lineage, which
+/// never coalesces, is returned but not tabulated. If doSing is zero,
+/// singleton branches are not tabulated.
+///
+/// If tailK > 0 and self has no upper bound, coalescent events are
+/// simulated only until tailK or fewer lineages remain. Expected
+/// branch lengths, conditional on those lineages, are then added to bt
+/// in place of sampled ones, and the remaining lineages are joined
+/// without further tabulation. This reduces the variance of each
+/// replicate without changing its expectation.
+/// @param[inout] pnv array of PopNode objects, including self
+/// @param[in] sp parameter values of each PopNode in pnv, as set by
+/// PopNode_segPars
+/// @param[inout] stat if not NULL, the sufficient statistics of the
+/// gene genealogy within self are added to *stat. See SegStat.
+Gene       *PopNode_coalesce(PopNode * self, PopNode *pnv,
+                             const SegPar *sp, GeneStore * gs,
+                             BranchTab * bt, int doSing, int tailK,
+                             SegStat * stat, gsl_rng * rng) {
+    unsigned long i, j, k;
+    double      x;
+    const SegPar *seg = sp + self->ndx;
+	double end = seg->end;
+    double      t = seg->start;
+    const double twoN = seg->twoN;
 #ifndef NDEBUG
     if(t > end) {
         fflush(stdout);
 		fprintf(stderr, "ERROR:%s:%s:%d: start=%lf > %lf=end\n",
 				__FILE__,__func__,__LINE__, t, end);
-        PopNode_print(stderr, self, 0);
         exit(1);
 	}
 #endif
@@ -385,21 +449,26 @@ Gene       *PopNode_coalesce(PopNode * self, gsl_rng * rng) {
     // Coalescent loop continues until only one sample is left
     // or we reach the end of the interval.
     while(self->nsamples > 1 && t < end) {
+        if(self->nsamples <= tailK && self->end < 0)
+            break;
         {
             int         n = self->nsamples;
-            double      mean = 2.0 * *self->twoN / (n * (n - 1));
-			x = gsl_ran_exponential(rng, mean);
+            double      mean = 2.0 * twoN / (n * (n - 1));
+			x = FastRng_exponential(rng, mean);
         }
 
+        if(stat)
+            stat->pairTime += 0.5 * self->nsamples * (self->nsamples - 1)
+                * fmin(x, end - t);
         if(t + x < end) {
             // coalescent event within interval
             t += x;
-            for(i = 0; i < self->nsamples; ++i)
-                Gene_addToBranch(self->sample[i], x);
+            if(stat)
+                ++stat->ncoal;
 
             // choose a random pair to join
-            i = gsl_rng_uniform_int(rng, self->nsamples);
-            j = gsl_rng_uniform_int(rng, self->nsamples - 1);
+            i = FastRng_uniformInt(rng, self->nsamples);
+            j = FastRng_uniformInt(rng, self->nsamples - 1);
             if(j >= i)
                 ++j;
             if(j < i) {
@@ -409,8 +478,12 @@ Gene       *PopNode_coalesce(PopNode * self, gsl_rng * rng) {
             }
             assert(i < j);
 
-            self->sample[i] = Gene_join(self->sample[i], self->sample[j]);
-            CHECKMEM(self->sample[i]);
+            // The branches of the two children end here.
+            Gene_tabulate(self->sample[i], t, bt, doSing);
+            Gene_tabulate(self->sample[j], t, bt, doSing);
+
+            self->sample[i] = Gene_join(self->sample[i], self->sample[j],
+                                        t, gs);
             --self->nsamples;
             if(j != self->nsamples) {
                 self->sample[j] = self->sample[self->nsamples];
@@ -419,44 +492,55 @@ Gene       *PopNode_coalesce(PopNode * self, gsl_rng * rng) {
         } else {
             // no coalescent event within interval
 			assert(isfinite(end));
-            x = end - t;
-            for(i = 0; i < self->nsamples; ++i)
-                Gene_addToBranch(self->sample[i], x);
             t = end;
         }
     }
 
+    if(self->nsamples > 1 && self->end < 0) {
+        PopNode_tailExpectation(self, t, twoN, bt, doSing);
+        while(self->nsamples > 1) {
+            --self->nsamples;
+            self->sample[0] = Gene_join(self->sample[0],
+                                        self->sample[self->nsamples], t, gs);
+            self->sample[self->nsamples] = NULL;
+        }
+    }
+
     // Make sure we're at the end of the interval
     if(t < end) {
         assert(self->nsamples < 2);
-        x = end - t;  // may be infinite
-        for(i = 0; i < self->nsamples; ++i)
-            Gene_addToBranch(self->sample[i], x);
         t = end;      // may be infinite
     }
 
     // If we have both samples and parents, then move samples to parents
     if(self->nsamples > 0 && self->nparents > 0) {
         assert(t == end);
-		assert(NULL!=self->mix || self->nparents <= 1);
+		assert(self->mix >= 0 || self->nparents <= 1);
+        PopNode *par0 = pnv + self->parent[0];
 		switch(self->nparents) {
 		case 1:
 			// add all samples to parent 0
 			for(i = 0; i < self->nsamples; ++i) {
 				assert(self->sample[i]);
-                PopNode_addSample(self->parent[0], self->sample[i]);
+                PopNode_addSample(par0, self->sample[i]);
 			}
 			break;
 		default:
 			// distribute samples among parents
 			assert(self->nparents==2);
+            PopNode *par1 = pnv + self->parent[1];
+            double mix = seg->mix;
 			for(i = 0; i < self->nsamples; ++i) {
-				if(gsl_rng_uniform(rng) < *self->mix) {
+				if(FastRng_uniform(rng) < mix) {
 					assert(self->sample[i]);
-					PopNode_addSample(self->parent[1], self->sample[i]);
+					PopNode_addSample(par1, self->sample[i]);
+                    if(stat)
+                        ++stat->nmix[1];
 				} else {
 					assert(self->sample[i]);
-					PopNode_addSample(self->parent[0], self->sample[i]);
+					PopNode_addSample(par0, self->sample[i]);
+                    if(stat)
+                        ++stat->nmix[0];
 				}
 			}
 		}
@@ -472,72 +556,43 @@ void PopNode_free(PopNode * self) {
     free(self);
 }
 
-/// Randomly perturb all free parameters in tree while maintaining
-/// inequality constraints.
-void PopNode_randomize(PopNode *self, Bounds bnd, ParStore *parstore,
-                       gsl_rng *rng) {
-    do{
-        PopNode_untouch(self);
-        PopNode_randomize_r(self, bnd, parstore, rng);
-    }while(!PopNode_feasible(self, bnd, 0));
-}
-
-/// Recurse through the tree perturbing free parameters. Must call
-/// PopNode_untouch before calling this function.
-static void PopNode_randomize_r(PopNode *self, Bounds bnd,
-                                ParStore *parstore, gsl_rng *rng) {
-
-	// If parents have been touched, then randomize this
-	// node. Otherwise, postpone.
-	bool postpone = false;
-	switch(self->nparents) {
-	case 0:
-		postpone = false;
-		break;
-	case 2:
-		if(!self->parent[1]->touched) {
-			postpone = true;
-			break;
-		}
-		// fall through
-	case 1:
-		assert(self->parent[0]->touched);
-		break;
-	default:
-            fprintf(stderr,"%s:%s:%d: bad value of nparents: %d\n",
-                    __FILE__,__func__,__LINE__, self->nparents);
-            exit(EXIT_FAILURE);
-	}
-
-	if(postpone)
-		return;
-
-    // perturb self->twoN
+/// Randomly perturb the free parameters of a single PopNode. Does
+/// not process descendants. Parents must be randomized before their
+/// children, because the start time of each node is constrained by
+/// those of its parents and children. The caller must check that the
+/// resulting parameters are feasible.
+/// @param[in] pnv array of PopNode objects, including self
+void PopNode_randomize(PopNode *self, const PopNode *pnv, Bounds bnd,
+                       ParStore *parstore, gsl_rng *rng) {
+    double *par = ParStore_values(parstore);
+
+    // perturb twoN
     if(self->twoNfree)
-        *self->twoN = dtnorm(*self->twoN, 10000.0, bnd.lo_twoN,
-                             bnd.hi_twoN, rng);
+        par[self->twoN] = dtnorm(par[self->twoN], 10000.0, bnd.lo_twoN,
+                                 bnd.hi_twoN, rng);
 
-    // perturb self->start
+    // perturb start
     if(self->startFree) {
+        const PopNode *p0, *p1, *c0, *c1;
 
         // hi_t is the minimum age of parents or bnd.hi_t
         double hi_t = bnd.hi_t;
         switch(self->nparents) {
         case 0:
-            hi_t = fmin(hi_t, *self->start
+            hi_t = fmin(hi_t, par[self->start]
 						+ gsl_ran_exponential(rng, 10000.0));
             break;
         case 1:
-			assert(self->parent[0]->touched);
-            ParStore_constrain_ptr(parstore, self->parent[0]->start);
-			hi_t = *self->parent[0]->start;
+            p0 = pnv + self->parent[0];
+            ParStore_constrain_ndx(parstore, p0->start);
+			hi_t = par[p0->start];
             break;
         case 2:
-			assert(self->parent[0]->touched);
-			assert(self->parent[1]->touched);
-            ParStore_constrain_ptr(parstore, self->parent[0]->start);
-            ParStore_constrain_ptr(parstore, self->parent[1]->start);
-			hi_t = fmin(*self->parent[0]->start, *self->parent[1]->start);
+            p0 = pnv + self->parent[0];
+            p1 = pnv + self->parent[1];
+            ParStore_constrain_ndx(parstore, p0->start);
+            ParStore_constrain_ndx(parstore, p1->start);
+			hi_t = fmin(par[p0->start], par[p1->start]);
             break;
         default:
             fprintf(stderr,"%s:%s:%d: bad value of nparents: %d\n",
@@ -551,158 +606,145 @@ static void PopNode_randomize_r(PopNode *self, Bounds bnd,
         case 0:
             break;
         case 1:
-            ParStore_constrain_ptr(parstore, self->child[0]->start);
-            lo_t = *self->child[0]->start;
+            c0 = pnv + self->child[0];
+            ParStore_constrain_ndx(parstore, c0->start);
+            lo_t = par[c0->start];
             break;
         case 2:
-            ParStore_constrain_ptr(parstore, self->child[0]->start);
-            ParStore_constrain_ptr(parstore, self->child[1]->start);
-            lo_t = fmax(*self->child[0]->start, *self->child[1]->start);
+            c0 = pnv + self->child[0];
+            c1 = pnv + self->child[1];
+            ParStore_constrain_ndx(parstore, c0->start);
+            ParStore_constrain_ndx(parstore, c1->start);
+            lo_t = fmax(par[c0->start], par[c1->start]);
             break;
         default:
             fprintf(stderr,"%s:%s:%d: bad value of nchildren: %d\n",
                     __FILE__,__func__,__LINE__, self->nchildren);
             exit(EXIT_FAILURE);
         }
-		*self->start = gsl_ran_flat(rng, lo_t, hi_t);
+		par[self->start] = gsl_ran_flat(rng, lo_t, hi_t);
     }
 
     if(self->mixFree) {
-        assert(self->mix);
-        *self->mix = gsl_ran_beta(rng, 1.0, 5.0);
+        assert(self->mix >= 0);
+        par[self->mix] = gsl_ran_beta(rng, 1.0, 5.0);
     }
-
-	self->touched = true;
-
-    int i;
-    for(i=0; i < self->nchildren; ++i)
-        PopNode_randomize_r(self->child[i], bnd, parstore, rng);
 }
 
-/// Reset the value of each Gaussian parameter by sampling from the
-/// relevant distribution.
-void PopNode_gaussian(PopNode *self, Bounds bnd,
-                      ParStore *ps, gsl_rng *rng) {
-	PopNode_untouch(self);
-    ParStore_constrain(ps);
-	PopNode_gaussian_r(self, bnd, ps, rng);
+/// Return 1 if ndx refers to a Gaussian parameter, or 0 otherwise.
+static int isGaussian(int ndx) {
+    return ndx >= 0 && ndx / MAXPAR == Gaussian;
 }
 
-/// Traverse the population tree to reset the value of each Gaussian
-/// parameter by sampling from the relevant distribution.
-/// Call PopNode_untouch before calling this function.
-static void PopNode_gaussian_r(PopNode *self, Bounds bnd,
-                               ParStore *ps, gsl_rng *rng) {
-
-	// If parents are untouched, postpone this node.
-	bool postpone = false;
-	switch(self->nparents) {
-	case 0:
-		postpone = false;
-		break;
-	case 2:
-		if(!self->parent[1]->touched) {
-			postpone = true;
-			break;
-		}
-		// fall through
-	case 1:
-		assert(self->parent[0]->touched);
-		break;
-	default:
-            fprintf(stderr,"%s:%s:%d: bad value of nparents: %d\n",
-                    __FILE__,__func__,__LINE__, self->nparents);
-            exit(EXIT_FAILURE);
-	}
-
-	if(postpone)
-		return;
-
-    // perturb self->twoN
-    ParStore_sample(ps, self->twoN, bnd.lo_twoN, bnd.hi_twoN, rng);
-
-    // perturb self->start
-    // hi_t is the minimum age of parents or bnd.hi_t
-    double hi_t = bnd.hi_t;
-    switch(self->nparents) {
-    case 0:
-        hi_t = fmin(hi_t, *self->start
-                    + gsl_ran_exponential(rng, 10000.0));
-        break;
-    case 1:
-        assert(self->parent[0]->touched);
-        hi_t = *self->parent[0]->start;
-        break;
-    case 2:
-        assert(self->parent[0]->touched);
-        assert(self->parent[1]->touched);
-        hi_t = fmin(*self->parent[0]->start, *self->parent[1]->start);
-        break;
-    default:
-        fprintf(stderr,"%s:%s:%d: bad value of nparents: %d\n",
-                __FILE__,__func__,__LINE__, self->nparents);
-        exit(EXIT_FAILURE);
+/// Describe the Gaussian parameters of a single PopNode, and the
+/// bounds within which each is sampled, in array gp, which must have
+/// room for 3 entries. Return the number of entries. Entries appear
+/// in the order twoN, start, mix. Processing a list built by calling
+/// this function on each node, parents before children, resamples
+/// all Gaussian parameters. See GaussPar_sample.
+/// @param[in] pnv array of PopNode objects, including self
+int PopNode_gaussPars(const PopNode *self, const PopNode *pnv, Bounds bnd,
+                      GaussPar gp[3]) {
+    int n = 0;
+
+    if(isGaussian(self->twoN)) {
+        gp[n] = (GaussPar) {
+            .ndx = self->twoN, .lo = bnd.lo_twoN, .hi = bnd.hi_twoN,
+            .loNdx = {-1, -1}, .hiNdx = {-1, -1}, .expHi = false};
+        ++n;
     }
 
-    // lo_t is the maximum age of children or bnd.lo_t
-    double lo_t = bnd.lo_t;
-    switch(self->nchildren) {
-    case 0:
-        break;
-    case 1:
-        lo_t = *self->child[0]->start;
-        break;
-    case 2:
-        lo_t = fmax(*self->child[0]->start, *self->child[1]->start);
-        break;
-    default:
-        fprintf(stderr,"%s:%s:%d: bad value of nchildren: %d\n",
-                __FILE__,__func__,__LINE__, self->nchildren);
-        exit(EXIT_FAILURE);
+    // A start time lies between the ages of children and parents, or
+    // within bnd if there are none. The upper bound of the root's
+    // start time is random.
+    if(isGaussian(self->start)) {
+        GaussPar *g = gp + n;
+        *g = (GaussPar) {
+            .ndx = self->start, .lo = -HUGE_VAL, .hi = HUGE_VAL,
+            .loNdx = {-1, -1}, .hiNdx = {-1, -1}, .expHi = false};
+        if(self->nparents == 0) {
+            g->hi = bnd.hi_t;
+            g->expHi = true;
+        }
+        for(int i = 0; i < self->nparents; ++i)
+            g->hiNdx[i] = pnv[self->parent[i]].start;
+        if(self->nchildren == 0)
+            g->lo = bnd.lo_t;
+        for(int i = 0; i < self->nchildren; ++i)
+            g->loNdx[i] = pnv[self->child[i]].start;
+        ++n;
     }
-    ParStore_sample(ps, self->start, lo_t, hi_t, rng);
 
-    // Perturb mix probability
-    ParStore_sample(ps, self->mix, 0.0, 1.0, rng);
-
-	self->touched = true;
+    if(isGaussian(self->mix)) {
+        gp[n] = (GaussPar) {
+            .ndx = self->mix, .lo = 0.0, .hi = 1.0,
+            .loNdx = {-1, -1}, .hiNdx = {-1, -1}, .expHi = false};
+        ++n;
+    }
+    return n;
+}
 
-    int i;
-    for(i=0; i < self->nchildren; ++i)
-        PopNode_gaussian_r(self->child[i], bnd, ps, rng);
+/// Resample Gaussian parameters, processing the entries of gp in
+/// order. Constrained parameters must be up to date on entry.
+void GaussPar_sample(int n, const GaussPar gp[n], ParStore *ps,
+                     gsl_rng *rng) {
+    const double *par = ParStore_values(ps);
+    for(int i = 0; i < n; ++i) {
+        const GaussPar *g = gp + i;
+        double lo = g->lo, hi = g->hi;
+        if(g->expHi)
+            hi = fmin(hi, par[g->ndx] + gsl_ran_exponential(rng, 10000.0));
+        for(int j = 0; j < 2; ++j) {
+            if(g->hiNdx[j] >= 0)
+                hi = fmin(hi, par[g->hiNdx[j]]);
+            if(g->loNdx[j] >= 0)
+                lo = fmax(lo, par[g->loNdx[j]]);
+        }
+        ParStore_sample(ps, g->ndx, lo, hi, rng);
+    }
 }
 
-/// Return 1 if parameters satisfy inequality constraints, or 0 otherwise.
-int PopNode_feasible(const PopNode *self, Bounds bnd, int verbose) {
-	if( *self->twoN < bnd.lo_twoN || *self->twoN > bnd.hi_twoN) {
+/// Return 1 if parameters of a single PopNode satisfy inequality
+/// constraints, or 0 otherwise. Does not check descendants.
+/// @param[in] pnv array of PopNode objects, including self
+/// @param[in] par array of parameter values
+int PopNode_feasible(const PopNode *self, const PopNode *pnv,
+                     const double *par, Bounds bnd, int verbose) {
+    double twoN = par[self->twoN];
+    double start = par[self->start];
+    double t;
+
+	if( twoN < bnd.lo_twoN || twoN > bnd.hi_twoN) {
         if(verbose)
             fprintf(stderr,"%s FAIL: twoN=%lg not in [%lg, %lg]\n",
-                    __func__, *self->twoN, bnd.lo_twoN, bnd.hi_twoN);
+                    __func__, twoN, bnd.lo_twoN, bnd.hi_twoN);
 		return 0;
     }
 
-	if( *self->start > bnd.hi_t || *self->start < bnd.lo_t) {
+	if( start > bnd.hi_t || start < bnd.lo_t) {
         if(verbose)
             fprintf(stderr,"%s FAIL: start=%lg not in [%lg, %lg]\n",
-                    __func__, *self->start,
+                    __func__, start,
                     bnd.lo_t, bnd.hi_t);
 		return 0;
     }
 
 	switch(self->nparents) {
 	case 2:
-		if(*self->start > *self->parent[1]->start) {
+        t = par[pnv[self->parent[1]].start];
+		if(start > t) {
             if(verbose)
                 fprintf(stderr,"%s FAIL: child=%lg older than parent=%lg\n",
-                        __func__, *self->start, *self->parent[1]->start);
+                        __func__, start, t);
             return 0;
         }
 		// fall through
 	case 1:
-		if(*self->start > *self->parent[0]->start) {
+        t = par[pnv[self->parent[0]].start];
+		if(start > t) {
             if(verbose)
                 fprintf(stderr,"%s FAIL: child=%lg older than parent=%lg\n",
-                        __func__, *self->start, *self->parent[0]->start);
+                        __func__, start, t);
 			return 0;
         }
 		break;
@@ -712,18 +754,20 @@ int PopNode_feasible(const PopNode *self, Bounds bnd, int verbose) {
 
 	switch(self->nchildren) {
 	case 2:
-		if(*self->start < *self->child[1]->start) {
+        t = par[pnv[self->child[1]].start];
+		if(start < t) {
             if(verbose)
                 fprintf(stderr,"%s FAIL: parent=%lg younger than child=%lg\n",
-                        __func__, *self->start, *self->child[1]->start);
+                        __func__, start, t);
 			return 0;
         }
 		// fall through
 	case 1:
-		if(*self->start < *self->child[0]->start) {
+        t = par[pnv[self->child[0]].start];
+		if(start < t) {
             if(verbose)
                 fprintf(stderr,"%s FAIL: parent=%lg younger than child=%lg\n",
-                        __func__, *self->start, *self->child[0]->start);
+                        __func__, start, t);
 			return 0;
         }
 		break;
@@ -731,43 +775,19 @@ int PopNode_feasible(const PopNode *self, Bounds bnd, int verbose) {
 		break;
 	}
 
-    if(self->mix != NULL) {
-		if(*self->mix < 0.0 || *self->mix > 1.0) {
+    if(self->mix >= 0) {
+        double mix = par[self->mix];
+		if(mix < 0.0 || mix > 1.0) {
             if(verbose)
                 fprintf(stderr,"%s FAIL: mix=%lg not in [0, 1]\n",
-                        __func__, *self->twoN);
+                        __func__, mix);
 			return 0;
         }
     }
 
-    int i;
-    for(i=0; i < self->nchildren; ++i) {
-        if(0==PopNode_feasible(self->child[i], bnd, verbose))
-		   return 0;
-	}
 	return 1;
 }
 
-/// Add dp to each parameter pointer, using ordinary (not pointer)
-/// arithmetic.
-void PopNode_shiftParamPtrs(PopNode *self, size_t dp, int sign) {
-    SHIFT_PTR(self->twoN, dp, sign);
-    SHIFT_PTR(self->start, dp, sign);
-    SHIFT_PTR(self->end, dp, sign);
-    SHIFT_PTR(self->mix, dp, sign);
-}
-
-/// Add dp to each PopNode pointer, using ordinary (not pointer)
-/// arithmetic.
-void PopNode_shiftPopNodePtrs(PopNode *self, size_t dp, int sign) {
-    int i;
-    for(i=0; i < self->nparents; ++i)
-        SHIFT_PTR(self->parent[i], dp, sign);
-
-    for(i=0; i < self->nchildren; ++i)
-        SHIFT_PTR(self->child[i], dp, sign);
-}
-
 /// Allocate a new NodeStore, which provides an interface
 /// for getting PopNode objects, one at a time, out
 /// of a previously-allocated array v.
@@ -809,29 +829,31 @@ void SampNdx_init(SampNdx * self) {
 void SampNdx_addSamples(SampNdx * self, unsigned nsamples,
 						PopNode * pnode) {
     unsigned    i;
-    if(self->n + nsamples >= MAXSAMP)
+    if(self->n + nsamples > MAXSAMP)
         eprintf("%s:%s:%d: too many samples\n", __FILE__, __func__, __LINE__);
     for(i = 0; i < nsamples; ++i) {
-        self->node[self->n] = pnode;
+        self->node[self->n] = pnode->ndx;
         self->n += 1;
     }
 }
 
 /// Put samples into the gene tree. Should be done at the start of
-/// each simulation.
-void SampNdx_populateTree(SampNdx * self) {
+/// each simulation. Genes are allocated from gs.
+/// @param[inout] pnv array of PopNode objects
+/// @param[in] par array of parameter values
+void SampNdx_populateTree(SampNdx * self, PopNode *pnv, const double *par,
+                          GeneStore * gs) {
     unsigned    i;
     for(i = 0; i < self->n; ++i)
-        PopNode_newGene(self->node[i], i);
+        PopNode_newGene(pnv + self->node[i], par, i, gs);
 }
 
 unsigned SampNdx_size(SampNdx * self) {
     return self->n;
 }
 
-/// This equality check doesn't do much, because the pointers in
-/// different SampNdx objects don't have to be (in fact shouldn't be)
-/// equal.
+/// This equality check compares the number of samples and the index
+/// of the PopNode that contains each sample.
 int         SampNdx_equals(const SampNdx *lhs, const SampNdx *rhs){
     if(lhs==NULL && rhs==NULL)
         return 1;
@@ -839,44 +861,57 @@ int         SampNdx_equals(const SampNdx *lhs, const SampNdx *rhs){
         return 0;
     if(lhs->n != rhs->n)
         return 0;
-    return 1;
+    return 0 == memcmp(lhs->node, rhs->node, lhs->n * sizeof(lhs->node[0]));
 }
 
 /// Check sanity of a SampNdx.
 void        SampNdx_sanityCheck(SampNdx *self, const char *file, int line) {
 #ifndef NDEBUG
     REQUIRE(self != NULL, file, line);
-    REQUIRE(self->n < MAXSAMP, file, line);
+    REQUIRE(self->n <= MAXSAMP, file, line);
     int i;
     for(i=0; i < self->n; ++i)
-        REQUIRE(NULL != self->node[i], file, line);
+        REQUIRE(self->node[i] >= 0, file, line);
 #endif
 }
 
-/// Return 1 if all pointers in SampNdx are in [start,end); return 0
+/// Return 1 if all indices in SampNdx are in [0,nseg); return 0
 /// otherwise.
-int SampNdx_ptrsLegal(SampNdx *self, PopNode *start, PopNode *end) {
+int SampNdx_ndxLegal(const SampNdx *self, int nseg) {
     int i;
     assert(self);
     for(i=0; i < self->n; ++i) {
-        if(self->node[i] < start || self->node[i] >= end)
+        if(self->node[i] < 0 || self->node[i] >= nseg)
             return 0;
     }
     return 1;
 }
 
-/// Shift all pointers within SampNdx by an offset of magnitude
-/// dpop. If sign > 0, the shift is positive; otherwise it is
-/// negative.
-void SampNdx_shiftPtrs(SampNdx *self, size_t dpop, int sign) {
-    int i;
-    for(i=0; i < self->n; ++i)
-        SHIFT_PTR(self->node[i], dpop, sign);
+/// Set maxsamp[i] to the largest number of lineages that can be
+/// present at once in PopNode pnv[i]. This is the number of samples
+/// that descend from it along any path. Array order lists nodes with
+/// children before parents, as in PopNode_postorder. Return the sum
+/// of maxsamp.
+int SampNdx_maxLineages(const SampNdx *self, int nseg, const PopNode *pnv,
+                        const int order[nseg], int maxsamp[nseg]) {
+    tipId_t     desc[nseg];     // samples descending from each node
+    int         i, j, total = 0;
+    memset(desc, 0, sizeof(desc));
+    for(i = 0; i < self->n; ++i)
+        desc[self->node[i]] |= ((tipId_t) 1) << i;
+    for(i = 0; i < nseg; ++i) {
+        const PopNode *node = pnv + order[i];
+        for(j = 0; j < node->nchildren; ++j)
+            desc[order[i]] |= desc[node->child[j]];
+        maxsamp[order[i]] = num1bits(desc[order[i]]);
+        total += maxsamp[order[i]];
+    }
+    return total;
 }
 
-
 #ifdef TEST
 
+#include "branchtab.h"
 #include <string.h>
 #include <assert.h>
 #include <time.h>
@@ -925,37 +960,56 @@ int main(int argc, char **argv) {
         .hi_t = 1e5
     };
 
-    double twoN0 = 1.0, start0= 0.0;
+    ParStore *ps = ParStore_new();
+    ParamStatus pstat;
+    ParStore_addFreePar(ps, 1.0, 0.0, 1e9, "twoN0");
+    ParStore_addFreePar(ps, 0.0, 0.0, 1e5, "start0");
+    ParStore_addFreePar(ps, 100.0, 0.0, 1e9, "twoN1");
+    ParStore_addFreePar(ps, 123.0, 0.0, 1e5, "start1");
+    int twoN0 = ParStore_findNdx(ps, &pstat, "twoN0");
+    int start0 = ParStore_findNdx(ps, &pstat, "start0");
+    int twoN1 = ParStore_findNdx(ps, &pstat, "twoN1");
+    int start1 = ParStore_findNdx(ps, &pstat, "start1");
+    double *par = ParStore_values(ps);
+    assert(par[twoN1] == 100.0);
+    assert(par[start1] == 123.0);
+
     bool twoNfree = true;
     bool startFree = true;
-    PopNode *p0 = PopNode_new(&twoN0, twoNfree,
-                              &start0, startFree, ns);
-    assert(p0->twoN == &twoN0);
-    assert(p0->start == &start0);
-    assert(p0->end == NULL);
-    assert(p0->mix == NULL);
+    PopNode *p0 = PopNode_new(twoN0, twoNfree,
+                              start0, startFree, ns);
+    assert(p0->ndx == 0);
+    assert(p0->twoN == twoN0);
+    assert(p0->start == start0);
+    assert(p0->end == -1);
+    assert(p0->mix == -1);
     assert(p0->nsamples == 0);
     assert(p0->nchildren == 0);
-    assert(p0->child[0] == NULL);
-    assert(p0->child[1] == NULL);
-    assert(p0->parent[0] == NULL);
-    assert(p0->parent[1] == NULL);
-
-    double twoN1 = 100.0, start1= 123.0;
-    PopNode *p1 = PopNode_new(&twoN1, twoNfree, &start1, startFree, ns);
-    assert(p1->twoN == &twoN1);
-    assert(p1->start == &start1);
-    assert(p1->end == NULL);
-    assert(p1->mix == NULL);
+    assert(p0->child[0] == -1);
+    assert(p0->child[1] == -1);
+    assert(p0->parent[0] == -1);
+    assert(p0->parent[1] == -1);
+
+    PopNode *p1 = PopNode_new(twoN1, twoNfree, start1, startFree, ns);
+    Gene *buff[4][MAXSAMP];
+    PopNode_setBuffer(p0, buff[0], MAXSAMP);
+    PopNode_setBuffer(p1, buff[1], MAXSAMP);
+    assert(p1->ndx == 1);
+    assert(p1->twoN == twoN1);
+    assert(p1->start == start1);
+    assert(p1->end == -1);
+    assert(p1->mix == -1);
     assert(p1->nsamples == 0);
     assert(p1->nchildren == 0);
-    assert(p1->child[0] == NULL);
-    assert(p1->child[1] == NULL);
-    assert(p1->parent[0] == NULL);
-    assert(p1->parent[1] == NULL);
-
-    Gene *g1 = Gene_new(id1);
-    Gene *g2 = Gene_new(id2);
+    assert(p1->child[0] == -1);
+    assert(p1->child[1] == -1);
+    assert(p1->parent[0] == -1);
+    assert(p1->parent[1] == -1);
+
+    GeneStore *gs = GeneStore_new(10);
+    CHECKMEM(gs);
+    Gene *g1 = Gene_new(id1, 0.0, gs);
+    Gene *g2 = Gene_new(id2, 0.0, gs);
     PopNode_addSample(p1, g1);
     PopNode_addSample(p1, g2);
     assert(p1->nsamples == 2);
@@ -963,47 +1017,99 @@ int main(int argc, char **argv) {
     PopNode_addChild(p1, p0);
     assert(p1->nchildren == 1);
     assert(p0->nparents == 1);
-    assert(p1->child[0] == p0);
-    assert(p0->parent[0] == p1);
+    assert(p1->child[0] == p0->ndx);
+    assert(p0->parent[0] == p1->ndx);
+    assert(p0->end == p1->start);
 
 	if(verbose) {
         printf("Before randomization\n");
-		PopNode_printShallow(p1, stdout);
-		PopNode_printShallow(p0, stdout);
+		PopNode_printShallow(p1, par, stdout);
+		PopNode_printShallow(p0, par, stdout);
     }
 
-    ParStore *ps = ParStore_new();
     gsl_rng    *rng = gsl_rng_alloc(gsl_rng_taus);
     unsigned long rngseed = (unsigned long) time(NULL);
     gsl_rng_set(rng, rngseed);
-    PopNode_randomize(p1, bnd, ps, rng);
+    int order[nseg];
+    assert(2 == PopNode_postorder(p1->ndx, v, nseg, order));
+    assert(order[0] == 0);
+    assert(order[1] == 1);
+    do{
+        PopNode_randomize(p1, v, bnd, ps, rng);
+        PopNode_randomize(p0, v, bnd, ps, rng);
+    }while(!PopNode_feasible(p1, v, par, bnd, 0)
+           || !PopNode_feasible(p0, v, par, bnd, 0));
     gsl_rng_free(rng);
+    assert(par[start0] <= par[start1]);
 
 	if(verbose) {
         printf("After randomization\n");
-		PopNode_printShallow(p1, stdout);
-		PopNode_printShallow(p0, stdout);
+		PopNode_printShallow(p1, par, stdout);
+		PopNode_printShallow(p0, par, stdout);
     }
 
-    size_t twoNloc = (size_t) p1->twoN;
-    size_t startloc = (size_t) p1->start;
-    size_t endloc = (size_t) p1->end;
-    PopNode_shiftParamPtrs(p1, (size_t) 1u, 1);
-    assert(endloc==0u || twoNloc+1u == (size_t) p1->twoN);
-    assert(endloc==0u || startloc+1u == (size_t) p1->start);
-    assert(endloc==0u || endloc+1u == (size_t) p1->end);
+    // A copy made by memcpy has the same links.
+    PopNode w[2];
+    PopNode_clear(p1);
+    memcpy(w, v, sizeof(w));
+    assert(w[0].parent[0] == 1);
+    assert(w[1].child[0] == 0);
+    assert(PopNode_feasible(w+0, w, par, bnd, 0));
+    assert(PopNode_feasible(w+1, w, par, bnd, 0));
+
+    // With tailK=3, the 3 lineages of root p1 get expected branch
+    // lengths: 2N/3 for each singleton and N/3 for each pair.
+    {
+        tipId_t id4 = 4;
+        double t1 = par[start1], N = par[twoN1];
+        BranchTab *bt = BranchTab_new();
+        PopNode_addSample(p1, Gene_new(id1, t1, gs));
+        PopNode_addSample(p1, Gene_new(id2, t1, gs));
+        PopNode_addSample(p1, Gene_new(id4, t1, gs));
+        SegPar sp[2];
+        PopNode_segPars(2, v, par, sp);
+        Gene *root = PopNode_coalesce(p1, v, sp, gs, bt, 1, 3, NULL,
+                                      NULL);
+        assert(root);
+        assert(root->tipId == (id1|id2|id4));
+        assert(p1->nsamples == 1);
+        assert(BranchTab_size(bt) == 6);
+        assert(fabs(BranchTab_get(bt, id1) - 2.0*N/3) < 1e-9*N);
+        assert(fabs(BranchTab_get(bt, id4) - 2.0*N/3) < 1e-9*N);
+        assert(fabs(BranchTab_get(bt, id1|id2) - N/3) < 1e-9*N);
+        assert(fabs(BranchTab_get(bt, id2|id4) - N/3) < 1e-9*N);
+        BranchTab_free(bt);
+        PopNode_clear(p1);
+    }
 
-    int i;
-    size_t parent[2], child[2];
-    for(i=0; i < p1->nparents; ++i)
-        parent[i] = (size_t) p1->parent[i];
-    for(i=0; i < p1->nchildren; ++i)
-        child[i] = (size_t) p1->child[i];
-    PopNode_shiftPopNodePtrs(p1, (size_t) 1u, 1);
-    for(i=0; i < p1->nparents; ++i)
-        assert(parent[i]+1u == (size_t) p1->parent[i]);
-    for(i=0; i < p1->nchildren; ++i)
-        assert(child[i]+1u == (size_t) p1->child[i]);
+    // Free parameters need no resampling. A Gaussian start time in a
+    // node without parents or children is bounded by bnd.
+    {
+        GaussPar gp[3];
+        assert(0 == PopNode_gaussPars(p0, v, bnd, gp));
+        assert(0 == PopNode_gaussPars(p1, v, bnd, gp));
+
+        ParStore_addGaussianPar(ps, 50.0, 10.0, "startG");
+        int startG = ParStore_findNdx(ps, &pstat, "startG");
+        PopNode vg[1];
+        NodeStore *nsg = NodeStore_new(1, vg);
+        CHECKMEM(nsg);
+        PopNode *pg = PopNode_new(twoN1, twoNfree, startG, false, nsg);
+        assert(1 == PopNode_gaussPars(pg, vg, bnd, gp));
+        assert(gp[0].ndx == startG);
+        assert(gp[0].lo == bnd.lo_t);
+        assert(gp[0].hi == bnd.hi_t);
+        assert(gp[0].expHi);
+        assert(gp[0].loNdx[0] == -1 && gp[0].hiNdx[0] == -1);
+        gsl_rng *rng2 = gsl_rng_alloc(gsl_rng_taus);
+        for(int i = 0; i < 100; ++i) {
+            GaussPar_sample(1, gp, ps, rng2);
+            assert(par[startG] >= bnd.lo_t);
+            assert(par[startG] <= bnd.hi_t);
+        }
+        gsl_rng_free(rng2);
+        NodeStore_free(nsg);
+    }
 
     unitTstResult("PopNode", "untested");
 
@@ -1014,36 +1120,54 @@ int main(int argc, char **argv) {
     SampNdx_init(&sndx);
     assert(SampNdx_size(&sndx) == 0);
 
-	double twoN = 100.0;
-	double start = 20.0;
-    PopNode    *pnode = PopNode_new(&twoN, twoNfree, &start, startFree, ns);
+    PopNode    *pnode = PopNode_new(twoN0, twoNfree, start0, startFree, ns);
+    PopNode_setBuffer(pnode, buff[2], MAXSAMP);
     SampNdx_addSamples(&sndx, 1, pnode);
     SampNdx_addSamples(&sndx, 2, pnode);
-    assert(SampNdx_ptrsLegal(&sndx, v, v+nseg));
+    assert(SampNdx_ndxLegal(&sndx, nseg));
 
     assert(3 == SampNdx_size(&sndx));
-    SampNdx_populateTree(&sndx);
+    GeneStore_reset(gs);
+    SampNdx_populateTree(&sndx, v, par, gs);
     assert(3 == PopNode_nsamples(pnode));
+    assert(3 == GeneStore_size(gs));
     SampNdx_sanityCheck(&sndx, __FILE__, __LINE__);
     NodeStore_free(ns);
 
     SampNdx     sndx2 = {.n = 3 };
     SampNdx_init(&sndx2);
-	double twoN2 = 100.0;
-	double start2 = 20.0;
     PopNode v2[nseg];
     NodeStore *ns2 = NodeStore_new(nseg, v2);
-    CHECKMEM(ns);
-    pnode = PopNode_new(&twoN2, twoNfree, &start2, startFree, ns2);
+    CHECKMEM(ns2);
+    (void) PopNode_new(twoN1, twoNfree, start1, startFree, ns2);
+    (void) PopNode_new(twoN1, twoNfree, start1, startFree, ns2);
+    pnode = PopNode_new(twoN1, twoNfree, start1, startFree, ns2);
+    PopNode_setBuffer(pnode, buff[3], MAXSAMP);
     SampNdx_addSamples(&sndx2, 1, pnode);
     SampNdx_addSamples(&sndx2, 2, pnode);
-    SampNdx_populateTree(&sndx2);
+    GeneStore_reset(gs);
+    SampNdx_populateTree(&sndx2, v2, par, gs);
     NodeStore_free(ns2);
     SampNdx_sanityCheck(&sndx2, __FILE__, __LINE__);
     assert(SampNdx_equals(&sndx, &sndx2));
-    assert(SampNdx_ptrsLegal(&sndx2, v2, v2+nseg));
+    assert(SampNdx_ndxLegal(&sndx2, nseg));
+    assert(!SampNdx_ndxLegal(&sndx2, 2));
+
+    // Node 1 is the parent of node 0, and node 2 stands alone.
+    {
+        SampNdx     s3;
+        int         ord[3] = {0, 1, 2}, maxsamp[3];
+        SampNdx_init(&s3);
+        SampNdx_addSamples(&s3, 2, p0);
+        SampNdx_addSamples(&s3, 1, p1);
+        assert(5 == SampNdx_maxLineages(&s3, 3, v, ord, maxsamp));
+        assert(maxsamp[0] == 2);
+        assert(maxsamp[1] == 3);
+        assert(maxsamp[2] == 0);
+    }
 
     ParStore_free(ps);
+    GeneStore_free(gs);
 
 	unitTstResult("SampNdx", "OK");
 
@@ -8,67 +8,127 @@
 #  define POPNAMESIZE 30
 #  define MAXSAMP ((int)(8*sizeof(tipId_t)))
 
+// Largest number of lineages for which PopNode_coalesce will
+// tabulate expected rather than sampled branch lengths in the root.
+// The work is proportional to 2 to this power.
+#  define POPNODE_MAXTAIL 16
+
 struct SampNdx {
     // Array "node" contains an entry for each sample. That entry
-    // is a pointer to the node into which the sample should
+    // is the index of the PopNode into which the sample should
     // be placed. The sample gets a label of type tipIt_t. For sample
     // i, the label equals 2^i (i.e. 1<<i). There is another class,
     // called LblNdx, which maintains an array of labels. In that
     // array, the i'th label refers to the i'th sample in SampNdx.
     // I keep them separate, because LblNdx needs to be passed to
-    // functions that have no need to know about pointers to PopNode
-    // objects.
+    // functions that have no need to know about PopNode objects.
     unsigned    n;              // number of samples
-    PopNode    *node[MAXSAMP];
+    int         node[MAXSAMP];
+};
+
+/// Current parameter values of a PopNode, gathered from the parameter
+/// array so that simulation reads one record per segment rather than
+/// four scattered values. In a node without an upper bound, end is
+/// HUGE_VAL. In a node without two parents, mix is 0. The record is
+/// 32 bytes, so an array aligned on 64 bytes never splits one across
+/// cache lines. See PopNode_segPars.
+struct SegPar {
+    double      start, end, twoN, mix;
+};
+
+/// Sufficient statistics of the gene genealogy within a single
+/// PopNode, which determine its likelihood. While k lineages are
+/// present, coalescent events occur at rate k(k-1)/(2*twoN), so the
+/// log likelihood is -ncoal*log(twoN) - pairTime/twoN, where pairTime
+/// sums k(k-1)/2 over the time spent with k lineages. Lineages that
+/// leave a node with two parents contribute nmix[1]*log(m) +
+/// nmix[0]*log(1-m), where m is the fraction from parent[1].
+struct SegStat {
+    int         ncoal;          // number of coalescent events
+    int         nmix[2];        // lineages moved to each parent
+    double      pairTime;       // integral of k(k-1)/2 over time
+};
+
+/// A Gaussian parameter, with the bounds within which it is sampled.
+/// The lower bound is the largest of lo and the values indexed by
+/// loNdx; the upper bound is the smallest of hi and the values
+/// indexed by hiNdx. Unused indices are -1. If expHi is true, the
+/// upper bound is also no larger than the parameter's current value
+/// plus an exponential random variable with mean 10000.
+struct GaussPar {
+    int         ndx;            // index of parameter
+    double      lo, hi;
+    int         loNdx[2], hiNdx[2];
+    bool        expHi;
 };
 
+// Links among PopNode objects are indices into the array of PopNode
+// objects. Parameters are indices into the array returned by
+// ParStore_values. Neither contains pointers, so an array of PopNode
+// objects can be copied with memcpy. Missing links and parameters
+// have index -1. The only pointer, "sample", refers to a buffer owned
+// by the caller (see PopNode_setBuffer), which a copy must replace.
 struct PopNode {
     int         nparents, nchildren, nsamples;
-    double      *twoN;           // ptr to current pop size
-    double      *start, *end;    // duration of this PopNode
-    double      *mix;            // ptr to frac of pop derived from parent[1]
-    struct PopNode *parent[2];
-    struct PopNode *child[2];
-    Gene       *sample[MAXSAMP];
+    int         ndx;             // index of this node
+    int         twoN;            // current pop size
+    int         start, end;      // duration of this PopNode
+    int         mix;             // frac of pop derived from parent[1]
+    int         parent[2];
+    int         child[2];
+    int         maxsamp;         // capacity of sample
+    Gene      **sample;          // lineages now in this node
     bool        twoNfree, startFree, mixFree; // true => parameter varies
-    bool        touched;   // true => node has been visited during traversal
 };
 
-PopNode    *PopNode_new(double *twoN, bool twoNfree, double *start,
+PopNode    *PopNode_new(int twoN, bool twoNfree, int start,
                         bool startFree, NodeStore *ns);
 void        PopNode_addChild(PopNode * parent, PopNode * child);
-void        PopNode_mix(PopNode * child, double *mPtr, bool mixFree,
+void        PopNode_mix(PopNode * child, int mix, bool mixFree,
                         PopNode * introgressor, PopNode * native);
-void        PopNode_newGene(PopNode * self, unsigned ndx);
+void        PopNode_newGene(PopNode * self, const double *par, unsigned ndx,
+                            GeneStore * gs);
 void        PopNode_addSample(PopNode * self, Gene * gene);
-Gene       *PopNode_coalesce(PopNode * self, gsl_rng * rng);
-int         PopNode_feasible(const PopNode *self, Bounds bnd, int verbose);
+void        PopNode_setBuffer(PopNode * self, Gene ** buff, int maxsamp);
+Gene       *PopNode_coalesce(PopNode * self, PopNode *pnv,
+                             const SegPar *sp, GeneStore * gs,
+                             BranchTab * bt, int doSing, int tailK,
+                             SegStat * stat, gsl_rng * rng);
+void        PopNode_segPars(int nseg, const PopNode *pnv, const double *par,
+                            SegPar *sp);
+int         PopNode_feasible(const PopNode *self, const PopNode *pnv,
+                             const double *par, Bounds bnd, int verbose);
 void        PopNode_free(PopNode * self);
 void        PopNode_clear(PopNode * self);
 int         PopNode_isClear(const PopNode *self);
-void        PopNode_print(FILE * fp, PopNode * self, int indent);
-void        PopNode_printShallow(PopNode * self, FILE * fp);
-PopNode    *PopNode_root(PopNode * self);
-void        PopNode_sanityFromLeaf(PopNode * self, const char *file,
-                                   int line);
+int         PopNode_postorder(int root, const PopNode *pnv, int nseg,
+                              int order[nseg]);
+void        PopNode_print(FILE * fp, const PopNode * self, const PopNode *pnv,
+                          const double *par, int indent);
+void        PopNode_printShallow(const PopNode * self, const double *par,
+                                 FILE * fp);
+void        PopNode_sanityCheck(const PopNode * self, const char *file,
+                                int line);
 int         PopNode_nsamples(PopNode * self);
-void        PopNode_shiftParamPtrs(PopNode *self, size_t dp, int sign);
-void        PopNode_shiftPopNodePtrs(PopNode *self, size_t dp, int sign);
-void        PopNode_untouch(PopNode * self);
-void        PopNode_randomize(PopNode *self, Bounds bnd, ParStore *parstore,
-                              gsl_rng *rng);
-void        PopNode_gaussian(PopNode *self, Bounds bnd,
-                             ParStore *ps, gsl_rng *rng);
+void        PopNode_randomize(PopNode *self, const PopNode *pnv, Bounds bnd,
+                              ParStore *parstore, gsl_rng *rng);
+int         PopNode_gaussPars(const PopNode *self, const PopNode *pnv,
+                              Bounds bnd, GaussPar gp[3]);
+void        GaussPar_sample(int n, const GaussPar gp[n], ParStore *ps,
+                            gsl_rng *rng);
 
 void        SampNdx_init(SampNdx * self);
 void        SampNdx_addSamples(SampNdx * self, unsigned nsamples,
 							   PopNode * pnode);
-void        SampNdx_populateTree(SampNdx * self);
+void        SampNdx_populateTree(SampNdx * self, PopNode *pnv,
+                                 const double *par, GeneStore * gs);
 unsigned    SampNdx_size(SampNdx * self);
 int         SampNdx_equals(const SampNdx *lhs, const SampNdx *rhs);
 void        SampNdx_sanityCheck(SampNdx *self, const char *file, int line);
-int         SampNdx_ptrsLegal(SampNdx *self, PopNode *start, PopNode *end);
-void        SampNdx_shiftPtrs(SampNdx *self, size_t dpop, int sign);
+int         SampNdx_ndxLegal(const SampNdx *self, int nseg);
+int         SampNdx_maxLineages(const SampNdx *self, int nseg,
+                                const PopNode *pnv, const int order[nseg],
+                                int maxsamp[nseg]);
 
 NodeStore  *NodeStore_new(int len, PopNode *v);
 void        NodeStore_free(NodeStore *self);
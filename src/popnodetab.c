@@ -181,20 +181,22 @@ void PopNodeTab_print(PopNodeTab *self) {
 }
 
 /// Check the sanity of each node and make sure there is only one
-/// root.
+/// root: a single node without parents. Because the network has no
+/// cycles, every other node then descends from that root.
 /// @return root of population tree
 PopNode *PopNodeTab_check_and_root(PopNodeTab *self, const char *file,
                                    int line) {
     int i;
-    PopNode *node, *root = NULL;
+    PopNode *root = NULL;
     for(i=0; i < PNT_DIM; ++i) {
         El *el;
         for(el = self->tab[i]; el; el = el->next) {
-            PopNode_sanityFromLeaf(el->node, file, line);
-            node = PopNode_root(el->node);
+            PopNode_sanityCheck(el->node, file, line);
+            if(el->node->nparents > 0)
+                continue;
             if(root == NULL)
-                root = node;
-            else if(root != node) {
+                root = el->node;
+            else {
                 fprintf(stderr,
                         "%s:%d: Pop tree has multiple roots.\n",
                         file, line);
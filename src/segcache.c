@@ -0,0 +1,168 @@
+/**
+ * @file segcache.c
+ * @author Alan R. Rogers
+ * @brief Cache the output of each population segment of a simulation.
+ *
+ * For each segment, a SegCache holds a BranchTab with the lengths of
+ * the branches that ended within the segment, summed across
+ * replicates, and a record, for each replicate, of the lineages that
+ * left the segment for its parents. If a later simulation uses the
+ * same random numbers and the parameters of a segment and all its
+ * descendants are unchanged, the segment's output can be reused
+ * instead of re-simulating. See GPTree_simulateIncr.
+ *
+ * Segments are identified by their position, k, in the order in which
+ * they are simulated. The output of a segment is replaced only when
+ * it is simulated again, so the cache always describes the most
+ * recent simulation.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "segcache.h"
+#include "branchtab.h"
+#include "misc.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct SegOutput SegOutput;
+
+/// Output of one segment. The lineages of replicate r end just
+/// before lin[linEnd[r]] and begin where those of replicate r-1 end.
+struct SegOutput {
+    BranchTab  *bt;
+    unsigned long *linEnd;
+    SegLineage *lin;
+    unsigned long nlin, maxlin;
+};
+
+struct SegCache {
+    int         nseg, doSing, tailK;
+    unsigned long nreps, seed;
+    double    (*segpar)[4];     // parameters of each segment
+    SegOutput  *out;            // output of each segment
+};
+
+static void SegCache_freeOutput(SegCache * self);
+
+static void SegCache_freeOutput(SegCache * self) {
+    for(int k = 0; k < self->nseg; ++k) {
+        if(self->out[k].bt)
+            BranchTab_free(self->out[k].bt);
+        free(self->out[k].linEnd);
+        free(self->out[k].lin);
+    }
+    free(self->out);
+    free(self->segpar);
+    self->out = NULL;
+    self->segpar = NULL;
+    self->nseg = 0;
+}
+
+SegCache   *SegCache_new(void) {
+    SegCache   *self = malloc(sizeof(SegCache));
+    CHECKMEM(self);
+    memset(self, 0, sizeof(SegCache));
+    return self;
+}
+
+void SegCache_free(SegCache * self) {
+    SegCache_freeOutput(self);
+    free(self);
+}
+
+/// Prepare to simulate nreps replicates, in which segment k has
+/// parameters segpar[k]. On return, changed[k] is nonzero if segment
+/// k's parameters differ from those of the previous simulation. All
+/// segments have changed if the cache is empty or if the previous
+/// simulation differed in nseg, nreps, seed, doSing, or tailK. In
+/// that case, the function returns 1. Otherwise it returns 0.
+int SegCache_begin(SegCache * self, int nseg, const double segpar[nseg][4],
+                   unsigned long nreps, unsigned long seed, int doSing,
+                   int tailK, int changed[nseg]) {
+    int         k, j, all;
+
+    all = (self->out == NULL || self->nseg != nseg
+           || self->nreps != nreps || self->seed != seed
+           || self->doSing != doSing || self->tailK != tailK);
+
+    if(all) {
+        SegCache_freeOutput(self);
+        self->nseg = nseg;
+        self->segpar = malloc(nseg * sizeof(self->segpar[0]));
+        CHECKMEM(self->segpar);
+        self->out = malloc(nseg * sizeof(self->out[0]));
+        CHECKMEM(self->out);
+        memset(self->out, 0, nseg * sizeof(self->out[0]));
+        for(k = 0; k < nseg; ++k) {
+            self->out[k].linEnd = malloc(nreps * sizeof(unsigned long));
+            CHECKMEM(self->out[k].linEnd);
+        }
+    }
+    for(k = 0; k < nseg; ++k) {
+        changed[k] = all;
+        for(j = 0; j < 4; ++j) {
+            if(!all && self->segpar[k][j] != segpar[k][j])
+                changed[k] = 1;
+            self->segpar[k][j] = segpar[k][j];
+        }
+    }
+    self->nreps = nreps;
+    self->seed = seed;
+    self->doSing = doSing;
+    self->tailK = tailK;
+    return all;
+}
+
+/// Discard the output of segment k, which is about to be simulated.
+/// Its table is emptied in place, keeping its memory. If it has none,
+/// a new one is made to fold site patterns as does table like.
+void SegCache_clear(SegCache * self, int k, const BranchTab * like) {
+    assert(k < self->nseg);
+    SegOutput  *out = self->out + k;
+    if(out->bt)
+        BranchTab_clear(out->bt);
+    else
+        out->bt = BranchTab_newLike(like);
+    out->nlin = 0;
+}
+
+/// Return the BranchTab of segment k.
+BranchTab  *SegCache_branchTab(SegCache * self, int k) {
+    assert(k < self->nseg);
+    return self->out[k].bt;
+}
+
+/// Record a lineage that left segment k for parent 0 or 1.
+void SegCache_addLineage(SegCache * self, int k, tipId_t tipId,
+                         double birth, int parent) {
+    SegOutput  *out = self->out + k;
+    if(out->nlin == out->maxlin) {
+        out->maxlin = (out->maxlin ? 2 * out->maxlin : 256);
+        out->lin = realloc(out->lin, out->maxlin * sizeof(out->lin[0]));
+        CHECKMEM(out->lin);
+    }
+    out->lin[out->nlin].tipId = tipId;
+    out->lin[out->nlin].birth = birth;
+    out->lin[out->nlin].parent = parent;
+    ++out->nlin;
+}
+
+/// Finish the lineages of segment k in replicate rep.
+void SegCache_endRep(SegCache * self, int k, unsigned long rep) {
+    assert(rep < self->nreps);
+    self->out[k].linEnd[rep] = self->out[k].nlin;
+}
+
+/// Return a pointer to the lineages that left segment k in replicate
+/// rep, and set *n to their number.
+const SegLineage *SegCache_lineages(const SegCache * self, int k,
+                                    unsigned long rep, unsigned *n) {
+    assert(rep < self->nreps);
+    const SegOutput *out = self->out + k;
+    unsigned long first = (rep == 0 ? 0 : out->linEnd[rep - 1]);
+    *n = out->linEnd[rep] - first;
+    return out->lin + first;
+}
@@ -0,0 +1,33 @@
+#ifndef ARR_SEGCACHE_H
+#  define ARR_SEGCACHE_H
+
+#  include "typedefs.h"
+
+/// Largest value of nreps*nseg for which GPTree_simulateIncr will use
+/// a SegCache. Memory grows in proportion to this product.
+#  define SEGCACHE_MAXREC (1UL<<18)
+
+typedef struct SegLineage SegLineage;
+
+/// A lineage that left a segment for one of its parents.
+struct SegLineage {
+    tipId_t     tipId;
+    double      birth;
+    int         parent;         // 0 or 1
+};
+
+SegCache   *SegCache_new(void);
+void        SegCache_free(SegCache * self);
+int         SegCache_begin(SegCache * self, int nseg,
+                           const double segpar[nseg][4],
+                           unsigned long nreps, unsigned long seed,
+                           int doSing, int tailK, int changed[nseg]);
+void        SegCache_clear(SegCache * self, int k, const BranchTab * like);
+BranchTab  *SegCache_branchTab(SegCache * self, int k);
+void        SegCache_addLineage(SegCache * self, int k, tipId_t tipId,
+                                double birth, int parent);
+void        SegCache_endRep(SegCache * self, int k, unsigned long rep);
+const SegLineage *SegCache_lineages(const SegCache * self, int k,
+                                    unsigned long rep, unsigned *n);
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file sobol.c
+ * @author Alan R. Rogers
+ * @brief Randomized quasi-Monte Carlo using scrambled Sobol points.
+ *
+ * Direction numbers are those of Joe and Kuo (2008, SIAM J Sci Comput
+ * 30:2635-2654). Each Sobol object is randomized by a random linear
+ * matrix scramble followed by a random digital shift (Matousek 1998,
+ * J Complexity 14:527-556). Each coordinate of a scrambled point is
+ * uniform on [0,1), and the points retain the equidistribution
+ * properties of the original sequence, so averages over independent
+ * scramblings give unbiased estimates together with valid standard
+ * errors.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "sobol.h"
+#include "misc.h"
+#include <assert.h>
+
+typedef struct SobolState SobolState;
+
+/// State of a rng_sobol generator.
+struct SobolState {
+    FastRngState rng;           // fallback generator
+    int         next;           // index of next coordinate in u
+    uint32_t    u[SOBOL_DIM];   // coordinates of current point
+};
+
+// Primitive polynomials and initial direction numbers for dimensions
+// 2 through SOBOL_DIM. Dimension 1 is the van der Corput sequence.
+static const struct {
+    int         s, a;
+    uint32_t    m[6];
+} jk[SOBOL_DIM - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+    {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},
+    {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},
+    {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}}
+};
+
+static uint32_t scramble(const uint32_t row[32], uint32_t x);
+static void sobol_set(void *vstate, unsigned long seed);
+static unsigned long sobol_get(void *vstate);
+static double sobol_get_double(void *vstate);
+
+/// Multiply the binary digits of x by a 32x32 matrix whose i'th row
+/// is row[i]. Bit 31 of x is its first digit.
+static uint32_t scramble(const uint32_t row[32], uint32_t x) {
+    uint32_t    y = 0;
+    for(int i = 0; i < 32; ++i)
+        y |= (uint32_t) __builtin_parity(row[i] & x) << (31 - i);
+    return y;
+}
+
+/// Initialize a Sobol sequence, scrambled using random numbers
+/// generated from seed.
+void Sobol_init(Sobol * self, unsigned long seed) {
+    FastRngState r;
+    uint32_t    row[32];
+    uint32_t    v[32];
+    int         d, i, k;
+
+    // Use xoshiro256++ directly to generate scrambling matrices.
+    rng_xoshiro256pp->set(&r, seed);
+
+    for(d = 0; d < SOBOL_DIM; ++d) {
+        // unscrambled direction numbers
+        if(d == 0) {
+            for(i = 0; i < 32; ++i)
+                v[i] = 1u << (31 - i);
+        } else {
+            int         s = jk[d - 1].s, a = jk[d - 1].a;
+            for(i = 0; i < s; ++i)
+                v[i] = jk[d - 1].m[i] << (31 - i);
+            for(i = s; i < 32; ++i) {
+                v[i] = v[i - s] ^ (v[i - s] >> s);
+                for(k = 1; k < s; ++k)
+                    if((a >> (s - 1 - k)) & 1)
+                        v[i] ^= v[i - k];
+            }
+        }
+
+        // Random lower-triangular matrix with unit diagonal: row i
+        // has bit 31-i set and random bits to its left.
+        for(i = 0; i < 32; ++i) {
+            uint32_t    diag = 1u << (31 - i);
+            uint32_t    left = (i == 0 ? 0u : ~((diag << 1) - 1u));
+            row[i] = diag | ((uint32_t) (Xoshiro_next(r.s) >> 32) & left);
+        }
+        for(i = 0; i < 32; ++i)
+            self->v[d][i] = scramble(row, v[i]);
+        self->shift[d] = (uint32_t) (Xoshiro_next(r.s) >> 32);
+    }
+}
+
+/// Return coordinate dim of point n, as a 32-bit integer. Divide by
+/// 2^32 to get a value in [0,1).
+uint32_t Sobol_coord(const Sobol * self, unsigned long n, int dim) {
+    assert(dim >= 0 && dim < SOBOL_DIM);
+    unsigned long g = n ^ (n >> 1);     // Gray code
+    uint32_t    x = self->shift[dim];
+    for(int i = 0; g != 0 && i < 32; ++i, g >>= 1)
+        if(g & 1)
+            x ^= self->v[dim][i];
+    return x;
+}
+
+/// Prepare rng, which must be of type rng_sobol, to generate point n
+/// of sequence sobol. Deviates beyond the dimension of the sequence
+/// come from a xoshiro256++ stream initialized from seed.
+void Sobol_setRng(gsl_rng * rng, const Sobol * sobol, unsigned long n,
+                  unsigned long seed) {
+    assert(rng->type == rng_sobol);
+    SobolState *state = (SobolState *) rng->state;
+    gsl_rng_set(rng, seed);
+    for(int d = 0; d < SOBOL_DIM; ++d)
+        state->u[d] = Sobol_coord(sobol, n, d);
+    state->next = 0;
+}
+
+/// Seed the fallback generator. The Sobol point is set by
+/// Sobol_setRng; until then, all values come from the fallback.
+static void sobol_set(void *vstate, unsigned long seed) {
+    SobolState *state = (SobolState *) vstate;
+    rng_xoshiro256pp->set(&state->rng, seed);
+    state->next = SOBOL_DIM;
+}
+
+static unsigned long sobol_get(void *vstate) {
+    SobolState *state = (SobolState *) vstate;
+    return (unsigned long) (Xoshiro_next(state->rng.s) >> 32);
+}
+
+static double sobol_get_double(void *vstate) {
+    SobolState *state = (SobolState *) vstate;
+    if(state->next < SOBOL_DIM)
+        return state->u[state->next++] * 0x1.0p-32;
+    return (Xoshiro_next(state->rng.s) >> 11) * 0x1.0p-53;
+}
+
+static const gsl_rng_type sobol_type = {
+    "sobol",
+    0xffffffffUL,               // max
+    0,                          // min
+    sizeof(SobolState),
+    &sobol_set,
+    &sobol_get,
+    &sobol_get_double
+};
+
+const gsl_rng_type *rng_sobol = &sobol_type;
+
+#ifdef TEST
+
+#  include <math.h>
+#  include <stdio.h>
+#  include <string.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+int main(int argc, char **argv) {
+    int         verbose = 0, d, i, j;
+
+    if(argc > 1) {
+        if(argc != 2 || 0 != strcmp(argv[1], "-v")) {
+            fprintf(stderr, "usage: xsobol [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    Sobol       sobol;
+    Sobol_init(&sobol, 1);
+
+    // Each block of 2^m points puts exactly one point into each
+    // interval of width 2^-m, in every dimension.
+    const int   m = 10, npts = 1 << m;
+    for(d = 0; d < SOBOL_DIM; ++d) {
+        char        seen[npts];
+        memset(seen, 0, sizeof(seen));
+        for(i = 0; i < npts; ++i) {
+            j = Sobol_coord(&sobol, i + npts, d) >> (32 - m);
+            assert(!seen[j]);
+            seen[j] = 1;
+        }
+    }
+
+    // The same holds for pairs of dimensions on a grid of 2^m
+    // squares, for the first two dimensions.
+    {
+        char        seen[npts];
+        memset(seen, 0, sizeof(seen));
+        for(i = 0; i < npts; ++i) {
+            int         x = Sobol_coord(&sobol, i, 0) >> (32 - m / 2);
+            int         y = Sobol_coord(&sobol, i, 1) >> (32 - m / 2);
+            assert(!seen[(x << (m / 2)) | y]);
+            seen[(x << (m / 2)) | y] = 1;
+        }
+    }
+
+    // Different seeds give different scramblings.
+    Sobol       sobol2;
+    Sobol_init(&sobol2, 2);
+    assert(Sobol_coord(&sobol, 5, 3) != Sobol_coord(&sobol2, 5, 3));
+
+    // The generator returns coordinates first, then falls back to
+    // xoshiro256++.
+    gsl_rng    *rng = gsl_rng_alloc(rng_sobol);
+    CHECKMEM(rng);
+    Sobol_setRng(rng, &sobol, 7, 99);
+    for(d = 0; d < SOBOL_DIM; ++d)
+        assert(gsl_rng_uniform(rng)
+               == Sobol_coord(&sobol, 7, d) * 0x1.0p-32);
+    double      x = gsl_rng_uniform(rng);
+    assert(0.0 <= x && x < 1.0);
+
+    // Integrate a smooth function of 4 variables. The exact answer
+    // is 1. RQMC error should be far smaller than MC error, whose
+    // standard deviation here is about 0.046.
+    double      sum = 0.0;
+    for(i = 0; i < npts; ++i) {
+        double      f = 1.0;
+        Sobol_setRng(rng, &sobol, i, 1);
+        for(d = 0; d < 4; ++d)
+            f *= 2.0 * gsl_rng_uniform(rng);
+        sum += f;
+    }
+    sum /= npts;
+    if(verbose)
+        printf("RQMC integral: %lf\n", sum);
+    assert(fabs(sum - 1.0) < 0.01);
+
+    gsl_rng_free(rng);
+    unitTstResult("Sobol", "OK");
+    return 0;
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef ARR_SOBOL_H
+#  define ARR_SOBOL_H
+
+#  include "fastrng.h"
+#  include <stdint.h>
+#  include <gsl/gsl_rng.h>
+
+/// Number of dimensions of the Sobol sequence.
+#  define SOBOL_DIM 16
+
+typedef struct Sobol Sobol;
+
+/// A randomly scrambled Sobol sequence. Each replicate of a
+/// simulation uses one point of the sequence.
+struct Sobol {
+    uint32_t    v[SOBOL_DIM][32];   // scrambled direction numbers
+    uint32_t    shift[SOBOL_DIM];   // random digital shift
+};
+
+/// A gsl_rng_type whose first SOBOL_DIM uniform deviates (as from
+/// gsl_rng_uniform) are the coordinates of a point of a Sobol
+/// sequence. Later deviates, and all integers (as from
+/// gsl_rng_uniform_int), come from xoshiro256++. It is not
+/// rng_xoshiro256pp, so FastRng functions draw exponentials by
+/// inversion, which preserves the structure of the Sobol points.
+extern const gsl_rng_type *rng_sobol;
+
+void        Sobol_init(Sobol * self, unsigned long seed);
+uint32_t    Sobol_coord(const Sobol * self, unsigned long n, int dim);
+void        Sobol_setRng(gsl_rng * rng, const Sobol * sobol, unsigned long n,
+                         unsigned long seed);
+
+#endif
@@ -215,13 +215,13 @@ static void Stack_push(Stack *self, tipId_t x) {
 /// stack.
 static void generatePatterns(int bit, int npops, Stack *stk, tipId_t pat,
                              int doSing) {
-    assert(sizeof(tipId_t) < sizeof (unsigned long long));
     if(bit == npops) {
         // Recursion stops here. If current pattern is
         // legal, then push it onto the stack. Then return.
 
         // Exclude patterns with all bits on, or all bits off.
-        if(pat==0 || pat == (1ULL << npops) -1ULL)
+        tipId_t all = ~((tipId_t) 0) >> (8*sizeof(tipId_t) - npops);
+        if(pat==0 || pat == all)
             return;
         // Exclude singleton patterns unless "doSing" is true.
         if(!doSing && isPow2(pat))
@@ -229,7 +229,7 @@ static void generatePatterns(int bit, int npops, Stack *stk, tipId_t pat,
         Stack_push(stk, pat);
         return;
     }
-    tipId_t on = 1UL << bit;
+    tipId_t on = ((tipId_t) 1) << bit;
     generatePatterns(bit+1, npops, stk, pat|on, doSing); // curr bit on
     generatePatterns(bit+1, npops, stk, pat, doSing);    // curr bit off
 }
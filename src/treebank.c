@@ -0,0 +1,682 @@
+/**
+ * @file treebank.c
+ * @author Alan R. Rogers
+ * @brief Reuse simulated gene genealogies by importance sampling.
+ *
+ * A TreeBank holds gene genealogies simulated at a reference
+ * parameter vector. For each replicate, it stores the branch length
+ * of each site pattern, along with the sufficient statistics (see
+ * SegStat) that determine the genealogy's likelihood. Expected branch
+ * lengths at a nearby parameter vector are then estimated by
+ * weighting each replicate by its likelihood ratio, without new
+ * simulations.
+ *
+ * Reweighting is possible only when population sizes and admixture
+ * fractions change. If the nearby point has different segment start
+ * times, the stored genealogies are not valid samples, so the caller
+ * must estimate some other way, and the bank is kept for other
+ * points. If the weights are so uneven that the effective sample size
+ * falls below a threshold, the bank is replaced by a fresh simulation
+ * at the new point. Replicates are simulated in parallel, in blocks
+ * with random number streams keyed as in patprob, so the new bank
+ * does not depend on the number of threads.
+ *
+ * One TreeBank may be shared by several threads. Each lookup borrows
+ * its work space from a pool within the bank, which grows to one
+ * buffer per concurrent lookup and is released when the bank is
+ * rebuilt.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "treebank.h"
+#include "branchtab.h"
+#include "fastrng.h"
+#include "gptree.h"
+#include "jobqueue.h"
+#include "misc.h"
+#include "popnode.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_rng.h>
+
+// Replicates are simulated in blocks of TREEBANK_BLOCK, each with its
+// own random number stream, as in patprob.
+#define TREEBANK_BLOCK 4096
+
+typedef struct LogLik LogLik;
+typedef struct Scratch Scratch;
+typedef struct BankBlock BankBlock;
+typedef struct BankState BankState;
+
+/// Coefficients of the log likelihood of each segment.
+struct LogLik {
+    int         nseg;
+    double     *lnTwoN;         // log(twoN)
+    double     *invTwoN;        // 1/twoN
+    double     *lnMix[2];       // log(1-mix) and log(mix)
+};
+
+/// Work space for one call to TreeBank_lookup.
+struct Scratch {
+    Scratch    *next;
+    double     *sum;            // [npat] weighted sum of each pattern
+    double     *w;              // [nreps] importance weights
+    LogLik      ll;
+};
+
+/// A block of replicates, which is the unit of work in
+/// TreeBank_build.
+struct BankBlock {
+    long        block, firstRep, nreps;
+    unsigned long seed;
+    int         doSing;
+    const LogLik *ll;           // log likelihood at reference point
+    TreeBank   *bank;
+
+    // Returned values: site pattern and length of each branch
+    tipId_t    *key;
+    double     *len;
+    unsigned long nbranch, maxbranch;
+};
+
+/// State of each thread in TreeBank_build.
+struct BankState {
+    GPTree     *tree;
+    gsl_rng    *rng;
+    BranchTab  *rep;            // a single replicate
+};
+
+struct TreeBank {
+    pthread_rwlock_t lock;
+    pthread_mutex_t poolLock;   // protects pool
+    Scratch    *pool;           // unused work space
+    double      minEss;         // rebuild if ESS < minEss * nreps
+    int         nThreads;       // threads used to rebuild
+    long        nreps;          // number of replicates; 0 if empty
+    int         doSing;         // nonzero => singletons tabulated
+    int         nseg;           // number of segments
+    double     *start;          // [nseg] start times at reference
+    double     *logLik0;        // [nreps] log likelihoods at reference
+    SegStat    *stat;           // [nreps*nseg] sufficient statistics
+
+    // Branches of replicate r are first[r] through first[r+1]-1.
+    // Branch b belongs to site pattern key[pndx[b]].
+    unsigned long *first;       // [nreps+1]
+    unsigned   *pndx;
+    double     *len;
+    unsigned long nbranch, maxbranch;
+    tipId_t    *key;            // distinct site patterns, sorted
+    unsigned    npat;
+};
+
+static void LogLik_alloc(LogLik * self, int nseg);
+static void LogLik_set(LogLik * self, const double twoN[],
+                       const double mix[]);
+static void LogLik_free(LogLik * self);
+static double LogLik_eval(const LogLik * self, const SegStat stat[]);
+static Scratch *TreeBank_getScratch(TreeBank * self);
+static void TreeBank_putScratch(TreeBank * self, Scratch * s);
+static void TreeBank_clear(TreeBank * self);
+static void TreeBank_build(TreeBank * self, GPTree * gptree, long nreps,
+                           int doSing, unsigned long seed);
+static void *BankState_new(void *gptree);
+static void BankState_free(void *state);
+static int  BankBlock_simulate(void *varg, void *tdata);
+static int  TreeBank_lookup(TreeBank * self, BranchTab * bt, long nreps,
+                            int doSing, int nseg, const double twoN[nseg],
+                            const double mix[nseg],
+                            const double start[nseg], int *stale);
+static int  compareTipId(const void *void_x, const void *void_y);
+
+static void LogLik_alloc(LogLik * self, int nseg) {
+    self->nseg = nseg;
+    self->lnTwoN = malloc(nseg * sizeof(self->lnTwoN[0]));
+    self->invTwoN = malloc(nseg * sizeof(self->invTwoN[0]));
+    self->lnMix[0] = malloc(nseg * sizeof(self->lnMix[0][0]));
+    self->lnMix[1] = malloc(nseg * sizeof(self->lnMix[1][0]));
+    CHECKMEM(self->lnTwoN);
+    CHECKMEM(self->invTwoN);
+    CHECKMEM(self->lnMix[0]);
+    CHECKMEM(self->lnMix[1]);
+}
+
+/// Set coefficients for the given population sizes and admixture
+/// fractions of the self->nseg segments.
+static void LogLik_set(LogLik * self, const double twoN[],
+                       const double mix[]) {
+    for(int i = 0; i < self->nseg; ++i) {
+        self->lnTwoN[i] = log(twoN[i]);
+        self->invTwoN[i] = 1.0 / twoN[i];
+        self->lnMix[0][i] = log1p(-mix[i]);
+        self->lnMix[1][i] = log(mix[i]);
+    }
+}
+
+static void LogLik_free(LogLik * self) {
+    free(self->lnTwoN);
+    free(self->invTwoN);
+    free(self->lnMix[0]);
+    free(self->lnMix[1]);
+}
+
+/// Log likelihood of one genealogy, whose sufficient statistics are
+/// in stat[0..nseg-1], omitting terms that do not depend on
+/// parameters.
+static double LogLik_eval(const LogLik * self, const SegStat stat[]) {
+    double      x = 0.0;
+    for(int i = 0; i < self->nseg; ++i) {
+        x -= stat[i].ncoal * self->lnTwoN[i]
+            + stat[i].pairTime * self->invTwoN[i];
+        for(int j = 0; j < 2; ++j)
+            if(stat[i].nmix[j])
+                x += stat[i].nmix[j] * self->lnMix[j][i];
+    }
+    return x;
+}
+
+static int compareTipId(const void *void_x, const void *void_y) {
+    const tipId_t *x = (const tipId_t *) void_x;
+    const tipId_t *y = (const tipId_t *) void_y;
+    return (*x > *y) - (*x < *y);
+}
+
+/// Construct an empty TreeBank. It will be rebuilt whenever the
+/// effective sample size falls below minEss times the number of
+/// replicates, using nThreads threads.
+TreeBank   *TreeBank_new(double minEss, int nThreads) {
+    TreeBank   *self = malloc(sizeof(TreeBank));
+    CHECKMEM(self);
+    memset(self, 0, sizeof(TreeBank));
+    self->minEss = minEss;
+    self->nThreads = nThreads;
+    if(pthread_rwlock_init(&self->lock, NULL)
+       || pthread_mutex_init(&self->poolLock, NULL))
+        eprintf("%s:%s:%d: can't initialize lock\n",
+                __FILE__, __func__, __LINE__);
+    return self;
+}
+
+/// Borrow work space for a lookup, allocating it only if the pool is
+/// empty. The caller must hold a lock on the bank, so that its size
+/// doesn't change.
+static Scratch *TreeBank_getScratch(TreeBank * self) {
+    pthread_mutex_lock(&self->poolLock);
+    Scratch    *s = self->pool;
+    if(s)
+        self->pool = s->next;
+    pthread_mutex_unlock(&self->poolLock);
+    if(s == NULL) {
+        s = malloc(sizeof(Scratch));
+        CHECKMEM(s);
+        s->sum = malloc(self->npat * sizeof(s->sum[0]));
+        s->w = malloc(self->nreps * sizeof(s->w[0]));
+        CHECKMEM(s->sum);
+        CHECKMEM(s->w);
+        LogLik_alloc(&s->ll, self->nseg);
+    }
+    return s;
+}
+
+/// Return work space to the pool.
+static void TreeBank_putScratch(TreeBank * self, Scratch * s) {
+    pthread_mutex_lock(&self->poolLock);
+    s->next = self->pool;
+    self->pool = s;
+    pthread_mutex_unlock(&self->poolLock);
+}
+
+/// Release the contents of a TreeBank, leaving it empty. The caller
+/// must hold a write lock, so no work space is on loan.
+static void TreeBank_clear(TreeBank * self) {
+    while(self->pool) {
+        Scratch    *s = self->pool;
+        self->pool = s->next;
+        free(s->sum);
+        free(s->w);
+        LogLik_free(&s->ll);
+        free(s);
+    }
+    free(self->start);
+    free(self->logLik0);
+    free(self->stat);
+    free(self->first);
+    free(self->pndx);
+    free(self->len);
+    free(self->key);
+    self->start = self->logLik0 = self->len = NULL;
+    self->stat = NULL;
+    self->first = NULL;
+    self->pndx = NULL;
+    self->key = NULL;
+    self->nreps = 0;
+    self->nbranch = self->maxbranch = 0;
+    self->npat = 0;
+}
+
+void TreeBank_free(TreeBank * self) {
+    TreeBank_clear(self);
+    pthread_rwlock_destroy(&self->lock);
+    pthread_mutex_destroy(&self->poolLock);
+    free(self);
+}
+
+/// Replace the contents of the bank with nreps replicates simulated
+/// at the current parameters of gptree. Replicates are simulated in
+/// blocks of TREEBANK_BLOCK, divided among the bank's threads. Block
+/// b uses the random stream identified by seed and b, as in patprob,
+/// so the bank does not depend on the number of threads. The caller
+/// must hold a write lock.
+static void TreeBank_build(TreeBank * self, GPTree * gptree, long nreps,
+                           int doSing, unsigned long seed) {
+    int         nseg = GPTree_nseg(gptree);
+    double      twoN[nseg], mix[nseg];
+    long        r, k;
+    unsigned long b;
+
+    TreeBank_clear(self);
+    self->nreps = nreps;
+    self->doSing = doSing;
+    self->nseg = nseg;
+    self->start = malloc(nseg * sizeof(self->start[0]));
+    self->logLik0 = malloc(nreps * sizeof(self->logLik0[0]));
+    self->stat = malloc(nreps * nseg * sizeof(self->stat[0]));
+    self->first = malloc((nreps + 1) * sizeof(self->first[0]));
+    CHECKMEM(self->start);
+    CHECKMEM(self->logLik0);
+    CHECKMEM(self->stat);
+    CHECKMEM(self->first);
+
+    if(GPTree_segPars(gptree, nseg, twoN, mix, self->start))
+        eprintf("%s:%s:%d: genealogies can't be reweighted\n",
+                __FILE__, __func__, __LINE__);
+    LogLik      ll;
+    LogLik_alloc(&ll, nseg);
+    LogLik_set(&ll, twoN, mix);
+
+    long        nblocks = (nreps + TREEBANK_BLOCK - 1) / TREEBANK_BLOCK;
+    BankBlock  *blk = malloc(nblocks * sizeof(blk[0]));
+    CHECKMEM(blk);
+    memset(blk, 0, nblocks * sizeof(blk[0]));
+    for(k = 0; k < nblocks; ++k) {
+        blk[k].block = k;
+        blk[k].firstRep = k * TREEBANK_BLOCK;
+        blk[k].nreps = (k + 1 < nblocks ? TREEBANK_BLOCK
+                        : nreps - k * TREEBANK_BLOCK);
+        blk[k].seed = seed;
+        blk[k].doSing = doSing;
+        blk[k].ll = &ll;
+        blk[k].bank = self;
+    }
+
+    int         nThreads = (self->nThreads < nblocks ? self->nThreads
+                            : (int) nblocks);
+    if(nThreads <= 1) {
+        void       *state = BankState_new(gptree);
+        for(k = 0; k < nblocks; ++k)
+            BankBlock_simulate(blk + k, state);
+        BankState_free(state);
+    } else {
+        JobQueue   *jq = JobQueue_new(nThreads, gptree, BankState_new,
+                                      BankState_free);
+        for(k = 0; k < nblocks; ++k)
+            JobQueue_addJob(jq, BankBlock_simulate, blk + k);
+        JobQueue_waitOnJobs(jq);
+        JobQueue_free(jq);
+    }
+    LogLik_free(&ll);
+
+    // Concatenate the blocks' branches in block order. Within each
+    // block, first[] is relative to the block's own arrays.
+    for(k = 0; k < nblocks; ++k)
+        self->nbranch += blk[k].nbranch;
+    self->maxbranch = self->nbranch;
+    tipId_t    *bkey = malloc(self->nbranch * sizeof(bkey[0]));
+    self->len = malloc(self->nbranch * sizeof(self->len[0]));
+    CHECKMEM(bkey);
+    CHECKMEM(self->len);
+    b = 0;
+    for(k = 0; k < nblocks; ++k) {
+        memcpy(bkey + b, blk[k].key, blk[k].nbranch * sizeof(bkey[0]));
+        memcpy(self->len + b, blk[k].len,
+               blk[k].nbranch * sizeof(self->len[0]));
+        for(r = blk[k].firstRep; r < blk[k].firstRep + blk[k].nreps; ++r)
+            self->first[r] += b;
+        b += blk[k].nbranch;
+        free(blk[k].key);
+        free(blk[k].len);
+    }
+    self->first[nreps] = self->nbranch;
+    free(blk);
+
+    // Index the distinct site patterns.
+    self->key = memdup(bkey, self->nbranch * sizeof(bkey[0]));
+    CHECKMEM(self->key);
+    qsort(self->key, self->nbranch, sizeof(self->key[0]), compareTipId);
+    for(b = 0; b < self->nbranch; ++b)
+        if(self->npat == 0 || self->key[b] != self->key[self->npat - 1])
+            self->key[self->npat++] = self->key[b];
+    self->pndx = malloc(self->nbranch * sizeof(self->pndx[0]));
+    CHECKMEM(self->pndx);
+    for(b = 0; b < self->nbranch; ++b) {
+        tipId_t    *kp = bsearch(bkey + b, self->key, self->npat,
+                                 sizeof(self->key[0]), compareTipId);
+        assert(kp);
+        self->pndx[b] = kp - self->key;
+    }
+    free(bkey);
+}
+
+/// Thread state for TreeBank_build: a copy of the GPTree, which
+/// gathers segment statistics, a generator, and a table for a single
+/// replicate.
+static void *BankState_new(void *gptree) {
+    BankState  *self = malloc(sizeof(BankState));
+    CHECKMEM(self);
+    self->tree = GPTree_dup((GPTree *) gptree);
+    GPTree_setSegStats(self->tree, 1);
+    self->rng = gsl_rng_alloc(rng_xoshiro256pp);
+    CHECKMEM(self->rng);
+    self->rep = BranchTab_newDense(GPTree_nsamples(self->tree));
+    return self;
+}
+
+static void BankState_free(void *state) {
+    BankState  *self = (BankState *) state;
+    GPTree_free(self->tree);
+    gsl_rng_free(self->rng);
+    BranchTab_free(self->rep);
+    free(self);
+}
+
+/// Simulate one block of replicates for TreeBank_build. Statistics
+/// and log likelihoods go straight into the bank, whose entries for
+/// different blocks don't overlap. Branches go into the block's own
+/// arrays, and first[r] is set relative to them.
+static int BankBlock_simulate(void *varg, void *tdata) {
+    BankBlock  *arg = (BankBlock *) varg;
+    BankState  *state = (BankState *) tdata;
+    TreeBank   *bank = arg->bank;
+    int         nseg = bank->nseg;
+    long        r, end = arg->firstRep + arg->nreps;
+
+    gsl_rng_set(state->rng, FastRng_streamSeed(arg->seed, arg->block));
+    for(r = arg->firstRep; r < end; ++r) {
+        BranchTab_clear(state->rep);
+        GPTree_simulate(state->tree, state->rep, state->rng, 1,
+                        arg->doSing);
+        GPTree_segStats(state->tree, nseg, bank->stat + r * nseg);
+        bank->logLik0[r] = LogLik_eval(arg->ll, bank->stat + r * nseg);
+
+        unsigned    n = BranchTab_size(state->rep);
+        if(arg->nbranch + n > arg->maxbranch) {
+            arg->maxbranch = 2 * (arg->nbranch + n);
+            arg->key = realloc(arg->key,
+                               arg->maxbranch * sizeof(arg->key[0]));
+            arg->len = realloc(arg->len,
+                               arg->maxbranch * sizeof(arg->len[0]));
+            CHECKMEM(arg->key);
+            CHECKMEM(arg->len);
+        }
+        double      sqr[n];
+        BranchTab_toArrays(state->rep, n, arg->key + arg->nbranch,
+                           arg->len + arg->nbranch, sqr);
+        bank->first[r] = arg->nbranch;
+        arg->nbranch += n;
+    }
+    return 0;
+}
+
+/// Estimate summed branch lengths by reweighting the bank, and add
+/// them to bt, which is empty. The bank stores site patterns of
+/// samples, which bt folds into populations if it was made to do so.
+/// Return 0 on success. Otherwise, return 1, leaving bt unchanged. In
+/// that case, set *stale if the bank should be rebuilt: because it is
+/// empty, because it was built with a different number of replicates
+/// or treatment of singletons, or because the effective sample size
+/// is too small. If segment start times differ from those of the
+/// bank, its genealogies are not valid samples, but the bank is kept
+/// for other points, so *stale is 0. The caller must hold a lock.
+static int TreeBank_lookup(TreeBank * self, BranchTab * bt, long nreps,
+                           int doSing, int nseg, const double twoN[nseg],
+                           const double mix[nseg],
+                           const double start[nseg], int *stale) {
+    long        r;
+    int         i;
+    unsigned long b;
+
+    *stale = 1;
+    if(self->nreps != nreps || self->doSing != doSing || self->nseg != nseg)
+        return 1;
+
+    // Genealogies are valid samples only if segment boundaries agree.
+    for(i = 0; i < nseg; ++i) {
+        if(start[i] != self->start[i]) {
+            *stale = 0;
+            return 1;
+        }
+    }
+
+    // Importance weights, w = exp(logLik - logLik0 - max).
+    Scratch    *s = TreeBank_getScratch(self);
+    double     *w = s->w;
+    LogLik_set(&s->ll, twoN, mix);
+    double      maxw = -HUGE_VAL;
+    for(r = 0; r < nreps; ++r) {
+        w[r] = LogLik_eval(&s->ll, self->stat + r * nseg)
+            - self->logLik0[r];
+        if(w[r] > maxw)
+            maxw = w[r];
+    }
+
+    double      sumw = 0.0, sumw2 = 0.0;
+    if(isfinite(maxw)) {
+        for(r = 0; r < nreps; ++r) {
+            w[r] = exp(w[r] - maxw);
+            sumw += w[r];
+            sumw2 += w[r] * w[r];
+        }
+    }
+    if(sumw == 0.0 || sumw * sumw < self->minEss * nreps * sumw2) {
+        TreeBank_putScratch(self, s);
+        return 1;
+    }
+    *stale = 0;
+
+    // Self-normalized weighted sums, scaled to nreps replicates.
+    double     *sum = s->sum;
+    memset(sum, 0, self->npat * sizeof(sum[0]));
+    for(r = 0; r < nreps; ++r)
+        for(b = self->first[r]; b < self->first[r + 1]; ++b)
+            sum[self->pndx[b]] += w[r] * self->len[b];
+
+    // Folding is linear, so it can wait until the replicates have
+    // been summed.
+    for(unsigned j = 0; j < self->npat; ++j)
+        if(sum[j] > 0.0)
+            BranchTab_add(bt, self->key[j], sum[j] * nreps / sumw);
+    TreeBank_putScratch(self, s);
+    return 0;
+}
+
+/// Estimate the summed branch length of each site pattern in nreps
+/// replicates, at the current parameters of gptree. The result is
+/// scaled like that of patprob. If the bank is usable here, the
+/// estimate reweights its genealogies. If the bank is empty, was
+/// built with different nreps or doSing, or has too small an
+/// effective sample size here, it is rebuilt by simulating nreps
+/// replicates at this point, using the random streams identified by
+/// seed. Return NULL if the estimate must come from elsewhere:
+/// because segment start times differ from those of the bank, or
+/// because gptree has Gaussian parameters or tabulates expected
+/// tails.
+BranchTab  *TreeBank_estimate(TreeBank * self, GPTree * gptree, long nreps,
+                              int doSing, unsigned long seed) {
+    int         nseg = GPTree_nseg(gptree), stale;
+    double      twoN[nseg], mix[nseg], start[nseg];
+
+    if(GPTree_segPars(gptree, nseg, twoN, mix, start))
+        return NULL;
+
+    BranchTab  *bt = GPTree_newBranchTab(gptree, doSing);
+    pthread_rwlock_rdlock(&self->lock);
+    int         status = TreeBank_lookup(self, bt, nreps, doSing, nseg,
+                                         twoN, mix, start, &stale);
+    pthread_rwlock_unlock(&self->lock);
+
+    // Another thread may have rebuilt the bank while it was unlocked,
+    // so look again before rebuilding.
+    if(status && stale) {
+        pthread_rwlock_wrlock(&self->lock);
+        status = TreeBank_lookup(self, bt, nreps, doSing, nseg, twoN, mix,
+                                 start, &stale);
+        if(status && stale) {
+            TreeBank_build(self, gptree, nreps, doSing, seed);
+            status = TreeBank_lookup(self, bt, nreps, doSing, nseg, twoN,
+                                     mix, start, &stale);
+            assert(status == 0);
+        }
+        pthread_rwlock_unlock(&self->lock);
+    }
+    if(status) {
+        BranchTab_free(bt);
+        return NULL;
+    }
+    return bt;
+}
+
+#ifdef TEST
+
+#  include "parstore.h"
+#  include <stdio.h>
+#  include <unistd.h>
+
+#  ifdef NDEBUG
+#    error "Unit tests must be compiled without -DNDEBUG flag"
+#  endif
+
+// Two samples from x, whose ancestor, a, is of different size.
+const char *input =
+    "time fixed  T0=0\n"
+    "time free   Ta=500\n"
+    "twoN free   2Nx=400\n"
+    "twoN free   2Na=1500\n"
+    "segment x   t=T0     twoN=2Nx    samples=2\n"
+    "segment a   t=Ta     twoN=2Na\n" "derive x from a\n";
+
+int main(int argc, char **argv) {
+    int         verbose = 0;
+    const long  nreps = 50000;
+
+    if(argc > 1) {
+        if(argc != 2 || 0 != strcmp(argv[1], "-v")) {
+            fprintf(stderr, "usage: xtreebank [-v]\n");
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    const char *fname = "treebank-tmp.lgo";
+    FILE       *fp = fopen(fname, "w");
+    fputs(input, fp);
+    fclose(fp);
+    Bounds      bnd = {
+        .lo_twoN = 1.0,
+        .hi_twoN = 1e7,
+        .lo_t = 0.0,
+        .hi_t = HUGE_VAL
+    };
+    GPTree     *g = GPTree_new(fname, bnd);
+    unlink(fname);
+
+    // Free parameters are Ta, 2Nx, and 2Na, in that order.
+    int         dim = GPTree_nFree(g);
+    assert(dim == 3);
+    double      x[dim];
+    GPTree_getParams(g, dim, x);
+    assert(x[0] == 500.0 && x[1] == 400.0 && x[2] == 1500.0);
+
+    TreeBank   *bank = TreeBank_new(0.5, 1);
+
+    // The first call fills the bank; the second reuses it.
+    BranchTab  *bt1 = TreeBank_estimate(bank, g, nreps, 1, 1);
+    BranchTab  *bt2 = TreeBank_estimate(bank, g, nreps, 1, 2);
+    assert(bt1 && bt2);
+    assert(BranchTab_equals(bt1, bt2));
+    BranchTab_free(bt1);
+    BranchTab_free(bt2);
+
+    // Reweight at nearby sizes, and compare with exact values.
+    x[1] = 440.0;
+    x[2] = 1400.0;
+    GPTree_setParams(g, dim, x);
+    BranchTab  *bt = TreeBank_estimate(bank, g, nreps, 1, 3);
+    assert(bt);
+    BranchTab  *near = BranchTab_dup(bt);
+    BranchTab_divideBy(bt, (double) nreps);
+    BranchTab  *ex = BranchTab_new();
+    int         status = GPTree_expected(g, ex, 1.0, 1);
+    assert(status == 0);
+    double      est = BranchTab_get(bt, 1), exact = BranchTab_get(ex, 1);
+    if(verbose)
+        printf("reweighted=%lf exact=%lf\n", est, exact);
+    assert(fabs(est - exact) < 0.03 * exact);
+    BranchTab_free(bt);
+    BranchTab_free(ex);
+
+    // At a different start time, the bank can't be used, but it is
+    // kept for points whose start times agree with it.
+    x[0] = 510.0;
+    GPTree_setParams(g, dim, x);
+    bt = TreeBank_estimate(bank, g, nreps, 1, 4);
+    assert(bt == NULL);
+    x[0] = 500.0;
+    GPTree_setParams(g, dim, x);
+    bt = TreeBank_estimate(bank, g, nreps, 1, 5);
+    assert(bt);
+    assert(BranchTab_equals(bt, near));
+    BranchTab_free(bt);
+    BranchTab_free(near);
+
+    // The bank doesn't depend on the number of threads that build it.
+    TreeBank   *bank3 = TreeBank_new(0.5, 3);
+    bt1 = TreeBank_estimate(bank, g, nreps / 2, 1, 7);
+    bt2 = TreeBank_estimate(bank3, g, nreps / 2, 1, 7);
+    assert(bt1 && bt2);
+    assert(BranchTab_equals(bt1, bt2));
+    BranchTab_free(bt1);
+    BranchTab_free(bt2);
+    TreeBank_free(bank3);
+
+    // A different number of replicates forces a rebuild.
+    bt = TreeBank_estimate(bank, g, nreps / 2, 1, 5);
+    assert(bt);
+    BranchTab_free(bt);
+
+    // So does a large change in size, whose effective sample size
+    // is small.
+    x[1] = 4000.0;
+    GPTree_setParams(g, dim, x);
+    bt = TreeBank_estimate(bank, g, nreps / 2, 1, 6);
+    assert(bt);
+    BranchTab_divideBy(bt, (double) (nreps / 2));
+    ex = BranchTab_new();
+    status = GPTree_expected(g, ex, 1.0, 1);
+    assert(status == 0);
+    est = BranchTab_get(bt, 1);
+    exact = BranchTab_get(ex, 1);
+    if(verbose)
+        printf("rebuilt=%lf exact=%lf\n", est, exact);
+    assert(fabs(est - exact) < 0.03 * exact);
+    BranchTab_free(bt);
+    BranchTab_free(ex);
+
+    TreeBank_free(bank);
+    GPTree_free(g);
+    unitTstResult("TreeBank", "OK");
+    return 0;
+}
+#endif
@@ -0,0 +1,11 @@
+#ifndef ARR_TREEBANK_H
+#  define ARR_TREEBANK_H
+
+#  include "typedefs.h"
+
+TreeBank   *TreeBank_new(double minEss, int nThreads);
+void        TreeBank_free(TreeBank * self);
+BranchTab  *TreeBank_estimate(TreeBank * self, GPTree * gptree, long nreps,
+                              int doSing, unsigned long seed);
+
+#endif
@@ -10,7 +10,9 @@ typedef struct Bounds Bounds;
 typedef struct BranchTab BranchTab;
 typedef struct Constraint Constraint;
 typedef struct El El;
+typedef struct GaussPar GaussPar;
 typedef struct Gene Gene;
+typedef struct GeneStore GeneStore;
 typedef struct GPTree GPTree;
 typedef struct HashTab HashTab;
 typedef struct HashTabSeq HashTabSeq;
@@ -20,12 +22,18 @@ typedef enum   ParamStatus ParamStatus;
 typedef enum   ParamType ParamType;
 typedef struct ParKeyVal ParKeyVal;
 typedef struct ParStore ParStore;
+typedef struct PatFold PatFold;
 typedef struct PopNode PopNode;
 typedef struct PopNodeTab PopNodeTab;
 typedef struct SimSched SimSched;
+typedef struct SimState SimState;
 typedef struct SampNdx SampNdx;
+typedef struct SegPar SegPar;
+typedef struct SegCache SegCache;
+typedef struct SegStat SegStat;
 typedef struct StrInt StrInt;
 typedef struct Tokenizer Tokenizer;
+typedef struct TreeBank TreeBank;
 typedef struct DAFReader DAFReader;
 
 /// Distinguish between parameters that free, fixed, Gaussian, or
@@ -35,17 +43,27 @@ typedef struct DAFReader DAFReader;
 /// distribution; Constrained ones are functions of one or more free
 /// parameters.
 enum ParamStatus {Free, Fixed, Gaussian, Constrained};
+#define NPARSTATUS 4
 
 /// Distinguish between parameters that describe population size,
 /// time, and gene flow.
 enum ParamType { TwoN, Time, MixFrac };
 
-#if 1
+// Each sample is a bit in a tipId_t, so TIPID_SIZE is the maximum
+// number of samples. The default is 32. Builds with -DTIPID_SIZE=64
+// or 128 handle larger samples but run more slowly. The Makefile
+// builds all three, and tipIdDispatch chooses among them at run time.
+#ifndef TIPID_SIZE
 #  define TIPID_SIZE 32
+#endif
+#if TIPID_SIZE==32
 typedef uint32_t tipId_t;
-#else
-#  define TIPID_SIZE 64
+#elif TIPID_SIZE==64
 typedef uint64_t tipId_t;
+#elif TIPID_SIZE==128
+typedef unsigned __int128 tipId_t;
+#else
+#  error "TIPID_SIZE must be 32, 64, or 128"
 #endif
 
 #define KL_COST 1
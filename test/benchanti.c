@@ -0,0 +1,151 @@
+/**
+ * @file benchanti.c
+ * @author Alan R. Rogers
+ * @brief Compare the variance of ordinary and antithetic simulations.
+ *
+ * Runs patprob repeatedly on the model in an .lgo file, using
+ * independent random numbers and then antithetic pairs of replicates,
+ * and reports the variance across runs of each site pattern's
+ * estimated branch length, along with the time per replicate. Usage:
+ *
+ *     benchanti [-i nreps] [-r nruns] [-t nthreads] input.lgo
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "branchtab.h"
+#include "fastrng.h"
+#include "gptree.h"
+#include "lblndx.h"
+#include "misc.h"
+#include "parstore.h"
+#include "patprob.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAXPAT 1000
+
+static double seconds(void);
+static double run(const GPTree * gptree, long nreps, int nruns, int nThreads,
+                  int antithetic, int npat, const tipId_t pat[npat],
+                  double mean[npat], double var[npat]);
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/// Call patprob nruns times. On return, mean[i] and var[i] are the
+/// mean and variance across runs of the branch length of pattern
+/// pat[i]. Function returns seconds per replicate.
+static double run(const GPTree * gptree, long nreps, int nruns, int nThreads,
+                  int antithetic, int npat, const tipId_t pat[npat],
+                  double mean[npat], double var[npat]) {
+    double      t = seconds();
+
+    memset(mean, 0, npat * sizeof(mean[0]));
+    memset(var, 0, npat * sizeof(var[0]));
+    for(int r = 0; r < nruns; ++r) {
+        BranchTab  *bt = patprob(gptree, nreps, 0, nThreads,
+                                 FastRng_streamSeed(12345, r + 1), 0,
+                                 antithetic, 0, 0);
+        BranchTab_divideBy(bt, (double) nreps);
+        for(int i = 0; i < npat; ++i) {
+            double      x = BranchTab_get(bt, pat[i]);
+            mean[i] += x;
+            var[i] += x * x;
+        }
+        BranchTab_free(bt);
+    }
+    t = seconds() - t;
+    for(int i = 0; i < npat; ++i) {
+        mean[i] /= nruns;
+        var[i] = (var[i] - nruns * mean[i] * mean[i]) / (nruns - 1);
+    }
+    return t / ((double) nreps * nruns);
+}
+
+int main(int argc, char **argv) {
+    long        nreps = 10000;
+    int         i, nruns = 50, nThreads = 1;
+
+    for(;;) {
+        i = getopt(argc, argv, "i:r:t:");
+        if(i == -1)
+            break;
+        switch (i) {
+        case 'i':
+            nreps = strtol(optarg, NULL, 10);
+            break;
+        case 'r':
+            nruns = strtol(optarg, NULL, 10);
+            break;
+        case 't':
+            nThreads = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: benchanti [-i nreps] [-r nruns]"
+                    " [-t nthreads] input.lgo\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(argc - optind != 1 || nruns < 2 || nreps < 2) {
+        fprintf(stderr, "usage: benchanti [-i nreps] [-r nruns]"
+                " [-t nthreads] input.lgo\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Bounds      bnd = {
+        .lo_twoN = 1.0,
+        .hi_twoN = 1e6,
+        .lo_t = 0.0,
+        .hi_t = 1e6
+    };
+    GPTree     *gptree = GPTree_new(argv[optind], bnd);
+    LblNdx      lblndx = GPTree_getLblNdx(gptree);
+
+    // Find the site patterns.
+    BranchTab  *bt = patprob(gptree, 10000, 0, nThreads, 1, 0, 0, 0, 0);
+    unsigned    npat = BranchTab_size(bt);
+    if(npat > MAXPAT)
+        npat = MAXPAT;
+    tipId_t     pat[npat];
+    double      x[npat], sqr[npat];
+    BranchTab_toArrays(bt, npat, pat, x, sqr);
+    BranchTab_free(bt);
+
+    double      m0[npat], v0[npat], m1[npat], v1[npat];
+    double      t0 = run(gptree, nreps, nruns, nThreads, 0, npat, pat, m0,
+                         v0);
+    double      t1 = run(gptree, nreps, nruns, nThreads, 1, npat, pat, m1,
+                         v1);
+
+    printf("# %d runs of %ld replicates\n", nruns, nreps);
+    printf("%15s %12s %12s %12s %8s\n", "SitePat", "Mean", "Var(indep)",
+           "Var(anti)", "Ratio");
+    unsigned    ord[npat];
+    orderpat(npat, ord, pat);
+    double      sumRatio = 0.0;
+    for(unsigned j = 0; j < npat; ++j) {
+        char        buff[100];
+        i = ord[j];
+        printf("%15s %12.4lf %12.4lg %12.4lg %8.3lf\n",
+               patLbl(sizeof(buff), buff, pat[i], &lblndx), m0[i], v0[i],
+               v1[i], v1[i] / v0[i]);
+        sumRatio += v1[i] / v0[i];
+    }
+    printf("# mean variance ratio (anti/indep): %.3lf\n", sumRatio / npat);
+    printf("# microseconds per replicate: indep %.3lf, anti %.3lf\n",
+           1e6 * t0, 1e6 * t1);
+    printf("# efficiency gain (indep var*time / anti var*time): %.3lf\n",
+           t0 / (t1 * sumRatio / npat));
+
+    GPTree_free(gptree);
+    return 0;
+}
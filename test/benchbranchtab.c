@@ -0,0 +1,293 @@
+/**
+ * @file benchbranchtab.c
+ * @author Alan R. Rogers
+ * @brief Compare BranchTab with the chained table it replaced.
+ *
+ * Branch lengths are generated by simulating random coalescent trees
+ * of n samples, each of which contributes 2(n-1) branches. These are
+ * stored, and then tabulated by each method in blocks of 4096 trees,
+ * as in patprob: each block goes into an empty table, which is then
+ * added to a running total. The methods are (1) the original
+ * BranchTab, a 16-bucket hash table of sorted linked lists with a
+ * node allocated per key, which is reproduced below as ListTab, (2)
+ * BranchTab_new, an open-addressing hash table, and (3)
+ * BranchTab_newDense, which indexes directly with the key when n is
+ * small enough. Reports time per branch and the largest relative
+ * difference between totals, which should be zero. Usage:
+ *
+ *     benchbranchtab [-i ntrees] [n ...]
+ *
+ * The default is 5000 trees with n equal to 8, 16, and 32. The
+ * linked lists are slow enough with 32 samples that larger values
+ * take minutes.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "branchtab.h"
+#include "fastrng.h"
+#include "misc.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK 4096
+#define LT_DIM 16u
+
+typedef struct LTLink LTLink;
+typedef struct ListTab ListTab;
+
+struct LTLink {
+    LTLink     *next;
+    tipId_t     key;
+    double      value;
+};
+
+struct ListTab {
+    LTLink     *tab[LT_DIM];
+};
+
+static double seconds(void);
+static void usage(void);
+static long simulate(int nsamp, long ntrees, tipId_t key[], double len[],
+                     gsl_rng * rng);
+static LTLink *LTLink_add(LTLink * self, tipId_t key, double value);
+static void LTLink_free(LTLink * self);
+static ListTab *ListTab_new(void);
+static void ListTab_free(ListTab * self);
+static void ListTab_add(ListTab * self, tipId_t key, double value);
+static void ListTab_plusEquals(ListTab * lhs, const ListTab * rhs);
+static double ListTab_get(const ListTab * self, tipId_t key);
+static double timeList(int nsamp, long ntrees, const tipId_t key[],
+                       const double len[], ListTab ** total);
+static double timeTab(int nsamp, long ntrees, const tipId_t key[],
+                      const double len[], int dense, BranchTab ** total);
+static double maxRelDiff(BranchTab * bt, const ListTab * lt);
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: benchbranchtab [-i ntrees] [n ...]\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Simulate ntrees coalescent trees of nsamp samples, storing the
+/// site pattern and length of each branch but the root. Return the
+/// number of branches.
+static long simulate(int nsamp, long ntrees, tipId_t key[], double len[],
+                     gsl_rng * rng) {
+    tipId_t     tip[nsamp];
+    double      birth[nsamp];
+    long        i, m = 0;
+    int         k, a, b;
+
+    for(i = 0; i < ntrees; ++i) {
+        double      t = 0.0;
+        for(k = 0; k < nsamp; ++k) {
+            tip[k] = ((tipId_t) 1) << k;
+            birth[k] = 0.0;
+        }
+        for(k = nsamp; k > 1; --k) {
+            t += FastRng_exponential(rng, 2.0 / (k * (k - 1.0)));
+            a = FastRng_uniformInt(rng, k);
+            b = FastRng_uniformInt(rng, k - 1);
+            if(b >= a)
+                ++b;
+            key[m] = tip[a];
+            len[m++] = t - birth[a];
+            key[m] = tip[b];
+            len[m++] = t - birth[b];
+            tip[a] |= tip[b];
+            birth[a] = t;
+            tip[b] = tip[k - 1];
+            birth[b] = birth[k - 1];
+        }
+    }
+    return m;
+}
+
+/// Add a value to a sorted list, allocating a node for a new key.
+static LTLink *LTLink_add(LTLink * self, tipId_t key, double value) {
+    if(self == NULL || key < self->key) {
+        LTLink     *new = malloc(sizeof(*new));
+        CHECKMEM(new);
+        new->next = self;
+        new->key = key;
+        new->value = value;
+        return new;
+    } else if(key > self->key) {
+        self->next = LTLink_add(self->next, key, value);
+        return self;
+    }
+    self->value += value;
+    return self;
+}
+
+static void LTLink_free(LTLink * self) {
+    if(self == NULL)
+        return;
+    LTLink_free(self->next);
+    free(self);
+}
+
+static ListTab *ListTab_new(void) {
+    ListTab    *self = malloc(sizeof(*self));
+    CHECKMEM(self);
+    memset(self, 0, sizeof(*self));
+    return self;
+}
+
+static void ListTab_free(ListTab * self) {
+    for(unsigned i = 0; i < LT_DIM; ++i)
+        LTLink_free(self->tab[i]);
+    free(self);
+}
+
+static void ListTab_add(ListTab * self, tipId_t key, double value) {
+    unsigned    h = tipIdHash(key) & (LT_DIM - 1);
+    self->tab[h] = LTLink_add(self->tab[h], key, value);
+}
+
+static void ListTab_plusEquals(ListTab * lhs, const ListTab * rhs) {
+    for(unsigned i = 0; i < LT_DIM; ++i)
+        for(LTLink * el = rhs->tab[i]; el; el = el->next)
+            ListTab_add(lhs, el->key, el->value);
+}
+
+static double ListTab_get(const ListTab * self, tipId_t key) {
+    const LTLink *el = self->tab[tipIdHash(key) & (LT_DIM - 1)];
+    while(el && el->key < key)
+        el = el->next;
+    return (el && el->key == key) ? el->value : nan("");
+}
+
+/// Tabulate with ListTab. Return seconds elapsed.
+static double timeList(int nsamp, long ntrees, const tipId_t key[],
+                       const double len[], ListTab ** total) {
+    long        i, j, m = 2L * (nsamp - 1);
+    double      t = seconds();
+
+    *total = ListTab_new();
+    for(i = 0; i < ntrees; i += BLOCK) {
+        long        end = (i + BLOCK < ntrees ? i + BLOCK : ntrees);
+        ListTab    *blk = ListTab_new();
+        for(j = i * m; j < end * m; ++j)
+            ListTab_add(blk, key[j], len[j]);
+        ListTab_plusEquals(*total, blk);
+        ListTab_free(blk);
+    }
+    return seconds() - t;
+}
+
+/// Tabulate with BranchTab, reusing one table for all blocks.
+/// Return seconds elapsed.
+static double timeTab(int nsamp, long ntrees, const tipId_t key[],
+                      const double len[], int dense, BranchTab ** total) {
+    long        i, j, m = 2L * (nsamp - 1);
+    double      t = seconds();
+
+    *total = (dense ? BranchTab_newDense(nsamp) : BranchTab_new());
+    BranchTab  *blk = (dense ? BranchTab_newDense(nsamp) : BranchTab_new());
+    for(i = 0; i < ntrees; i += BLOCK) {
+        long        end = (i + BLOCK < ntrees ? i + BLOCK : ntrees);
+        BranchTab_clear(blk);
+        for(j = i * m; j < end * m; ++j)
+            BranchTab_add(blk, key[j], len[j]);
+        BranchTab_plusEquals(*total, blk);
+    }
+    BranchTab_free(blk);
+    return seconds() - t;
+}
+
+/// Largest relative difference between corresponding values.
+static double maxRelDiff(BranchTab * bt, const ListTab * lt) {
+    unsigned    n = BranchTab_size(bt);
+    tipId_t     key[n];
+    double      val[n], sqr[n], d, maxdiff = 0.0;
+
+    BranchTab_toArrays(bt, n, key, val, sqr);
+    for(unsigned i = 0; i < n; ++i) {
+        d = fabs(ListTab_get(lt, key[i]) - val[i]) / val[i];
+        if(!(d <= maxdiff))
+            maxdiff = d;
+    }
+    return maxdiff;
+}
+
+int main(int argc, char **argv) {
+    long        ntrees = 5000;
+    int         i, j, nsamp[TIPID_SIZE], nn = 0;
+
+    for(;;) {
+        j = getopt(argc, argv, "i:");
+        if(j == -1)
+            break;
+        switch (j) {
+        case 'i':
+            ntrees = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    for(i = optind; i < argc && nn < TIPID_SIZE; ++i)
+        nsamp[nn++] = strtol(argv[i], NULL, 10);
+    if(nn == 0) {
+        nsamp[nn++] = 8;
+        nsamp[nn++] = 16;
+        nsamp[nn++] = 32;
+    }
+    if(ntrees < 1)
+        usage();
+    for(i = 0; i < nn; ++i)
+        if(nsamp[i] < 2 || nsamp[i] > TIPID_SIZE)
+            usage();
+
+    gsl_rng    *rng = gsl_rng_alloc(rng_xoshiro256pp);
+    CHECKMEM(rng);
+    gsl_rng_set(rng, 12345);
+
+    printf("#%6s %8s %10s %10s %10s %10s\n", "nsamp", "npat", "list",
+           "hashed", "dense", "maxdiff");
+    printf("#%6s %8s %10s %10s %10s %10s\n", "", "", "ns/branch",
+           "ns/branch", "ns/branch", "");
+    for(i = 0; i < nn; ++i) {
+        long        m = 2L * (nsamp[i] - 1) * ntrees;
+        tipId_t    *key = malloc(m * sizeof(key[0]));
+        double     *len = malloc(m * sizeof(len[0]));
+        CHECKMEM(key);
+        CHECKMEM(len);
+        m = simulate(nsamp[i], ntrees, key, len, rng);
+
+        ListTab    *lt;
+        BranchTab  *hashed, *dense;
+        double      tl = timeList(nsamp[i], ntrees, key, len, &lt);
+        double      th = timeTab(nsamp[i], ntrees, key, len, 0, &hashed);
+        double      td = timeTab(nsamp[i], ntrees, key, len, 1, &dense);
+        double      d = fmax(maxRelDiff(hashed, lt), maxRelDiff(dense, lt));
+
+        printf("%7d %8u %10.2lf %10.2lf %10.2lf %10.3lg\n", nsamp[i],
+               BranchTab_size(hashed), 1e9 * tl / m, 1e9 * th / m,
+               1e9 * td / m, d);
+
+        ListTab_free(lt);
+        BranchTab_free(hashed);
+        BranchTab_free(dense);
+        free(key);
+        free(len);
+    }
+    printf("# %ld trees per sample size. Large dense tables are"
+           " hashed.\n", ntrees);
+
+    gsl_rng_free(rng);
+    return 0;
+}
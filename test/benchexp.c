@@ -0,0 +1,76 @@
+/**
+ * @file benchexp.c
+ * @author Alan R. Rogers
+ * @brief Time alternative ways of generating exponential variates.
+ *
+ * Compares (1) gsl_ran_exponential with gsl_rng_taus, which is how
+ * coalescent waiting times were once generated, (2) inversion, using
+ * the inline xoshiro256++ uniform and one call to log1p per draw, and
+ * (3) FastRng_exponential, which rescales unit exponentials generated
+ * in blocks by the ziggurat method. Usage: benchexp [ndraws]
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "fastrng.h"
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_rng.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double seconds(void);
+static void report(const char *lbl, double secs, double sum, long n);
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/// The sum is printed so that the compiler cannot discard the loop.
+static void report(const char *lbl, double secs, double sum, long n) {
+    printf("%-28s %8.3lf ns/draw   mean=%lf\n", lbl, 1e9 * secs / n,
+           sum / n);
+}
+
+int main(int argc, char **argv) {
+    long        i, n = 50000000;
+    double      t, sum, mean = 2.5;
+
+    if(argc == 2)
+        n = strtol(argv[1], NULL, 10);
+    if(argc > 2 || n <= 0) {
+        fprintf(stderr, "usage: benchexp [ndraws]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gsl_rng    *taus = gsl_rng_alloc(gsl_rng_taus);
+    gsl_rng    *xo = gsl_rng_alloc(rng_xoshiro256pp);
+    gsl_rng_set(taus, 1);
+    gsl_rng_set(xo, 1);
+
+    sum = 0.0;
+    t = seconds();
+    for(i = 0; i < n; ++i)
+        sum += gsl_ran_exponential(taus, mean);
+    report("gsl_ran_exponential(taus)", seconds() - t, sum, n);
+
+    sum = 0.0;
+    t = seconds();
+    for(i = 0; i < n; ++i)
+        sum += -mean * log1p(-FastRng_uniform(xo));
+    report("inversion(xoshiro)", seconds() - t, sum, n);
+
+    sum = 0.0;
+    t = seconds();
+    for(i = 0; i < n; ++i)
+        sum += FastRng_exponential(xo, mean);
+    report("FastRng_exponential", seconds() - t, sum, n);
+
+    gsl_rng_free(taus);
+    gsl_rng_free(xo);
+    return 0;
+}
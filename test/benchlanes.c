@@ -0,0 +1,355 @@
+/**
+ * @file benchlanes.c
+ * @author Alan R. Rogers
+ * @brief Compare scalar and batched simulation of replicates.
+ *
+ * Simulates the model in an .lgo file, first one replicate at a time
+ * with GPTree_simulate and then in batches of nlanes with Lanes, a
+ * kernel reproduced below that finishes each segment in every
+ * replicate of a batch before beginning the next segment. Lineages
+ * are tipIds and birth times in flat arrays, rather than Gene
+ * objects. In both methods, replicate i uses random stream i, and
+ * each lane draws from its stream in the same sequence as
+ * GPTree_simulate, so the two should produce the same gene
+ * genealogies. Reports the time per replicate of each method and the
+ * largest relative difference between their site pattern branch
+ * lengths, which should reflect only rounding error. Usage:
+ *
+ *     benchlanes [-i nreps] [-l nlanes] input.lgo
+ *
+ * Lanes was never faster than GPTree_simulate, so patprob does not
+ * use it. Most of the time goes to random number generation and to
+ * BranchTab_add, neither of which gains from running lanes side by
+ * side. A version that advanced the lanes in lockstep, one
+ * coalescent event per live lane per pass, was about 20% slower
+ * still, because each lane's clock and lineage count lived in memory
+ * rather than in registers, and lanes branched unpredictably.
+ *
+ * @copyright Copyright (c) 2016, Alan R. Rogers
+ * <rogers@anthro.utah.edu>. This file is released under the Internet
+ * Systems Consortium License, which can be found in file "LICENSE".
+ */
+
+#include "binary.h"
+#include "branchtab.h"
+#include "fastrng.h"
+#include "gptree.h"
+#include "lblndx.h"
+#include "misc.h"
+#include "parse.h"
+#include "parstore.h"
+#include "popnode.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SEED 12345UL
+#define MAXLANES 8
+
+typedef struct Lanes Lanes;
+
+/// A population tree, and space for the lineages of MAXLANES
+/// replicates.
+struct Lanes {
+    int         nseg, total, ngauss;
+    PopNode    *pnv;
+    int        *order;
+    SampNdx     sndx;
+    LblNdx      lblndx;
+    ParStore   *parstore;
+    Bounds      bnd;
+    GaussPar   *gauss;          // Gaussian parameters, parents first
+    SegPar     *segpar;         // [MAXLANES*nseg]
+    int        *off;            // offset of each PopNode's lineages
+    int        *n;              // lineages in node i, lane l: n[i*MAXLANES+l]
+    tipId_t    *tip;            // lineage s of node i, lane l:
+    double     *birth;          //   [l*total + off[i] + s]
+};
+
+static double seconds(void);
+static void usage(void);
+static Lanes *Lanes_new(const char *fname, Bounds bnd);
+static void Lanes_free(Lanes * self);
+static void Lanes_push(Lanes * self, int node, int lane, tipId_t tip,
+                       double birth);
+static void Lanes_simulate(Lanes * self, int nlanes, BranchTab * bt,
+                           int doSing, gsl_rng * rng[nlanes]);
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: benchlanes [-i nreps] [-l nlanes] input.lgo\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Read a population tree from fname, as GPTree_new does.
+static Lanes *Lanes_new(const char *fname, Bounds bnd) {
+    Lanes      *self = malloc(sizeof(Lanes));
+    CHECKMEM(self);
+    memset(self, 0, sizeof(Lanes));
+    int         i;
+
+    self->bnd = bnd;
+    self->parstore = ParStore_new();
+    LblNdx_init(&self->lblndx);
+    SampNdx_init(&self->sndx);
+    FILE       *fp = efopen(fname, "r");
+    self->nseg = countSegments(fp);
+    rewind(fp);
+    self->pnv = malloc(self->nseg * sizeof(self->pnv[0]));
+    CHECKMEM(self->pnv);
+    NodeStore  *ns = NodeStore_new(self->nseg, self->pnv);
+    CHECKMEM(ns);
+    PopNode    *root = mktree(fp, &self->sndx, &self->lblndx,
+                              self->parstore, &self->bnd, ns);
+    fclose(fp);
+    NodeStore_free(ns);
+
+    self->order = malloc(self->nseg * sizeof(self->order[0]));
+    CHECKMEM(self->order);
+    if(self->nseg != PopNode_postorder(root - self->pnv, self->pnv,
+                                       self->nseg, self->order)) {
+        fprintf(stderr, "benchlanes: disconnected segments\n");
+        exit(EXIT_FAILURE);
+    }
+
+    self->gauss = malloc(3 * self->nseg * sizeof(self->gauss[0]));
+    CHECKMEM(self->gauss);
+    for(i = self->nseg - 1; i >= 0; --i)
+        self->ngauss += PopNode_gaussPars(self->pnv + self->order[i],
+                                          self->pnv, self->bnd,
+                                          self->gauss + self->ngauss);
+
+    int         maxsamp[self->nseg];
+    self->total = SampNdx_maxLineages(&self->sndx, self->nseg, self->pnv,
+                                      self->order, maxsamp);
+    self->off = malloc(self->nseg * sizeof(self->off[0]));
+    CHECKMEM(self->off);
+    for(i = 0; i < self->nseg; ++i)
+        self->off[i] = (i == 0 ? 0 : self->off[i - 1] + maxsamp[i - 1]);
+    self->segpar = malloc(MAXLANES * self->nseg * sizeof(self->segpar[0]));
+    self->n = malloc(self->nseg * MAXLANES * sizeof(self->n[0]));
+    self->tip = malloc(MAXLANES * self->total * sizeof(self->tip[0]));
+    self->birth = malloc(MAXLANES * self->total * sizeof(self->birth[0]));
+    CHECKMEM(self->segpar);
+    CHECKMEM(self->n);
+    CHECKMEM(self->tip);
+    CHECKMEM(self->birth);
+    return self;
+}
+
+static void Lanes_free(Lanes * self) {
+    free(self->pnv);
+    free(self->order);
+    ParStore_free(self->parstore);
+    free(self->gauss);
+    free(self->segpar);
+    free(self->off);
+    free(self->n);
+    free(self->tip);
+    free(self->birth);
+    free(self);
+}
+
+/// Add a lineage to PopNode pnv[node] in lane.
+static void Lanes_push(Lanes * self, int node, int lane, tipId_t tip,
+                       double birth) {
+    int         s = self->n[node * MAXLANES + lane]++;
+    int         ndx = lane * self->total + self->off[node] + s;
+    self->tip[ndx] = tip;
+    self->birth[ndx] = birth;
+}
+
+/// Simulate nlanes replicates, adding their branch lengths to bt.
+/// Lane l uses random number generator rng[l], from which it draws
+/// Gaussian parameters and then the gene genealogy, as does a call to
+/// GPTree_simulate with nreps=1.
+static void Lanes_simulate(Lanes * self, int nlanes, BranchTab * bt,
+                           int doSing, gsl_rng * rng[nlanes]) {
+    const int   L = nlanes, total = self->total, nseg = self->nseg;
+    const PopNode *pnv = self->pnv;
+    const double *par = ParStore_values(self->parstore);
+    int         i, k, l, s;
+
+    memset(self->n, 0, nseg * MAXLANES * sizeof(self->n[0]));
+    for(l = 0; l < L; ++l) {
+        ParStore_constrain(self->parstore);
+        if(self->ngauss > 0)
+            GaussPar_sample(self->ngauss, self->gauss, self->parstore,
+                            rng[l]);
+        PopNode_segPars(nseg, pnv, par, self->segpar + l * nseg);
+    }
+
+    // Each sample is born at the start of its PopNode.
+    for(i = 0; i < (int) self->sndx.n; ++i) {
+        int         node = self->sndx.node[i];
+        for(l = 0; l < L; ++l)
+            Lanes_push(self, node, l, ((tipId_t) 1) << i,
+                       self->segpar[l * nseg + node].start);
+    }
+
+    // Children precede parents in order.
+    for(k = 0; k < nseg; ++k) {
+        const PopNode *node = pnv + self->order[k];
+        int        *n = self->n + node->ndx * MAXLANES;
+        tipId_t    *tip = self->tip + self->off[node->ndx];
+        double     *birth = self->birth + self->off[node->ndx];
+
+        for(l = 0; l < L; ++l) {
+            tipId_t    *ltip = tip + l * total;
+            double     *lbirth = birth + l * total;
+            const SegPar *seg = self->segpar + l * nseg + node->ndx;
+            double      t = seg->start;
+            double      end = seg->end;
+            double      twoN2 = 2.0 * seg->twoN;
+            int         ln = n[l];
+            unsigned long a, b, c;
+
+            // Coalescent loop continues until only one lineage is
+            // left or we reach the end of the interval.
+            while(ln > 1 && t < end) {
+                double      x = FastRng_exponential(rng[l],
+                                                    twoN2 / (ln * (ln - 1)));
+                if(!(t + x < end))
+                    break;
+                t += x;
+
+                // choose a random pair to join
+                a = FastRng_uniformInt(rng[l], ln);
+                b = FastRng_uniformInt(rng[l], ln - 1);
+                if(b >= a)
+                    ++b;
+                if(b < a) {
+                    c = a;
+                    a = b;
+                    b = c;
+                }
+
+                // The branches of the two children end here.
+                if(doSing || !isPow2(ltip[a]))
+                    BranchTab_add(bt, ltip[a], t - lbirth[a]);
+                if(doSing || !isPow2(ltip[b]))
+                    BranchTab_add(bt, ltip[b], t - lbirth[b]);
+
+                ltip[a] |= ltip[b];
+                lbirth[a] = t;
+                --ln;
+                if(b != (unsigned long) ln) {
+                    ltip[b] = ltip[ln];
+                    lbirth[b] = lbirth[ln];
+                }
+            }
+            n[l] = ln;
+        }
+
+        // Move the survivors to parents.
+        if(node->nparents == 0)
+            continue;
+        for(l = 0; l < L; ++l) {
+            tipId_t    *ltip = tip + l * total;
+            double     *lbirth = birth + l * total;
+            if(node->nparents == 1) {
+                for(s = 0; s < n[l]; ++s)
+                    Lanes_push(self, node->parent[0], l, ltip[s],
+                               lbirth[s]);
+            } else {
+                double      mix = self->segpar[l * nseg + node->ndx].mix;
+                for(s = 0; s < n[l]; ++s) {
+                    int         p = (FastRng_uniform(rng[l]) < mix);
+                    Lanes_push(self, node->parent[p], l, ltip[s],
+                               lbirth[s]);
+                }
+            }
+            n[l] = 0;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long        i, nreps = 1000000;
+    int         j, l, nl, nlanes = MAXLANES;
+
+    for(;;) {
+        j = getopt(argc, argv, "i:l:");
+        if(j == -1)
+            break;
+        switch (j) {
+        case 'i':
+            nreps = strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            nlanes = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    if(argc - optind != 1 || nreps < 1 || nlanes < 1 || nlanes > MAXLANES)
+        usage();
+
+    Bounds      bnd = {
+        .lo_twoN = 1.0,
+        .hi_twoN = 1e6,
+        .lo_t = 0.0,
+        .hi_t = 1e6
+    };
+    GPTree     *gptree = GPTree_new(argv[optind], bnd);
+    Lanes      *lanes = Lanes_new(argv[optind], bnd);
+    gsl_rng    *rng[MAXLANES];
+    for(l = 0; l < MAXLANES; ++l) {
+        rng[l] = gsl_rng_alloc(rng_xoshiro256pp);
+        CHECKMEM(rng[l]);
+    }
+
+    BranchTab  *bt0 = BranchTab_new();
+    double      t0 = seconds();
+    for(i = 0; i < nreps; ++i) {
+        gsl_rng_set(rng[0], FastRng_streamSeed(SEED, i));
+        GPTree_simulate(gptree, bt0, rng[0], 1, 0);
+    }
+    t0 = seconds() - t0;
+
+    BranchTab  *bt1 = BranchTab_new();
+    double      t1 = seconds();
+    for(i = 0; i < nreps; i += nl) {
+        nl = (nreps - i < nlanes ? (int) (nreps - i) : nlanes);
+        for(l = 0; l < nl; ++l)
+            gsl_rng_set(rng[l], FastRng_streamSeed(SEED, i + l));
+        Lanes_simulate(lanes, nl, bt1, 0, rng);
+    }
+    t1 = seconds() - t1;
+
+    unsigned    npat = BranchTab_size(bt0);
+    tipId_t     pat[npat];
+    double      x[npat], sqr[npat], maxdiff = 0.0;
+    BranchTab_toArrays(bt0, npat, pat, x, sqr);
+    for(unsigned k = 0; k < npat; ++k) {
+        double      d = fabs(BranchTab_get(bt1, pat[k]) - x[k]) / x[k];
+        if(!(d <= maxdiff))
+            maxdiff = d;
+    }
+    if(BranchTab_size(bt1) != npat)
+        maxdiff = HUGE_VAL;
+
+    printf("# %ld replicates, %d lanes, %u site patterns\n", nreps, nlanes,
+           npat);
+    printf("# max relative difference: %.3lg\n", maxdiff);
+    printf("# microseconds per replicate: scalar %.3lf, lanes %.3lf\n",
+           1e6 * t0 / nreps, 1e6 * t1 / nreps);
+    printf("# speedup: %.3lf\n", t0 / t1);
+
+    BranchTab_free(bt0);
+    BranchTab_free(bt1);
+    for(l = 0; l < MAXLANES; ++l)
+        gsl_rng_free(rng[l]);
+    Lanes_free(lanes);
+    GPTree_free(gptree);
+    return 0;
+}
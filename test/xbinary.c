@@ -95,5 +95,16 @@ int main(void) {
     printBits(sizeof(r64), &r64, stdout);
     putchar('\n');
 
+    // Functions of tipId_t must use all TIPID_SIZE bits.
+    tipId_t hi = ((tipId_t) 1) << (TIPID_SIZE - 1);
+    int bit[2];
+    assert(isPow2(hi));
+    assert(reverseBits(hi) == 1);
+    assert(reverseBits(1) == hi);
+    assert(reverseBits(reverseBits(hi | 6)) == (hi | 6));
+    assert(num1bits(hi | 1) == 2);
+    assert(getBits(hi | 2, 2, bit) == 2);
+    assert(bit[0] == 1 && bit[1] == TIPID_SIZE - 1);
+
     return 0;
 }
@@ -84,23 +84,28 @@ int main(int argc, char **argv) {
     assert(ParStore_nGaussian(ps) == 0);
 
     double val, *ptr;
+    int ndx;
     ParamStatus pstat, pstat2;
 
     val = 12.3;
     ParStore_addFixedPar(ps, val, "x");
     ptr = ParStore_findPtr(ps, &pstat, "x");
+    ndx = ParStore_findNdx(ps, &pstat, "x");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr == val);
 	assert(pstat == Fixed);
     assert(ParStore_nFixed(ps) == 1);
     assert(ParStore_nFree(ps) == 0);
     assert(ParStore_nGaussian(ps) == 0);
     assert(ParStore_getFixed(ps, 0) == val);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(*ptr == val);
 
     val = 23.4;
     ParStore_addFreePar(ps, val, 10.0, 30.0, "y");
     ptr = ParStore_findPtr(ps, &pstat, "y");
+    ndx = ParStore_findNdx(ps, &pstat, "y");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr == val);
 	assert(pstat == Free);
     assert(ParStore_nFixed(ps) == 1);
@@ -109,24 +114,28 @@ int main(int argc, char **argv) {
     assert(ParStore_getFree(ps, 0) == val);
     assert(ParStore_loFree(ps, 0) == 10.0);
     assert(ParStore_hiFree(ps, 0) == 30.0);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(*ptr == val);
 
     val = 88.3;
     ParStore_addFixedPar(ps, val, "w");
     ptr = ParStore_findPtr(ps, &pstat, "w");
+    ndx = ParStore_findNdx(ps, &pstat, "w");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr == val);
 	assert(pstat == Fixed);
     assert(ParStore_nFixed(ps) == 2);
     assert(ParStore_nFree(ps) == 1);
     assert(ParStore_nGaussian(ps) == 0);
     assert(ParStore_getFixed(ps, 1) == val);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(*ptr == val);
 
     val = -23.8;
     ParStore_addFreePar(ps, val, -100.0, 0.0, "z");
     ptr = ParStore_findPtr(ps, &pstat, "z");
+    ndx = ParStore_findNdx(ps, &pstat, "z");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr == val);
 	assert(pstat == Free);
     assert(ParStore_nFixed(ps) == 2);
@@ -135,12 +144,14 @@ int main(int argc, char **argv) {
     assert(ParStore_getFree(ps, 1) == val);
     assert(ParStore_loFree(ps, 1) == -100.0);
     assert(ParStore_hiFree(ps, 1) == 0.0);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(*ptr == val);
 
     val = 0.8;
     ParStore_addFreePar(ps, val, 0.0, 1.0, "a");
     ptr = ParStore_findPtr(ps, &pstat, "a");
+    ndx = ParStore_findNdx(ps, &pstat, "a");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr == val);
 	assert(pstat == Free);
     assert(ParStore_nFixed(ps) == 2);
@@ -149,13 +160,15 @@ int main(int argc, char **argv) {
     assert(ParStore_getFree(ps, 2) == val);
     assert(ParStore_loFree(ps, 2) == 0.0);
     assert(ParStore_hiFree(ps, 2) == 1.0);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(*ptr == val);
 
     double sd = 1.2;
     val = 2.3;
     ParStore_addGaussianPar(ps, val, sd, "gauss");
     ptr = ParStore_findPtr(ps, &pstat, "gauss");
+    ndx = ParStore_findNdx(ps, &pstat, "gauss");
+    assert(ParStore_values(ps) + ndx == ptr);
     assert(*ptr = val);
 	assert(pstat == Gaussian);
     assert(ParStore_nFixed(ps) == 2);
@@ -163,7 +176,7 @@ int main(int argc, char **argv) {
     assert(ParStore_nGaussian(ps) == 1);
     assert(ParStore_getGaussian(ps, 0) == val);
     assert(*ptr == val);
-    ParStore_sample(ps, ptr, val-1,val+1, rng);
+    ParStore_sample(ps, ndx, val-1,val+1, rng);
     assert(ParStore_getGaussian(ps, 0) != val);
     assert(*ptr != val);
 
@@ -177,6 +190,9 @@ int main(int argc, char **argv) {
         ParStore_print(ps, stdout);
 
     ParStore *ps2 = ParStore_dup(ps);
+    assert(-1 == ParStore_findNdx(ps, &pstat, "notthere"));
+    assert(ParStore_findNdx(ps, &pstat, "gauss")
+           == ParStore_findNdx(ps2, &pstat2, "gauss"));
     size_t offset = ((size_t) ps2) - ((size_t) ps);
     int    i;
 